@@ -0,0 +1,83 @@
+// program_cache.cpp
+//
+//    Cold vs warm program creation with clx::program_cache. A cold run builds
+//    from source and populates the cache, a warm run reloads the stored
+//    binaries, as a fresh process would.
+
+#include <chrono>
+#include <filesystem>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "cl/clx.hpp"
+#include "cl/kernels.hpp"
+#include "cl/program_cache.hpp"
+
+static int num_iterations = 10;
+
+clx::kernel::source const *programs[] = {&clx::kernel::histogram_image,
+                                          &clx::kernel::gausian_filter};
+
+template <typename F> auto time_ms(F &&f) -> double {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main() {
+  auto platform_id = cl_platform_id{};
+  auto devices = std::vector<cl_device_id>{};
+  for (auto const &platform : clx::get_platform_ids()) {
+    platform_id = platform;
+    devices = clx::get_device_ids(platform_id, CL_DEVICE_TYPE_ALL);
+    if (devices.size() != 0) {
+      break;
+    }
+  }
+  if (devices.size() == 0) {
+    fmt::print("[ERROR] no OpenCL device found.\n");
+    return 1;
+  }
+  devices.resize(1);
+  fmt::print("[INFO] device: {}\n", clx::get_device_info_name(devices[0]));
+
+  auto context = clx::create_context(platform_id, devices);
+  auto cache = clx::program_cache{std::filesystem::temp_directory_path() /
+                                  "clx_program_cache_bench"};
+
+  for (auto src : programs) {
+    auto cold = 0.0;
+    auto warm = 0.0;
+    for (auto i = 0; i < num_iterations; i++) {
+      cache.clear();
+      cold += time_ms([&] {
+        auto p = clx::build_program_cached(cache, context, devices, src->text,
+                                           src->hash, nullptr);
+        if (p) {
+          clReleaseProgram(p);
+        }
+      });
+      warm += time_ms([&] {
+        auto p = clx::build_program_cached(cache, context, devices, src->text,
+                                           src->hash, nullptr);
+        if (p) {
+          clReleaseProgram(p);
+        }
+      });
+    }
+    if (clx::last_error() != CL_SUCCESS) {
+      fmt::print("[ERROR] {} failed. ({})\n", clx::last_error_func(),
+                 clx::last_error());
+      return 1;
+    }
+    fmt::print("{}: cold = {:.3f} ms, warm = {:.3f} ms, speedup = {:.1f}x\n",
+               src->name, cold / num_iterations, warm / num_iterations,
+               cold / warm);
+  }
+
+  cache.clear();
+  clReleaseContext(context);
+  return 0;
+}
@@ -0,0 +1,172 @@
+// scaling.cpp
+//
+//    Strong scaling of clx::partitioned_executor across CPU sub-devices. The
+//    CPU device is split into 1, 2, 4, ... equal sub-devices and the same
+//    square (1D) and convolve (2D, 2-row halo) launches are partitioned
+//    across them. The last column is the share of kernel argument binds
+//    skipped by clx::bound_kernel because the value was already set.
+
+#include <chrono>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "cl/clx.hpp"
+#include "cl/bound_kernel.hpp"
+#include "cl/executor.hpp"
+#include "cl/kernels.hpp"
+
+static int num_iterations = 10;
+
+const std::size_t num_elements = 16 << 20;
+const std::size_t signal_width = 2048;
+const std::size_t signal_height = 2048;
+const cl_int mask_width = 3;
+
+template <typename F> auto time_ms(F &&f) -> double {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+struct result {
+  double square_ms;
+  double convolve_ms;
+  clx::kernel_arg_stats args;
+};
+
+auto skipped_percent(clx::kernel_arg_stats const &s) -> double {
+  auto total = s.calls + s.skipped;
+  return total ? 100.0 * s.skipped / total : 0.0;
+}
+
+auto measure(cl_platform_id platform, std::vector<cl_device_id> const &devices)
+    -> result {
+  auto context = clx::create_context(platform, devices);
+  auto simple =
+      clx::create_program_with_source(context, clx::kernel::simple.text);
+  auto convolution =
+      clx::create_program_with_source(context, clx::kernel::convolution.text);
+  clx::build_program(simple, devices);
+  clx::build_program(convolution, devices);
+
+  auto output_width = signal_width - mask_width + 1;
+  auto output_height = signal_height - mask_width + 1;
+  auto data = clx::create_buffer(context, CL_MEM_READ_WRITE,
+                                 num_elements * sizeof(cl_int), nullptr);
+  auto input = clx::create_buffer(
+      context, CL_MEM_READ_ONLY, signal_width * signal_height * sizeof(cl_uint),
+      nullptr);
+  auto mask_data = std::vector<cl_uint>(mask_width * mask_width, 1);
+  auto mask = clx::create_buffer(
+      context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      mask_data.size() * sizeof(cl_uint), mask_data.data());
+  auto output = clx::create_buffer(
+      context, CL_MEM_WRITE_ONLY,
+      output_width * output_height * sizeof(cl_uint), nullptr);
+
+  auto executor = clx::partitioned_executor{context, devices};
+
+  auto square_layout = clx::partition_layout{};
+  square_layout.units = num_elements;
+  square_layout.output_unit_bytes = sizeof(cl_int);
+  auto square = [&] {
+    executor.run(simple, "square", nullptr, data, square_layout, 1,
+                 [](clx::bound_kernel &k, clx::partition_slice const &s) {
+                   return clx::set_arguments(k, s.output);
+                 });
+  };
+
+  auto convolve_layout = clx::partition_layout{};
+  convolve_layout.units = output_height;
+  convolve_layout.inner = output_width;
+  convolve_layout.output_unit_bytes = output_width * sizeof(cl_uint);
+  convolve_layout.input_units = signal_height;
+  convolve_layout.input_unit_bytes = signal_width * sizeof(cl_uint);
+  convolve_layout.halo_after = mask_width - 1;
+  auto convolve = [&] {
+    executor.run(convolution, "convolve", input, output, convolve_layout, 2,
+                 [&](clx::bound_kernel &k, clx::partition_slice const &s) {
+                   return clx::set_arguments(k, s.input, mask, s.output,
+                                             cl_int(signal_width), mask_width);
+                 });
+  };
+
+  // warm-up
+  square();
+  convolve();
+
+  auto square_ms = time_ms([&] {
+    for (auto i = 0; i < num_iterations; i++) {
+      square();
+    }
+  });
+  auto convolve_ms = time_ms([&] {
+    for (auto i = 0; i < num_iterations; i++) {
+      convolve();
+    }
+  });
+  auto args = executor.argument_stats();
+
+  clReleaseMemObject(data);
+  clReleaseMemObject(input);
+  clReleaseMemObject(mask);
+  clReleaseMemObject(output);
+  clReleaseProgram(simple);
+  clReleaseProgram(convolution);
+  clReleaseContext(context);
+  return {square_ms / num_iterations, convolve_ms / num_iterations, args};
+}
+
+int main() {
+  auto platform_id = cl_platform_id{};
+  auto cpu_devices = std::vector<cl_device_id>{};
+  for (auto const &platform : clx::get_platform_ids()) {
+    platform_id = platform;
+    cpu_devices = clx::get_device_ids(platform_id, CL_DEVICE_TYPE_CPU);
+    if (cpu_devices.size() != 0) {
+      break;
+    }
+  }
+  if (cpu_devices.size() == 0) {
+    fmt::print("[ERROR] no CPU device found.\n");
+    return 1;
+  }
+  auto cpu = cpu_devices[0];
+  auto units = clx::get_device_info_max_compute_units(cpu);
+  auto max_sub_devices = clx::get_device_info_partition_max_sub_devices(cpu);
+  fmt::print("[INFO] device: {}, compute units: {}, max sub-devices: {}\n",
+             clx::get_device_info_name(cpu), units, max_sub_devices);
+
+  fmt::print("{:>12} | {:>12} {:>8} | {:>12} {:>8} | {:>8}\n", "sub-devices",
+             "square ms", "speedup", "convolve ms", "speedup", "skipped");
+  auto base = measure(platform_id, {cpu});
+  fmt::print("{:>12} | {:>12.3f} {:>8.2f} | {:>12.3f} {:>8.2f} | {:>7.1f}%\n",
+             "whole", base.square_ms, 1.0, base.convolve_ms, 1.0,
+             skipped_percent(base.args));
+
+  for (auto n = 1u; n <= max_sub_devices && n <= units; n *= 2) {
+    auto subs = clx::create_sub_devices_equally(cpu, units / n);
+    if (subs.size() < n) {
+      fmt::print("{:>12} | skipped, clCreateSubDevices failed\n", n);
+      continue;
+    }
+    auto used = std::vector<cl_device_id>(std::begin(subs),
+                                          std::begin(subs) + n);
+    auto t = measure(platform_id, used);
+    fmt::print("{:>12} | {:>12.3f} {:>8.2f} | {:>12.3f} {:>8.2f} | {:>7.1f}%\n",
+               n, t.square_ms, base.square_ms / t.square_ms, t.convolve_ms,
+               base.convolve_ms / t.convolve_ms, skipped_percent(t.args));
+    for (auto &d : subs) {
+      clReleaseDevice(d);
+    }
+  }
+
+  if (clx::last_error() != CL_SUCCESS) {
+    fmt::print("[ERROR] {} failed. ({})\n", clx::last_error_func(),
+               clx::last_error());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,929 @@
+// suite.cpp
+//
+//    clx_bench: every exercise kernel over a sweep of problem sizes, timed
+//    with profiling events after warm-up runs. Prints p50/p95/p99 and the
+//    effective bandwidth, optionally writes the results as JSON and compares
+//    them with a saved baseline, failing on a regression.
+//
+//      clx_bench [--json out.json] [--baseline base.json] [--threshold 0.1]
+//                [--reps 20] [--warmup 2] [--device cpu|gpu|all]
+//
+//    Runs on the CPU device by default, so regressions are caught on
+//    machines without a GPU; CLX_DEVICE picks a device by name.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "cl/bench.hpp"
+#include "cl/buffer_pool.hpp"
+#include "cl/clx.hpp"
+#include "cl/convolve.hpp"
+#include "cl/device_caps.hpp"
+#include "cl/device_select.hpp"
+#include "cl/gaussian.hpp"
+#include "cl/histogram.hpp"
+#include "cl/kernels.hpp"
+
+struct suite {
+  cl_context context;
+  cl_command_queue queue;
+  clx::device_caps const &caps;
+  clx::bench_options options;
+  std::vector<clx::bench_result> results;
+
+  auto fits(std::size_t bytes) const -> bool {
+    return bytes <= caps.max_mem_alloc_size;
+  }
+
+  auto build(clx::kernel::source const &source) -> cl_program {
+    auto program = clx::create_program_with_source(context, source.text);
+    auto ds = std::vector<cl_device_id>{caps.id};
+    if (program && !clx::build_program(program, ds)) {
+      fmt::print("[ERROR] {}: {}\n", source.name,
+                 clx::get_program_build_info_log(program, caps.id).c_str());
+      clReleaseProgram(program);
+      return nullptr;
+    }
+    return program;
+  }
+
+  auto run(std::string name, std::size_t size, std::size_t bytes,
+           clx::bench_body const &body) -> void {
+    results.push_back(
+        clx::run_bench(queue, std::move(name), size, bytes, body, options));
+  }
+};
+
+auto random_words(std::size_t n) -> std::vector<cl_uint> {
+  auto rng = std::mt19937{42};
+  auto out = std::vector<cl_uint>(n);
+  for (auto &v : out) {
+    v = rng();
+  }
+  return out;
+}
+
+auto enqueue(cl_command_queue q, cl_kernel k, cl_uint work_dim,
+             const size_t *global, const size_t *local,
+             std::vector<cl_event> &events) -> cl_int {
+  auto e = cl_event{};
+  auto err = clEnqueueNDRangeKernel(q, k, work_dim, nullptr, global, local, 0,
+                                    nullptr, &e);
+  if (err == CL_SUCCESS) {
+    events.push_back(e);
+  }
+  return err;
+}
+
+auto bench_vadd(suite &s) -> void {
+  auto program = s.build(clx::kernel::adder2);
+  if (!program) {
+    return;
+  }
+  auto kernel = clx::create_kernel(program, "vadd");
+  for (auto n : {std::size_t{1} << 16, std::size_t{1} << 20,
+                 std::size_t{1} << 24}) {
+    if (!s.fits(n * sizeof(cl_int))) {
+      continue;
+    }
+    auto a = random_words(n);
+    auto flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+    auto bytes = n * sizeof(cl_int);
+    auto ma = clx::create_buffer(s.context, flags, bytes, a.data());
+    auto mb = clx::create_buffer(s.context, flags, bytes, a.data());
+    auto mc = clx::create_buffer(s.context, CL_MEM_WRITE_ONLY,
+                                 n * sizeof(cl_int), nullptr);
+    clx::set_arguments(kernel, ma, mb, mc);
+    size_t global[1] = {n};
+    s.run("vadd", n, 3 * n * sizeof(cl_int), [&](auto &events) {
+      return enqueue(s.queue, kernel, 1, global, nullptr, events);
+    });
+    clReleaseMemObject(ma);
+    clReleaseMemObject(mb);
+    clReleaseMemObject(mc);
+  }
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+}
+
+auto bench_square(suite &s) -> void {
+  auto program = s.build(clx::kernel::simple);
+  if (!program) {
+    return;
+  }
+  auto kernel = clx::create_kernel(program, "square");
+  for (auto n : {std::size_t{1} << 16, std::size_t{1} << 20,
+                 std::size_t{1} << 24}) {
+    if (!s.fits(n * sizeof(cl_int))) {
+      continue;
+    }
+    // ones, so repeated squaring stays in range
+    auto data = std::vector<cl_int>(n, 1);
+    auto m = clx::create_buffer(s.context,
+                                CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                n * sizeof(cl_int), data.data());
+    clx::set_arguments(kernel, m);
+    size_t global[1] = {n};
+    s.run("square", n, 2 * n * sizeof(cl_int), [&](auto &events) {
+      return enqueue(s.queue, kernel, 1, global, nullptr, events);
+    });
+    clReleaseMemObject(m);
+  }
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+}
+
+// square on pooled sub-buffers, with a size mix that grows every round so
+// the pool has to give back the blocks the previous round left idle.
+auto bench_buffer_pool(suite &s) -> void {
+  auto program = s.build(clx::kernel::simple);
+  if (!program) {
+    return;
+  }
+  auto kernel = clx::create_kernel(program, "square");
+  auto block_size = std::size_t{16} << 20;
+  auto pool = clx::buffer_pool{s.context, s.caps.id, CL_MEM_READ_WRITE,
+                               block_size};
+  for (auto n : {std::size_t{1} << 14, std::size_t{1} << 18,
+                 std::size_t{1} << 20}) {
+    auto bytes = n * sizeof(cl_int);
+    if (!s.fits(bytes)) {
+      continue;
+    }
+    auto regions = std::vector<clx::buffer_region>{};
+    for (auto i = std::size_t{0}; i < 8; i++) {
+      regions.push_back(pool.allocate(bytes));
+    }
+    auto ok = std::all_of(std::begin(regions), std::end(regions),
+                          [](auto const &r) { return r.mem != nullptr; });
+    if (ok) {
+      size_t global[1] = {n};
+      auto next = std::size_t{0};
+      s.run("square_pooled", n, 2 * bytes, [&](auto &events) {
+        clx::set_arguments(kernel, regions[next++ % regions.size()].mem);
+        return enqueue(s.queue, kernel, 1, global, nullptr, events);
+      });
+    }
+    clx::finish(s.queue);
+    for (auto const &r : regions) {
+      pool.release(r);
+    }
+  }
+  pool.trim();
+  fmt::print("[INFO] buffer pool: {}\n", clx::to_string(pool.stats()));
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+}
+
+auto bench_convolve(suite &s) -> void {
+  auto program = s.build(clx::kernel::convolution);
+  if (!program) {
+    return;
+  }
+  auto kernel = clx::create_kernel(program, "convolve");
+  const cl_int mask_width = 3;
+  auto mask_data = std::vector<cl_uint>(mask_width * mask_width, 1);
+  auto mask = clx::create_buffer(
+      s.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      mask_data.size() * sizeof(cl_uint), mask_data.data());
+  for (auto w : {std::size_t{256}, std::size_t{1024}, std::size_t{4096}}) {
+    if (!s.fits(w * w * sizeof(cl_uint))) {
+      continue;
+    }
+    auto ow = w - mask_width + 1;
+    auto input_data = random_words(w * w);
+    auto input = clx::create_buffer(
+        s.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        w * w * sizeof(cl_uint), input_data.data());
+    auto output = clx::create_buffer(s.context, CL_MEM_WRITE_ONLY,
+                                     ow * ow * sizeof(cl_uint), nullptr);
+    clx::set_arguments(kernel, input, mask, output, cl_int(w), mask_width);
+    size_t global[2] = {ow, ow};
+    s.run("convolve", w * w, (w * w + ow * ow) * sizeof(cl_uint),
+          [&](auto &events) {
+            return enqueue(s.queue, kernel, 2, global, nullptr, events);
+          });
+    clReleaseMemObject(input);
+    clReleaseMemObject(output);
+  }
+  clReleaseMemObject(mask);
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+}
+
+// the tiled kernel at a few mask widths, with the mask read from a buffer
+// and baked into the program.
+auto bench_convolve_tiled(suite &s) -> void {
+  for (auto m : {3, 7}) {
+    auto mask_data = std::vector<cl_uint>(m * m, 1);
+    auto mask = clx::create_buffer(
+        s.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        mask_data.size() * sizeof(cl_uint), mask_data.data());
+    for (auto baked : {false, true}) {
+      auto convolution = clx::tiled_convolution{
+          s.context, s.caps.id, m,
+          baked ? mask_data : std::vector<cl_uint>{}};
+      if (!convolution) {
+        fmt::print("[ERROR] convolve_tiled, mask {}: {}\n", m,
+                   convolution.build_log().c_str());
+        continue;
+      }
+      auto name = fmt::format("convolve_tiled_{}m{}", baked ? "baked_" : "",
+                              m);
+      for (auto w : {std::size_t{256}, std::size_t{1024}, std::size_t{4096}}) {
+        if (!s.fits(w * w * sizeof(cl_uint))) {
+          continue;
+        }
+        auto ow = w - m + 1;
+        auto input_data = random_words(w * w);
+        auto input = clx::create_buffer(
+            s.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            w * w * sizeof(cl_uint), input_data.data());
+        auto output = clx::create_buffer(s.context, CL_MEM_WRITE_ONLY,
+                                         ow * ow * sizeof(cl_uint), nullptr);
+        s.run(name, w * w, (w * w + ow * ow) * sizeof(cl_uint),
+              [&](auto &events) {
+                auto e = cl_event{};
+                auto err = convolution.enqueue(s.queue, input, mask, output,
+                                               w, w, 0, nullptr, &e);
+                if (err == CL_SUCCESS) {
+                  events.push_back(e);
+                }
+                return err;
+              });
+        clReleaseMemObject(input);
+        clReleaseMemObject(output);
+      }
+    }
+    clReleaseMemObject(mask);
+  }
+}
+
+// the direct and FFT paths over a sweep of mask widths, reporting the first
+// width at which the FFT path is faster (see clx::fft_mask_width).
+auto bench_convolve_crossover(suite &s) -> void {
+  const auto w = std::size_t{1024};
+  if (!s.fits(w * w * sizeof(cl_uint))) {
+    return;
+  }
+  auto input_data = random_words(w * w);
+  auto input = clx::create_buffer(
+      s.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      w * w * sizeof(cl_uint), input_data.data());
+  auto output = clx::create_buffer(s.context, CL_MEM_WRITE_ONLY,
+                                   w * w * sizeof(cl_uint), nullptr);
+  auto timed = [&](std::string name, std::size_t m, auto enqueue) -> double {
+    auto ow = w - m + 1;
+    s.run(std::move(name), w * w, (w * w + ow * ow) * sizeof(cl_uint),
+          [&](auto &events) {
+            auto e = cl_event{};
+            auto err = enqueue(&e);
+            if (err == CL_SUCCESS) {
+              events.push_back(e);
+            }
+            return err;
+          });
+    auto const &r = s.results.back();
+    return r.err == CL_SUCCESS ? r.p50 : -1;
+  };
+
+  auto crossover = 0;
+  for (auto m : {3, 7, 11, 15, 21, 31}) {
+    auto mask = std::vector<cl_uint>(m * m, 1);
+    auto direct = clx::tiled_convolution{s.context, s.caps.id, m, mask};
+    auto fft = clx::fft_convolution{s.context, s.caps.id, m, mask};
+    if (!direct || !fft) {
+      fmt::print("[ERROR] convolve, mask {}: {}\n", m,
+                 (direct ? fft.build_log() : direct.build_log()).c_str());
+      continue;
+    }
+    auto direct_ms = timed(fmt::format("convolve_direct_m{}", m), m,
+                           [&](cl_event *e) {
+                             return direct.enqueue(s.queue, input, nullptr,
+                                                   output, w, w, 0, nullptr,
+                                                   e);
+                           });
+    auto fft_ms = timed(fmt::format("convolve_fft_m{}", m), m,
+                        [&](cl_event *e) {
+                          return fft.enqueue(s.queue, input, output, w, w, 0,
+                                             nullptr, e);
+                        });
+    if (!crossover && direct_ms > 0 && fft_ms > 0 && fft_ms < direct_ms) {
+      crossover = m;
+    }
+  }
+  if (crossover) {
+    fmt::print("[INFO] convolve {}x{}: FFT faster from mask width {} "
+               "(convolver switches at {})\n",
+               w, w, crossover, clx::fft_mask_width);
+  } else {
+    fmt::print("[INFO] convolve {}x{}: direct faster at every mask width\n",
+               w, w);
+  }
+  clReleaseMemObject(input);
+  clReleaseMemObject(output);
+}
+
+auto create_image(cl_context context, cl_channel_type type, std::size_t w,
+                  std::size_t h, void *data) -> cl_mem {
+  auto format = cl_image_format{CL_RGBA, type};
+  auto flags = data ? CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR
+                    : CL_MEM_WRITE_ONLY;
+  auto err = cl_int{};
+  auto image = clCreateImage2D(context, flags, &format, w, h, 0, data, &err);
+  clx::set_err_if_err(err, "clCreateImage2D");
+  return image;
+}
+
+auto bench_gaussian_filter(suite &s) -> void {
+  auto program = s.build(clx::kernel::gausian_filter);
+  if (!program) {
+    return;
+  }
+  auto kernel = clx::create_kernel(program, "gaussian_filter");
+  auto err = cl_int{};
+  auto sampler = clCreateSampler(s.context, CL_FALSE, CL_ADDRESS_CLAMP_TO_EDGE,
+                                 CL_FILTER_NEAREST, &err);
+  for (auto w : {std::size_t{256}, std::size_t{1024}, std::size_t{4096}}) {
+    if (w > s.caps.image2d_max_width || w > s.caps.image2d_max_height ||
+        !s.fits(w * w * 4)) {
+      continue;
+    }
+    auto pixels = random_words(w * w);
+    auto src = create_image(s.context, CL_UNORM_INT8, w, w, pixels.data());
+    auto dst = create_image(s.context, CL_UNORM_INT8, w, w, nullptr);
+    clx::set_arguments(kernel, clx::image(src), clx::image(dst), sampler,
+                       cl_int(w), cl_int(w));
+    size_t local[2] = {16, 16};
+    size_t global[2] = {(w + 15) / 16 * 16, (w + 15) / 16 * 16};
+    s.run("gaussian_filter", w * w, 2 * w * w * 4, [&](auto &events) {
+      return enqueue(s.queue, kernel, 2, global, local, events);
+    });
+    clReleaseMemObject(src);
+    clReleaseMemObject(dst);
+  }
+  clReleaseSampler(sampler);
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+}
+
+// both passes of the separable filter over images and over buffers, from
+// the radius of the 3x3 kernel up to sigma 10. a marker opens each sample,
+// as the row pass's event stays inside the filter.
+auto bench_separable_gaussian(suite &s) -> void {
+  auto marked = [&](std::vector<cl_event> &events, auto enqueue) -> cl_int {
+    auto start = cl_event{};
+    auto err = clEnqueueMarkerWithWaitList(s.queue, 0, nullptr, &start);
+    if (err != CL_SUCCESS) {
+      return err;
+    }
+    events.push_back(start);
+    auto e = cl_event{};
+    err = enqueue(&e);
+    if (err == CL_SUCCESS) {
+      events.push_back(e);
+    }
+    return err;
+  };
+  for (auto sigma : {1.0f / 3, 1.0f, 3.0f, 10.0f}) {
+    auto filter = clx::separable_gaussian{s.context, s.caps.id, sigma};
+    if (!filter) {
+      fmt::print("[ERROR] separable gaussian, sigma {}: {}\n", sigma,
+                 filter.build_log().c_str());
+      continue;
+    }
+    auto radius = filter.radius();
+    for (auto w : {std::size_t{256}, std::size_t{1024}, std::size_t{4096}}) {
+      if (w > s.caps.image2d_max_width || w > s.caps.image2d_max_height ||
+          !s.fits(w * w * 16)) {
+        continue;
+      }
+      auto pixels = random_words(w * w);
+      auto src = create_image(s.context, CL_UNORM_INT8, w, w, pixels.data());
+      auto dst = create_image(s.context, CL_UNORM_INT8, w, w, nullptr);
+      s.run(fmt::format("gaussian_separable_image_r{}", radius), w * w,
+            2 * w * w * 4, [&](auto &events) {
+              return marked(events, [&](cl_event *e) {
+                return filter.enqueue_image(s.queue, src, dst, w, w, 0,
+                                            nullptr, e);
+              });
+            });
+      clReleaseMemObject(src);
+      clReleaseMemObject(dst);
+
+      auto flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+      auto in = clx::create_buffer(s.context, flags, w * w * 4, pixels.data());
+      auto out = clx::create_buffer(s.context, CL_MEM_WRITE_ONLY, w * w * 4,
+                                    nullptr);
+      s.run(fmt::format("gaussian_separable_buffer_r{}", radius), w * w,
+            2 * w * w * 4, [&](auto &events) {
+              return marked(events, [&](cl_event *e) {
+                return filter.enqueue_buffer(s.queue, in, out, w, w, 0,
+                                             nullptr, e);
+              });
+            });
+      clReleaseMemObject(in);
+      clReleaseMemObject(out);
+    }
+  }
+}
+
+// the image pass and the sum of the partial histograms, timed together.
+auto bench_histogram(suite &s, char const *name, char const *sum_name,
+                     cl_channel_type type, std::size_t pixel_bytes, int bins)
+    -> void {
+  auto program = s.build(clx::kernel::histogram_image);
+  if (!program) {
+    return;
+  }
+  auto kernel = clx::create_kernel(program, name);
+  auto sum = clx::create_kernel(program, sum_name);
+  const cl_int pixels_per_item = 32;
+  size_t local[2] = {16, 16};
+  size_t sum_global[1] = {256 * 3};
+  size_t sum_local[1] = {std::min<std::size_t>(
+      256, clx::get_kernel_work_group_info_size(sum, s.caps.id))};
+  auto histogram = clx::create_buffer(s.context, CL_MEM_WRITE_ONLY,
+                                      257 * 3 * sizeof(cl_uint), nullptr);
+  for (auto w : {std::size_t{256}, std::size_t{1024}, std::size_t{4096}}) {
+    if (w > s.caps.image2d_max_width || w > s.caps.image2d_max_height ||
+        !s.fits(w * w * pixel_bytes)) {
+      continue;
+    }
+    auto data = std::vector<unsigned char>(w * w * pixel_bytes);
+    if (type == CL_FLOAT) {
+      auto rng = std::mt19937{42};
+      auto dist = std::uniform_real_distribution<float>{0, 1};
+      for (auto i = std::size_t{0}; i < w * w * 4; i++) {
+        auto f = dist(rng);
+        std::memcpy(data.data() + i * sizeof(f), &f, sizeof(f));
+      }
+    } else {
+      auto words = random_words(w * w);
+      std::memcpy(data.data(), words.data(), data.size());
+    }
+    auto image = create_image(s.context, type, w, w, data.data());
+    auto items_x = (w + pixels_per_item - 1) / pixels_per_item;
+    size_t global[2] = {(items_x + local[0] - 1) / local[0] * local[0],
+                        (w + local[1] - 1) / local[1] * local[1]};
+    auto num_groups = (global[0] / local[0]) * (global[1] / local[1]);
+    auto partial = clx::create_buffer(s.context, CL_MEM_READ_WRITE,
+                                      num_groups * bins * sizeof(cl_uint),
+                                      nullptr);
+    clx::set_arguments(kernel, clx::image(image), pixels_per_item,
+                       clx::buffer<cl_uint>(partial),
+                       clx::local<cl_uint>(bins));
+    clx::set_arguments(sum, partial, cl_int(num_groups), histogram);
+    s.run(name, w * w, w * w * pixel_bytes, [&](auto &events) {
+      auto err = enqueue(s.queue, kernel, 2, global, local, events);
+      if (err != CL_SUCCESS) {
+        return err;
+      }
+      return enqueue(s.queue, sum, 1, sum_global, sum_local, events);
+    });
+    clReleaseMemObject(image);
+    clReleaseMemObject(partial);
+  }
+  clReleaseMemObject(histogram);
+  clReleaseKernel(kernel);
+  clReleaseKernel(sum);
+  clReleaseProgram(program);
+}
+
+// the unorm8 histogram with each local histogram privatization, over
+// uniform-random pixels and over a single color, where every work-item
+// contends for the same three bins.
+auto bench_histogram_privatization(suite &s) -> void {
+  auto program = s.build(clx::kernel::histogram_image);
+  if (!program) {
+    return;
+  }
+  auto shared = clx::create_kernel(program, "histogram_image_rgba_unorm8");
+  auto privatized =
+      clx::create_kernel(program, "histogram_image_rgba_unorm8_private");
+  auto sum =
+      clx::create_kernel(program, "histogram_sum_partial_results_unorm8");
+  const cl_int pixels_per_item = 32;
+  size_t local[2] = {16, 16};
+  size_t sum_global[1] = {256 * 3};
+  size_t sum_local[1] = {std::min<std::size_t>(
+      256, clx::get_kernel_work_group_info_size(sum, s.caps.id))};
+  auto warp =
+      clx::get_kernel_work_group_info_preferred_multiple(privatized, s.caps.id);
+  auto histogram = clx::create_buffer(s.context, CL_MEM_WRITE_ONLY,
+                                      256 * 3 * sizeof(cl_uint), nullptr);
+  for (auto w : {std::size_t{1024}, std::size_t{4096}}) {
+    if (w > s.caps.image2d_max_width || w > s.caps.image2d_max_height ||
+        !s.fits(w * w * 4)) {
+      continue;
+    }
+    auto items_x = (w + pixels_per_item - 1) / pixels_per_item;
+    size_t global[2] = {(items_x + local[0] - 1) / local[0] * local[0],
+                        (w + local[1] - 1) / local[1] * local[1]};
+    auto num_groups = (global[0] / local[0]) * (global[1] / local[1]);
+    auto partial = clx::create_buffer(s.context, CL_MEM_READ_WRITE,
+                                      num_groups * 256 * 3 * sizeof(cl_uint),
+                                      nullptr);
+    clx::set_arguments(sum, partial, cl_int(num_groups), histogram);
+    for (auto flat : {false, true}) {
+      auto pixels = flat ? std::vector<cl_uint>(w * w, 0x80402010u)
+                         : random_words(w * w);
+      auto image = create_image(s.context, CL_UNORM_INT8, w, w, pixels.data());
+      for (auto p : {clx::histogram_privatization::shared,
+                     clx::histogram_privatization::sub_group,
+                     clx::histogram_privatization::lane}) {
+        auto layout = clx::histogram_layout_for(p, s.caps, local[0] * local[1],
+                                                warp, 256 * 3);
+        auto kernel = p == clx::histogram_privatization::shared ? shared
+                                                                : privatized;
+        auto err =
+            p == clx::histogram_privatization::shared
+                ? clx::set_arguments(kernel, clx::image(image),
+                                     pixels_per_item,
+                                     clx::buffer<cl_uint>(partial),
+                                     clx::local<cl_uint>(256 * 3))
+                : clx::set_arguments(kernel, clx::image(image),
+                                     pixels_per_item,
+                                     clx::buffer<cl_uint>(partial),
+                                     clx::local<cl_uint>(layout.local_words),
+                                     cl_int(layout.copies),
+                                     cl_int(layout.interleaved));
+        auto name = fmt::format("histogram_unorm8_{}_{}", clx::to_string(p),
+                                flat ? "flat" : "uniform");
+        s.run(name, w * w, w * w * 4, [&](auto &events) {
+          if (err != CL_SUCCESS) {
+            return err;
+          }
+          auto e = enqueue(s.queue, kernel, 2, global, local, events);
+          if (e != CL_SUCCESS) {
+            return e;
+          }
+          return enqueue(s.queue, sum, 1, sum_global, sum_local, events);
+        });
+      }
+      clReleaseMemObject(image);
+    }
+    clReleaseMemObject(partial);
+  }
+  clReleaseMemObject(histogram);
+  clReleaseKernel(shared);
+  clReleaseKernel(privatized);
+  clReleaseKernel(sum);
+  clReleaseProgram(program);
+}
+
+// the two-kernel merge against the single-launch ones, all over the
+// device's privatized layout. atomic includes the fill that zeroes the final
+// histogram.
+auto bench_histogram_merge(suite &s) -> void {
+  auto program = s.build(clx::kernel::histogram_image);
+  if (!program) {
+    return;
+  }
+  auto two_pass =
+      clx::create_kernel(program, "histogram_image_rgba_unorm8_private");
+  auto atomic =
+      clx::create_kernel(program, "histogram_image_rgba_unorm8_atomic");
+  auto last_group =
+      clx::create_kernel(program, "histogram_image_rgba_unorm8_last_group");
+  auto sum =
+      clx::create_kernel(program, "histogram_sum_partial_results_unorm8");
+  const cl_int pixels_per_item = 32;
+  size_t local[2] = {16, 16};
+  size_t sum_global[1] = {256 * 3};
+  size_t sum_local[1] = {std::min<std::size_t>(
+      256, clx::get_kernel_work_group_info_size(sum, s.caps.id))};
+  auto warp =
+      clx::get_kernel_work_group_info_preferred_multiple(two_pass, s.caps.id);
+  auto layout = clx::histogram_layout_for(
+      clx::histogram_privatization::automatic, s.caps, local[0] * local[1],
+      warp, 256 * 3);
+  auto histogram = clx::create_buffer(s.context, CL_MEM_READ_WRITE,
+                                      256 * 3 * sizeof(cl_uint), nullptr);
+  auto zero = cl_uint{0};
+  auto groups_done = clx::create_buffer(
+      s.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(zero),
+      &zero);
+  for (auto w : {std::size_t{1024}, std::size_t{4096}}) {
+    if (w > s.caps.image2d_max_width || w > s.caps.image2d_max_height ||
+        !s.fits(w * w * 4)) {
+      continue;
+    }
+    auto items_x = (w + pixels_per_item - 1) / pixels_per_item;
+    size_t global[2] = {(items_x + local[0] - 1) / local[0] * local[0],
+                        (w + local[1] - 1) / local[1] * local[1]};
+    auto num_groups = (global[0] / local[0]) * (global[1] / local[1]);
+    auto partial = clx::create_buffer(s.context, CL_MEM_READ_WRITE,
+                                      num_groups * 256 * 3 * sizeof(cl_uint),
+                                      nullptr);
+    clx::set_arguments(sum, partial, cl_int(num_groups), histogram);
+    for (auto flat : {false, true}) {
+      auto pixels = flat ? std::vector<cl_uint>(w * w, 0x80402010u)
+                         : random_words(w * w);
+      auto image = create_image(s.context, CL_UNORM_INT8, w, w, pixels.data());
+      auto tmp = clx::local<cl_uint>(layout.local_words);
+      auto copies = cl_int(layout.copies);
+      auto interleaved = cl_int(layout.interleaved);
+      for (auto m : {clx::histogram_merge::two_pass,
+                     clx::histogram_merge::atomic,
+                     clx::histogram_merge::last_group}) {
+        auto kernel = m == clx::histogram_merge::two_pass ? two_pass
+                      : m == clx::histogram_merge::atomic ? atomic
+                                                          : last_group;
+        auto err = cl_int{};
+        switch (m) {
+        case clx::histogram_merge::two_pass:
+          err = clx::set_arguments(kernel, clx::image(image), pixels_per_item,
+                                   clx::buffer<cl_uint>(partial), tmp, copies,
+                                   interleaved);
+          break;
+        case clx::histogram_merge::atomic:
+          err = clx::set_arguments(kernel, clx::image(image), pixels_per_item,
+                                   clx::buffer<cl_uint>(histogram), tmp,
+                                   copies, interleaved);
+          break;
+        case clx::histogram_merge::last_group:
+          err = clx::set_arguments(kernel, clx::image(image), pixels_per_item,
+                                   clx::buffer<cl_uint>(partial), tmp, copies,
+                                   interleaved,
+                                   clx::buffer<cl_uint>(histogram),
+                                   clx::buffer<cl_uint>(groups_done));
+          break;
+        }
+        auto name = fmt::format("histogram_merge_{}_{}", clx::to_string(m),
+                                flat ? "flat" : "uniform");
+        s.run(name, w * w, w * w * 4, [&](auto &events) {
+          if (err != CL_SUCCESS) {
+            return err;
+          }
+          if (m == clx::histogram_merge::atomic) {
+            auto e = cl_event{};
+            auto fill = clEnqueueFillBuffer(s.queue, histogram, &zero,
+                                            sizeof(zero), 0,
+                                            256 * 3 * sizeof(cl_uint), 0,
+                                            nullptr, &e);
+            if (fill != CL_SUCCESS) {
+              return fill;
+            }
+            events.push_back(e);
+          }
+          auto e = enqueue(s.queue, kernel, 2, global, local, events);
+          if (e != CL_SUCCESS || m != clx::histogram_merge::two_pass) {
+            return e;
+          }
+          return enqueue(s.queue, sum, 1, sum_global, sum_local, events);
+        });
+      }
+      clReleaseMemObject(image);
+    }
+    clReleaseMemObject(partial);
+  }
+  clReleaseMemObject(groups_done);
+  clReleaseMemObject(histogram);
+  clReleaseKernel(two_pass);
+  clReleaseKernel(atomic);
+  clReleaseKernel(last_group);
+  clReleaseKernel(sum);
+  clReleaseProgram(program);
+}
+
+// the per-frame cost of a histogram_stream, counting, accumulating and, with
+// a window, updating the ring, with no readback.
+auto bench_histogram_stream(suite &s) -> void {
+  const auto w = std::size_t{1024};
+  if (w > s.caps.image2d_max_width || w > s.caps.image2d_max_height ||
+      !s.fits(w * w * 4)) {
+    return;
+  }
+  auto pixels = random_words(w * w);
+  auto image = create_image(s.context, CL_UNORM_INT8, w, w, pixels.data());
+  for (auto window : {std::size_t{0}, std::size_t{30}}) {
+    auto stream = clx::histogram_stream(s.context, s.caps.id, window);
+    if (!stream) {
+      fmt::print("[WARN] histogram_stream: {}\n", stream.build_log());
+      continue;
+    }
+    s.run(fmt::format("histogram_stream_w{}", window), w * w, w * w * 4,
+          [&](auto &events) {
+            auto start = cl_event{};
+            auto err =
+                clEnqueueMarkerWithWaitList(s.queue, 0, nullptr, &start);
+            if (err != CL_SUCCESS) {
+              return err;
+            }
+            events.push_back(start);
+            auto e = cl_event{};
+            err = stream.enqueue_frame(s.queue, image, w, w, 0, nullptr, &e);
+            if (err == CL_SUCCESS) {
+              events.push_back(e);
+            }
+            return err;
+          });
+  }
+  clReleaseMemObject(image);
+}
+
+// the generic engine across sample types, channel and bin counts, in local
+// memory where the histogram fits and in global memory always.
+auto bench_histogram_generic(suite &s) -> void {
+  const auto pixels = std::size_t{2048} * 2048;
+  auto engine = clx::histogram_engine(s.context, s.caps.id);
+  for (auto const &c :
+       {clx::histogram_config_for_depth(3, 256, 8),
+        clx::histogram_config_for_depth(1, 4096, 12),
+        clx::histogram_config_for_depth(1, 65536, 16),
+        clx::histogram_config_for_depth(4, 1024, 10),
+        clx::histogram_config{clx::histogram_sample::f32, 1, 1024, 0, 1}}) {
+    auto bytes = pixels * c.channels * clx::sample_size(c.sample);
+    if (!s.fits(bytes)) {
+      continue;
+    }
+    // samples spread over the configured range
+    auto words = random_words(pixels * c.channels);
+    auto data = std::vector<unsigned char>(bytes);
+    for (std::size_t i = 0; i < words.size(); i++) {
+      switch (c.sample) {
+      case clx::histogram_sample::u8:
+        data[i] = static_cast<cl_uchar>(words[i]);
+        break;
+      case clx::histogram_sample::u16: {
+        auto v = static_cast<cl_ushort>(words[i] & cl_uint(c.range_max));
+        std::memcpy(&data[i * 2], &v, sizeof(v));
+        break;
+      }
+      case clx::histogram_sample::f32: {
+        auto v = static_cast<cl_float>(words[i] >> 8) / (1 << 24);
+        std::memcpy(&data[i * 4], &v, sizeof(v));
+        break;
+      }
+      }
+    }
+    auto samples = clx::create_buffer(
+        s.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes,
+        data.data());
+    auto histogram = clx::create_buffer(s.context, CL_MEM_READ_WRITE,
+                                        c.total_bins() * sizeof(cl_uint),
+                                        nullptr);
+    for (auto storage :
+         {clx::histogram_storage::local, clx::histogram_storage::global}) {
+      if (storage == clx::histogram_storage::local &&
+          engine.storage_for(c) != storage) {
+        continue;
+      }
+      auto name = fmt::format(
+          "histogram_generic_{}x{}_{}_{}", c.channels, c.bins,
+          c.sample == clx::histogram_sample::u8    ? "u8"
+          : c.sample == clx::histogram_sample::u16 ? "u16"
+                                                   : "f32",
+          clx::to_string(storage));
+      s.run(name, pixels, bytes, [&](auto &events) {
+        auto start = cl_event{};
+        auto err = clEnqueueMarkerWithWaitList(s.queue, 0, nullptr, &start);
+        if (err != CL_SUCCESS) {
+          return err;
+        }
+        events.push_back(start);
+        auto e = cl_event{};
+        err = engine.enqueue(s.queue, c, samples, pixels, histogram, storage,
+                             0, nullptr, &e);
+        if (err == CL_SUCCESS) {
+          events.push_back(e);
+        }
+        return err;
+      });
+    }
+    clReleaseMemObject(samples);
+    clReleaseMemObject(histogram);
+  }
+}
+
+auto usage(char const *name) -> int {
+  fmt::print("usage: {} [--json out.json] [--baseline base.json] "
+             "[--threshold 0.1] [--reps 20] [--warmup 2] "
+             "[--device cpu|gpu|all]\n",
+             name);
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  auto options = clx::bench_options{};
+  auto json_path = std::string{};
+  auto baseline_path = std::string{};
+  auto threshold = 0.1;
+  auto type = cl_device_type{CL_DEVICE_TYPE_CPU};
+  for (auto i = 1; i < argc; i++) {
+    auto arg = std::string{argv[i]};
+    if (i + 1 == argc) {
+      return usage(argv[0]);
+    }
+    auto value = std::string{argv[++i]};
+    if (arg == "--json") {
+      json_path = value;
+    } else if (arg == "--baseline") {
+      baseline_path = value;
+    } else if (arg == "--threshold") {
+      threshold = std::stod(value);
+    } else if (arg == "--reps") {
+      options.reps = std::max(std::stoi(value), 1);
+    } else if (arg == "--warmup") {
+      options.warmup = std::max(std::stoi(value), 0);
+    } else if (arg == "--device" && value == "cpu") {
+      type = CL_DEVICE_TYPE_CPU;
+    } else if (arg == "--device" && value == "gpu") {
+      type = CL_DEVICE_TYPE_GPU;
+    } else if (arg == "--device" && value == "all") {
+      type = CL_DEVICE_TYPE_ALL;
+    } else {
+      return usage(argv[0]);
+    }
+  }
+
+  auto policy = clx::selection_policy{};
+  policy.requirements.type = type;
+  policy.persist = false;
+  auto choice = clx::select_device(policy);
+  if (!choice) {
+    fmt::print("[ERROR] no matching OpenCL device found.\n");
+    return 1;
+  }
+  auto const &caps = clx::device_caps_of(choice.device);
+  fmt::print("[INFO] device: {}\n", caps.name.c_str());
+
+  auto devices = std::vector<cl_device_id>{choice.device};
+  auto context = clx::create_context(choice.platform, devices);
+  auto queue = clx::create_command_queue(context, choice.device,
+                                         CL_QUEUE_PROFILING_ENABLE);
+  auto s = suite{context, queue, caps, options, {}};
+
+  bench_vadd(s);
+  bench_square(s);
+  bench_buffer_pool(s);
+  bench_convolve(s);
+  bench_convolve_tiled(s);
+  bench_convolve_crossover(s);
+  bench_histogram_generic(s);
+  if (caps.image_support) {
+    bench_gaussian_filter(s);
+    bench_separable_gaussian(s);
+    bench_histogram(s, "histogram_image_rgba_unorm8",
+                    "histogram_sum_partial_results_unorm8", CL_UNORM_INT8, 4,
+                    256 * 3);
+    bench_histogram(s, "histogram_image_rgba_fp",
+                    "histogram_sum_partial_results_fp", CL_FLOAT, 16,
+                    257 * 3);
+    bench_histogram_privatization(s);
+    bench_histogram_merge(s);
+    bench_histogram_stream(s);
+  } else {
+    fmt::print("[INFO] no image support, skipping image kernels\n");
+  }
+
+  auto baseline = clx::read_bench_baseline(baseline_path);
+  fmt::print("{:>36} {:>10} | {:>10} {:>10} {:>10} | {:>8} | {:>8}\n",
+             "kernel", "size", "p50 ms", "p95 ms", "p99 ms", "GB/s",
+             "vs base");
+  auto failed = false;
+  for (auto const &r : s.results) {
+    if (r.err != CL_SUCCESS) {
+      fmt::print("{:>36} {:>10} | failed ({})\n", r.name, r.size, r.err);
+      failed = true;
+      continue;
+    }
+    auto it = baseline.find(clx::detail::bench_key(r.name, r.size));
+    auto change = it != std::end(baseline) && it->second > 0
+                      ? fmt::format("{:+.1f}%", 100 * (r.p50 / it->second - 1))
+                      : std::string{"-"};
+    fmt::print("{:>36} {:>10} | {:>10.4f} {:>10.4f} {:>10.4f} | {:>8.2f} | "
+               "{:>8}\n",
+               r.name, r.size, r.p50, r.p95, r.p99, r.gb_per_s, change);
+  }
+
+  if (!json_path.empty()) {
+    std::ofstream out(json_path);
+    out << clx::to_json(caps.name.c_str(), s.results);
+    if (!out) {
+      fmt::print("[ERROR] failed to write {}\n", json_path);
+      failed = true;
+    }
+  }
+
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+
+  auto regressions = clx::find_regressions(s.results, baseline, threshold);
+  for (auto const &c : regressions) {
+    fmt::print("[REGRESSION] {} size {}: {:.4f} ms -> {:.4f} ms ({:+.1f}%)\n",
+               c.name, c.size, c.baseline_ms, c.ms, 100 * (c.ratio() - 1));
+  }
+  if (!baseline_path.empty() && baseline.empty()) {
+    fmt::print("[WARN] no results read from baseline {}\n", baseline_path);
+  }
+  return failed || !regressions.empty() ? 1 : 0;
+}
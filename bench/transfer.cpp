@@ -0,0 +1,132 @@
+// transfer.cpp
+//
+//    Host <-> device bandwidth for three transfer paths, 1 MB to 1 GB:
+//      pageable - clEnqueueWriteBuffer/ReadBuffer from a std::vector
+//      pinned   - the same calls from a clx::staging_buffer
+//      map      - clx::mapped_buffer on the device buffer, memcpy in/out
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "cl/clx.hpp"
+#include "cl/staging.hpp"
+
+static int num_iterations = 5;
+
+template <typename F> auto time_ms(F &&f) -> double {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+auto gb_per_s(std::size_t bytes, double ms) -> double {
+  return double(bytes) * num_iterations / (ms * 1e-3) / 1e9;
+}
+
+int main() {
+  auto platform_id = cl_platform_id{};
+  auto devices = std::vector<cl_device_id>{};
+  for (auto const &platform : clx::get_platform_ids()) {
+    platform_id = platform;
+    devices = clx::get_device_ids(platform_id, CL_DEVICE_TYPE_ALL);
+    if (devices.size() != 0) {
+      break;
+    }
+  }
+  if (devices.size() == 0) {
+    fmt::print("[ERROR] no OpenCL device found.\n");
+    return 1;
+  }
+  devices.resize(1);
+  fmt::print("[INFO] device: {}\n", clx::get_device_info_name(devices[0]));
+
+  auto context = clx::create_context(platform_id, devices);
+  auto queue = clx::create_command_queue(context, devices[0], 0);
+  auto max_alloc = clx::get_device_info_max_mem_alloc_size(devices[0]);
+
+  fmt::print("{:>10} | {:>8} {:>8} | {:>8} {:>8} | {:>8} {:>8}  (GB/s)\n",
+             "size", "page-up", "page-dn", "pin-up", "pin-dn", "map-up",
+             "map-dn");
+
+  for (auto size = std::size_t{1} << 20; size <= std::size_t{1} << 30;
+       size <<= 2) {
+    if (size > max_alloc) {
+      fmt::print("{:>8}MB | skipped, exceeds CL_DEVICE_MAX_MEM_ALLOC_SIZE\n",
+                 size >> 20);
+      continue;
+    }
+    auto buffer =
+        clx::create_buffer(context, CL_MEM_READ_WRITE, size, nullptr);
+    auto pageable = std::vector<unsigned char>(size, 1);
+    auto pinned = clx::staging_buffer{context, queue, size};
+    if (!buffer || !pinned) {
+      fmt::print("{:>8}MB | skipped, allocation failed\n", size >> 20);
+      if (buffer) {
+        clReleaseMemObject(buffer);
+      }
+      continue;
+    }
+    std::memset(pinned.data(), 1, size);
+
+    auto page_up = time_ms([&] {
+      for (auto i = 0; i < num_iterations; i++) {
+        clx::enqueue_write_buffer(queue, buffer, CL_TRUE, 0, size,
+                                  pageable.data());
+      }
+    });
+    auto page_dn = time_ms([&] {
+      for (auto i = 0; i < num_iterations; i++) {
+        clx::enqueue_read_buffer(queue, buffer, CL_TRUE, 0, size,
+                                 pageable.data());
+      }
+    });
+    auto pin_up = time_ms([&] {
+      for (auto i = 0; i < num_iterations; i++) {
+        pinned.upload(queue, buffer, CL_TRUE, 0, size);
+      }
+    });
+    auto pin_dn = time_ms([&] {
+      for (auto i = 0; i < num_iterations; i++) {
+        pinned.download(queue, buffer, CL_TRUE, 0, size);
+      }
+    });
+    auto map_up = time_ms([&] {
+      for (auto i = 0; i < num_iterations; i++) {
+        auto view = clx::mapped_buffer{queue, buffer,
+                                       CL_MAP_WRITE_INVALIDATE_REGION, 0, size};
+        std::memcpy(view.data(), pageable.data(), size);
+        view.unmap();
+        clx::finish(queue);
+      }
+    });
+    auto map_dn = time_ms([&] {
+      for (auto i = 0; i < num_iterations; i++) {
+        auto view = clx::mapped_buffer{queue, buffer, CL_MAP_READ, 0, size};
+        std::memcpy(pageable.data(), view.data(), size);
+        view.unmap();
+        clx::finish(queue);
+      }
+    });
+
+    fmt::print("{:>8}MB | {:>8.2f} {:>8.2f} | {:>8.2f} {:>8.2f} | {:>8.2f} "
+               "{:>8.2f}\n",
+               size >> 20, gb_per_s(size, page_up), gb_per_s(size, page_dn),
+               gb_per_s(size, pin_up), gb_per_s(size, pin_dn),
+               gb_per_s(size, map_up), gb_per_s(size, map_dn));
+    clReleaseMemObject(buffer);
+  }
+
+  if (clx::last_error() != CL_SUCCESS) {
+    fmt::print("[ERROR] {} failed. ({})\n", clx::last_error_func(),
+               clx::last_error());
+  }
+
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+  return 0;
+}
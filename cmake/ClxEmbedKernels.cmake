@@ -0,0 +1,50 @@
+# Embed OpenCL C sources into a generated header.
+#
+#  clx_embed_kernels(<header> SOURCES <file.cl>...)
+#
+# Each file becomes a constexpr clx::kernel::source named after the file
+# (lower case, non-alphanumerics replaced by '_'), and clx::kernel::registry
+# lists all of them. The header is regenerated whenever a source changes.
+
+include(CMakeParseArguments)
+
+function(clx_embed_kernels header)
+  cmake_parse_arguments(EMBED "" "" "SOURCES" ${ARGN})
+
+  set(content "// generated by clx_embed_kernels, do not edit.\n")
+  set(content "${content}#pragma once\n\nnamespace clx {\nnamespace kernel {\n\n")
+  set(names)
+  foreach(src ${EMBED_SOURCES})
+    get_filename_component(src "${src}" ABSOLUTE)
+    get_filename_component(name "${src}" NAME_WE)
+    string(TOLOWER "${name}" name)
+    string(MAKE_C_IDENTIFIER "${name}" name)
+    list(FIND names ${name} found)
+    if(NOT found EQUAL -1)
+      message(FATAL_ERROR "clx_embed_kernels: duplicate kernel name '${name}' (${src})")
+    endif()
+    list(APPEND names ${name})
+
+    file(READ "${src}" code)
+    string(FIND "${code}" ")clx\"" delimiter)
+    if(NOT delimiter EQUAL -1)
+      message(FATAL_ERROR "clx_embed_kernels: ${src} contains the raw string delimiter")
+    endif()
+    set(content "${content}constexpr source ${name}{\"${name}\", R\"clx(${code})clx\"};\n\n")
+    set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${src}")
+  endforeach()
+
+  set(content "${content}constexpr source const *registry[] = {\n")
+  foreach(name ${names})
+    set(content "${content}    &${name},\n")
+  endforeach()
+  set(content "${content}};\n\n} // namespace kernel\n} // namespace clx\n")
+
+  # only touch the header when it changes, so dependents are not rebuilt
+  if(EXISTS "${header}")
+    file(READ "${header}" old)
+  endif()
+  if(NOT "${old}" STREQUAL "${content}")
+    file(WRITE "${header}" "${content}")
+  endif()
+endfunction()
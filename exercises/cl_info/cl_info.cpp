@@ -1,4 +1,5 @@
 #include "cl/clx.hpp"
+#include "cl/device_caps.hpp"
 #include <fmt/format.h>
 
 int main() {
@@ -8,6 +9,8 @@ int main() {
     auto devices = clx::get_device_ids(platform, CL_DEVICE_TYPE_GPU);
     for (auto &device : devices) {
       fmt::print("[INFO] device: {}\n", clx::to_string(device));
+      fmt::print("[INFO] caps: {}\n",
+                 clx::to_string(clx::device_caps_of(device)));
     }
   }
 
@@ -34,4 +34,115 @@ __kernel void convolve(
     } 
     
 	output[y * get_global_size(0) + x] = sum;
-}
\ No newline at end of file
+}
+
+// convolve_tiled
+//
+//    The same convolution of an inputWidth x inputHeight signal into its
+//    (inputWidth - MASK_WIDTH + 1) x (inputHeight - MASK_WIDTH + 1) valid
+//    part, built with the mask width, and optionally the mask itself, baked
+//    in with -D, so the tap loops unroll:
+//
+//      -D MASK_WIDTH=3 [-D MASK_VALUES=1,1,1,1,0,1,1,1,1]
+//
+//    Each work-group stages its input tile plus the MASK_WIDTH - 1 halo in
+//    local memory with uint4 loads, and each work-item computes
+//    OUTPUTS_PER_ITEM (4) neighbouring outputs along x as one uint4.
+
+#ifdef MASK_WIDTH
+
+#ifndef LOCAL_X
+#define LOCAL_X 16
+#endif
+#ifndef LOCAL_Y
+#define LOCAL_Y 8
+#endif
+
+#define OUTPUTS_PER_ITEM 4
+#define TILE_W (LOCAL_X * OUTPUTS_PER_ITEM)
+#define TILE_ROWS (LOCAL_Y + MASK_WIDTH - 1)
+// the tile's columns, rounded up to whole uint4s
+#define TILE_VECS ((TILE_W + MASK_WIDTH - 1 + 3) / 4)
+
+#ifdef MASK_VALUES
+__constant uint bakedMask[MASK_WIDTH * MASK_WIDTH] = { MASK_VALUES };
+#define MASK(r, c) bakedMask[(r) * MASK_WIDTH + (c)]
+#else
+#define MASK(r, c) mask[(r) * MASK_WIDTH + (c)]
+#endif
+
+__kernel __attribute__((reqd_work_group_size(LOCAL_X, LOCAL_Y, 1)))
+void convolve_tiled(
+    const __global uint * const input,
+    __constant uint * const mask,
+    __global uint * const output,
+    const int inputWidth,
+    const int inputHeight)
+{
+    __local uint tile[TILE_ROWS][TILE_VECS * 4];
+    const int outputWidth = inputWidth - MASK_WIDTH + 1;
+    const int outputHeight = inputHeight - MASK_WIDTH + 1;
+    const int lx = get_local_id(0);
+    const int ly = get_local_id(1);
+    const int x0 = get_group_id(0) * TILE_W;
+    const int y0 = get_group_id(1) * LOCAL_Y;
+
+    for (int i = ly * LOCAL_X + lx; i < TILE_ROWS * TILE_VECS;
+         i += LOCAL_X * LOCAL_Y)
+    {
+        const int row = i / TILE_VECS;
+        const int col = (i % TILE_VECS) * 4;
+        const int gx = x0 + col;
+        const int gy = y0 + row;
+        uint4 v = (uint4)(0);
+        if (gy < inputHeight)
+        {
+            const __global uint *p = input + gy * inputWidth + gx;
+            if (gx + 3 < inputWidth)
+            {
+                v = vload4(0, p);
+            }
+            else
+            {
+                // the ragged right edge of the signal
+                v.s0 = gx < inputWidth ? p[0] : 0;
+                v.s1 = gx + 1 < inputWidth ? p[1] : 0;
+                v.s2 = gx + 2 < inputWidth ? p[2] : 0;
+            }
+        }
+        vstore4(v, 0, &tile[row][col]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const int x = x0 + lx * OUTPUTS_PER_ITEM;
+    const int y = y0 + ly;
+    if (x >= outputWidth || y >= outputHeight)
+    {
+        return;
+    }
+
+    uint4 sum = (uint4)(0);
+    #pragma unroll
+    for (int r = 0; r < MASK_WIDTH; r++)
+    {
+        #pragma unroll
+        for (int c = 0; c < MASK_WIDTH; c++)
+        {
+            sum += MASK(r, c) * vload4(0, &tile[ly + r][lx * 4 + c]);
+        }
+    }
+
+    __global uint *out = output + y * outputWidth + x;
+    if (x + 3 < outputWidth)
+    {
+        vstore4(sum, 0, out);
+    }
+    else
+    {
+        out[0] = sum.s0;
+        if (x + 1 < outputWidth) out[1] = sum.s1;
+        if (x + 2 < outputWidth) out[2] = sum.s2;
+    }
+}
+
+#endif
@@ -10,11 +10,22 @@
 //
 //    This is a simple example that demonstrates OpenCL platform, device, and
 //    context use.
+//
+//      convolution [signalWidth signalHeight [maskWidth]]
+//
+//    Convolves the book's 8x8 signal, or a random one of the given size,
+//    with the book's 3x3 mask or a random one of the given width, and checks
+//    the result on the host. Masks from clx::fft_mask_width on go through
+//    the FFT path, smaller ones through the tiled kernel. Problems below the
+//    calibrated host/device crossover, like the book's, and machines without
+//    a CPU device run on the multithreaded host backend instead.
 
 #include <iostream>
 #include <fstream>
+#include <random>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #ifdef __APPLE__
 #include <OpenCL/cl.h>
@@ -27,6 +38,10 @@
 #endif
 
 #include "cl/clx.hpp"
+#include "cl/convolve.hpp"
+#include "cl/device_select.hpp"
+#include "cl/dispatch.hpp"
+#include "cl/kernels.hpp"
 #include <fmt/format.h>
 
 // Constants
@@ -39,11 +54,6 @@ cl_uint inputSignal[inputSignalWidth][inputSignalHeight] = {
     {9, 3, 3, 9, 0, 0, 0, 0}, {0, 9, 0, 8, 0, 0, 0, 0},
     {3, 0, 8, 8, 9, 4, 4, 4}, {5, 9, 8, 1, 8, 1, 1, 1}};
 
-const unsigned int outputSignalWidth = 6;
-const unsigned int outputSignalHeight = 6;
-
-cl_uint outputSignal[outputSignalWidth][outputSignalHeight];
-
 const unsigned int maskWidth = 3;
 const unsigned int maskHeight = 3;
 
@@ -53,6 +63,62 @@ cl_uint mask[maskWidth][maskHeight] = {
     {1, 1, 1},
 };
 
+///
+// The valid convolution of the signal, computed on the host to check the
+// kernel against
+std::vector<cl_uint> convolveReference(std::vector<cl_uint> const &input,
+                                       size_t width, size_t height,
+                                       std::vector<cl_uint> const &mask,
+                                       size_t maskWidth) {
+  size_t outputWidth = width - maskWidth + 1;
+  size_t outputHeight = height - maskWidth + 1;
+  std::vector<cl_uint> output(outputWidth * outputHeight);
+  for (size_t y = 0; y < outputHeight; y++) {
+    for (size_t x = 0; x < outputWidth; x++) {
+      cl_uint sum = 0;
+      for (size_t r = 0; r < maskWidth; r++) {
+        for (size_t c = 0; c < maskWidth; c++) {
+          sum += mask[r * maskWidth + c] * input[(y + r) * width + x + c];
+        }
+      }
+      output[y * outputWidth + x] = sum;
+    }
+  }
+  return output;
+}
+
+///
+// Print small outputs and check them against convolveReference
+///
+int checkOutput(std::vector<cl_uint> const &input, size_t width,
+                size_t height, std::vector<cl_uint> const &mask,
+                size_t maskWidth, std::vector<cl_uint> const &output) {
+  size_t outputWidth = width - maskWidth + 1;
+  size_t outputHeight = height - maskWidth + 1;
+  if (outputWidth <= 16 && outputHeight <= 16) {
+    for (size_t y = 0; y < outputHeight; y++) {
+      for (size_t x = 0; x < outputWidth; x++) {
+        std::cout << output[y * outputWidth + x] << " ";
+      }
+      std::cout << std::endl;
+    }
+  }
+
+  auto reference = convolveReference(input, width, height, mask, maskWidth);
+  auto mismatches = 0;
+  for (size_t i = 0; i < output.size(); i++) {
+    mismatches += output[i] != reference[i];
+  }
+  if (mismatches) {
+    std::cerr << mismatches << " of " << output.size()
+              << " outputs differ from the host result" << std::endl;
+    return 1;
+  }
+
+  std::cout << std::endl << "Executed program succesfully." << std::endl;
+  return 0;
+}
+
 ///
 // Function to check and handle OpenCL errors
 inline void checkErr(cl_int err, const char *name) {
@@ -67,89 +133,104 @@ inline void checkErr(cl_int err, const char *name) {
 //
 int main(int argc, char **argv) {
 
-  // First, select an OpenCL platform to run on.
-  auto platforms = clx::get_platform_ids();
-  auto platform_id = cl_platform_id{};
-  auto cpu_devices = std::vector<cl_device_id>{};
-
-  // selecte devices
-  for (auto const &platform : platforms) {
-    platform_id = platform;
-    cpu_devices = clx::get_device_ids(platform_id, CL_DEVICE_TYPE_CPU);
-    if (cpu_devices.size() != 0) {
-      break;
+  // select the best ranked CPU device across all platforms
+  auto policy = clx::selection_policy{};
+  policy.name = "convolution";
+  policy.requirements.type = CL_DEVICE_TYPE_CPU;
+  auto choice = clx::select_device(policy);
+  if (!choice) {
+    std::cout << "No CPU device found, using the host backend" << std::endl;
+  }
+
+  // The book's 8x8 signal, or a random one of the given size
+  size_t width = inputSignalWidth;
+  size_t height = inputSignalHeight;
+  std::vector<cl_uint> input(&inputSignal[0][0],
+                             &inputSignal[0][0] + width * height);
+  size_t maskSize = maskWidth;
+  auto maskValues = std::vector<cl_uint>(&mask[0][0],
+                                         &mask[0][0] + maskWidth * maskHeight);
+  std::mt19937 rng(42);
+  if (argc == 3 || argc == 4) {
+    width = std::stoul(argv[1]);
+    height = std::stoul(argv[2]);
+    input.resize(width * height);
+    for (auto &v : input) {
+      v = rng() % 10;
     }
   }
-  if (cpu_devices.size() == 0) {
-    std::cout << "No CPU device found" << std::endl;
-    exit(-1);
+  if (argc == 4) {
+    maskSize = std::stoul(argv[3]);
+    maskValues.resize(maskSize * maskSize);
+    for (auto &v : maskValues) {
+      v = rng() % 4;
+    }
+  }
+  if (maskSize < 1 || width < maskSize || height < maskSize) {
+    std::cerr << "The signal must be at least as large as the mask"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  size_t outputWidth = width - maskSize + 1;
+  size_t outputHeight = height - maskSize + 1;
+  auto output = std::vector<cl_uint>(outputWidth * outputHeight);
+
+  // Launch and copies cost more than small problems, so those stay on the
+  // host
+  auto dispatch = clx::dispatcher{choice};
+  auto work = output.size() * maskSize * maskSize;
+  if (dispatch.backend_for(clx::operation::convolve, work) ==
+      clx::backend::host) {
+    fmt::print("[INFO] {}x{} signal, {}x{} mask, host backend\n", width,
+               height, maskSize, maskSize);
+    dispatch.convolve(input.data(), width, height, maskValues.data(),
+                      maskSize, output.data());
+    return checkOutput(input, width, height, maskValues, maskSize, output);
   }
 
+  auto platform_id = choice.platform;
+  auto cpu_devices = std::vector<cl_device_id>{choice.device};
+
   auto context = clx::create_context(
       platform_id, cpu_devices,
       [](const char *, const void *, size_t, void *) { exit(1); }, nullptr);
 
-  std::ifstream srcFile("Convolution.cl");
-  checkErr(srcFile.is_open() ? CL_SUCCESS : -1, "reading Convolution.cl");
-
-  std::string srcProg(std::istreambuf_iterator<char>(srcFile),
-                      (std::istreambuf_iterator<char>()));
-
-  const char *src = srcProg.c_str();
-  size_t length = srcProg.length();
-
-  // Create program from source
-  auto program = clx::create_program(context, "");
-  auto success = clx::build_program(program, cpu_devices);
-  if (!success) {
-    fmt::print("{}\n",
-               clx::get_program_build_info_log(program, cpu_devices[0]));
+  // Build the direct kernel, with the mask baked in, or the FFT path for
+  // large masks
+  auto convolution =
+      clx::convolver{context, cpu_devices[0], int(maskSize), maskValues};
+  if (!convolution) {
+    fmt::print("{}\n", convolution.build_log().c_str());
+    checkErr(clx::last_error(), "convolver");
   }
+  fmt::print("[INFO] {}x{} signal, {}x{} mask, {} path\n", width, height,
+             maskSize, maskSize, convolution.uses_fft() ? "FFT" : "direct");
 
-  auto kernel = clx::create_kernel(program, "");
-
-  auto input_signal_buffer =
-      clx::create_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                         sizeof(cl_uint) * inputSignalHeight * inputSignalWidth,
-                         static_cast<void *>(inputSignal));
-
-  auto mask_buffer = clx::create_buffer(
+  auto input_signal_buffer = clx::create_buffer(
       context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-      sizeof(cl_uint) * maskHeight * maskWidth, static_cast<void *>(mask));
+      sizeof(cl_uint) * input.size(), static_cast<void *>(input.data()));
 
   auto output_signal_buffer = clx::create_buffer(
       context, CL_MEM_WRITE_ONLY,
-      sizeof(cl_uint) * outputSignalHeight * outputSignalWidth, nullptr);
+      sizeof(cl_uint) * outputHeight * outputWidth, nullptr);
 
   auto queue = clx::create_command_queue(context, cpu_devices[0], 0);
 
-  success =
-      clx::set_arguments(kernel, input_signal_buffer, mask_buffer,
-                         output_signal_buffer, outputSignalWidth, maskWidth);
-
-  if (!success) {
-    fmt::print("[ERROR] failed to set arguments.\n");
-  }
-
-  const size_t globalWorkSize[1] = {outputSignalWidth * outputSignalHeight};
-  const size_t localWorkSize[1] = {1};
+  // Queue the convolution up for execution over the 2D output
+  auto err = convolution.enqueue(queue, input_signal_buffer,
+                                 output_signal_buffer, width, height);
+  checkErr(err, "convolve");
 
-  // Queue the kernel up for execution across the array
-  auto err = clx::enqueue_nd_ranage_kernel(queue, kernel, 1, NULL,
-                                           globalWorkSize, localWorkSize);
-  err = clx::enqueue_read_buffer(
-      queue, output_signal_buffer, CL_TRUE, 0,
-      sizeof(cl_uint) * outputSignalHeight * outputSignalHeight, outputSignal);
+  err = clx::enqueue_read_buffer(queue, output_signal_buffer, CL_TRUE, 0,
+                                 sizeof(cl_uint) * output.size(),
+                                 output.data());
+  checkErr(err, "clEnqueueReadBuffer");
 
-  // Output the result buffer
-  for (int y = 0; y < outputSignalHeight; y++) {
-    for (int x = 0; x < outputSignalWidth; x++) {
-      std::cout << outputSignal[x][y] << " ";
-    }
-    std::cout << std::endl;
-  }
+  auto status =
+      checkOutput(input, width, height, maskValues, maskSize, output);
 
-  std::cout << std::endl << "Executed program succesfully." << std::endl;
-
-  return 0;
+  clReleaseMemObject(input_signal_buffer);
+  clReleaseMemObject(output_signal_buffer);
+  clReleaseCommandQueue(queue);
+  return status;
 }
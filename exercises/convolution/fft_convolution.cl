@@ -0,0 +1,123 @@
+// fft_convolution.cl
+//
+//    Convolution (as in Convolution.cl, a correlation with the mask) through
+//    2D FFTs, for masks large enough that the direct O(K^2) taps per output
+//    dominate. The signal is cut into overlapping n x n tiles (overlap-save);
+//    each tile is transformed, multiplied by the conjugate mask spectrum and
+//    transformed back, and its first n - K + 1 rows and columns are valid
+//    outputs.
+//
+//    Transforms are out-of-place Stockham passes over complex float2 data,
+//    ping-ponging between two buffers: radix-4 passes plus one radix-2 pass
+//    for odd powers of two. Each launch covers every row (or every column)
+//    of a batch of square tiles, with global size (n / R, n, tiles).
+
+float2 complexMul(float2 a, float2 b)
+{
+    return (float2)(a.x * b.x - a.y * b.y, a.x * b.y + a.y * b.x);
+}
+
+float2 twiddle(float angle)
+{
+    float c;
+    float s = sincos(angle, &c);
+    return (float2)(c, s);
+}
+
+// elements of one transform are stride apart, transforms dist apart; sign is
+// -1 for the forward and +1 for the inverse transform. ns is the length of
+// the sub-transforms already combined by the earlier passes.
+__kernel void fft_radix2(__global const float2 *src,
+                         __global float2 *dst,
+                         int n, int ns, int stride, int dist, float sign)
+{
+    const int j = get_global_id(0);
+    const int offset = get_global_id(2) * n * n + get_global_id(1) * dist;
+    __global const float2 *in = src + offset;
+    __global float2 *out = dst + offset;
+
+    const float angle = sign * 2.0f * M_PI_F * (j % ns) / (ns * 2);
+    const float2 v0 = in[j * stride];
+    const float2 v1 = complexMul(in[(j + n / 2) * stride], twiddle(angle));
+
+    const int d = (j / ns) * ns * 2 + j % ns;
+    out[d * stride] = v0 + v1;
+    out[(d + ns) * stride] = v0 - v1;
+}
+
+__kernel void fft_radix4(__global const float2 *src,
+                         __global float2 *dst,
+                         int n, int ns, int stride, int dist, float sign)
+{
+    const int j = get_global_id(0);
+    const int offset = get_global_id(2) * n * n + get_global_id(1) * dist;
+    __global const float2 *in = src + offset;
+    __global float2 *out = dst + offset;
+    const int q = n / 4;
+
+    const float angle = sign * 2.0f * M_PI_F * (j % ns) / (ns * 4);
+    const float2 v0 = in[j * stride];
+    const float2 v1 = complexMul(in[(j + q) * stride], twiddle(angle));
+    const float2 v2 = complexMul(in[(j + 2 * q) * stride], twiddle(2 * angle));
+    const float2 v3 = complexMul(in[(j + 3 * q) * stride], twiddle(3 * angle));
+
+    const float2 a0 = v0 + v2;
+    const float2 a1 = v0 - v2;
+    const float2 a2 = v1 + v3;
+    // (v1 - v3) times sign * i
+    const float2 a3 = sign * (float2)(v3.y - v1.y, v1.x - v3.x);
+
+    const int d = (j / ns) * ns * 4 + j % ns;
+    out[d * stride] = a0 + a2;
+    out[(d + ns) * stride] = a1 + a3;
+    out[(d + 2 * ns) * stride] = a0 - a2;
+    out[(d + 3 * ns) * stride] = a1 - a3;
+}
+
+// tile t of the batch starts at tile firstTile + t of the signal, tiles
+// being step apart and tilesX to a row. samples past the signal are zero.
+__kernel void fft_load_tiles(__global const uint *input,
+                             int width, int height,
+                             int tilesX, int step, int n, int firstTile,
+                             __global float2 *dst)
+{
+    const int tile = firstTile + get_global_id(2);
+    const int x = (tile % tilesX) * step + get_global_id(0);
+    const int y = (tile / tilesX) * step + get_global_id(1);
+    float2 v = (float2)(0.0f);
+    if (x < width && y < height)
+    {
+        v.x = (float)input[y * width + x];
+    }
+    dst[(get_global_id(2) * n + get_global_id(1)) * n + get_global_id(0)] = v;
+}
+
+// launched over step x step outputs per tile.
+__kernel void fft_store_tiles(__global const float2 *src,
+                              __global uint *output,
+                              int outputWidth, int outputHeight,
+                              int tilesX, int step, int n, int firstTile)
+{
+    const int tile = firstTile + get_global_id(2);
+    const int x = (tile % tilesX) * step + get_global_id(0);
+    const int y = (tile / tilesX) * step + get_global_id(1);
+    if (x < outputWidth && y < outputHeight)
+    {
+        const int i =
+            (get_global_id(2) * n + get_global_id(1)) * n + get_global_id(0);
+        const float2 v = src[i];
+        output[y * outputWidth + x] = convert_uint_sat_rte(v.x);
+    }
+}
+
+// data times the conjugate of the mask spectrum, which turns the product
+// into a correlation; scale folds in the inverse transform's 1 / n^2.
+__kernel void fft_multiply(__global float2 *data,
+                           __global const float2 *spectrum,
+                           int nn, float scale)
+{
+    const int i = get_global_id(0);
+    __global float2 *d = data + get_global_id(1) * nn + i;
+    const float2 m = spectrum[i];
+    *d = complexMul(*d, (float2)(m.x, -m.y)) * scale;
+}
@@ -25,8 +25,11 @@ __kernel void gaussian_filter(__read_only image2d_t srcImg,
         {
             for( int x = startImageCoord.x; x <= endImageCoord.x; x++)
             {
+                // clamp to width x height rather than the image's edge,
+                // so a larger image (a tile) can hold the pixels
+                int2 coord = (int2)(clamp(x, 0, width - 1), clamp(y, 0, height - 1));
                 outColor += (read_imagef(srcImg, sampler, 
-														(int2)(x, y)) * (kernelWeights[weight] / 16.0f));
+														coord) * (kernelWeights[weight] / 16.0f));
                 weight += 1;
             }
         }
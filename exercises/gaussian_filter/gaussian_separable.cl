@@ -0,0 +1,166 @@
+// Separable Gaussian filter of an RGBA image, as a row pass into a float
+// intermediate followed by a column pass.
+//
+// Each work-group stages its tile plus a RADIUS-wide halo in local memory
+// once, and each work-item then computes PIXELS_PER_ITEM outputs along the
+// pass direction from it, so a pixel is read from global memory about once
+// per pass instead of 2 * RADIUS + 1 times. Reads are clamped to
+// width x height, which may be smaller than the images (tiles, reused
+// intermediates). The host compiles the program per radius.
+
+#ifndef RADIUS
+#define RADIUS 1
+#endif
+#ifndef PIXELS_PER_ITEM
+#define PIXELS_PER_ITEM 4
+#endif
+#ifndef LOCAL_X
+#define LOCAL_X 16
+#endif
+#ifndef LOCAL_Y
+#define LOCAL_Y 8
+#endif
+
+#define TILE_W (LOCAL_X * PIXELS_PER_ITEM)
+#define TILE_H (LOCAL_Y * PIXELS_PER_ITEM)
+
+// weights holds the 2 * RADIUS + 1 normalized taps.
+
+__kernel __attribute__((reqd_work_group_size(LOCAL_X, LOCAL_Y, 1)))
+void gaussian_rows_image(__read_only image2d_t src,
+                         __write_only image2d_t dst,
+                         sampler_t sampler,
+                         __constant float *weights,
+                         int width, int height)
+{
+    __local float4 tile[LOCAL_Y][TILE_W + 2 * RADIUS];
+    const int lx = get_local_id(0);
+    const int ly = get_local_id(1);
+    const int x0 = get_group_id(0) * TILE_W;
+    const int y = get_global_id(1);
+    const int cy = min(y, height - 1);
+
+    for (int i = lx; i < TILE_W + 2 * RADIUS; i += LOCAL_X)
+    {
+        const int x = clamp(x0 + i - RADIUS, 0, width - 1);
+        tile[ly][i] = read_imagef(src, sampler, (int2)(x, cy));
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // outputs are LOCAL_X apart, so neighbouring work-items write
+    // neighbouring pixels
+    for (int p = 0; p < PIXELS_PER_ITEM; p++)
+    {
+        const int i = lx + p * LOCAL_X;
+        if (x0 + i < width && y < height)
+        {
+            float4 sum = (float4)(0.0f);
+            for (int k = 0; k <= 2 * RADIUS; k++)
+                sum += weights[k] * tile[ly][i + k];
+            write_imagef(dst, (int2)(x0 + i, y), sum);
+        }
+    }
+}
+
+__kernel __attribute__((reqd_work_group_size(LOCAL_X, LOCAL_Y, 1)))
+void gaussian_columns_image(__read_only image2d_t src,
+                            __write_only image2d_t dst,
+                            sampler_t sampler,
+                            __constant float *weights,
+                            int width, int height)
+{
+    __local float4 tile[TILE_H + 2 * RADIUS][LOCAL_X];
+    const int lx = get_local_id(0);
+    const int ly = get_local_id(1);
+    const int x = get_global_id(0);
+    const int y0 = get_group_id(1) * TILE_H;
+    const int cx = min(x, width - 1);
+
+    for (int i = ly; i < TILE_H + 2 * RADIUS; i += LOCAL_Y)
+    {
+        const int y = clamp(y0 + i - RADIUS, 0, height - 1);
+        tile[i][lx] = read_imagef(src, sampler, (int2)(cx, y));
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int p = 0; p < PIXELS_PER_ITEM; p++)
+    {
+        const int i = ly + p * LOCAL_Y;
+        if (x < width && y0 + i < height)
+        {
+            float4 sum = (float4)(0.0f);
+            for (int k = 0; k <= 2 * RADIUS; k++)
+                sum += weights[k] * tile[i + k][lx];
+            write_imagef(dst, (int2)(x, y0 + i), sum);
+        }
+    }
+}
+
+// the same passes over plain buffers of RGBA8 pixels, width pixels per row,
+// with a float4 intermediate in [0, 1].
+
+__kernel __attribute__((reqd_work_group_size(LOCAL_X, LOCAL_Y, 1)))
+void gaussian_rows_buffer(__global const uchar4 *src,
+                          __global float4 *dst,
+                          __constant float *weights,
+                          int width, int height)
+{
+    __local float4 tile[LOCAL_Y][TILE_W + 2 * RADIUS];
+    const int lx = get_local_id(0);
+    const int ly = get_local_id(1);
+    const int x0 = get_group_id(0) * TILE_W;
+    const int y = get_global_id(1);
+    const int cy = min(y, height - 1);
+
+    for (int i = lx; i < TILE_W + 2 * RADIUS; i += LOCAL_X)
+    {
+        const int x = clamp(x0 + i - RADIUS, 0, width - 1);
+        tile[ly][i] = convert_float4(src[cy * width + x]) * (1.0f / 255.0f);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int p = 0; p < PIXELS_PER_ITEM; p++)
+    {
+        const int i = lx + p * LOCAL_X;
+        if (x0 + i < width && y < height)
+        {
+            float4 sum = (float4)(0.0f);
+            for (int k = 0; k <= 2 * RADIUS; k++)
+                sum += weights[k] * tile[ly][i + k];
+            dst[y * width + x0 + i] = sum;
+        }
+    }
+}
+
+__kernel __attribute__((reqd_work_group_size(LOCAL_X, LOCAL_Y, 1)))
+void gaussian_columns_buffer(__global const float4 *src,
+                             __global uchar4 *dst,
+                             __constant float *weights,
+                             int width, int height)
+{
+    __local float4 tile[TILE_H + 2 * RADIUS][LOCAL_X];
+    const int lx = get_local_id(0);
+    const int ly = get_local_id(1);
+    const int x = get_global_id(0);
+    const int y0 = get_group_id(1) * TILE_H;
+    const int cx = min(x, width - 1);
+
+    for (int i = ly; i < TILE_H + 2 * RADIUS; i += LOCAL_Y)
+    {
+        const int y = clamp(y0 + i - RADIUS, 0, height - 1);
+        tile[i][lx] = src[y * width + cx];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int p = 0; p < PIXELS_PER_ITEM; p++)
+    {
+        const int i = ly + p * LOCAL_Y;
+        if (x < width && y0 + i < height)
+        {
+            float4 sum = (float4)(0.0f);
+            for (int k = 0; k <= 2 * RADIUS; k++)
+                sum += weights[k] * tile[i + k][lx];
+            dst[(y0 + i) * width + x] = convert_uchar4_sat_rte(sum * 255.0f);
+        }
+    }
+}
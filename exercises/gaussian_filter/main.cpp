@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <sstream>
 #include <string.h>
 
@@ -13,41 +18,36 @@
 #include <fmt/format.h>
 
 #include "cl/clx.hpp"
+#include "cl/device_select.hpp"
+#include "cl/gaussian.hpp"
+#include "cl/kernels.hpp"
+#include "cl/tuner.hpp"
+#include "stream.hpp"
+#include "tile.hpp"
 ///
-//  Create an OpenCL context on the first available platform using
-//  either a GPU or CPU depending on what is available.
+//  Create an OpenCL context on the best device that supports images, as
+//  ranked by clx::select_device. The choice is remembered across runs.
 //
 cl_context CreateContext() {
   cl_int errNum;
-  cl_uint numPlatforms;
-  cl_platform_id firstPlatformId;
   cl_context context = NULL;
 
-  // First, select an OpenCL platform to run on.  For this example, we
-  // simply choose the first available platform.  Normally, you would
-  // query for all available platforms and select the most appropriate one.
-  errNum = clGetPlatformIDs(1, &firstPlatformId, &numPlatforms);
-  if (errNum != CL_SUCCESS || numPlatforms <= 0) {
-    std::cerr << "Failed to find any OpenCL platforms." << std::endl;
+  auto policy = clx::selection_policy{};
+  policy.name = "gaussian_filter";
+  policy.requirements.images = true;
+  auto choice = clx::select_device(policy);
+  if (!choice) {
+    std::cerr << "Failed to find an OpenCL device with image support."
+              << std::endl;
     return NULL;
   }
+  fmt::print("[INFO] device: {}\n", clx::get_device_info_name(choice.device));
 
-  // Next, create an OpenCL context on the platform.  Attempt to
-  // create a GPU-based context, and if that fails, try to create
-  // a CPU-based context.
-  cl_context_properties contextProperties[] = {
-      CL_CONTEXT_PLATFORM, (cl_context_properties)firstPlatformId, 0};
-  context = clCreateContextFromType(contextProperties, CL_DEVICE_TYPE_GPU, NULL,
-                                    NULL, &errNum);
+  context = clx::create_context(choice.platform, {choice.device}, nullptr,
+                                nullptr, errNum);
   if (errNum != CL_SUCCESS) {
-    std::cout << "Could not create GPU context, trying CPU..." << std::endl;
-    context = clCreateContextFromType(contextProperties, CL_DEVICE_TYPE_CPU,
-                                      NULL, NULL, &errNum);
-    if (errNum != CL_SUCCESS) {
-      std::cerr << "Failed to create an OpenCL GPU or CPU context."
-                << std::endl;
-      return NULL;
-    }
+    std::cerr << "Failed to create an OpenCL context." << std::endl;
+    return NULL;
   }
 
   return context;
@@ -100,26 +100,16 @@ cl_command_queue CreateCommandQueue(cl_context context, cl_device_id *device) {
 }
 
 ///
-//  Create an OpenCL program from the kernel source file
+//  Create an OpenCL program from an embedded kernel source
 //
 cl_program CreateProgram(cl_context context, cl_device_id device,
-                         const char *fileName) {
+                         clx::kernel::source const &source) {
   cl_int errNum;
   cl_program program;
 
-  std::ifstream kernelFile(fileName, std::ios::in);
-  if (!kernelFile.is_open()) {
-    std::cerr << "Failed to open file for reading: " << fileName << std::endl;
-    return NULL;
-  }
-
-  std::ostringstream oss;
-  oss << kernelFile.rdbuf();
-
-  std::string srcStdStr = oss.str();
-  const char *srcStr = srcStdStr.c_str();
-  program =
-      clCreateProgramWithSource(context, 1, (const char **)&srcStr, NULL, NULL);
+  const char *srcStr = source.text.data();
+  size_t srcLen = source.text.size();
+  program = clCreateProgramWithSource(context, 1, &srcStr, &srcLen, NULL);
   if (program == NULL) {
     std::cerr << "Failed to create CL program from source." << std::endl;
     return NULL;
@@ -168,40 +158,98 @@ void Cleanup(cl_context context, cl_command_queue commandQueue,
 }
 
 ///
-//  Load an image using the FreeImage library and create an OpenCL
-//  image out of it
+//  Unloads a FreeImage bitmap when it goes out of scope
+//
+struct BitmapDeleter {
+  void operator()(FIBITMAP *image) const { FreeImage_Unload(image); }
+};
+using Bitmap = std::unique_ptr<FIBITMAP, BitmapDeleter>;
+
+///
+//  Host pixels from std::aligned_alloc, for an image created over them
 //
-cl_mem LoadImage(cl_context context, char *fileName, size_t &width,
-                 size_t &height) {
+struct AlignedDeleter {
+  void operator()(BYTE *pixels) const { std::free(pixels); }
+};
+using AlignedPixels = std::unique_ptr<BYTE, AlignedDeleter>;
+
+///
+//  Load an image using the FreeImage library as a 32-bit bitmap. Its bits,
+//  FreeImage_GetPitch bytes per row, are uploaded as they are, with no
+//  intermediate copy
+//
+Bitmap LoadBitmap(char *fileName, size_t &width, size_t &height) {
   FREE_IMAGE_FORMAT format = FreeImage_GetFileType(fileName, 0);
   FIBITMAP *image = FreeImage_Load(format, fileName);
   fmt::print("img format - {} \n", format);
   if (!image) {
     fmt::print("coundn't load the image\n");
+    return nullptr;
   }
 
-  // Convert to 32-bit image
-  FIBITMAP *temp = image;
-  image = FreeImage_ConvertTo32Bits(image);
-  FreeImage_Unload(temp);
+  // Convert to 32-bit image, unless it already is one
+  if (FreeImage_GetBPP(image) != 32) {
+    FIBITMAP *temp = image;
+    image = FreeImage_ConvertTo32Bits(image);
+    FreeImage_Unload(temp);
+    if (!image) {
+      fmt::print("coundn't convert the image\n");
+      return nullptr;
+    }
+  }
 
   width = FreeImage_GetWidth(image);
   height = FreeImage_GetHeight(image);
+  return Bitmap(image);
+}
 
-  char *buffer = new char[width * height * 4];
-  memcpy(buffer, FreeImage_GetBits(image), width * height * 4);
-
-  FreeImage_Unload(image);
-
-  // Create OpenCL image
+///
+//  Create an OpenCL image over the pixels of a loaded bitmap. Other devices
+//  than CPUs get one copy straight from the bitmap. CPU devices use host
+//  memory in place: the bitmap's when it is aligned as the device requires,
+//  else pixels, which the bitmap is written into with rows padded to the
+//  alignment. Both must outlive the image
+//
+cl_mem LoadImage(cl_context context, cl_device_id device, FIBITMAP *image,
+                 AlignedPixels &pixels) {
   cl_image_format clImageFormat;
   clImageFormat.image_channel_order = CL_RGBA;
   clImageFormat.image_channel_data_type = CL_UNORM_INT8;
 
+  size_t width = FreeImage_GetWidth(image);
+  size_t height = FreeImage_GetHeight(image);
+  size_t pitch = FreeImage_GetPitch(image);
+  BYTE *bits = FreeImage_GetBits(image);
+
+  cl_mem_flags flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+  if (clx::get_device_info_type(device) & CL_DEVICE_TYPE_CPU) {
+    size_t align = std::max<size_t>(
+        clx::get_device_info_mem_base_addr_align(device),
+        alignof(std::max_align_t));
+    if (reinterpret_cast<uintptr_t>(bits) % align != 0 ||
+        pitch % align != 0) {
+      // FreeImage's allocator rarely meets the device alignment, so the
+      // rows are written once into storage that does
+      size_t alignedPitch = (width * 4 + align - 1) / align * align;
+      size_t bytes = alignedPitch * height;
+      pixels.reset(static_cast<BYTE *>(std::aligned_alloc(align, bytes)));
+      if (!pixels) {
+        std::cerr << "Error allocating aligned image memory" << std::endl;
+        return 0;
+      }
+      FreeImage_ConvertToRawBits(pixels.get(), image, int(alignedPitch), 32,
+                                 FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK,
+                                 FI_RGBA_BLUE_MASK, FALSE);
+      bits = pixels.get();
+      pitch = alignedPitch;
+    }
+    flags = CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR;
+  }
+
   cl_int errNum;
   cl_mem clImage;
-  clImage = clCreateImage2D(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                            &clImageFormat, width, height, 0, buffer, &errNum);
+  clImage = clCreateImage2D(context, flags, &clImageFormat, width, height,
+                            pitch, bits, &errNum);
 
   if (errNum != CL_SUCCESS) {
     std::cerr << "Error creating CL image object - " << errNum << std::endl;
@@ -229,18 +277,6 @@ bool SaveImage(char *fileName, char *buffer, int width, int height) {
   return (FreeImage_Save(FIF_BMP, image, fileName) == TRUE) ? true : false;
 }
 
-///
-//  Round up to the nearest multiple of the group size
-//
-size_t RoundUp(int groupSize, int globalSize) {
-  int r = globalSize % groupSize;
-  if (r == 0) {
-    return globalSize;
-  } else {
-    return globalSize + groupSize - r;
-  }
-}
-
 ///
 //  main() for HelloBinaryWorld example
 //
@@ -253,14 +289,38 @@ int main(int argc, char **argv) {
   cl_sampler sampler = 0;
   cl_int errNum;
 
-  if (argc != 3) {
-    std::cerr << "USAGE: " << argv[0] << " <inputImageFile> <outputImageFiles>"
+  // --sigma <s> filters with a separable Gaussian of that sigma instead of
+  // the fixed 3x3 kernel
+  float sigma = 0;
+  for (int i = 1; i + 1 < argc; i++) {
+    if (std::string(argv[i]) == "--sigma") {
+      sigma = std::stof(argv[i + 1]);
+      std::copy(argv + i + 2, argv + argc, argv + i);
+      argc -= 2;
+      break;
+    }
+  }
+
+  bool streaming = argc > 1 && std::string(argv[1]) == "--stream";
+  if ((!streaming && argc != 3 && argc != 4) ||
+      (streaming && argc != 4 && argc != 5)) {
+    std::cerr << "USAGE: " << argv[0]
+              << " [--sigma s] <inputImageFile> <outputImageFiles> [tileSize]"
               << std::endl;
+    std::cerr << "       " << argv[0]
+              << " --stream <frameDirectory|frameList> <outputDirectory>"
+                 " [framesInFlight]"
+              << std::endl;
+    return 1;
+  }
+
+  // Create an OpenCL context on the selected device
+  cl_context context = CreateContext();
+  if (context == NULL) {
     return 1;
   }
 
-  // Create a command-queue on the first device available
-  // on the created context
+  // Create a command-queue on the device of the created context
   commandQueue = CreateCommandQueue(context, &device);
   if (commandQueue == NULL) {
     Cleanup(context, commandQueue, program, kernel, imageObjects, sampler);
@@ -277,29 +337,6 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  // Load input image from file and load it into
-  // an OpenCL image object
-  size_t width, height;
-  imageObjects[0] = LoadImage(context, argv[1], width, height);
-  if (imageObjects[0] == 0) {
-    std::cerr << "Error loading: " << std::string(argv[1]) << std::endl;
-    Cleanup(context, commandQueue, program, kernel, imageObjects, sampler);
-    return 1;
-  }
-
-  // Create ouput image object
-  cl_image_format clImageFormat;
-  clImageFormat.image_channel_order = CL_RGBA;
-  clImageFormat.image_channel_data_type = CL_UNORM_INT8;
-  imageObjects[1] = clCreateImage2D(context, CL_MEM_WRITE_ONLY, &clImageFormat,
-                                    width, height, 0, NULL, &errNum);
-
-  if (errNum != CL_SUCCESS) {
-    std::cerr << "Error creating CL output image object." << std::endl;
-    Cleanup(context, commandQueue, program, kernel, imageObjects, sampler);
-    return 1;
-  }
-
   // Create sampler for sampling image object
   sampler =
       clCreateSampler(context,
@@ -313,7 +350,7 @@ int main(int argc, char **argv) {
   }
 
   // Create OpenCL program
-  program = CreateProgram(context, device, "gausian_filter.cl");
+  program = CreateProgram(context, device, clx::kernel::gausian_filter);
   if (program == NULL) {
     Cleanup(context, commandQueue, program, kernel, imageObjects, sampler);
     return 1;
@@ -327,25 +364,136 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  // Set the kernel arguments
-  errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), &imageObjects[0]);
-  errNum |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &imageObjects[1]);
-  errNum |= clSetKernelArg(kernel, 2, sizeof(cl_sampler), &sampler);
-  errNum |= clSetKernelArg(kernel, 3, sizeof(cl_int), &width);
-  errNum |= clSetKernelArg(kernel, 4, sizeof(cl_int), &height);
+  std::unique_ptr<clx::separable_gaussian> separable;
+  if (sigma > 0) {
+    separable =
+        std::make_unique<clx::separable_gaussian>(context, device, sigma);
+    if (!*separable) {
+      std::cerr << "Failed to create the separable filter - "
+                << clx::last_error() << std::endl;
+      std::cerr << separable->build_log().c_str();
+      Cleanup(context, commandQueue, program, kernel, imageObjects, sampler);
+      return 1;
+    }
+    fmt::print("[INFO] separable gaussian, sigma {}, radius {}\n", sigma,
+               separable->radius());
+  }
+
+  // The 3x3 filter, or the separable one with --sigma, from src to dst; the
+  // streaming and tiled paths enqueue it per frame or tile
+  auto filter = [&](cl_command_queue queue, cl_mem src, cl_mem dst, size_t w,
+                    size_t h, cl_uint numWait, const cl_event *wait,
+                    cl_event *done) {
+    if (separable) {
+      return separable->enqueue_image(queue, src, dst, w, h, numWait, wait,
+                                      done);
+    }
+    cl_int err = clx::set_arguments(kernel, clx::image(src), clx::image(dst),
+                                    sampler, cl_int(w), cl_int(h));
+    if (err != CL_SUCCESS) {
+      return err;
+    }
+    size_t global[2] = {w, h};
+    return clx::enqueue_tuned(queue, kernel, 2, global, true, numWait, wait,
+                              done);
+  };
+
+  // Stream a sequence of frames through the filter
+  if (streaming) {
+    std::size_t inFlight = argc > 4 ? std::stoul(argv[4]) : 3;
+    int failed =
+        RunStream(context, device, filter, argv[2], argv[3], inFlight);
+    Cleanup(context, commandQueue, program, kernel, imageObjects, sampler);
+    return failed == 0 ? 0 : 1;
+  }
+
+  // Load input image from file
+  size_t width, height;
+  Bitmap bitmap = LoadBitmap(argv[1], width, height);
+  if (!bitmap) {
+    std::cerr << "Error loading: " << std::string(argv[1]) << std::endl;
+    Cleanup(context, commandQueue, program, kernel, imageObjects, sampler);
+    return 1;
+  }
+
+  // Filter images the device cannot hold whole, or when asked to, in tiles
+  // streamed through a fixed set of device images
+  if (argc == 4 || NeedsTiling(device, width, height)) {
+    size_t tileSize = argc == 4 ? std::stoul(argv[3]) : 2048;
+    char *buffer = new char[width * height * 4];
+    // the 3x3 filter reads one pixel around each output pixel, the
+    // separable one its radius
+    size_t radius = separable ? separable->radius() : 1;
+    errNum = FilterTiled(context, device, filter,
+                         FreeImage_GetBits(bitmap.get()),
+                         (unsigned char *)buffer, width, height,
+                         FreeImage_GetPitch(bitmap.get()), tileSize, radius);
+    if (errNum != CL_SUCCESS) {
+      std::cerr << "Error filtering tiles - " << errNum << std::endl;
+    } else if (!SaveImage(argv[2], buffer, width, height)) {
+      std::cerr << "Error writing output image: " << argv[2] << std::endl;
+      errNum = CL_INVALID_VALUE;
+    }
+    delete[] buffer;
+    Cleanup(context, commandQueue, program, kernel, imageObjects, sampler);
+    return errNum == CL_SUCCESS ? 0 : 1;
+  }
+
+  // Wrap the pixels in an OpenCL image object; bitmap and pixels are freed
+  // on return, after Cleanup has released the image
+  AlignedPixels pixels;
+  imageObjects[0] = LoadImage(context, device, bitmap.get(), pixels);
+  if (imageObjects[0] == 0) {
+    std::cerr << "Error loading: " << std::string(argv[1]) << std::endl;
+    Cleanup(context, commandQueue, program, kernel, imageObjects, sampler);
+    return 1;
+  }
+
+  // Create ouput image object
+  cl_image_format clImageFormat;
+  clImageFormat.image_channel_order = CL_RGBA;
+  clImageFormat.image_channel_data_type = CL_UNORM_INT8;
+  imageObjects[1] = clCreateImage2D(context, CL_MEM_WRITE_ONLY, &clImageFormat,
+                                    width, height, 0, NULL, &errNum);
+
   if (errNum != CL_SUCCESS) {
-    std::cerr << "Error setting kernel arguments." << std::endl;
+    std::cerr << "Error creating CL output image object." << std::endl;
     Cleanup(context, commandQueue, program, kernel, imageObjects, sampler);
     return 1;
   }
 
-  size_t localWorkSize[2] = {16, 16};
-  size_t globalWorkSize[2] = {RoundUp(localWorkSize[0], width),
-                              RoundUp(localWorkSize[1], height)};
+  if (separable) {
+    errNum = separable->enqueue_image(commandQueue, imageObjects[0],
+                                      imageObjects[1], width, height);
+  } else {
+    // Set the kernel arguments
+    errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), &imageObjects[0]);
+    errNum |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &imageObjects[1]);
+    errNum |= clSetKernelArg(kernel, 2, sizeof(cl_sampler), &sampler);
+    cl_int imageWidth = cl_int(width);
+    cl_int imageHeight = cl_int(height);
+    errNum |= clSetKernelArg(kernel, 3, sizeof(cl_int), &imageWidth);
+    errNum |= clSetKernelArg(kernel, 4, sizeof(cl_int), &imageHeight);
+    if (errNum != CL_SUCCESS) {
+      std::cerr << "Error setting kernel arguments." << std::endl;
+      Cleanup(context, commandQueue, program, kernel, imageObjects, sampler);
+      return 1;
+    }
 
-  // Queue the kernel up for execution
-  errNum = clEnqueueNDRangeKernel(commandQueue, kernel, 2, NULL, globalWorkSize,
-                                  localWorkSize, 0, NULL, NULL);
+    // Tune the work-group size once per device and image size bucket; the
+    // kernel bound-checks, so the global size is padded to the local size
+    size_t globalWorkSize[2] = {width, height};
+    auto problem = clx::work_size{width, height, 1};
+    auto &tuner = clx::default_autotuner();
+    if (!tuner.lookup(kernel, device, 2, problem)) {
+      auto space = clx::tuning_space{};
+      space.pad = true;
+      tuner.tune(commandQueue, kernel, 2, problem, space);
+    }
+
+    // Queue the kernel up for execution
+    errNum = clx::enqueue_tuned(commandQueue, kernel, 2, globalWorkSize, true);
+  }
   if (errNum != CL_SUCCESS) {
     std::cerr << "Error queuing kernel for execution." << std::endl;
     Cleanup(context, commandQueue, program, kernel, imageObjects, sampler);
@@ -0,0 +1,286 @@
+#include "stream.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <FreeImage.h>
+#include <fmt/format.h>
+
+#include "cl/channel.hpp"
+#include "cl/clx.hpp"
+#include "cl/staging.hpp"
+#include "cl/tuner.hpp"
+
+namespace {
+
+// one frame in flight. the pinned buffers and device images are kept across
+// frames and only reallocated when a frame is larger than the last.
+struct Frame {
+  std::filesystem::path input;
+  std::filesystem::path output;
+  bool ok = false;
+  std::size_t width = 0;
+  std::size_t height = 0;
+
+  std::unique_ptr<clx::staging_buffer> in;
+  std::unique_ptr<clx::staging_buffer> out;
+  cl_mem images[2] = {nullptr, nullptr};
+  std::size_t imageWidth = 0;
+  std::size_t imageHeight = 0;
+  cl_event done = nullptr;
+
+  ~Frame() {
+    for (auto image : images) {
+      if (image) {
+        clReleaseMemObject(image);
+      }
+    }
+  }
+};
+
+auto ListFrames(std::string const &input)
+    -> std::vector<std::filesystem::path> {
+  auto frames = std::vector<std::filesystem::path>{};
+  auto ec = std::error_code{};
+  if (std::filesystem::is_directory(input, ec)) {
+    for (auto const &entry : std::filesystem::directory_iterator(input, ec)) {
+      if (entry.is_regular_file(ec)) {
+        frames.push_back(entry.path());
+      }
+    }
+    std::sort(std::begin(frames), std::end(frames));
+    return frames;
+  }
+  std::ifstream list(input);
+  auto line = std::string{};
+  while (std::getline(list, line)) {
+    if (!line.empty()) {
+      frames.push_back(line);
+    }
+  }
+  return frames;
+}
+
+auto EnsureStaging(std::unique_ptr<clx::staging_buffer> &buffer,
+                   cl_context context, cl_command_queue queue,
+                   std::size_t size) -> bool {
+  if (!buffer || buffer->capacity() < size) {
+    buffer.reset();
+    buffer = std::make_unique<clx::staging_buffer>(context, queue, size);
+  }
+  return static_cast<bool>(*buffer);
+}
+
+// decodes straight into the frame's pinned upload buffer, in the bottom-up
+// row order LoadImage uses.
+auto DecodeFrame(Frame &f, cl_context context, cl_command_queue queue)
+    -> bool {
+  auto name = f.input.string();
+  auto format = FreeImage_GetFileType(name.c_str(), 0);
+  if (format == FIF_UNKNOWN) {
+    format = FreeImage_GetFIFFromFilename(name.c_str());
+  }
+  auto image = format == FIF_UNKNOWN ? nullptr
+                                     : FreeImage_Load(format, name.c_str());
+  if (!image) {
+    return false;
+  }
+  f.width = FreeImage_GetWidth(image);
+  f.height = FreeImage_GetHeight(image);
+  auto ok = EnsureStaging(f.in, context, queue, f.width * f.height * 4);
+  if (ok) {
+    FreeImage_ConvertToRawBits(f.in->as<BYTE>(), image, f.width * 4, 32,
+                               FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK,
+                               FI_RGBA_BLUE_MASK, FALSE);
+  }
+  FreeImage_Unload(image);
+  return ok;
+}
+
+auto EncodeFrame(Frame &f) -> bool {
+  auto image = FreeImage_ConvertFromRawBits(
+      f.out->as<BYTE>(), f.width, f.height, f.width * 4, 32, FI_RGBA_RED_MASK,
+      FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, FALSE);
+  if (!image) {
+    return false;
+  }
+  auto name = f.output.string();
+  auto format = FreeImage_GetFIFFromFilename(name.c_str());
+  if (format == FIF_UNKNOWN) {
+    format = FIF_BMP;
+  }
+  // e.g. JPEG has no alpha channel
+  if (!FreeImage_FIFSupportsExportBPP(format, 32)) {
+    auto rgb = FreeImage_ConvertTo24Bits(image);
+    FreeImage_Unload(image);
+    image = rgb;
+  }
+  auto ok = image && FreeImage_Save(format, image, name.c_str());
+  if (image) {
+    FreeImage_Unload(image);
+  }
+  return ok;
+}
+
+auto EnsureImages(Frame &f, cl_context context) -> bool {
+  if (f.images[0] && f.imageWidth == f.width && f.imageHeight == f.height) {
+    return true;
+  }
+  for (auto &image : f.images) {
+    if (image) {
+      clReleaseMemObject(image);
+      image = nullptr;
+    }
+  }
+  cl_image_format format;
+  format.image_channel_order = CL_RGBA;
+  format.image_channel_data_type = CL_UNORM_INT8;
+  cl_int err;
+  f.images[0] = clCreateImage2D(context, CL_MEM_READ_ONLY, &format, f.width,
+                                f.height, 0, nullptr, &err);
+  f.images[1] = clCreateImage2D(context, CL_MEM_WRITE_ONLY, &format, f.width,
+                                f.height, 0, nullptr, &err);
+  f.imageWidth = f.width;
+  f.imageHeight = f.height;
+  return f.images[0] && f.images[1];
+}
+
+// upload on one queue, filter on another and read back on a third; the
+// events chain them, so the next frame's upload can run under this frame's
+// kernel and the previous frame's readback.
+auto SubmitFrame(Frame &f, cl_context context, cl_command_queue upload,
+                 cl_command_queue compute, cl_command_queue readback,
+                 TileFilter const &filter) -> bool {
+  if (!EnsureImages(f, context) ||
+      !EnsureStaging(f.out, context, readback, f.width * f.height * 4)) {
+    return false;
+  }
+  size_t origin[3] = {0, 0, 0};
+  size_t region[3] = {f.width, f.height, 1};
+  cl_event uploaded = nullptr;
+  cl_event filtered = nullptr;
+  auto err = clEnqueueWriteImage(upload, f.images[0], CL_FALSE, origin, region,
+                                 f.width * 4, 0, f.in->data(), 0, nullptr,
+                                 &uploaded);
+  if (err == CL_SUCCESS) {
+    err = filter(compute, f.images[0], f.images[1], f.width, f.height, 1,
+                 &uploaded, &filtered);
+  }
+  if (err == CL_SUCCESS) {
+    err = clEnqueueReadImage(readback, f.images[1], CL_FALSE, origin, region,
+                             f.width * 4, 0, f.out->data(), 1, &filtered,
+                             &f.done);
+  }
+  for (auto e : {uploaded, filtered}) {
+    if (e) {
+      clReleaseEvent(e);
+    }
+  }
+  clFlush(upload);
+  clFlush(compute);
+  clFlush(readback);
+  if (err != CL_SUCCESS) {
+    clFinish(upload);
+    clFinish(compute);
+    clFinish(readback);
+  }
+  return err == CL_SUCCESS;
+}
+
+} // namespace
+
+int RunStream(cl_context context, cl_device_id device,
+              TileFilter const &filter, std::string const &input,
+              std::string const &outputDir, std::size_t inFlight) {
+  auto frames = ListFrames(input);
+  if (frames.empty()) {
+    fmt::print("[ERROR] no frames in {}\n", input);
+    return 1;
+  }
+  auto ec = std::error_code{};
+  std::filesystem::create_directories(outputDir, ec);
+
+  auto upload = clx::create_command_queue(context, device, 0);
+  auto compute = clx::create_command_queue(context, device, 0);
+  auto readback = clx::create_command_queue(context, device, 0);
+  if (!upload || !compute || !readback) {
+    fmt::print("[ERROR] failed to create the stream queues\n");
+    return 1;
+  }
+
+  inFlight = std::max<std::size_t>(inFlight, 2);
+  auto slots = std::vector<std::unique_ptr<Frame>>{};
+  auto free = clx::channel<Frame *>{};
+  auto decoded = clx::channel<Frame *>{};
+  auto submitted = clx::channel<Frame *>{};
+  for (auto i = std::size_t{0}; i < inFlight; i++) {
+    slots.push_back(std::make_unique<Frame>());
+    free.push(slots.back().get());
+  }
+
+  auto failed = std::atomic<int>{0};
+  auto start = std::chrono::steady_clock::now();
+
+  auto decoder = std::thread([&] {
+    for (auto const &path : frames) {
+      auto f = *free.pop();
+      f->input = path;
+      f->output = std::filesystem::path{outputDir} / path.filename();
+      f->ok = DecodeFrame(*f, context, upload);
+      decoded.push(f);
+    }
+    decoded.close();
+  });
+
+  auto encoder = std::thread([&] {
+    while (auto f = submitted.pop()) {
+      auto &frame = **f;
+      if (frame.done) {
+        frame.ok = clWaitForEvents(1, &frame.done) == CL_SUCCESS;
+        clReleaseEvent(frame.done);
+        frame.done = nullptr;
+      }
+      if (!frame.ok || !EncodeFrame(frame)) {
+        fmt::print("[ERROR] failed to filter {}\n", frame.input.string());
+        failed++;
+      }
+      free.push(&frame);
+    }
+  });
+
+  // the submitting stage runs here, so only this thread binds the filter's
+  // kernels
+  while (auto f = decoded.pop()) {
+    auto &frame = **f;
+    if (frame.ok) {
+      frame.ok =
+          SubmitFrame(frame, context, upload, compute, readback, filter);
+    }
+    submitted.push(&frame);
+  }
+  submitted.close();
+
+  decoder.join();
+  encoder.join();
+  auto end = std::chrono::steady_clock::now();
+  auto seconds = std::chrono::duration<double>(end - start).count();
+
+  fmt::print("[INFO] {} frames ({} failed) in {:.3f} s, {:.1f} frames/s, "
+             "{} in flight\n",
+             frames.size(), failed.load(), seconds,
+             seconds > 0 ? frames.size() / seconds : 0.0, inFlight);
+
+  slots.clear();
+  clx::default_autotuner().forget(compute);
+  clReleaseCommandQueue(upload);
+  clReleaseCommandQueue(compute);
+  clReleaseCommandQueue(readback);
+  return failed;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "tile.hpp"
+
+///
+//  Filter every frame of a directory, or of a text file listing one frame
+//  path per line, into outputDir with filter. Decode, upload, filter,
+//  readback and encode run as concurrent stages over inFlight frames, each
+//  with its own pinned host buffers and device images, on separate upload,
+//  compute and readback queues. Prints the frame rate at the end and returns
+//  the number of frames that failed.
+//
+int RunStream(cl_context context, cl_device_id device,
+              TileFilter const &filter, std::string const &input,
+              std::string const &outputDir, std::size_t inFlight);
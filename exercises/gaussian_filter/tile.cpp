@@ -0,0 +1,146 @@
+#include "tile.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include "cl/clx.hpp"
+#include "cl/device_caps.hpp"
+
+namespace {
+
+struct TileSlot {
+  cl_mem src = nullptr;
+  cl_mem dst = nullptr;
+  // the slot's last readback; the next upload into the slot waits on it
+  cl_event readback = nullptr;
+};
+
+auto CreateTileImage(cl_context context, cl_mem_flags flags, size_t side)
+    -> cl_mem {
+  cl_image_format format;
+  format.image_channel_order = CL_RGBA;
+  format.image_channel_data_type = CL_UNORM_INT8;
+  cl_int err;
+  auto image = clCreateImage2D(context, flags, &format, side, side, 0, nullptr,
+                               &err);
+  clx::set_err_if_err(err, "clCreateImage2D");
+  return image;
+}
+
+} // namespace
+
+bool NeedsTiling(cl_device_id device, size_t width, size_t height) {
+  auto const &caps = clx::device_caps_of(device);
+  auto bytes = cl_ulong(width) * height * 4;
+  return width > caps.image2d_max_width || height > caps.image2d_max_height ||
+         bytes > caps.max_mem_alloc_size || 2 * bytes > caps.global_mem_size;
+}
+
+cl_int FilterTiled(cl_context context, cl_device_id device,
+                   TileFilter const &filter, const unsigned char *input,
+                   unsigned char *output, size_t width, size_t height,
+                   size_t pitch, size_t tileSize, size_t radius,
+                   size_t poolSize) {
+  auto const &caps = clx::device_caps_of(device);
+  poolSize = std::max<size_t>(poolSize, 1);
+
+  // the tile plus its halo on both sides must fit the image limits, and the
+  // whole pool the device memory
+  auto side = std::min({tileSize + 2 * radius, caps.image2d_max_width,
+                        caps.image2d_max_height});
+  while (side > 2 * radius + 1 &&
+         (cl_ulong(side) * side * 4 > caps.max_mem_alloc_size ||
+          2 * poolSize * cl_ulong(side) * side * 4 > caps.global_mem_size)) {
+    side /= 2;
+  }
+  if (side <= 2 * radius) {
+    return CL_INVALID_IMAGE_SIZE;
+  }
+  auto tile = side - 2 * radius;
+
+  auto upload = clx::create_command_queue(context, device, 0);
+  auto compute = clx::create_command_queue(context, device, 0);
+  auto readback = clx::create_command_queue(context, device, 0);
+  auto slots = std::vector<TileSlot>(poolSize);
+  auto err = upload && compute && readback ? CL_SUCCESS : clx::last_error();
+  for (auto &s : slots) {
+    if (err != CL_SUCCESS) {
+      break;
+    }
+    s.src = CreateTileImage(context, CL_MEM_READ_ONLY, side);
+    s.dst = CreateTileImage(context, CL_MEM_WRITE_ONLY, side);
+    if (!s.src || !s.dst) {
+      err = clx::last_error();
+    }
+  }
+
+  auto index = size_t{0};
+  for (auto y0 = size_t{0}; err == CL_SUCCESS && y0 < height; y0 += tile) {
+    for (auto x0 = size_t{0}; err == CL_SUCCESS && x0 < width; x0 += tile) {
+      auto &s = slots[index++ % slots.size()];
+      auto tw = std::min(tile, width - x0);
+      auto th = std::min(tile, height - y0);
+      // the halo is clipped at the image border, where the sampler's
+      // clamp-to-edge then sees the same pixels as on the whole image
+      auto hx = x0 >= radius ? x0 - radius : 0;
+      auto hy = y0 >= radius ? y0 - radius : 0;
+      auto hw = std::min(x0 + tw + radius, width) - hx;
+      auto hh = std::min(y0 + th + radius, height) - hy;
+
+      size_t origin[3] = {0, 0, 0};
+      size_t region[3] = {hw, hh, 1};
+      cl_event uploaded = nullptr;
+      cl_event filtered = nullptr;
+      err = clEnqueueWriteImage(upload, s.src, CL_FALSE, origin, region, pitch,
+                                0, input + hy * pitch + hx * 4,
+                                s.readback ? 1 : 0,
+                                s.readback ? &s.readback : nullptr, &uploaded);
+      clx::set_err_if_err(err, "clEnqueueWriteImage");
+      if (err == CL_SUCCESS) {
+        err = filter(compute, s.src, s.dst, hw, hh, 1, &uploaded, &filtered);
+      }
+      if (s.readback) {
+        clReleaseEvent(s.readback);
+        s.readback = nullptr;
+      }
+      if (err == CL_SUCCESS) {
+        size_t inner[3] = {x0 - hx, y0 - hy, 0};
+        size_t innerRegion[3] = {tw, th, 1};
+        err = clEnqueueReadImage(readback, s.dst, CL_FALSE, inner, innerRegion,
+                                 pitch, 0, output + y0 * pitch + x0 * 4, 1,
+                                 &filtered, &s.readback);
+        clx::set_err_if_err(err, "clEnqueueReadImage");
+      }
+      for (auto e : {uploaded, filtered}) {
+        if (e) {
+          clReleaseEvent(e);
+        }
+      }
+      clFlush(upload);
+      clFlush(compute);
+      clFlush(readback);
+    }
+  }
+
+  for (auto q : {upload, compute, readback}) {
+    if (q) {
+      clFinish(q);
+    }
+  }
+  for (auto &s : slots) {
+    if (s.readback) {
+      clReleaseEvent(s.readback);
+    }
+    for (auto m : {s.src, s.dst}) {
+      if (m) {
+        clReleaseMemObject(m);
+      }
+    }
+  }
+  for (auto q : {upload, compute, readback}) {
+    if (q) {
+      clReleaseCommandQueue(q);
+    }
+  }
+  return err;
+}
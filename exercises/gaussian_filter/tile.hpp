@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+///
+//  Enqueue a filter from src to dst, two width x height images, on queue
+//  after the wait list, returning the filter's completion event in done.
+//
+using TileFilter = std::function<cl_int(
+    cl_command_queue queue, cl_mem src, cl_mem dst, size_t width,
+    size_t height, cl_uint numWait, const cl_event *wait, cl_event *done)>;
+
+///
+//  Filter a width x height RGBA8 image held in host memory, rows pitch bytes
+//  apart, in tiles of at most tileSize x tileSize pixels. Each tile is
+//  uploaded with a halo of radius pixels on every side that has neighbours,
+//  so the filter sees the same pixels as on the whole image and the stitched
+//  output has no seams. Tiles stream through poolSize pairs of device
+//  images on separate upload, compute and readback queues, so device memory
+//  depends on the tile size only. tileSize is reduced to what the device's
+//  image and allocation limits allow.
+//
+cl_int FilterTiled(cl_context context, cl_device_id device,
+                   TileFilter const &filter, const unsigned char *input,
+                   unsigned char *output, size_t width, size_t height,
+                   size_t pitch, size_t tileSize, size_t radius,
+                   size_t poolSize = 3);
+
+///
+//  Whether a width x height RGBA8 image, and the output image of the same
+//  size, exceed what device can hold as two whole images.
+//
+bool NeedsTiling(cl_device_id device, size_t width, size_t height);
@@ -10,8 +10,6 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <sys/types.h>
 
 #ifdef __APPLE__
 #include <OpenCL/opencl.h>
@@ -19,11 +17,20 @@
 #include <CL/cl.h>
 #endif
 
-const char cl_kernel_histogram_filename[] = "histogram_image.cl";
+#include "cl/clx.hpp"
+#include "cl/device_caps.hpp"
+#include "cl/histogram.hpp"
+#include "cl/host.hpp"
+#include "cl/kernels.hpp"
+#include "cl/tuner.hpp"
 
+// used when tuning finds no working launch
 const int num_pixels_per_work_item = 32;
 static int num_iterations = 1000;
 
+// the exit status ctest reports as skipped (SKIP_RETURN_CODE)
+#define EXIT_SKIP 77
+
 // fill an image of w x h pixels with 4-channels / pixel with random data
 // each channel is an unisgned 8-bit value
 //
@@ -39,34 +46,16 @@ static void *create_image_data_unorm8(int w, int h) {
 
 // generate the reference results for unsigned 8-bit RGBA image.
 // this reference result will be compared with histogram results generated by
-// the OpenCL device.
+// the OpenCL device. counted by the multithreaded host backend.
 //
 static void *generate_reference_histogram_results_unorm8(void *image_data,
                                                          int w, int h) {
   unsigned int *ref_histogram_results =
       (unsigned int *)malloc(256 * 3 * sizeof(unsigned int));
-  unsigned char *img = (unsigned char *)image_data;
-  unsigned int *ptr = ref_histogram_results;
-  int i;
-
-  memset(ref_histogram_results, 0x0, 256 * 3 * sizeof(unsigned int));
-  for (i = 0; i < w * h * 4; i += 4) {
-    int indx = img[i];
-    ptr[indx]++;
-  }
-
-  ptr += 256;
-  for (i = 1; i < w * h * 4; i += 4) {
-    int indx = img[i];
-    ptr[indx]++;
-  }
-
-  ptr += 256;
-  for (i = 2; i < w * h * 4; i += 4) {
-    int indx = img[i];
-    ptr[indx]++;
-  }
+  std::vector<cl_uint> counts = clx::host::histogram_rgba_unorm8(
+      (const unsigned char *)image_data, (size_t)w * h);
 
+  memcpy(ref_histogram_results, counts.data(), 256 * 3 * sizeof(unsigned int));
   return ref_histogram_results;
 }
 
@@ -153,29 +142,154 @@ static int verify_histogram_results(const char *str,
   return 0;
 }
 
-static int read_kernel_from_file(const char *filename, char **source,
-                                 size_t *len) {
-  struct stat statbuf;
-  FILE *fh;
-  size_t file_len;
+// choose pixels per work-item and the work-group shape of a histogram kernel
+// from the tuning database, sweeping them once on a miss. allocates the
+// partial histogram buffer for the resulting number of work-groups, unless
+// merge is atomic, and binds the arguments of the histogram kernel and, for
+// two_pass, the sum kernel. any privatization but shared, and any merge but
+// two_pass, takes the private-layout kernels, sized per work-group shape.
+// groups_done is the last_group kernel's counter, zero before the first
+// launch.
+static cl_int setup_histogram_launch(
+    cl_context context, cl_command_queue queue, cl_kernel histogram,
+    cl_kernel sum, cl_mem image, cl_mem histogram_buffer, int bins,
+    int image_width, int image_height,
+    clx::histogram_privatization privatization, clx::histogram_merge merge,
+    cl_mem groups_done, cl_mem *partial, size_t *num_groups,
+    size_t global_work_size[2], size_t local_work_size[2]) {
+  size_t capacity = 0;
+  auto device = clx::get_command_queue_info_device(queue);
+  auto const &caps = clx::device_caps_of(device);
+  auto warp = clx::get_kernel_work_group_info_preferred_multiple(histogram,
+                                                                 device);
+  // passes the histogram kernel's arguments for a launch shape to f, which
+  // binds or checks them
+  auto arguments = [&](auto f, long pixels, clx::work_size const &local) {
+    auto layout = clx::histogram_layout_for(privatization, caps,
+                                            local[0] * local[1], warp, bins);
+    switch (merge) {
+    case clx::histogram_merge::two_pass:
+      break;
+    case clx::histogram_merge::atomic:
+      return f(histogram, clx::image(image), cl_int(pixels),
+               clx::buffer<cl_uint>(histogram_buffer),
+               clx::local<cl_uint>(layout.local_words), cl_int(layout.copies),
+               cl_int(layout.interleaved));
+    case clx::histogram_merge::last_group:
+      return f(histogram, clx::image(image), cl_int(pixels),
+               clx::buffer<cl_uint>(*partial),
+               clx::local<cl_uint>(layout.local_words), cl_int(layout.copies),
+               cl_int(layout.interleaved),
+               clx::buffer<cl_uint>(histogram_buffer),
+               clx::buffer<cl_uint>(groups_done));
+    }
+    if (layout.privatization == clx::histogram_privatization::shared) {
+      return f(histogram, clx::image(image), cl_int(pixels),
+               clx::buffer<cl_uint>(*partial), clx::local<cl_uint>(bins));
+    }
+    return f(histogram, clx::image(image), cl_int(pixels),
+             clx::buffer<cl_uint>(*partial),
+             clx::local<cl_uint>(layout.local_words), cl_int(layout.copies),
+             cl_int(layout.interleaved));
+  };
+  auto bind = [](auto... args) { return clx::set_arguments(args...); };
+  auto check = [](auto... args) { return clx::check_arguments(args...); };
+  auto apply = [&](long pixels, clx::work_size const &local) {
+    auto w = (image_width + pixels - 1) / pixels;
+    auto groups_x = (w + local[0] - 1) / local[0];
+    auto groups_y = (image_height + local[1] - 1) / local[1];
+    *num_groups = groups_x * groups_y;
+    auto size = *num_groups * 257 * 3 * sizeof(unsigned int);
+    if (merge != clx::histogram_merge::atomic && size > capacity) {
+      if (*partial) {
+        clReleaseMemObject(*partial);
+      }
+      *partial = clx::create_buffer(context, CL_MEM_READ_WRITE, size, NULL);
+      capacity = *partial ? size : 0;
+    }
+    arguments(bind, pixels, local);
+    if (merge == clx::histogram_merge::two_pass) {
+      clx::set_arguments(sum, *partial, cl_int(*num_groups),
+                         histogram_buffer);
+    }
+    return clx::work_size{groups_x * local[0], groups_y * local[1], 1};
+  };
+
+  auto &tuner = clx::default_autotuner();
+  auto problem = clx::work_size{size_t(image_width), size_t(image_height), 1};
+  auto tuned = tuner.lookup(histogram, device, 2, problem);
+  if (!tuned) {
+    auto space = clx::tuning_space{};
+    space.params = {8, 16, 32, 64};
+    space.apply = apply;
+    space.driver_choice = false;
+    tuned = tuner.tune(queue, histogram, 2, problem, space);
+  }
+  if (!tuned->local[0]) {
+    // every trial failed, fall back to a shape any device accepts
+    tuned->param = num_pixels_per_work_item;
+    tuned->local = {16, 1, 1};
+  }
+
+  auto global = apply(tuned->param, tuned->local);
+  if (merge != clx::histogram_merge::atomic && !*partial) {
+    return clx::last_error();
+  }
+  global_work_size[0] = global[0];
+  global_work_size[1] = global[1];
+  local_work_size[0] = tuned->local[0];
+  local_work_size[1] = tuned->local[1];
+  return arguments(check, tuned->param, tuned->local);
+}
 
-  fh = fopen(filename, "r");
-  if (fh == 0)
-    return -1;
+// one histogram of the image into histogram_buffer: the histogram kernel and
+// the sum kernel for two_pass, the histogram kernel alone for last_group, and
+// for atomic a fill that zeroes the bins the kernel adds to.
+static cl_int enqueue_histogram(cl_command_queue queue,
+                                clx::histogram_merge merge,
+                                cl_kernel histogram, cl_kernel sum,
+                                cl_mem histogram_buffer, int bins,
+                                size_t global_work_size[2],
+                                size_t local_work_size[2],
+                                size_t partial_global_work_size[1],
+                                size_t partial_local_work_size[1]) {
+  cl_int err;
+  if (merge == clx::histogram_merge::atomic) {
+    cl_uint zero = 0;
+    err = clEnqueueFillBuffer(queue, histogram_buffer, &zero, sizeof(zero), 0,
+                              bins * sizeof(cl_uint), 0, NULL, NULL);
+    if (err) {
+      printf("clEnqueueFillBuffer() failed. (%d)\n", err);
+      return err;
+    }
+  }
 
-  stat(filename, &statbuf);
-  file_len = (size_t)statbuf.st_size;
-  *len = file_len;
-  *source = (char *)malloc(file_len + 1);
-  fread(*source, file_len, 1, fh);
-  (*source)[file_len] = '\0';
+  err = clEnqueueNDRangeKernel(queue, histogram, 2, NULL, global_work_size,
+                               local_work_size, 0, NULL, NULL);
+  if (err) {
+    printf("clEnqueueNDRangeKernel() failed for histogram kernel. (%d)\n",
+           err);
+    return err;
+  }
 
-  fclose(fh);
-  return 0;
+  if (merge == clx::histogram_merge::two_pass) {
+    err = clEnqueueNDRangeKernel(queue, sum, 1, NULL,
+                                 partial_global_work_size,
+                                 partial_local_work_size, 0, NULL, NULL);
+    if (err) {
+      printf("clEnqueueNDRangeKernel() failed for sum partial results "
+             "kernel. (%d)\n",
+             err);
+      return err;
+    }
+  }
+  return CL_SUCCESS;
 }
 
 int test_histogram(cl_context context, cl_command_queue queue,
-                   cl_device_id device) {
+                   cl_device_id device,
+                   clx::histogram_privatization privatization,
+                   clx::histogram_merge merge) {
   cl_program program;
   cl_kernel histogram_rgba_unorm8;
   cl_kernel histogram_rgba_fp;
@@ -197,31 +311,26 @@ int test_histogram(cl_context context, cl_command_queue queue,
   cl_mem input_image_fp32;
   cl_mem histogram_buffer;
   cl_mem partial_histogram_buffer;
+  cl_mem groups_done;
+  cl_uint zero = 0;
   cl_event events[2];
   cl_ulong time_start, time_end;
   size_t src_len[1];
-  char *source[1];
-  int i, err;
+  const char *source[1];
+  int i, err, failed = 0;
 
   srand(0);
 
-  err = read_kernel_from_file(cl_kernel_histogram_filename, &source[0],
-                              &src_len[0]);
-  if (err) {
-    printf("read_kernel_from_file() failed. (%s) file not found\n",
-           cl_kernel_histogram_filename);
-    return EXIT_FAILURE;
-  }
+  source[0] = clx::kernel::histogram_image.text.data();
+  src_len[0] = clx::kernel::histogram_image.text.size();
 
-  program = clCreateProgramWithSource(context, 1, (const char **)source,
-                                      (size_t *)src_len, &err);
+  program = clCreateProgramWithSource(context, 1, source, src_len, &err);
   if (!program || err) {
     printf("clCreateProgramWithSource() failed. (%d)\n", err);
     return EXIT_FAILURE;
   }
-  free(source[0]);
 
-  err = clBuildProgram(program, 1, &device, NULL, NULL, NULL);
+  err = clBuildProgram(program, 1, &device, "-cl-kernel-arg-info", NULL, NULL);
   if (err != CL_SUCCESS) {
     char buffer[2048] = "";
 
@@ -232,8 +341,23 @@ int test_histogram(cl_context context, cl_command_queue queue,
     return EXIT_FAILURE;
   }
 
-  histogram_rgba_unorm8 =
-      clCreateKernel(program, "histogram_image_rgba_unorm8", &err);
+  // the unorm8 histogram privatizes its local histogram as asked, or as
+  // suits the device
+  if (privatization == clx::histogram_privatization::automatic) {
+    privatization =
+        clx::choose_histogram_privatization(clx::device_caps_of(device));
+  }
+  // and merges the work-groups' histograms in one launch or two
+  printf("Local histogram privatization = %s, merge = %s\n",
+         clx::to_string(privatization), clx::to_string(merge));
+  const char *unorm8_name = "histogram_image_rgba_unorm8_private";
+  if (merge == clx::histogram_merge::atomic)
+    unorm8_name = "histogram_image_rgba_unorm8_atomic";
+  else if (merge == clx::histogram_merge::last_group)
+    unorm8_name = "histogram_image_rgba_unorm8_last_group";
+  else if (privatization == clx::histogram_privatization::shared)
+    unorm8_name = "histogram_image_rgba_unorm8";
+  histogram_rgba_unorm8 = clCreateKernel(program, unorm8_name, &err);
   if (!histogram_rgba_unorm8 || err) {
     printf("clCreateKernel() failed creating kernel void "
            "histogram_rgba_unorm8(). (%d)\n",
@@ -264,12 +388,19 @@ int test_histogram(cl_context context, cl_command_queue queue,
     return EXIT_FAILURE;
   }
 
-  histogram_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY,
+  histogram_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE,
                                     257 * 3 * sizeof(unsigned int), NULL, &err);
   if (!histogram_buffer || err) {
     printf("clCreateBuffer() failed. (%d)\n", err);
     return EXIT_FAILURE;
   }
+  groups_done =
+      clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                     sizeof(cl_uint), &zero, &err);
+  if (!groups_done || err) {
+    printf("clCreateBuffer() failed. (%d)\n", err);
+    return EXIT_FAILURE;
+  }
 
   image_format.image_channel_order = CL_RGBA;
   image_format.image_channel_data_type = CL_UNORM_INT8;
@@ -294,73 +425,24 @@ int test_histogram(cl_context context, cl_command_queue queue,
 
   /************  Testing RGBA 8-bit histogram **********/
 
-  clGetKernelWorkGroupInfo(histogram_rgba_unorm8, device,
-                           CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t),
-                           &workgroup_size, NULL);
-  {
-    size_t gsize[2];
-    int w;
-
-    if (workgroup_size <= 256) {
-      gsize[0] = 16;
-      gsize[1] = workgroup_size / 16;
-    } else if (workgroup_size <= 1024) {
-      gsize[0] = workgroup_size / 16;
-      gsize[1] = 16;
-    } else {
-      gsize[0] = workgroup_size / 32;
-      gsize[1] = 32;
-    }
-
-    local_work_size[0] = gsize[0];
-    local_work_size[1] = gsize[1];
-
-    w = (image_width + num_pixels_per_work_item - 1) / num_pixels_per_work_item;
-    global_work_size[0] = ((w + gsize[0] - 1) / gsize[0]);
-    global_work_size[1] = ((image_height + gsize[1] - 1) / gsize[1]);
-
-    num_groups = global_work_size[0] * global_work_size[1];
-    global_work_size[0] *= gsize[0];
-    global_work_size[1] *= gsize[1];
-  }
-
-  partial_histogram_buffer =
-      clCreateBuffer(context, CL_MEM_READ_WRITE,
-                     num_groups * 257 * 3 * sizeof(unsigned int), NULL, &err);
-  if (!partial_histogram_buffer || err) {
-    printf("clCreateBuffer() failed. (%d)\n", err);
-    return EXIT_FAILURE;
-  }
-
-  clSetKernelArg(histogram_rgba_unorm8, 0, sizeof(cl_mem), &input_image_unorm8);
-  clSetKernelArg(histogram_rgba_unorm8, 1, sizeof(int),
-                 &num_pixels_per_work_item);
-  clSetKernelArg(histogram_rgba_unorm8, 2, sizeof(cl_mem),
-                 &partial_histogram_buffer);
-
-  clSetKernelArg(histogram_sum_partial_results_unorm8, 0, sizeof(cl_mem),
-                 &partial_histogram_buffer);
-  clSetKernelArg(histogram_sum_partial_results_unorm8, 1, sizeof(int),
-                 &num_groups);
-  clSetKernelArg(histogram_sum_partial_results_unorm8, 2, sizeof(cl_mem),
-                 &histogram_buffer);
-
-  // verify that the kernel works correctly.  also acts as a warmup
-  err =
-      clEnqueueNDRangeKernel(queue, histogram_rgba_unorm8, 2, NULL,
-                             global_work_size, local_work_size, 0, NULL, NULL);
+  partial_histogram_buffer = NULL;
+  err = setup_histogram_launch(
+      context, queue, histogram_rgba_unorm8,
+      histogram_sum_partial_results_unorm8, input_image_unorm8,
+      histogram_buffer, 256 * 3, image_width, image_height, privatization,
+      merge, groups_done, &partial_histogram_buffer, &num_groups,
+      global_work_size, local_work_size);
   if (err) {
-    printf("clEnqueueNDRangeKernel() failed for histogram_rgba_unorm8 kernel. "
-           "(%d)\n",
+    printf("setup_histogram_launch() failed for histogram_rgba_unorm8 "
+           "kernel. (%d)\n",
            err);
     return EXIT_FAILURE;
   }
 
-  // verify that the kernel works correctly.  also acts as a warmup
   clGetKernelWorkGroupInfo(histogram_sum_partial_results_unorm8, device,
                            CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t),
                            &workgroup_size, NULL);
-  if (workgroup_size < 256) {
+  if (merge == clx::histogram_merge::two_pass && workgroup_size < 256) {
     printf("A min. of 256 work-items in work-group is needed for "
            "histogram_sum_partial_results_unorm8 kernel. (%d)\n",
            (int)workgroup_size);
@@ -368,13 +450,14 @@ int test_histogram(cl_context context, cl_command_queue queue,
   }
   partial_global_work_size[0] = 256 * 3;
   partial_local_work_size[0] = (workgroup_size > 256) ? 256 : workgroup_size;
-  err = clEnqueueNDRangeKernel(queue, histogram_sum_partial_results_unorm8, 1,
-                               NULL, partial_global_work_size,
-                               partial_local_work_size, 0, NULL, NULL);
+
+  // verify that the kernels work correctly.  also acts as a warmup
+  err = enqueue_histogram(queue, merge, histogram_rgba_unorm8,
+                          histogram_sum_partial_results_unorm8,
+                          histogram_buffer, 256 * 3, global_work_size,
+                          local_work_size, partial_global_work_size,
+                          partial_local_work_size);
   if (err) {
-    printf("clEnqueueNDRangeKernel() failed for "
-           "histogram_sum_partial_results_unorm8 kernel. (%d)\n",
-           err);
     return EXIT_FAILURE;
   }
 
@@ -389,9 +472,10 @@ int test_histogram(cl_context context, cl_command_queue queue,
     printf("clEnqueueReadBuffer() failed. (%d)\n", err);
     return EXIT_FAILURE;
   }
-  verify_histogram_results(
-      "Image Histogram for image type = CL_RGBA, CL_UNORM_INT8",
-      histogram_results, ref_histogram_results, 256 * 3);
+  if (verify_histogram_results(
+          "Image Histogram for image type = CL_RGBA, CL_UNORM_INT8",
+          histogram_results, ref_histogram_results, 256 * 3))
+    failed = 1;
 
   // now measure performance
   err = clEnqueueMarker(queue, &events[0]);
@@ -401,23 +485,12 @@ int test_histogram(cl_context context, cl_command_queue queue,
     return EXIT_FAILURE;
   }
   for (i = 0; i < num_iterations; i++) {
-    err = clEnqueueNDRangeKernel(queue, histogram_rgba_unorm8, 2, NULL,
-                                 global_work_size, local_work_size, 0, NULL,
-                                 NULL);
-    if (err) {
-      printf("clEnqueueNDRangeKernel() failed for histogram_rgba_unorm8 "
-             "kernel. (%d)\n",
-             err);
-      return EXIT_FAILURE;
-    }
-
-    err = clEnqueueNDRangeKernel(queue, histogram_sum_partial_results_unorm8, 1,
-                                 NULL, partial_global_work_size,
-                                 partial_local_work_size, 0, NULL, NULL);
+    err = enqueue_histogram(queue, merge, histogram_rgba_unorm8,
+                            histogram_sum_partial_results_unorm8,
+                            histogram_buffer, 256 * 3, global_work_size,
+                            local_work_size, partial_global_work_size,
+                            partial_local_work_size);
     if (err) {
-      printf("clEnqueueNDRangeKernel() failed for "
-             "histogram_sum_partial_results_unorm8 kernel. (%d)\n",
-             err);
       return EXIT_FAILURE;
     }
   }
@@ -457,54 +530,22 @@ int test_histogram(cl_context context, cl_command_queue queue,
 
   /************  Testing RGBA 32-bit fp histogram **********/
 
-  clGetKernelWorkGroupInfo(histogram_rgba_fp, device, CL_KERNEL_WORK_GROUP_SIZE,
-                           sizeof(size_t), &workgroup_size, NULL);
-  {
-    size_t gsize[2];
-    int w;
-
-    if (workgroup_size <= 256) {
-      gsize[0] = 16;
-      gsize[1] = workgroup_size / 16;
-    } else if (workgroup_size <= 1024) {
-      gsize[0] = workgroup_size / 16;
-      gsize[1] = 16;
-    } else {
-      gsize[0] = workgroup_size / 32;
-      gsize[1] = 32;
-    }
-
-    local_work_size[0] = gsize[0];
-    local_work_size[1] = gsize[1];
-
-    w = (image_width + num_pixels_per_work_item - 1) / num_pixels_per_work_item;
-    global_work_size[0] = ((w + gsize[0] - 1) / gsize[0]);
-    global_work_size[1] = ((image_height + gsize[1] - 1) / gsize[1]);
-
-    num_groups = global_work_size[0] * global_work_size[1];
-    global_work_size[0] *= gsize[0];
-    global_work_size[1] *= gsize[1];
-  }
-
-  partial_histogram_buffer =
-      clCreateBuffer(context, CL_MEM_READ_WRITE,
-                     num_groups * 257 * 3 * sizeof(unsigned int), NULL, &err);
-  if (!partial_histogram_buffer || err) {
-    printf("clCreateBuffer() failed. (%d)\n", err);
+  if (partial_histogram_buffer)
+    clReleaseMemObject(partial_histogram_buffer);
+  partial_histogram_buffer = NULL;
+  err = setup_histogram_launch(
+      context, queue, histogram_rgba_fp, histogram_sum_partial_results_fp,
+      input_image_fp32, histogram_buffer, 257 * 3, image_width, image_height,
+      clx::histogram_privatization::shared, clx::histogram_merge::two_pass,
+      groups_done, &partial_histogram_buffer, &num_groups, global_work_size,
+      local_work_size);
+  if (err) {
+    printf("setup_histogram_launch() failed for histogram_rgba_fp kernel. "
+           "(%d)\n",
+           err);
     return EXIT_FAILURE;
   }
 
-  clSetKernelArg(histogram_rgba_fp, 0, sizeof(cl_mem), &input_image_fp32);
-  clSetKernelArg(histogram_rgba_fp, 1, sizeof(int), &num_pixels_per_work_item);
-  clSetKernelArg(histogram_rgba_fp, 2, sizeof(cl_mem),
-                 &partial_histogram_buffer);
-
-  clSetKernelArg(histogram_sum_partial_results_fp, 0, sizeof(cl_mem),
-                 &partial_histogram_buffer);
-  clSetKernelArg(histogram_sum_partial_results_fp, 1, sizeof(int), &num_groups);
-  clSetKernelArg(histogram_sum_partial_results_fp, 2, sizeof(cl_mem),
-                 &histogram_buffer);
-
   // verify that the kernel works correctly.  also acts as a warmup
   err =
       clEnqueueNDRangeKernel(queue, histogram_rgba_fp, 2, NULL,
@@ -548,8 +589,10 @@ int test_histogram(cl_context context, cl_command_queue queue,
     printf("clEnqueueReadBuffer() failed. (%d)\n", err);
     return EXIT_FAILURE;
   }
-  verify_histogram_results("Image Histogram for image type = CL_RGBA, CL_FLOAT",
-                           histogram_results, ref_histogram_results, 257 * 3);
+  if (verify_histogram_results(
+          "Image Histogram for image type = CL_RGBA, CL_FLOAT",
+          histogram_results, ref_histogram_results, 257 * 3))
+    failed = 1;
 
   // now measure performance
   err = clEnqueueMarker(queue, &events[0]);
@@ -622,11 +665,288 @@ int test_histogram(cl_context context, cl_command_queue queue,
 
   clReleaseProgram(program);
   clReleaseMemObject(partial_histogram_buffer);
+  clReleaseMemObject(groups_done);
   clReleaseMemObject(histogram_buffer);
   clReleaseMemObject(input_image_unorm8);
   clReleaseMemObject(input_image_fp32);
 
-  return EXIT_SUCCESS;
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// stream frames images, cycling through a few random ones, into a
+// clx::histogram_stream with a window of window frames. every interval frames
+// the running and window histograms are read without blocking into one of
+// two host copies; a copy is checked against the reference once its read
+// completes, just before it is reused, and at the end.
+int test_histogram_stream(cl_context context, cl_command_queue queue,
+                          cl_device_id device,
+                          clx::histogram_privatization privatization,
+                          int frames, int interval, int window) {
+  const int num_images = 4;
+  const int bins = clx::histogram_stream::bins;
+  int image_width = 1920;
+  int image_height = 1080;
+  cl_image_format image_format;
+  void *image_data[num_images];
+  unsigned int *ref_histogram_results[num_images];
+  cl_mem images[num_images];
+  cl_ulong running[2][bins], windowed[2][bins], expected[2][bins];
+  cl_event reads[2] = {NULL, NULL};
+  int read_frames[2] = {-1, -1};
+  cl_event events[2];
+  cl_ulong time_start, time_end;
+  int i, f, b, err, reads_issued = 0, failed = 0;
+
+  clx::histogram_stream stream(context, device, window, privatization);
+  if (!stream) {
+    printf("histogram_stream() failed. (%d)\n", clx::last_error());
+    if (!stream.build_log().empty())
+      printf("Log:\n%s\n", stream.build_log().c_str());
+    return EXIT_FAILURE;
+  }
+
+  image_format.image_channel_order = CL_RGBA;
+  image_format.image_channel_data_type = CL_UNORM_INT8;
+  for (i = 0; i < num_images; i++) {
+    image_data[i] = create_image_data_unorm8(image_width, image_height);
+    ref_histogram_results[i] =
+        (unsigned int *)generate_reference_histogram_results_unorm8(
+            image_data[i], image_width, image_height);
+    images[i] = clCreateImage2D(
+        context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &image_format,
+        image_width, image_height, 0, image_data[i], &err);
+    if (!images[i] || err) {
+      printf("clCreateImage2D() failed. (%d)\n", err);
+      return EXIT_FAILURE;
+    }
+  }
+
+  // the running and window histograms after the first n frames
+  auto reference = [&](int n, cl_ulong *run, cl_ulong *win) {
+    for (b = 0; b < bins; b++) {
+      run[b] = 0;
+      win[b] = 0;
+    }
+    for (int g = 0; g < n; g++) {
+      for (b = 0; b < bins; b++) {
+        run[b] += ref_histogram_results[g % num_images][b];
+        if (g >= n - window)
+          win[b] += ref_histogram_results[g % num_images][b];
+      }
+    }
+  };
+  // waits for the read, if any, into copy k and checks it
+  auto check = [&](int k) {
+    if (read_frames[k] < 0)
+      return;
+    if (reads[k]) {
+      clWaitForEvents(1, &reads[k]);
+      clReleaseEvent(reads[k]);
+      reads[k] = NULL;
+    }
+    int n = read_frames[k];
+    read_frames[k] = -1;
+    reference(n, expected[0], expected[1]);
+    for (b = 0; b < bins; b++) {
+      if (running[k][b] != expected[0][b] ||
+          (window > 0 && windowed[k][b] != expected[1][b])) {
+        printf("histogram stream: mismatch after %d frames at indx = %d\n",
+               n, b);
+        failed = 1;
+        return;
+      }
+    }
+  };
+
+  err = clEnqueueMarker(queue, &events[0]);
+  if (err) {
+    printf("clEnqeueMarker() failed for histogram stream. (%d)\n", err);
+    return EXIT_FAILURE;
+  }
+  for (f = 0; f < frames; f++) {
+    err = stream.enqueue_frame(queue, images[f % num_images], image_width,
+                               image_height);
+    if (err) {
+      printf("enqueue_frame() failed. (%d)\n", err);
+      return EXIT_FAILURE;
+    }
+    if ((f + 1) % interval == 0) {
+      int k = reads_issued++ % 2;
+      check(k);
+      read_frames[k] = f + 1;
+      err = stream.enqueue_read(queue, running[k], windowed[k], CL_FALSE, 0,
+                                NULL, &reads[k]);
+      if (err) {
+        printf("enqueue_read() failed. (%d)\n", err);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  err = clEnqueueMarker(queue, &events[1]);
+  if (err) {
+    printf("clEnqeueMarker() failed for histogram stream. (%d)\n", err);
+    return EXIT_FAILURE;
+  }
+  check(0);
+  check(1);
+
+  // the final state, blocking
+  err = stream.enqueue_read(queue, running[0], windowed[0], CL_TRUE);
+  if (err) {
+    printf("enqueue_read() failed. (%d)\n", err);
+    return EXIT_FAILURE;
+  }
+  read_frames[0] = frames;
+  check(0);
+  if (!failed)
+    printf("Histogram stream of %d frames, window = %d, read every %d "
+           "frames: VERIFIED\n",
+           frames, window, interval);
+
+  err = clGetEventProfilingInfo(events[0], CL_PROFILING_COMMAND_QUEUED,
+                                sizeof(cl_long), &time_start, NULL);
+  err |= clGetEventProfilingInfo(events[1], CL_PROFILING_COMMAND_END,
+                                 sizeof(cl_long), &time_end, NULL);
+  if (!err && frames > 0)
+    printf("Time per streamed frame = %g ms\n",
+           (double)(time_end - time_start) * 1e-9 * 1000.0 / (double)frames);
+  clReleaseEvent(events[0]);
+  clReleaseEvent(events[1]);
+
+  for (i = 0; i < num_images; i++) {
+    clReleaseMemObject(images[i]);
+    free(image_data[i]);
+    free(ref_histogram_results[i]);
+  }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// fill w x h pixels of config's channels samples each with random data: the
+// full range of integer samples, and [-0.05, 1.05] for float samples, so
+// that some fall outside the default [0, 1] range
+static void *create_image_data_generic(const clx::histogram_config &config,
+                                       int w, int h) {
+  size_t n = (size_t)w * h * config.channels;
+  void *p = malloc(n * clx::sample_size(config.sample));
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    switch (config.sample) {
+    case clx::histogram_sample::u8:
+      ((unsigned char *)p)[i] = (unsigned char)(rand() & 0xFF);
+      break;
+    case clx::histogram_sample::u16:
+      ((unsigned short *)p)[i] =
+          (unsigned short)(rand() & (int)config.range_max);
+      break;
+    case clx::histogram_sample::f32:
+      ((float *)p)[i] = (float)rand() / (float)RAND_MAX * 1.1f - 0.05f;
+      break;
+    }
+  }
+  return p;
+}
+
+// histogram an image of config's samples with clx::histogram_engine, in local
+// memory when the histogram fits and always in global memory, checking each
+// against the host reference and timing it
+int test_histogram_generic(cl_context context, cl_command_queue queue,
+                           cl_device_id device,
+                           const clx::histogram_config &config) {
+  int image_width = 1920;
+  int image_height = 1080;
+  size_t num_pixels = (size_t)image_width * image_height;
+  size_t num_entries = config.total_bins();
+  int iterations = num_iterations / 10;
+  cl_event events[2];
+  cl_ulong time_start, time_end;
+  char str[256];
+  int i, err, failed = 0;
+
+  clx::histogram_engine engine(context, device);
+  void *image_data = create_image_data_generic(config, image_width,
+                                               image_height);
+  std::vector<cl_uint> ref_histogram_results =
+      clx::host::histogram(config, image_data, num_pixels);
+  std::vector<cl_uint> histogram_results(num_entries);
+
+  cl_mem samples = clCreateBuffer(
+      context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+      num_pixels * config.channels * clx::sample_size(config.sample),
+      image_data, &err);
+  if (!samples || err) {
+    printf("clCreateBuffer() failed. (%d)\n", err);
+    return EXIT_FAILURE;
+  }
+  cl_mem histogram_buffer =
+      clCreateBuffer(context, CL_MEM_READ_WRITE,
+                     num_entries * sizeof(cl_uint), NULL, &err);
+  if (!histogram_buffer || err) {
+    printf("clCreateBuffer() failed. (%d)\n", err);
+    return EXIT_FAILURE;
+  }
+
+  for (auto storage :
+       {clx::histogram_storage::local, clx::histogram_storage::global}) {
+    if (storage == clx::histogram_storage::local &&
+        engine.storage_for(config) != storage) {
+      printf("Skipping local storage: %d bins do not fit in local memory\n",
+             (int)num_entries);
+      continue;
+    }
+    snprintf(str, sizeof(str), "Generic histogram, %d channels x %d bins, %s",
+             config.channels, config.bins, clx::to_string(storage));
+
+    // verify that the kernels work correctly.  also acts as a warmup
+    err = engine.enqueue(queue, config, samples, num_pixels,
+                         histogram_buffer, storage);
+    if (err) {
+      printf("histogram_engine::enqueue() failed. (%d)\n", err);
+      if (!engine.build_log().empty())
+        printf("Log:\n%s\n", engine.build_log().c_str());
+      return EXIT_FAILURE;
+    }
+    err = clEnqueueReadBuffer(queue, histogram_buffer, CL_TRUE, 0,
+                              num_entries * sizeof(cl_uint),
+                              histogram_results.data(), 0, NULL, NULL);
+    if (err) {
+      printf("clEnqueueReadBuffer() failed. (%d)\n", err);
+      return EXIT_FAILURE;
+    }
+    if (verify_histogram_results(str, histogram_results.data(),
+                                 ref_histogram_results.data(),
+                                 (int)num_entries))
+      failed = 1;
+
+    // now measure performance
+    err = clEnqueueMarker(queue, &events[0]);
+    for (i = 0; i < iterations && !err; i++)
+      err = engine.enqueue(queue, config, samples, num_pixels,
+                           histogram_buffer, storage);
+    if (!err)
+      err = clEnqueueMarker(queue, &events[1]);
+    if (!err)
+      err = clWaitForEvents(1, &events[1]);
+    if (err) {
+      printf("timing the generic histogram failed. (%d)\n", err);
+      return EXIT_FAILURE;
+    }
+    err = clGetEventProfilingInfo(events[0], CL_PROFILING_COMMAND_QUEUED,
+                                  sizeof(cl_long), &time_start, NULL);
+    err |= clGetEventProfilingInfo(events[1], CL_PROFILING_COMMAND_END,
+                                   sizeof(cl_long), &time_end, NULL);
+    if (!err)
+      printf("Time to compute histogram = %g ms\n",
+             (double)(time_end - time_start) * 1e-9 * 1000.0 /
+                 (double)iterations);
+    clReleaseEvent(events[0]);
+    clReleaseEvent(events[1]);
+  }
+
+  clReleaseMemObject(samples);
+  clReleaseMemObject(histogram_buffer);
+  free(image_data);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 int main(int argc, char **argv) {
@@ -635,6 +955,76 @@ int main(int argc, char **argv) {
   cl_command_queue queue;
   int err;
   cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+  clx::histogram_privatization privatization =
+      clx::histogram_privatization::automatic;
+  clx::histogram_merge merge = clx::histogram_merge::two_pass;
+  int frames = 0, interval = 30, window = 0;
+  int bins = 0, channels = 3;
+  const char *depth = "8";
+  clx::histogram_config config;
+
+  // --privatization shared|sub_group|lane|auto picks how work-items share
+  // the local histogram, --merge two_pass|atomic|last_group how the
+  // work-groups' histograms are combined. --frames n streams n frames into a
+  // running histogram, read back every --interval frames, with a sliding
+  // --window of the last frames. --bins n histograms --channels c samples
+  // per pixel of --depth 8|10|12|16|f32 with the generic engine. --device
+  // cpu|gpu picks the device type, gpu by default
+  for (int a = 1; a < argc; a += 2) {
+    if (a + 1 < argc && strcmp(argv[a], "--privatization") == 0) {
+      auto p = clx::parse_histogram_privatization(argv[a + 1]);
+      if (!p) {
+        printf("unknown privatization %s\n", argv[a + 1]);
+        return EXIT_FAILURE;
+      }
+      privatization = *p;
+    } else if (a + 1 < argc && strcmp(argv[a], "--merge") == 0) {
+      auto m = clx::parse_histogram_merge(argv[a + 1]);
+      if (!m) {
+        printf("unknown merge %s\n", argv[a + 1]);
+        return EXIT_FAILURE;
+      }
+      merge = *m;
+    } else if (a + 1 < argc && strcmp(argv[a], "--frames") == 0) {
+      frames = atoi(argv[a + 1]);
+    } else if (a + 1 < argc && strcmp(argv[a], "--interval") == 0) {
+      interval = atoi(argv[a + 1]) > 0 ? atoi(argv[a + 1]) : 1;
+    } else if (a + 1 < argc && strcmp(argv[a], "--window") == 0) {
+      window = atoi(argv[a + 1]) > 0 ? atoi(argv[a + 1]) : 0;
+    } else if (a + 1 < argc && strcmp(argv[a], "--bins") == 0) {
+      bins = atoi(argv[a + 1]);
+    } else if (a + 1 < argc && strcmp(argv[a], "--channels") == 0) {
+      channels = atoi(argv[a + 1]);
+    } else if (a + 1 < argc && strcmp(argv[a], "--depth") == 0) {
+      depth = argv[a + 1];
+    } else if (a + 1 < argc && strcmp(argv[a], "--device") == 0 &&
+               (strcmp(argv[a + 1], "cpu") == 0 ||
+                strcmp(argv[a + 1], "gpu") == 0)) {
+      device_type = strcmp(argv[a + 1], "cpu") == 0 ? CL_DEVICE_TYPE_CPU
+                                                     : CL_DEVICE_TYPE_GPU;
+    } else {
+      printf("usage: %s [--privatization shared|sub_group|lane|auto] "
+             "[--merge two_pass|atomic|last_group] [--frames n] "
+             "[--interval n] [--window n] [--bins n] [--channels c] "
+             "[--depth 8|10|12|16|f32] [--device cpu|gpu]\n",
+             argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (bins > 0) {
+    if (strcmp(depth, "f32") == 0)
+      config = {clx::histogram_sample::f32, channels, bins, 0.0, 1.0};
+    else if (atoi(depth) >= 1)
+      config = clx::histogram_config_for_depth(channels, bins, atoi(depth));
+    else
+      config.bins = 0;
+    if (!clx::valid(config)) {
+      printf("unsupported histogram: %d channels, %d bins, depth %s\n",
+             channels, bins, depth);
+      return EXIT_FAILURE;
+    }
+  }
 
 #if (__APPLE__) || defined(__MACOSX)
   cl_platform_id platform = NULL;
@@ -648,6 +1038,11 @@ int main(int argc, char **argv) {
 #endif
 
   err = clGetDeviceIDs(platform, device_type, 1, &device, NULL);
+  if (err == CL_DEVICE_NOT_FOUND) {
+    printf("Skipping: no %s device\n",
+           device_type == CL_DEVICE_TYPE_CPU ? "cpu" : "gpu");
+    return EXIT_SKIP;
+  }
   if (err != CL_SUCCESS) {
     printf("clGetDeviceIDs() failed. (%d)\n", err);
     return EXIT_FAILURE;
@@ -686,7 +1081,7 @@ int main(int argc, char **argv) {
   if (!strstr(ext_string, "cl_khr_local_int32_base_atomics")) {
     free(ext_string);
     printf("Skipping: histogram requires local atomics support\n");
-    return EXIT_SUCCESS;
+    return EXIT_SKIP;
   }
   free(ext_string);
 
@@ -703,7 +1098,16 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
-  if (test_histogram(context, queue, device) == EXIT_FAILURE)
+  if (bins > 0) {
+    if (test_histogram_generic(context, queue, device, config) ==
+        EXIT_FAILURE)
+      return EXIT_FAILURE;
+  } else if (frames > 0) {
+    if (test_histogram_stream(context, queue, device, privatization, frames,
+                              interval, window) == EXIT_FAILURE)
+      return EXIT_FAILURE;
+  } else if (test_histogram(context, queue, device, privatization, merge) ==
+             EXIT_FAILURE)
     return EXIT_FAILURE;
 
   clReleaseCommandQueue(queue);
@@ -0,0 +1,170 @@
+#pragma OPENCL EXTENSION cl_khr_local_int32_base_atomics : enable
+
+//
+// histograms of pixels of CHANNELS interleaved samples into BINS bins per channel. the host
+// specializes the program per configuration with -D:
+//
+//   SAMPLE_T                 uchar, ushort or float
+//   CHANNELS                 samples per pixel, 1 to 4
+//   BINS                     bins per channel
+//   RANGE_MIN, RANGE_MAX     integer samples: the inclusive range of values spread evenly over
+//                            the bins
+//   FLOAT_SAMPLES,
+//   RANGE_MIN, RANGE_SCALE   float samples: bin = (v - RANGE_MIN) * RANGE_SCALE
+//
+// samples outside the range count in the first or last bin. histograms are channel-major,
+// CHANNELS * BINS counts.
+//
+
+#ifndef SAMPLE_T
+#define SAMPLE_T uchar
+#endif
+#ifndef CHANNELS
+#define CHANNELS 1
+#endif
+#ifndef BINS
+#define BINS 256
+#endif
+#ifndef RANGE_MIN
+#define RANGE_MIN 0
+#endif
+#ifndef RANGE_MAX
+#define RANGE_MAX 255
+#endif
+
+#define TOTAL_BINS (CHANNELS * BINS)
+
+uint histogram_bin(SAMPLE_T v)
+{
+#ifdef FLOAT_SAMPLES
+    // fmax first, so that NaN lands in bin 0
+    float   f = fmin(fmax(((float)v - RANGE_MIN) * RANGE_SCALE, 0.0f), (float)(BINS - 1));
+    return (uint)f;
+#else
+    uint    u = (uint)(clamp((int)v, RANGE_MIN, RANGE_MAX) - RANGE_MIN);
+    return u * (uint)BINS / (uint)(RANGE_MAX - RANGE_MIN + 1);
+#endif
+}
+
+uint generic_bin_index(uint bin, int copy, int copies, int interleaved)
+{
+    return interleaved ? bin * copies + copy : copy * (TOTAL_BINS + 1) + bin;
+}
+
+//
+// one local histogram per work-group, in copies laid out as by histogram_image_rgba_unorm8_private,
+// added to histogram with global atomics once the group is done; histogram must be zeroed
+// before the launch. work-items stride over the pixels by the global size, so a few work-groups
+// per compute unit cover any image.
+//
+kernel
+void histogram_generic_local(global const SAMPLE_T *samples, uint num_pixels, global uint *histogram,
+                             local uint *tmp_histogram, int copies, int interleaved)
+{
+    int     local_size = (int)get_local_size(0);
+    int     tid = (int)get_local_id(0);
+    int     entries = copies * (interleaved ? TOTAL_BINS : TOTAL_BINS + 1);
+    int     copy = interleaved ? tid % copies : tid / ((local_size + copies - 1) / copies);
+    int     i, c;
+
+    for (i = tid; i < entries; i += local_size)
+        tmp_histogram[i] = 0;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // runs of equal bins per channel are added at once
+    uint    run_bin[CHANNELS];
+    uint    run_count[CHANNELS];
+    for (c = 0; c < CHANNELS; c++)
+    {
+        run_bin[c] = c * BINS;
+        run_count[c] = 0;
+    }
+    for (uint p = get_global_id(0); p < num_pixels; p += get_global_size(0))
+    {
+        for (c = 0; c < CHANNELS; c++)
+        {
+            uint    bin = c * BINS + histogram_bin(samples[p * CHANNELS + c]);
+            if (bin != run_bin[c])
+            {
+                if (run_count[c])
+                    atom_add(&tmp_histogram[generic_bin_index(run_bin[c], copy, copies, interleaved)], run_count[c]);
+                run_bin[c] = bin;
+                run_count[c] = 0;
+            }
+            run_count[c]++;
+        }
+    }
+    for (c = 0; c < CHANNELS; c++)
+    {
+        if (run_count[c])
+            atom_add(&tmp_histogram[generic_bin_index(run_bin[c], copy, copies, interleaved)], run_count[c]);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (i = tid; i < TOTAL_BINS; i += local_size)
+    {
+        uint    sum = 0;
+        for (c = 0; c < copies; c++)
+            sum += tmp_histogram[generic_bin_index(i, c, copies, interleaved)];
+        if (sum)
+            atomic_add(&histogram[i], sum);
+    }
+}
+
+//
+// for histograms too large for local memory: copies histograms in global memory, work-group g
+// adding to copy g % copies, so that fewer work-items contend for each bin than with a single
+// copy. copies_histogram holds copies * TOTAL_BINS counts, zeroed before the launch;
+// histogram_generic_reduce then sums the copies.
+//
+kernel
+void histogram_generic_global(global const SAMPLE_T *samples, uint num_pixels, global uint *copies_histogram,
+                              int copies)
+{
+    global uint *h = copies_histogram + (get_group_id(0) % copies) * TOTAL_BINS;
+    int     c;
+
+    uint    run_bin[CHANNELS];
+    uint    run_count[CHANNELS];
+    for (c = 0; c < CHANNELS; c++)
+    {
+        run_bin[c] = c * BINS;
+        run_count[c] = 0;
+    }
+    for (uint p = get_global_id(0); p < num_pixels; p += get_global_size(0))
+    {
+        for (c = 0; c < CHANNELS; c++)
+        {
+            uint    bin = c * BINS + histogram_bin(samples[p * CHANNELS + c]);
+            if (bin != run_bin[c])
+            {
+                if (run_count[c])
+                    atomic_add(&h[run_bin[c]], run_count[c]);
+                run_bin[c] = bin;
+                run_count[c] = 0;
+            }
+            run_count[c]++;
+        }
+    }
+    for (c = 0; c < CHANNELS; c++)
+    {
+        if (run_count[c])
+            atomic_add(&h[run_bin[c]], run_count[c]);
+    }
+}
+
+kernel
+void histogram_generic_reduce(global const uint *copies_histogram, int copies, global uint *histogram)
+{
+    int     i = get_global_id(0);
+
+    if (i >= TOTAL_BINS)
+        return;
+
+    uint    sum = 0;
+    for (int c = 0; c < copies; c++)
+        sum += copies_histogram[c * TOTAL_BINS + i];
+    histogram[i] = sum;
+}
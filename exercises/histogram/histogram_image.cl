@@ -48,9 +48,10 @@ void histogram_sum_partial_results_fp(global uint *partial_histogram, int num_gr
 // the kernel is executed over multiple work-groups.  for each work-group a partial histogram is generated
 // partial_histogram is an array of num_groups * (257 * 3 * 32-bits/entry) entries
 // we store 257 Red bins, followed by 257 Green bins and then the 257 Blue bins.
+// tmp_histogram is the work-group's local copy, 257 * 3 entries set by the host.
 //
 kernel
-void histogram_image_rgba_fp(image2d_t img, int num_pixels_per_workitem, global uint *histogram)
+void histogram_image_rgba_fp(image2d_t img, int num_pixels_per_workitem, global uint *histogram, local uint *tmp_histogram)
 {
     int     local_size = (int)get_local_size(0) * (int)get_local_size(1);
     int     image_width = get_image_width(img);
@@ -59,8 +60,6 @@ void histogram_image_rgba_fp(image2d_t img, int num_pixels_per_workitem, global
     int     x = get_global_id(0);
     int     y = get_global_id(1);
     
-    local uint  tmp_histogram[257 * 3];
-        
     int     tid = mad24(get_local_id(1), get_local_size(0), get_local_id(0));
     int     j = 257 * 3;
     int     indx = 0;
@@ -156,9 +155,10 @@ void histogram_sum_partial_results_unorm8(global uint *partial_histogram, int nu
 // the kernel is executed over multiple work-groups.  for each work-group a partial histogram is generated
 // partial_histogram is an array of num_groups * (256 * 3 * 32-bits/entry) entries
 // we store 256 Red bins, followed by 256 Green bins and then the 256 Blue bins.
+// tmp_histogram is the work-group's local copy, 256 * 3 entries set by the host.
 //
 kernel
-void histogram_image_rgba_unorm8(image2d_t img, int num_pixels_per_workitem, global uint *histogram)
+void histogram_image_rgba_unorm8(image2d_t img, int num_pixels_per_workitem, global uint *histogram, local uint *tmp_histogram)
 {
     int     local_size = (int)get_local_size(0) * (int)get_local_size(1);
     int     image_width = get_image_width(img);
@@ -167,8 +167,6 @@ void histogram_image_rgba_unorm8(image2d_t img, int num_pixels_per_workitem, glo
     int     x = get_global_id(0);
     int     y = get_global_id(1);
     
-    local uint  tmp_histogram[256 * 3];
-        
     int     tid = mad24(get_local_id(1), get_local_size(0), get_local_id(0));
     int     j = 256 * 3;
     int     indx = 0;
@@ -225,3 +223,205 @@ void histogram_image_rgba_unorm8(image2d_t img, int num_pixels_per_workitem, glo
     }
 }
 
+
+/***************************************************************************************************************/
+
+//
+// histogram_image_rgba_unorm8 with the work-group's local histogram replicated copies times, so
+// fewer work-items contend for each bin, and with runs of equal bins counted in registers and
+// committed with one atom_add, so flat images do not serialize on a single bin.
+//
+// interleaved = 0: work-items are split into copies consecutive blocks (sub-groups), each with
+//                  its own 256 * 3 bins; copies are 256 * 3 + 1 entries apart, so the same bin of
+//                  neighbouring copies falls in different local memory banks.
+// interleaved = 1: work-item tid uses copy tid % copies and bin b of it is at b * copies + copy,
+//                  so neighbouring lanes hitting the same bin hit different banks.
+//
+// tmp_histogram holds copies * (256 * 3 + 1) entries, or copies * 256 * 3 when interleaved.
+// the partial histograms are merged over the copies and written as histogram_image_rgba_unorm8
+// writes them, for histogram_sum_partial_results_unorm8.
+//
+uint private_bin_index(uint bin, int copy, int copies, int interleaved)
+{
+    return interleaved ? bin * copies + copy : copy * (256 * 3 + 1) + bin;
+}
+
+//
+// clear the work-group's copies, add the work-item's pixels to its copy and wait for the whole
+// group; bin i of the group is then merged_bin_unorm8(i).
+//
+void accumulate_unorm8_private(image2d_t img, int num_pixels_per_workitem, local uint *tmp_histogram,
+                               int copies, int interleaved)
+{
+    int     local_size = (int)get_local_size(0) * (int)get_local_size(1);
+    int     image_width = get_image_width(img);
+    int     image_height = get_image_height(img);
+    int     x = get_global_id(0);
+    int     y = get_global_id(1);
+
+    int     tid = mad24(get_local_id(1), get_local_size(0), get_local_id(0));
+    int     entries = copies * (interleaved ? 256 * 3 : 256 * 3 + 1);
+    int     copy = interleaved ? tid % copies : tid / ((local_size + copies - 1) / copies);
+    int     i, idx;
+
+    // clear the local buffer that will generate the partial histograms
+    for (i = tid; i < entries; i += local_size)
+        tmp_histogram[i] = 0;
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // the current run of equal bins per channel
+    uint    run_bin[3] = { 0, 256, 512 };
+    uint    run_count[3] = { 0, 0, 0 };
+    for (i=0, idx=x; i<num_pixels_per_workitem; i++, idx+=get_global_size(0))
+    {
+        if ((idx < image_width) && (y < image_height))
+        {
+            float4 clr = read_imagef(img, CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST, (float2)(idx, y));
+
+            uint    bins[3];
+            bins[0] = convert_uchar_sat(clr.x * 255.0f);
+            bins[1] = 256 + (uint)convert_uchar_sat(clr.y * 255.0f);
+            bins[2] = 512 + (uint)convert_uchar_sat(clr.z * 255.0f);
+            for (int c = 0; c < 3; c++)
+            {
+                if (bins[c] != run_bin[c])
+                {
+                    if (run_count[c])
+                        atom_add(&tmp_histogram[private_bin_index(run_bin[c], copy, copies, interleaved)], run_count[c]);
+                    run_bin[c] = bins[c];
+                    run_count[c] = 0;
+                }
+                run_count[c]++;
+            }
+        }
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        if (run_count[c])
+            atom_add(&tmp_histogram[private_bin_index(run_bin[c], copy, copies, interleaved)], run_count[c]);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+uint merged_bin_unorm8(local uint *tmp_histogram, int bin, int copies, int interleaved)
+{
+    uint    sum = 0;
+    for (int c = 0; c < copies; c++)
+        sum += tmp_histogram[private_bin_index(bin, c, copies, interleaved)];
+    return sum;
+}
+
+kernel
+void histogram_image_rgba_unorm8_private(image2d_t img, int num_pixels_per_workitem, global uint *histogram, local uint *tmp_histogram,
+                                         int copies, int interleaved)
+{
+    int     local_size = (int)get_local_size(0) * (int)get_local_size(1);
+    int     group_indx = mad24(get_group_id(1), get_num_groups(0), get_group_id(0)) * 256 * 3;
+    int     tid = mad24(get_local_id(1), get_local_size(0), get_local_id(0));
+
+    accumulate_unorm8_private(img, num_pixels_per_workitem, tmp_histogram, copies, interleaved);
+
+    // merge the copies into the work-group's partial histogram
+    for (int i = tid; i < 256 * 3; i += local_size)
+        histogram[group_indx + i] = merged_bin_unorm8(tmp_histogram, i, copies, interleaved);
+}
+
+/***************************************************************************************************************/
+
+//
+// single-launch variants of histogram_image_rgba_unorm8_private, with no separate summing kernel.
+//
+// histogram_image_rgba_unorm8_atomic adds each work-group's non-zero bins straight into the final
+// 256 * 3 histogram with global atomics; histogram must be zeroed before the launch. there is no
+// partial histogram buffer.
+//
+kernel
+void histogram_image_rgba_unorm8_atomic(image2d_t img, int num_pixels_per_workitem, global uint *histogram, local uint *tmp_histogram,
+                                        int copies, int interleaved)
+{
+    int     local_size = (int)get_local_size(0) * (int)get_local_size(1);
+    int     tid = mad24(get_local_id(1), get_local_size(0), get_local_id(0));
+
+    accumulate_unorm8_private(img, num_pixels_per_workitem, tmp_histogram, copies, interleaved);
+
+    for (int i = tid; i < 256 * 3; i += local_size)
+    {
+        uint    count = merged_bin_unorm8(tmp_histogram, i, copies, interleaved);
+        if (count)
+            atomic_add(&histogram[i], count);
+    }
+}
+
+//
+// histogram_image_rgba_unorm8_last_group writes the partial histograms as the two-kernel path
+// does, and the last work-group to finish, found by counting finished groups in groups_done,
+// sums them into histogram and resets the counter for the next launch. partials are written
+// and read with atomics, which unlike plain stores are visible across work-groups.
+//
+kernel
+void histogram_image_rgba_unorm8_last_group(image2d_t img, int num_pixels_per_workitem, global uint *partial_histogram,
+                                            local uint *tmp_histogram, int copies, int interleaved,
+                                            global uint *histogram, global uint *groups_done)
+{
+    local int is_last;
+    int     local_size = (int)get_local_size(0) * (int)get_local_size(1);
+    int     num_groups = get_num_groups(0) * get_num_groups(1);
+    int     group_indx = mad24(get_group_id(1), get_num_groups(0), get_group_id(0)) * 256 * 3;
+    int     tid = mad24(get_local_id(1), get_local_size(0), get_local_id(0));
+    int     i;
+
+    accumulate_unorm8_private(img, num_pixels_per_workitem, tmp_histogram, copies, interleaved);
+
+    for (i = tid; i < 256 * 3; i += local_size)
+        atomic_xchg(&partial_histogram[group_indx + i], merged_bin_unorm8(tmp_histogram, i, copies, interleaved));
+
+    barrier(CLK_GLOBAL_MEM_FENCE);
+    if (tid == 0)
+        is_last = atomic_inc(groups_done) == num_groups - 1;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (is_last)
+    {
+        for (i = tid; i < 256 * 3; i += local_size)
+        {
+            uint    sum = 0;
+            for (int g = 0; g < num_groups; g++)
+                sum += atomic_or(&partial_histogram[g * 256 * 3 + i], 0);
+            histogram[i] = sum;
+        }
+        if (tid == 0)
+            *groups_done = 0;
+    }
+}
+
+/***************************************************************************************************************/
+
+//
+// add one frame's 256 * 3 histogram to the running histogram of a stream, and clear the frame's
+// histogram for the next frame's histogram_image_rgba_unorm8_atomic.
+//
+// with window_frames > 0, ring holds the histograms of the last window_frames frames, slot being
+// the oldest, which the frame replaces; window, the sum of the ring, loses the oldest frame and
+// gains the new one. running and window are 64-bit so they do not wrap over long streams.
+//
+kernel
+void histogram_accumulate_unorm8(global uint *frame, global ulong *running, global uint *ring, int slot, int window_frames,
+                                 global ulong *window)
+{
+    int     i = get_global_id(0);
+
+    if (i >= 256 * 3)
+        return;
+
+    uint    count = frame[i];
+    frame[i] = 0;
+    running[i] += count;
+    if (window_frames > 0)
+    {
+        global uint *oldest = ring + slot * 256 * 3 + i;
+        window[i] = window[i] - *oldest + count;
+        *oldest = count;
+    }
+}
@@ -1,9 +1,9 @@
 #include <iostream>
-#include <sstream>
 #include <vector>
 #include <fmt/format.h>
 
 #include "cl/clx.hpp"
+#include "cl/host.hpp"
 #include "cl/kernels.hpp"
 
 #define BUFFER_SIZE 20
@@ -11,6 +11,13 @@ int A[BUFFER_SIZE];
 int B[BUFFER_SIZE];
 int C[BUFFER_SIZE];
 
+void print_result(int const *c) {
+  for (int i = 0; i < BUFFER_SIZE; i++) {
+    std::cout << c[i] << " ";
+  }
+  std::cout << "\n";
+}
+
 int _main() {
 
   // init A, B, C
@@ -20,91 +27,99 @@ int _main() {
     C[i] = 0;
   }
 
-  // 1. select platforms.
-  std::vector<cl::Platform> platforms = clx::get_platforms();
-  if (platforms.size() == 0) {
-    std::cout << "no platforms found.\n";
+  // 1. select a platform with a GPU, or add on the host without one.
+  cl_platform_id platform = nullptr;
+  std::vector<cl_device_id> devices;
+  for (auto const &p : clx::get_platform_ids()) {
+    devices = clx::get_device_ids(p, CL_DEVICE_TYPE_GPU);
+    if (!devices.empty()) {
+      platform = p;
+      break;
+    }
+  }
+  if (devices.empty()) {
+    std::cout << "no GPU found, adding on the host.\n";
+    clx::host::vadd(A, B, C, BUFFER_SIZE);
+    print_result(C);
+    return 0;
   }
-
-  cl_context_properties properties[] = {
-      CL_CONTEXT_PLATFORM, (cl_context_properties)(platforms[0]()), 0};
 
   // 2. create a context.
-  cl::Context context(CL_DEVICE_TYPE_GPU, properties);
+  cl_context context = clx::create_context(platform, devices);
+  if (!context) {
+    return -1;
+  }
 
   // 3. query devices.
-  std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
   for (auto &dev : devices) {
+    fmt::print("device: {}\n", clx::get_device_info_name(dev));
   }
 
   // 4. create command queue
-  cl::CommandQueue queue(context, devices[0], 0);
+  cl_command_queue queue = clx::create_command_queue(context, devices[0], 0);
 
   // 5. program object creation and build
-  cl::Program::Sources sources(1, std::make_pair(clx::kernel::adder2, 0));
-
-  cl::Program program(context, sources);
-
-  try {
-    program.build(devices);
-  } catch (cl::Error &e) {
+  cl_program program =
+      clx::create_program_with_source(context, clx::kernel::adder2.text);
+  if (!clx::build_program(program, devices)) {
     for (auto &dev : devices) {
       // Check the build status
-      cl_build_status status =
-          program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(dev);
-      if (status != CL_BUILD_ERROR)
+      if (clx::get_program_build_info_status(program, dev) != CL_BUILD_ERROR)
         continue;
 
       // Get the build log
-      std::string name = dev.getInfo<CL_DEVICE_NAME>();
-      std::string buildlog = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(dev);
-      std::cerr << "Build log for " << name << ":" << std::endl
-                << buildlog << std::endl;
+      std::cerr << "Build log for " << clx::get_device_info_name(dev) << ":"
+                << std::endl
+                << clx::get_program_build_info_log(program, dev) << std::endl;
     }
+    return -1;
   }
 
   // 6. kernel & memory creation
-  cl::Buffer aBuffer =
-      cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                 BUFFER_SIZE * sizeof(int), (void *)&A[0]);
-  cl::Buffer bBuffer =
-      cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                 BUFFER_SIZE * sizeof(int), (void *)&B[0]);
-
-  cl::Buffer cBuffer =
-      cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                 BUFFER_SIZE * sizeof(int), (void *)&C[0]);
-
-  cl::Kernel kernel(program, "vadd");
-  kernel.setArg(0, aBuffer);
-  kernel.setArg(1, bBuffer);
-  kernel.setArg(2, cBuffer);
+  cl_mem aBuffer =
+      clx::create_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                         BUFFER_SIZE * sizeof(int), (void *)&A[0]);
+  cl_mem bBuffer =
+      clx::create_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                         BUFFER_SIZE * sizeof(int), (void *)&B[0]);
+
+  cl_mem cBuffer =
+      clx::create_buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR,
+                         BUFFER_SIZE * sizeof(int), (void *)&C[0]);
+
+  cl_kernel kernel = clx::create_kernel(program, "vadd");
+  clx::set_arguments(kernel, aBuffer, bBuffer, cBuffer);
 
   // operations..
-  queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(BUFFER_SIZE),
-                             cl::NullRange);
+  size_t global[1] = {BUFFER_SIZE};
+  clx::enqueue_nd_ranage_kernel(queue, kernel, 1, nullptr, global, nullptr);
 
   // kenerl won't be  not executed right now, so to block operations, just map
   // the the output to the host memory.
-  int *output = (int *)queue.enqueueMapBuffer(
-      cBuffer, CL_TRUE /* block */, CL_MAP_READ, 0, BUFFER_SIZE * sizeof(int));
-
-  for (int i = 0; i < BUFFER_SIZE; i++) {
-    std::cout << C[i] << " ";
+  int *output = (int *)clx::enqueue_map_buffer(
+      queue, cBuffer, CL_TRUE /* block */, CL_MAP_READ, 0,
+      BUFFER_SIZE * sizeof(int));
+  if (output) {
+    print_result(output);
+    clx::enqueue_unmap_mem_object(queue, cBuffer, output);
+    clx::finish(queue);
   }
-  std::cout << "\n";
-
-  auto res = queue.enqueueUnmapMemObject(cBuffer, (void *)output);
 
-  return 0;
+  clReleaseKernel(kernel);
+  clReleaseMemObject(aBuffer);
+  clReleaseMemObject(bBuffer);
+  clReleaseMemObject(cBuffer);
+  clReleaseProgram(program);
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+  return clx::last_error() == CL_SUCCESS ? 0 : -1;
 }
 
 int main() {
-  try {
-    return _main();
-  } catch (cl::Error &err) {
-    std::cerr << "ERROR: " << err.what() << "(" << err.err() << ")"
-              << std::endl;
+  auto res = _main();
+  if (res != 0 && clx::last_error() != CL_SUCCESS) {
+    std::cerr << "ERROR: " << clx::last_error_func() << "("
+              << clx::last_error() << ")" << std::endl;
   }
-  return -1;
+  return res;
 }
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+#include "clx.hpp"
+#include "json.hpp"
+
+namespace clx {
+
+// enqueues one repetition of a benchmark on the queue, appending an event for
+// every command; the repetition takes from the first START to the last END.
+using bench_body = std::function<cl_int(std::vector<cl_event> &)>;
+
+struct bench_options {
+  int warmup = 2;
+  int reps = 20;
+};
+
+struct bench_result {
+  std::string name;
+  std::size_t size = 0;  // problem size, in elements or pixels
+  std::size_t bytes = 0; // device memory read and written per repetition
+  std::vector<double> samples; // ms, sorted
+  double min = 0;
+  double p50 = 0;
+  double p95 = 0;
+  double p99 = 0;
+  double gb_per_s = 0; // at p50
+  cl_int err = CL_SUCCESS;
+};
+
+// nearest-rank percentile of sorted samples.
+inline auto percentile(std::vector<double> const &sorted, double p) -> double {
+  if (sorted.empty()) {
+    return 0;
+  }
+  auto rank = static_cast<std::size_t>(std::ceil(p / 100 * sorted.size()));
+  return sorted[std::min(std::max<std::size_t>(rank, 1), sorted.size()) - 1];
+}
+
+namespace detail {
+
+inline auto release_events(std::vector<cl_event> &events) -> void {
+  for (auto e : events) {
+    clReleaseEvent(e);
+  }
+  events.clear();
+}
+
+} // namespace detail
+
+// times body on q, which needs CL_QUEUE_PROFILING_ENABLE. a failed repetition
+// ends the run and is reported in err.
+inline auto run_bench(cl_command_queue q, std::string name, std::size_t size,
+                      std::size_t bytes, bench_body const &body,
+                      bench_options const &options = {}) -> bench_result {
+  auto r = bench_result{};
+  r.name = std::move(name);
+  r.size = size;
+  r.bytes = bytes;
+  auto events = std::vector<cl_event>{};
+  for (auto i = 0; i < options.warmup + options.reps; i++) {
+    r.err = body(events);
+    if (r.err == CL_SUCCESS && events.empty()) {
+      r.err = CL_INVALID_EVENT;
+    }
+    if (r.err == CL_SUCCESS) {
+      r.err = clWaitForEvents(events.size(), events.data());
+    }
+    if (r.err != CL_SUCCESS) {
+      set_err_if_err(r.err, "run_bench");
+      clFinish(q);
+      detail::release_events(events);
+      break;
+    }
+    if (i >= options.warmup) {
+      auto start = get_event_profiling_info(events.front(),
+                                            CL_PROFILING_COMMAND_START);
+      auto end =
+          get_event_profiling_info(events.back(), CL_PROFILING_COMMAND_END);
+      r.samples.push_back(end > start ? (end - start) * 1e-6 : 0.0);
+    }
+    detail::release_events(events);
+  }
+
+  std::sort(std::begin(r.samples), std::end(r.samples));
+  if (!r.samples.empty()) {
+    r.min = r.samples.front();
+    r.p50 = percentile(r.samples, 50);
+    r.p95 = percentile(r.samples, 95);
+    r.p99 = percentile(r.samples, 99);
+    r.gb_per_s = r.p50 > 0 ? r.bytes / (r.p50 * 1e-3) / 1e9 : 0;
+  }
+  return r;
+}
+
+namespace detail {
+
+// the value of "key": in a line written by to_json, unquoted.
+inline auto json_field(std::string const &line, std::string const &key)
+    -> std::optional<std::string> {
+  auto pos = line.find('"' + key + "\":");
+  if (pos == std::string::npos) {
+    return std::nullopt;
+  }
+  pos = line.find_first_not_of(' ', pos + key.size() + 3);
+  if (pos == std::string::npos) {
+    return std::nullopt;
+  }
+  if (line[pos] == '"') {
+    auto end = line.find('"', pos + 1);
+    while (end != std::string::npos && line[end - 1] == '\\') {
+      end = line.find('"', end + 1);
+    }
+    if (end == std::string::npos) {
+      return std::nullopt;
+    }
+    return line.substr(pos + 1, end - pos - 1);
+  }
+  auto end = line.find_first_of(",}", pos);
+  return line.substr(pos, end - pos);
+}
+
+inline auto bench_key(std::string const &name, std::size_t size)
+    -> std::string {
+  return fmt::format("{}/{}", name, size);
+}
+
+} // namespace detail
+
+// one result per line, so a baseline can be read back without a JSON parser.
+inline auto to_json(std::string const &device,
+                    std::vector<bench_result> const &rs) -> std::string {
+  auto out = fmt::format("{{\n  \"device\": \"{}\",\n  \"results\": [\n",
+                         detail::json_escape(device));
+  for (auto i = std::size_t{0}; i < rs.size(); i++) {
+    auto const &r = rs[i];
+    out += fmt::format(
+        "    {{\"name\": \"{}\", \"size\": {}, \"bytes\": {}, \"reps\": {}, "
+        "\"min_ms\": {:.6f}, \"p50_ms\": {:.6f}, \"p95_ms\": {:.6f}, "
+        "\"p99_ms\": {:.6f}, \"gb_per_s\": {:.3f}, \"error\": {}}}{}\n",
+        detail::json_escape(r.name), r.size, r.bytes, r.samples.size(), r.min,
+        r.p50, r.p95, r.p99, r.gb_per_s, r.err,
+        i + 1 < rs.size() ? "," : "");
+  }
+  out += "  ]\n}\n";
+  return out;
+}
+
+// p50 by "name/size" from a file written by to_json; empty when missing.
+inline auto read_bench_baseline(std::string const &path)
+    -> std::map<std::string, double> {
+  auto out = std::map<std::string, double>{};
+  std::ifstream in(path);
+  auto line = std::string{};
+  while (std::getline(in, line)) {
+    auto name = detail::json_field(line, "name");
+    auto size = detail::json_field(line, "size");
+    auto p50 = detail::json_field(line, "p50_ms");
+    auto err = detail::json_field(line, "error");
+    if (!name || !size || !p50 || (err && std::stoi(*err) != CL_SUCCESS)) {
+      continue;
+    }
+    out[detail::bench_key(*name, std::stoull(*size))] = std::stod(*p50);
+  }
+  return out;
+}
+
+struct bench_change {
+  std::string name;
+  std::size_t size = 0;
+  double baseline_ms = 0;
+  double ms = 0;
+
+  // above 1 is slower than the baseline.
+  auto ratio() const -> double {
+    return baseline_ms > 0 ? ms / baseline_ms : 0;
+  }
+};
+
+// results whose p50 is more than threshold (0.1 for 10%) slower than the
+// baseline. results missing from the baseline are not compared.
+inline auto find_regressions(std::vector<bench_result> const &rs,
+                             std::map<std::string, double> const &baseline,
+                             double threshold) -> std::vector<bench_change> {
+  auto out = std::vector<bench_change>{};
+  for (auto const &r : rs) {
+    auto it = baseline.find(detail::bench_key(r.name, r.size));
+    if (it == std::end(baseline) || r.err != CL_SUCCESS) {
+      continue;
+    }
+    auto c = bench_change{r.name, r.size, it->second, r.p50};
+    if (c.ratio() > 1 + threshold) {
+      out.push_back(c);
+    }
+  }
+  return out;
+}
+
+} // namespace clx
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "clx.hpp"
+
+namespace clx {
+
+struct kernel_arg_stats {
+  std::size_t calls = 0;   // clSetKernelArg calls made
+  std::size_t skipped = 0; // binds that matched the argument already set
+};
+
+// A kernel that remembers what is bound to each argument index and only calls
+// clSetKernelArg when the value changes, so launching the same kernel over and
+// over costs no driver calls for the arguments that stay put. cl_mem and other
+// handles are compared by value: when a bound object is released and a new
+// one may reuse its handle, call forget() or invalidate() before binding
+// again. When the program kept argument info (-cl-kernel-arg-info), it is read
+// once and every value that reaches the driver is checked against it.
+class bound_kernel {
+public:
+  bound_kernel() = default;
+
+  // takes ownership of k.
+  explicit bound_kernel(cl_kernel k) : kernel_(k) {
+    if (kernel_) {
+      slots_.resize(get_kernel_info_num_args(kernel_));
+      load_arg_info();
+    }
+  }
+
+  bound_kernel(cl_program const &p, char const *name)
+      : bound_kernel(create_kernel(p, name)) {}
+
+  bound_kernel(bound_kernel const &) = delete;
+  auto operator=(bound_kernel const &) -> bound_kernel & = delete;
+
+  bound_kernel(bound_kernel &&o) noexcept
+      : kernel_(o.kernel_), slots_(std::move(o.slots_)),
+        arg_info_(o.arg_info_), stats_(o.stats_) {
+    o.kernel_ = nullptr;
+  }
+
+  auto operator=(bound_kernel &&o) noexcept -> bound_kernel & {
+    if (this != &o) {
+      reset();
+      kernel_ = o.kernel_;
+      slots_ = std::move(o.slots_);
+      arg_info_ = o.arg_info_;
+      stats_ = o.stats_;
+      o.kernel_ = nullptr;
+    }
+    return *this;
+  }
+
+  ~bound_kernel() { reset(); }
+
+  auto get() const -> cl_kernel { return kernel_; }
+  operator cl_kernel() const { return kernel_; }
+  explicit operator bool() const { return kernel_ != nullptr; }
+
+  auto num_args() const -> std::size_t { return slots_.size(); }
+
+  // rebinds one argument; the fast path when only it changed between
+  // launches.
+  template <typename T> auto set_argument(cl_uint i, T const &t) -> cl_int {
+    auto size = kernel_arg<T>::size(t);
+    auto value = kernel_arg<T>::value(t);
+    if (i < slots_.size() && slots_[i].matches(size, value)) {
+      stats_.skipped++;
+      return CL_SUCCESS;
+    }
+    if (arg_info_ && i < slots_.size() &&
+        !kernel_arg<T>::accepts(slots_[i].qualifier, slots_[i].type.c_str())) {
+      set_err_if_err(CL_INVALID_ARG_VALUE, "bound_kernel::set_argument");
+      return CL_INVALID_ARG_VALUE;
+    }
+    return bind(i, size, value);
+  }
+
+  // raw bytes, unchecked; a null value with a size allocates __local memory.
+  auto set_argument(cl_uint i, std::size_t size, void const *value)
+      -> cl_int {
+    if (i < slots_.size() && slots_[i].matches(size, value)) {
+      stats_.skipped++;
+      return CL_SUCCESS;
+    }
+    return bind(i, size, value);
+  }
+
+  // binds arguments from index 0, stops at the first one that fails and
+  // returns its error.
+  template <typename... Ts> auto set_arguments(Ts const &... ts) -> cl_int {
+    return set_arguments_impl(0, ts...);
+  }
+
+  // whether argument info was available for checking binds.
+  auto has_arg_info() const -> bool { return arg_info_; }
+
+  // forget the bound values, so the next bind of each argument goes to the
+  // driver.
+  auto invalidate() -> void {
+    for (auto &s : slots_) {
+      s.bound = false;
+    }
+  }
+
+  auto invalidate(cl_uint i) -> void {
+    if (i < slots_.size()) {
+      slots_[i].bound = false;
+    }
+  }
+
+  // forget every argument bound to m, before m is released.
+  auto forget(cl_mem m) -> void {
+    for (auto &s : slots_) {
+      if (s.matches(sizeof(m), &m)) {
+        s.bound = false;
+      }
+    }
+  }
+
+  auto stats() const -> kernel_arg_stats const & { return stats_; }
+  auto reset_stats() -> void { stats_ = {}; }
+
+private:
+  // argument values up to this size are kept without allocating, which
+  // covers handles, scalars and vectors up to 16 bytes.
+  static constexpr std::size_t inline_size = 16;
+
+  struct slot {
+    cl_kernel_arg_address_qualifier qualifier = 0;
+    std::string type;
+    bool bound = false;
+    bool null = false;
+    std::size_t size = 0;
+    std::array<unsigned char, inline_size> small;
+    std::vector<unsigned char> large;
+
+    auto data() const -> unsigned char const * {
+      return size <= inline_size ? small.data() : large.data();
+    }
+
+    auto matches(std::size_t s, void const *v) const -> bool {
+      if (!bound || size != s || null != (v == nullptr)) {
+        return false;
+      }
+      return null || std::memcmp(data(), v, s) == 0;
+    }
+
+    auto assign(std::size_t s, void const *v) -> void {
+      bound = true;
+      null = v == nullptr;
+      size = s;
+      if (null) {
+        return;
+      }
+      auto bytes = static_cast<unsigned char const *>(v);
+      if (s <= inline_size) {
+        std::memcpy(small.data(), bytes, s);
+      } else {
+        large.assign(bytes, bytes + s);
+      }
+    }
+  };
+
+  auto bind(cl_uint i, std::size_t size, void const *value) -> cl_int {
+    stats_.calls++;
+    auto err = clSetKernelArg(kernel_, i, size, value);
+    if (err != CL_SUCCESS) {
+      set_err_if_err(err, "clSetKernelArg");
+      if (i < slots_.size()) {
+        slots_[i].bound = false;
+      }
+      return err;
+    }
+    if (i < slots_.size()) {
+      slots_[i].assign(size, value);
+    }
+    return CL_SUCCESS;
+  }
+
+  // queried directly, as missing info is expected and not an error.
+  auto load_arg_info() -> void {
+    for (auto i = 0u; i < slots_.size(); i++) {
+      auto &s = slots_[i];
+      auto err = clGetKernelArgInfo(kernel_, i, CL_KERNEL_ARG_ADDRESS_QUALIFIER,
+                                    sizeof(s.qualifier), &s.qualifier, nullptr);
+      if (err != CL_SUCCESS) {
+        return;
+      }
+      s.type = get_kernel_arg_info_type_name(kernel_, i);
+    }
+    arg_info_ = true;
+  }
+
+  auto set_arguments_impl(cl_uint) -> cl_int { return CL_SUCCESS; }
+
+  template <typename T, typename... Ts>
+  auto set_arguments_impl(cl_uint i, T const &t, Ts const &... ts) -> cl_int {
+    auto err = set_argument(i, t);
+    if (err != CL_SUCCESS) {
+      return err;
+    }
+    return set_arguments_impl(i + 1, ts...);
+  }
+
+  auto reset() -> void {
+    if (kernel_) {
+      clReleaseKernel(kernel_);
+      kernel_ = nullptr;
+    }
+  }
+
+  cl_kernel kernel_ = nullptr;
+  std::vector<slot> slots_;
+  bool arg_info_ = false;
+  kernel_arg_stats stats_;
+};
+
+// same call form as set_arguments(cl_kernel, ...), skipping unchanged
+// arguments.
+template <typename... Ts>
+auto set_arguments(bound_kernel &k, Ts const &... ts) -> cl_int {
+  return k.set_arguments(ts...);
+}
+
+} // namespace clx
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+#include "clx.hpp"
+#include "device_caps.hpp"
+
+namespace clx {
+
+// a slice of a pooled backing buffer. mem is a sub-buffer covering
+// [offset, offset + capacity) of block, or a dedicated buffer for requests
+// larger than the biggest size class, with no block.
+struct buffer_region {
+  cl_mem mem = nullptr;
+  cl_mem block = nullptr;
+  std::size_t offset = 0;
+  std::size_t size = 0;
+  std::size_t capacity = 0;
+  std::size_t size_class = 0;
+};
+
+struct buffer_pool_stats {
+  std::size_t reserved = 0;  // bytes held in backing and dedicated buffers
+  std::size_t in_use = 0;    // capacity of live regions
+  std::size_t requested = 0; // bytes asked for by live regions
+  std::size_t cached = 0;    // capacity of freed regions kept for reuse
+  std::size_t high_water = 0;
+  std::size_t allocations = 0;
+  std::size_t reuses = 0;
+  std::size_t blocks = 0; // backing blocks currently held
+
+  // share of in-use bytes lost to size-class rounding.
+  auto internal_fragmentation() const -> double {
+    return in_use ? 1.0 - double(requested) / double(in_use) : 0.0;
+  }
+
+  // share of reserved bytes not handed out to a live region.
+  auto external_fragmentation() const -> double {
+    return reserved ? 1.0 - double(in_use) / double(reserved) : 0.0;
+  }
+};
+
+inline auto to_string(buffer_pool_stats const &s) -> std::string {
+  return fmt::format(
+      "[reserved:{}, in_use:{}, requested:{}, cached:{}, high_water:{}, "
+      "allocations:{}, reuses:{}, blocks:{}, internal_frag:{:.3f}, "
+      "external_frag:{:.3f}]",
+      s.reserved, s.in_use, s.requested, s.cached, s.high_water, s.allocations,
+      s.reuses, s.blocks, s.internal_fragmentation(),
+      s.external_fragmentation());
+}
+
+// Pooled device allocator. Large backing buffers are carved into
+// power-of-two size classes with clCreateSubBuffer, every class a multiple of
+// CL_DEVICE_MEM_BASE_ADDR_ALIGN so sub-buffer origins are always legal. A
+// released region keeps its sub-buffer and goes to its class's free list, so
+// steady-state allocation makes no OpenCL calls at all. A block none of whose
+// regions are live is released by trim(), and before a new block is carved,
+// so the pool does not grow without bound as the size mix shifts.
+class buffer_pool {
+public:
+  buffer_pool(cl_context ctx, cl_device_id d, cl_mem_flags flags,
+              std::size_t block_size)
+      : ctx_(ctx), flags_(flags),
+        alignment_(std::max<std::size_t>(
+            device_caps_of(d).mem_base_addr_align, 1)),
+        block_size_(round_up(block_size, alignment_)) {
+    auto size = alignment_;
+    while (size <= block_size_) {
+      free_.emplace_back();
+      size <<= 1;
+    }
+  }
+
+  buffer_pool(cl_context ctx, cl_device_id d, cl_mem_flags flags)
+      : buffer_pool(ctx, d, flags, 64 << 20) {}
+
+  buffer_pool(buffer_pool const &) = delete;
+  auto operator=(buffer_pool const &) -> buffer_pool & = delete;
+
+  ~buffer_pool() {
+    for (auto &list : free_) {
+      for (auto &r : list) {
+        clReleaseMemObject(r.mem);
+      }
+    }
+    for (auto &b : blocks_) {
+      clReleaseMemObject(b.mem);
+    }
+  }
+
+  auto alignment() const -> std::size_t { return alignment_; }
+
+  // returns a region with mem == nullptr on failure; the error is recorded in
+  // the last error.
+  auto allocate(std::size_t size) -> buffer_region {
+    auto lock = std::lock_guard<std::mutex>{mutex_};
+    auto c = size_class(size);
+    auto r = buffer_region{};
+    if (c == free_.size()) {
+      r = allocate_dedicated(size);
+    } else if (!free_[c].empty()) {
+      r = free_[c].back();
+      free_[c].pop_back();
+      block_of(r).live++;
+      stats_.cached -= r.capacity;
+      stats_.reuses++;
+    } else {
+      r = carve(c);
+    }
+    if (!r.mem) {
+      return r;
+    }
+
+    r.size = size;
+    stats_.in_use += r.capacity;
+    stats_.requested += r.size;
+    stats_.allocations++;
+    stats_.high_water = std::max(stats_.high_water, stats_.in_use);
+    return r;
+  }
+
+  auto release(buffer_region const &r) -> void {
+    if (!r.mem) {
+      return;
+    }
+    auto lock = std::lock_guard<std::mutex>{mutex_};
+    stats_.in_use -= r.capacity;
+    stats_.requested -= r.size;
+    if (r.size_class == free_.size()) {
+      stats_.reserved -= r.capacity;
+      clReleaseMemObject(r.mem);
+      return;
+    }
+    block_of(r).live--;
+    free_[r.size_class].push_back(r);
+    stats_.cached += r.capacity;
+  }
+
+  // release every block with no live region, along with its cached
+  // sub-buffers. cached regions of the other blocks are kept, since their
+  // space could not be handed out again otherwise.
+  auto trim() -> void {
+    auto lock = std::lock_guard<std::mutex>{mutex_};
+    trim_locked();
+  }
+
+  auto stats() const -> buffer_pool_stats {
+    auto lock = std::lock_guard<std::mutex>{mutex_};
+    return stats_;
+  }
+
+private:
+  struct block {
+    cl_mem mem;
+    std::size_t used; // bytes carved so far
+    std::size_t live; // regions handed out and not yet released
+  };
+
+  static auto round_up(std::size_t n, std::size_t m) -> std::size_t {
+    return (n + m - 1) / m * m;
+  }
+
+  auto class_size(std::size_t c) const -> std::size_t {
+    return alignment_ << c;
+  }
+
+  // free_.size() for requests that do not fit any class.
+  auto size_class(std::size_t size) const -> std::size_t {
+    auto c = std::size_t{0};
+    while (c < free_.size() && class_size(c) < size) {
+      c++;
+    }
+    return c;
+  }
+
+  auto block_of(buffer_region const &r) -> block & {
+    return *std::find_if(std::begin(blocks_), std::end(blocks_),
+                         [&](auto const &b) { return b.mem == r.block; });
+  }
+
+  auto trim_locked() -> void {
+    auto idle = [](block const &b) { return b.live == 0; };
+    if (std::none_of(std::begin(blocks_), std::end(blocks_), idle)) {
+      return;
+    }
+    for (auto &list : free_) {
+      auto last = std::remove_if(
+          std::begin(list), std::end(list), [&](buffer_region const &r) {
+            if (!idle(block_of(r))) {
+              return false;
+            }
+            clReleaseMemObject(r.mem);
+            stats_.cached -= r.capacity;
+            return true;
+          });
+      list.erase(last, std::end(list));
+    }
+    auto last = std::remove_if(std::begin(blocks_), std::end(blocks_),
+                               [&](block const &b) {
+                                 if (!idle(b)) {
+                                   return false;
+                                 }
+                                 clReleaseMemObject(b.mem);
+                                 stats_.reserved -= block_size_;
+                                 stats_.blocks--;
+                                 return true;
+                               });
+    blocks_.erase(last, std::end(blocks_));
+  }
+
+  auto carve(std::size_t c) -> buffer_region {
+    auto size = class_size(c);
+    if (blocks_.empty() || blocks_.back().used + size > block_size_) {
+      // the free list of c is empty, so rather than growing, first give back
+      // the blocks the previous size mix left idle.
+      trim_locked();
+    }
+    if (blocks_.empty() || blocks_.back().used + size > block_size_) {
+      auto mem = create_buffer(ctx_, flags_, block_size_, nullptr);
+      if (!mem) {
+        return {};
+      }
+      blocks_.push_back({mem, 0, 0});
+      stats_.reserved += block_size_;
+      stats_.blocks++;
+    }
+    // the tail of the previous block is left unused, which shows up as
+    // external fragmentation.
+    auto &b = blocks_.back();
+    auto mem = create_sub_buffer(b.mem, 0, b.used, size);
+    if (!mem) {
+      return {};
+    }
+    auto r = buffer_region{mem, b.mem, b.used, 0, size, c};
+    b.used += size;
+    b.live++;
+    return r;
+  }
+
+  auto allocate_dedicated(std::size_t size) -> buffer_region {
+    auto capacity = round_up(size, alignment_);
+    auto mem = create_buffer(ctx_, flags_, capacity, nullptr);
+    if (!mem) {
+      return {};
+    }
+    stats_.reserved += capacity;
+    return {mem, nullptr, 0, 0, capacity, free_.size()};
+  }
+
+  cl_context ctx_;
+  cl_mem_flags flags_;
+  std::size_t alignment_;
+  std::size_t block_size_;
+  std::vector<block> blocks_;
+  std::vector<std::vector<buffer_region>> free_;
+  buffer_pool_stats stats_;
+  mutable std::mutex mutex_;
+};
+
+} // namespace clx
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <fmt/format.h>
+
+namespace clx {
+
+// where clx keeps program binaries, benchmark results and tuning data:
+// CLX_CACHE_DIR, then $XDG_CACHE_HOME/clx, then ~/.cache/clx. this is the
+// only variable that moves them; each cache is a fixed name inside it.
+inline auto cache_directory() -> std::filesystem::path {
+  if (auto dir = std::getenv("CLX_CACHE_DIR")) {
+    return dir;
+  }
+  if (auto dir = std::getenv("XDG_CACHE_HOME")) {
+    return std::filesystem::path{dir} / "clx";
+  }
+  if (auto dir = std::getenv("HOME")) {
+    return std::filesystem::path{dir} / ".cache" / "clx";
+  }
+  return std::filesystem::temp_directory_path() / "clx";
+}
+
+inline auto unique_suffix() -> std::uint64_t {
+  auto rd = std::random_device{};
+  return (std::uint64_t{rd()} << 32 | rd()) ^
+         std::hash<std::thread::id>{}(std::this_thread::get_id());
+}
+
+// replace a file through a temporary and a rename, so concurrent readers see
+// either the old or the new content, never a torn file.
+inline auto write_file_atomic(std::filesystem::path const &path,
+                              std::string_view content) -> bool {
+  auto ec = std::error_code{};
+  std::filesystem::create_directories(path.parent_path(), ec);
+  auto tmp = path;
+  tmp += fmt::format(".{:016x}.tmp", unique_suffix());
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return false;
+    }
+    out.write(content.data(), content.size());
+    if (!out) {
+      out.close();
+      std::filesystem::remove(tmp, ec);
+      return false;
+    }
+  }
+  std::filesystem::rename(tmp, path, ec);
+  if (ec) {
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+  return true;
+}
+
+namespace detail {
+
+// "<hex key> <values...>" lines.
+inline auto read_records(std::filesystem::path const &path)
+    -> std::map<std::uint64_t, std::string> {
+  auto out = std::map<std::uint64_t, std::string>{};
+  std::ifstream in(path);
+  auto line = std::string{};
+  while (std::getline(in, line)) {
+    auto ss = std::istringstream{line};
+    auto key = std::uint64_t{};
+    if (ss >> std::hex >> key) {
+      auto rest = std::string{};
+      std::getline(ss >> std::ws, rest);
+      out[key] = rest;
+    }
+  }
+  return out;
+}
+
+// read-modify-write of one record; concurrent writers may drop each other's
+// record, which only costs a re-measurement.
+inline auto write_record(std::filesystem::path const &path, std::uint64_t key,
+                         std::string const &value) -> bool {
+  auto records = read_records(path);
+  records[key] = value;
+  auto content = std::string{};
+  for (auto const &r : records) {
+    content += fmt::format("{:016x} {}\n", r.first, r.second);
+  }
+  return write_file_atomic(path, content);
+}
+
+} // namespace detail
+
+} // namespace clx
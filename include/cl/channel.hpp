@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace clx {
+
+// A queue between pipeline stages running on different threads. pop() blocks
+// until a value arrives or the channel is closed and drained. It is
+// unbounded; pipelines bound the work in flight by circulating a fixed set of
+// slots through a channel of free slots.
+template <typename T> class channel {
+public:
+  auto push(T t) -> void {
+    {
+      auto lock = std::lock_guard<std::mutex>{m_};
+      values_.push_back(std::move(t));
+    }
+    cv_.notify_one();
+  }
+
+  // empty once the channel is closed and every value has been popped.
+  auto pop() -> std::optional<T> {
+    auto lock = std::unique_lock<std::mutex>{m_};
+    cv_.wait(lock, [&] { return closed_ || !values_.empty(); });
+    if (values_.empty()) {
+      return std::nullopt;
+    }
+    auto t = std::move(values_.front());
+    values_.pop_front();
+    return t;
+  }
+
+  // wakes every consumer; values already pushed are still delivered.
+  auto close() -> void {
+    {
+      auto lock = std::lock_guard<std::mutex>{m_};
+      closed_ = true;
+    }
+    cv_.notify_all();
+  }
+
+private:
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::deque<T> values_;
+  bool closed_ = false;
+};
+
+} // namespace clx
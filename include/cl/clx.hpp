@@ -1,3 +1,5 @@
+#pragma once
+
 #ifdef __APPLE__
 #include <OpenCL/opencl.h>
 #else
@@ -6,28 +8,46 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <array>
 
 #include <fmt/format.h>
 #include "sx.hpp"
+#include "trace.hpp"
 
 namespace clx {
 
-cl_int g_err;
-char const *g_func;
+// Errors are reported in two ways. Every function records its failing call in
+// a thread-local last error (g_err / g_func), overwriting any earlier one, so
+// the success path only costs a compare and submitter threads never race on
+// it. Functions that return an object also have an overload taking
+// `cl_int &err`, which reports the result of that one call and leaves the
+// last error untouched.
+inline thread_local cl_int g_err = CL_SUCCESS;
+inline thread_local char const *g_func = nullptr;
 
-auto set_err_if_err(cl_int const &err, char const *func) -> void {
+inline auto set_err_if_err(cl_int const &err, char const *func) -> void {
   if (err != CL_SUCCESS) {
     g_err = err;
     g_func = func;
   }
 }
 
+inline auto last_error() -> cl_int { return g_err; }
+
+inline auto last_error_func() -> char const * { return g_func; }
+
+inline auto clear_last_error() -> void {
+  g_err = CL_SUCCESS;
+  g_func = nullptr;
+}
+
 namespace detail {
 
-auto get_info_size(cl_device_id const &id, cl_device_info const &info)
+inline auto get_info_size(cl_device_id const &id, cl_device_info const &info)
     -> std::size_t {
   auto size = std::size_t{};
   auto err = clGetDeviceInfo(id, info, 0, nullptr, &size);
@@ -35,15 +55,15 @@ auto get_info_size(cl_device_id const &id, cl_device_info const &info)
   return size;
 }
 
-auto get_info_size(cl_platform_id const &id, cl_platform_info const &info)
-    -> std::size_t {
+inline auto get_info_size(cl_platform_id const &id,
+                          cl_platform_info const &info) -> std::size_t {
   auto size = std::size_t{};
   auto err = clGetPlatformInfo(id, info, 0, nullptr, &size);
   set_err_if_err(err, "clGetPlatformInfo");
   return size;
 }
 
-auto get_info_size(cl_context const &ctx, cl_context_info const &info)
+inline auto get_info_size(cl_context const &ctx, cl_context_info const &info)
     -> std::size_t {
   auto size = std::size_t{};
   auto err = clGetContextInfo(ctx, info, 0, nullptr, &size);
@@ -51,14 +71,47 @@ auto get_info_size(cl_context const &ctx, cl_context_info const &info)
   return size;
 }
 
-auto get_info_size(cl_program const &p, cl_device_id const &d,
-                   cl_program_build_info const &info) -> std::size_t {
+inline auto get_info_size(cl_program const &p, cl_program_info const &info)
+    -> std::size_t {
+  auto size = std::size_t{};
+  auto err = clGetProgramInfo(p, info, 0, nullptr, &size);
+  set_err_if_err(err, "clGetProgramInfo");
+  return size;
+}
+
+inline auto get_info_size(cl_program const &p, cl_device_id const &d,
+                          cl_program_build_info const &info) -> std::size_t {
   auto size = std::size_t{};
   auto err = clGetProgramBuildInfo(p, d, info, 0, nullptr, &size);
   set_err_if_err(err, "clGetProgramBuildInfo");
   return size;
 }
 
+inline auto get_info_size(cl_kernel const &k, cl_kernel_info const &info)
+    -> std::size_t {
+  auto size = std::size_t{};
+  auto err = clGetKernelInfo(k, info, 0, nullptr, &size);
+  set_err_if_err(err, "clGetKernelInfo");
+  return size;
+}
+
+inline auto get_info_size(cl_kernel const &k, cl_uint const &arg,
+                          cl_kernel_arg_info const &info) -> std::size_t {
+  auto size = std::size_t{};
+  auto err = clGetKernelArgInfo(k, arg, info, 0, nullptr, &size);
+  set_err_if_err(err, "clGetKernelArgInfo");
+  return size;
+}
+
+inline auto get_info_size(cl_kernel const &k, cl_device_id const &d,
+                          cl_kernel_work_group_info const &info)
+    -> std::size_t {
+  auto size = std::size_t{};
+  auto err = clGetKernelWorkGroupInfo(k, d, info, 0, nullptr, &size);
+  set_err_if_err(err, "clGetKernelWorkGroupInfo");
+  return size;
+}
+
 template <typename T, cl_uint Info>
 auto get_info_size(T const &t) -> std::size_t {
   return get_info_size(t, Info);
@@ -87,6 +140,58 @@ template <> struct return_type<CL_DEVICE_PROFILE> { using type = std::string; };
 template <> struct return_type<CL_DEVICE_EXTENSIONS> {
   using type = std::string;
 };
+template <> struct return_type<CL_DRIVER_VERSION> { using type = std::string; };
+template <> struct return_type<CL_DEVICE_PLATFORM> {
+  using type = cl_platform_id;
+};
+template <> struct return_type<CL_DEVICE_MAX_MEM_ALLOC_SIZE> {
+  using type = cl_ulong;
+};
+template <> struct return_type<CL_DEVICE_GLOBAL_MEM_SIZE> {
+  using type = cl_ulong;
+};
+template <> struct return_type<CL_DEVICE_GLOBAL_MEM_CACHE_SIZE> {
+  using type = cl_ulong;
+};
+template <> struct return_type<CL_DEVICE_LOCAL_MEM_SIZE> {
+  using type = cl_ulong;
+};
+template <> struct return_type<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE> {
+  using type = cl_ulong;
+};
+template <> struct return_type<CL_DEVICE_MAX_WORK_GROUP_SIZE> {
+  using type = std::size_t;
+};
+template <> struct return_type<CL_DEVICE_MAX_WORK_ITEM_SIZES> {
+  using type = std::vector<std::size_t>;
+};
+template <> struct return_type<CL_DEVICE_MAX_PARAMETER_SIZE> {
+  using type = std::size_t;
+};
+template <> struct return_type<CL_DEVICE_PROFILING_TIMER_RESOLUTION> {
+  using type = std::size_t;
+};
+template <> struct return_type<CL_DEVICE_IMAGE2D_MAX_WIDTH> {
+  using type = std::size_t;
+};
+template <> struct return_type<CL_DEVICE_IMAGE2D_MAX_HEIGHT> {
+  using type = std::size_t;
+};
+template <> struct return_type<CL_DEVICE_IMAGE3D_MAX_WIDTH> {
+  using type = std::size_t;
+};
+template <> struct return_type<CL_DEVICE_IMAGE3D_MAX_HEIGHT> {
+  using type = std::size_t;
+};
+template <> struct return_type<CL_DEVICE_IMAGE3D_MAX_DEPTH> {
+  using type = std::size_t;
+};
+template <> struct return_type<CL_DEVICE_IMAGE_MAX_BUFFER_SIZE> {
+  using type = std::size_t;
+};
+template <> struct return_type<CL_DEVICE_IMAGE_MAX_ARRAY_SIZE> {
+  using type = std::size_t;
+};
 template <> struct return_type<CL_CONTEXT_DEVICES> {
   using type = std::vector<cl_device_id>;
 };
@@ -95,45 +200,118 @@ template <> struct return_type<CL_CONTEXT_DEVICES> {
 template <> struct return_type<CL_PROGRAM_BUILD_LOG> {
   using type = std::string;
 };
+template <> struct return_type<CL_PROGRAM_BUILD_STATUS> {
+  using type = cl_build_status;
+};
+template <> struct return_type<CL_PROGRAM_DEVICES> {
+  using type = std::vector<cl_device_id>;
+};
+template <> struct return_type<CL_PROGRAM_BINARY_SIZES> {
+  using type = std::vector<std::size_t>;
+};
+template <> struct return_type<CL_PROGRAM_SOURCE> { using type = std::string; };
+
+// KERNEL
+template <> struct return_type<CL_KERNEL_FUNCTION_NAME> {
+  using type = std::string;
+};
+template <> struct return_type<CL_KERNEL_PROGRAM> { using type = cl_program; };
+template <> struct return_type<CL_KERNEL_WORK_GROUP_SIZE> {
+  using type = std::size_t;
+};
+template <> struct return_type<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE> {
+  using type = std::size_t;
+};
+template <> struct return_type<CL_KERNEL_COMPILE_WORK_GROUP_SIZE> {
+  using type = std::vector<std::size_t>;
+};
+template <> struct return_type<CL_KERNEL_LOCAL_MEM_SIZE> {
+  using type = cl_ulong;
+};
+template <> struct return_type<CL_KERNEL_ARG_TYPE_NAME> {
+  using type = std::string;
+};
+template <> struct return_type<CL_KERNEL_ARG_NAME> {
+  using type = std::string;
+};
 
 template <cl_uint Info> using return_type_t = typename return_type<Info>::type;
 
-auto get_info(cl_platform_id const &id, cl_uint const &info,
-              size_t param_value_size, void *param_value,
-              size_t *param_value_size_ret) -> cl_int {
+inline auto get_info(cl_platform_id const &id, cl_uint const &info,
+                     size_t param_value_size, void *param_value,
+                     size_t *param_value_size_ret) -> cl_int {
   auto err = clGetPlatformInfo(id, info, param_value_size, param_value,
                                param_value_size_ret);
   set_err_if_err(err, "clGetPlatformInfo");
   return err;
 }
 
-auto get_info(cl_device_id const &id, cl_uint const &info,
-              size_t param_value_size, void *param_value,
-              size_t *param_value_size_ret) -> cl_int {
+inline auto get_info(cl_device_id const &id, cl_uint const &info,
+                     size_t param_value_size, void *param_value,
+                     size_t *param_value_size_ret) -> cl_int {
   auto err = clGetDeviceInfo(id, info, param_value_size, param_value,
                              param_value_size_ret);
   set_err_if_err(err, "clGetDeviceInfo");
   return err;
 }
 
-auto get_info(cl_context const &ctx, cl_uint const &info,
-              size_t param_value_size, void *param_value,
-              size_t *param_value_size_ret) -> cl_int {
+inline auto get_info(cl_context const &ctx, cl_uint const &info,
+                     size_t param_value_size, void *param_value,
+                     size_t *param_value_size_ret) -> cl_int {
   auto err = clGetContextInfo(ctx, info, param_value_size, param_value,
                               param_value_size_ret);
   set_err_if_err(err, "clGetContextInfo");
   return err;
 }
 
-auto get_info(cl_program const &p, cl_device_id const &d, cl_uint const &info,
-              size_t param_value_size, void *param_value,
-              size_t *param_value_size_ret) -> cl_int {
+inline auto get_info(cl_program const &p, cl_uint const &info,
+                     size_t param_value_size, void *param_value,
+                     size_t *param_value_size_ret) -> cl_int {
+  auto err = clGetProgramInfo(p, info, param_value_size, param_value,
+                              param_value_size_ret);
+  set_err_if_err(err, "clGetProgramInfo");
+  return err;
+}
+
+inline auto get_info(cl_program const &p, cl_device_id const &d,
+                     cl_uint const &info, size_t param_value_size,
+                     void *param_value, size_t *param_value_size_ret)
+    -> cl_int {
   auto err = clGetProgramBuildInfo(p, d, info, param_value_size, param_value,
                                    param_value_size_ret);
   set_err_if_err(err, "clGetProgramBuildInfo");
   return err;
 }
 
+inline auto get_info(cl_kernel const &k, cl_uint const &info,
+                     size_t param_value_size, void *param_value,
+                     size_t *param_value_size_ret) -> cl_int {
+  auto err = clGetKernelInfo(k, info, param_value_size, param_value,
+                             param_value_size_ret);
+  set_err_if_err(err, "clGetKernelInfo");
+  return err;
+}
+
+inline auto get_info(cl_kernel const &k, cl_uint const &arg,
+                     cl_uint const &info, size_t param_value_size,
+                     void *param_value, size_t *param_value_size_ret)
+    -> cl_int {
+  auto err = clGetKernelArgInfo(k, arg, info, param_value_size, param_value,
+                                param_value_size_ret);
+  set_err_if_err(err, "clGetKernelArgInfo");
+  return err;
+}
+
+inline auto get_info(cl_kernel const &k, cl_device_id const &d,
+                     cl_uint const &info, size_t param_value_size,
+                     void *param_value, size_t *param_value_size_ret)
+    -> cl_int {
+  auto err = clGetKernelWorkGroupInfo(k, d, info, param_value_size,
+                                      param_value, param_value_size_ret);
+  set_err_if_err(err, "clGetKernelWorkGroupInfo");
+  return err;
+}
+
 template <typename R, typename... Ts> struct _get_info {
   auto operator()(Ts... ts, cl_uint const &info) -> R {
     R r;
@@ -156,6 +334,15 @@ template <typename... Ts> struct _get_info<std::string, Ts...> {
   }
 };
 
+template <typename T, typename... Ts> struct _get_info<std::vector<T>, Ts...> {
+  auto operator()(Ts... ts, cl_uint const &info) -> std::vector<T> {
+    auto size = get_info_size(ts..., info);
+    auto out = std::vector<T>(size / sizeof(T));
+    get_info(ts..., info, size, out.data(), nullptr);
+    return out;
+  }
+};
+
 // template <cl_uint Info, typename T>
 // auto get_info(T const &t) -> return_type_t<Info> {
 // return _get_info<return_type_t<Info>, T>{}(t, Info);
@@ -166,11 +353,14 @@ auto get_info(Ts... ts) -> return_type_t<Info> {
   return _get_info<return_type_t<Info>, Ts...>{}(ts..., Info);
 }
 
-auto get_property_name(cl_platform_id const &i) -> cl_context_properties {
+inline auto get_property_name(cl_platform_id const &)
+    -> cl_context_properties {
   return CL_CONTEXT_PLATFORM;
 }
 
-auto create_context_properties_impl() -> cl_context_properties { return 0; }
+inline auto create_context_properties_impl() -> cl_context_properties {
+  return 0;
+}
 
 template <typename T, typename... Ts>
 auto create_context_properties_impl(T t, Ts... ts)
@@ -181,59 +371,183 @@ auto create_context_properties_impl(T t, Ts... ts)
 
 } // namespace detail
 
-auto get_platform_info_name(cl_platform_id const &id) -> std::string {
+inline auto get_platform_info_name(cl_platform_id const &id) -> std::string {
   return detail::get_info<CL_PLATFORM_NAME>(id);
 }
 
-auto get_platform_info_vendor(cl_platform_id const &id) -> std::string {
+inline auto get_platform_info_vendor(cl_platform_id const &id) -> std::string {
   return detail::get_info<CL_PLATFORM_VENDOR>(id);
 }
 
-auto get_platform_info_extensions(cl_platform_id const &id) -> std::string {
+inline auto get_platform_info_extensions(cl_platform_id const &id)
+    -> std::string {
   return detail::get_info<CL_PLATFORM_EXTENSIONS>(id);
 }
 
-auto get_platform_info_profile(cl_platform_id const &id) -> std::string {
+inline auto get_platform_info_profile(cl_platform_id const &id) -> std::string {
   return detail::get_info<CL_PLATFORM_PROFILE>(id);
 }
 
-auto get_platform_info_version(cl_platform_id const &id) -> std::string {
+inline auto get_platform_info_version(cl_platform_id const &id) -> std::string {
   return detail::get_info<CL_PLATFORM_VERSION>(id);
 }
 
-auto get_device_info_type(cl_device_id const &id) {
+inline auto get_device_info_type(cl_device_id const &id) {
   return detail::get_info<CL_DEVICE_TYPE>(id);
 }
 
-auto get_device_info_profile(cl_device_id const &id) -> std::string {
+inline auto get_device_info_profile(cl_device_id const &id) -> std::string {
   return detail::get_info<CL_DEVICE_PROFILE>(id);
 }
 
-auto get_device_info_name(cl_device_id const &id) -> std::string {
+inline auto get_device_info_name(cl_device_id const &id) -> std::string {
   return detail::get_info<CL_DEVICE_NAME>(id);
 }
 
-auto get_device_info_extensions(cl_device_id const &id) -> std::string {
+inline auto get_device_info_extensions(cl_device_id const &id) -> std::string {
   return detail::get_info<CL_DEVICE_EXTENSIONS>(id);
 }
 
-auto get_device_info_vendor(cl_device_id const &id) -> std::string {
+inline auto get_device_info_vendor(cl_device_id const &id) -> std::string {
   return detail::get_info<CL_DEVICE_VENDOR>(id);
 }
 
-auto get_program_build_info_log(cl_program const &p, cl_device_id const &id)
+inline auto get_device_info_version(cl_device_id const &id) -> std::string {
+  return detail::get_info<CL_DEVICE_VERSION>(id);
+}
+
+inline auto get_device_info_driver_version(cl_device_id const &id)
     -> std::string {
+  return detail::get_info<CL_DRIVER_VERSION>(id);
+}
+
+inline auto get_device_info_platform(cl_device_id const &id) -> cl_platform_id {
+  return detail::get_info<CL_DEVICE_PLATFORM>(id);
+}
+
+inline auto get_device_info_max_compute_units(cl_device_id const &id)
+    -> cl_uint {
+  return detail::get_info<CL_DEVICE_MAX_COMPUTE_UNITS>(id);
+}
+
+inline auto get_device_info_partition_max_sub_devices(cl_device_id const &id)
+    -> cl_uint {
+  return detail::get_info<CL_DEVICE_PARTITION_MAX_SUB_DEVICES>(id);
+}
+
+inline auto get_device_info_max_mem_alloc_size(cl_device_id const &id)
+    -> cl_ulong {
+  return detail::get_info<CL_DEVICE_MAX_MEM_ALLOC_SIZE>(id);
+}
+
+// in bytes; the device reports CL_DEVICE_MEM_BASE_ADDR_ALIGN in bits.
+inline auto get_device_info_mem_base_addr_align(cl_device_id const &id)
+    -> std::size_t {
+  return detail::get_info<CL_DEVICE_MEM_BASE_ADDR_ALIGN>(id) / 8;
+}
+
+inline auto get_program_build_info_log(cl_program const &p,
+                                       cl_device_id const &id) -> std::string {
   return detail::get_info<CL_PROGRAM_BUILD_LOG>(p, id);
 }
 
-auto get_platform_id_count() -> uint32_t {
+inline auto get_program_build_info_status(cl_program const &p,
+                                          cl_device_id const &id)
+    -> cl_build_status {
+  return detail::get_info<CL_PROGRAM_BUILD_STATUS>(p, id);
+}
+
+inline auto get_program_info_devices(cl_program const &p)
+    -> std::vector<cl_device_id> {
+  return detail::get_info<CL_PROGRAM_DEVICES>(p);
+}
+
+inline auto get_program_info_binary_sizes(cl_program const &p)
+    -> std::vector<std::size_t> {
+  return detail::get_info<CL_PROGRAM_BINARY_SIZES>(p);
+}
+
+// binaries are returned in the order of get_program_info_devices(). devices
+// the program was not built for have an empty binary.
+inline auto get_program_info_binaries(cl_program const &p)
+    -> std::vector<std::vector<unsigned char>> {
+  auto sizes = get_program_info_binary_sizes(p);
+  auto bins = std::vector<std::vector<unsigned char>>(sizes.size());
+  auto ptrs = std::vector<unsigned char *>(sizes.size());
+  for (auto i = 0u; i < sizes.size(); i++) {
+    bins[i].resize(sizes[i]);
+    ptrs[i] = bins[i].data();
+  }
+  auto err = clGetProgramInfo(p, CL_PROGRAM_BINARIES,
+                              ptrs.size() * sizeof(unsigned char *),
+                              ptrs.data(), nullptr);
+  set_err_if_err(err, "clGetProgramInfo");
+  if (err != CL_SUCCESS) {
+    bins.clear();
+  }
+  return bins;
+}
+
+inline auto get_kernel_info_function_name(cl_kernel const &k) -> std::string {
+  return detail::get_info<CL_KERNEL_FUNCTION_NAME>(k);
+}
+
+inline auto get_kernel_info_num_args(cl_kernel const &k) -> cl_uint {
+  return detail::get_info<CL_KERNEL_NUM_ARGS>(k);
+}
+
+inline auto get_kernel_info_program(cl_kernel const &k) -> cl_program {
+  return detail::get_info<CL_KERNEL_PROGRAM>(k);
+}
+
+inline auto get_program_info_source(cl_program const &p) -> std::string {
+  return detail::get_info<CL_PROGRAM_SOURCE>(p);
+}
+
+inline auto get_kernel_work_group_info_size(cl_kernel const &k,
+                                            cl_device_id const &d)
+    -> std::size_t {
+  return detail::get_info<CL_KERNEL_WORK_GROUP_SIZE>(k, d);
+}
+
+inline auto get_kernel_work_group_info_preferred_multiple(cl_kernel const &k,
+                                                          cl_device_id const &d)
+    -> std::size_t {
+  return detail::get_info<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(k, d);
+}
+
+inline auto get_kernel_work_group_info_local_mem_size(cl_kernel const &k,
+                                                      cl_device_id const &d)
+    -> cl_ulong {
+  return detail::get_info<CL_KERNEL_LOCAL_MEM_SIZE>(k, d);
+}
+
+// argument info is only guaranteed when the program was built with
+// -cl-kernel-arg-info.
+inline auto get_kernel_arg_info_address_qualifier(cl_kernel const &k,
+                                                  cl_uint arg)
+    -> cl_kernel_arg_address_qualifier {
+  return detail::get_info<CL_KERNEL_ARG_ADDRESS_QUALIFIER>(k, arg);
+}
+
+inline auto get_kernel_arg_info_type_name(cl_kernel const &k, cl_uint arg)
+    -> std::string {
+  return detail::get_info<CL_KERNEL_ARG_TYPE_NAME>(k, arg);
+}
+
+inline auto get_kernel_arg_info_name(cl_kernel const &k, cl_uint arg)
+    -> std::string {
+  return detail::get_info<CL_KERNEL_ARG_NAME>(k, arg);
+}
+
+inline auto get_platform_id_count() -> uint32_t {
   auto cnt = 0u;
   auto err = clGetPlatformIDs(0, nullptr, &cnt);
   set_err_if_err(err, "clGetPlatformIDs");
   return cnt;
 }
 
-auto get_platform_ids() -> std::vector<cl_platform_id> {
+inline auto get_platform_ids() -> std::vector<cl_platform_id> {
   auto cnt = get_platform_id_count();
   std::vector<cl_platform_id> ids(cnt);
   auto err = clGetPlatformIDs(cnt, ids.data(), nullptr);
@@ -241,15 +555,15 @@ auto get_platform_ids() -> std::vector<cl_platform_id> {
   return ids;
 }
 
-auto get_device_id_count(cl_platform_id const &id, cl_device_type const &type)
-    -> std::size_t {
+inline auto get_device_id_count(cl_platform_id const &id,
+                                cl_device_type const &type) -> std::size_t {
   auto cnt = cl_uint{0};
   auto err = clGetDeviceIDs(id, type, 0, nullptr, &cnt);
   set_err_if_err(err, "clGetDeviceIDs");
   return cnt;
 }
 
-auto get_device_ids(cl_platform_id const &id, cl_device_type const &type)
+inline auto get_device_ids(cl_platform_id const &id, cl_device_type const &type)
     -> std::vector<cl_device_id> {
   auto cnt = get_device_id_count(id, type);
   std::vector<cl_device_id> ids(cnt);
@@ -258,24 +572,53 @@ auto get_device_ids(cl_platform_id const &id, cl_device_type const &type)
   return ids;
 }
 
+// split a device into sub-devices of units compute units each.
+inline auto create_sub_devices_equally(cl_device_id const &id, cl_uint units)
+    -> std::vector<cl_device_id> {
+  cl_device_partition_property props[] = {CL_DEVICE_PARTITION_EQUALLY,
+                                          (cl_device_partition_property)units,
+                                          0};
+  auto cnt = cl_uint{0};
+  auto err = clCreateSubDevices(id, props, 0, nullptr, &cnt);
+  set_err_if_err(err, "clCreateSubDevices");
+  if (err != CL_SUCCESS) {
+    return {};
+  }
+  std::vector<cl_device_id> ids(cnt);
+  err = clCreateSubDevices(id, props, cnt, ids.data(), nullptr);
+  set_err_if_err(err, "clCreateSubDevices");
+  if (err != CL_SUCCESS) {
+    ids.clear();
+  }
+  return ids;
+}
+
 using context_callback = void(CL_CALLBACK *)(const char *errinfo,
                                              const void *private_info,
                                              size_t cb, void *user_data);
 
-auto create_context(cl_platform_id const &platform,
-                    std::vector<cl_device_id> const &devices,
-                    context_callback cb, void *user_data) -> cl_context {
-  cl_int err;
+inline auto create_context(cl_platform_id const &platform,
+                           std::vector<cl_device_id> const &devices,
+                           context_callback cb, void *user_data, cl_int &err)
+    -> cl_context {
   cl_context_properties properties[] = {CL_CONTEXT_PLATFORM,
                                         (cl_context_properties)platform, 0};
-  auto ctx = clCreateContext(properties, devices.size(), devices.data(), cb,
-                             user_data, &err);
+  return clCreateContext(properties, devices.size(), devices.data(), cb,
+                         user_data, &err);
+}
+
+inline auto create_context(cl_platform_id const &platform,
+                           std::vector<cl_device_id> const &devices,
+                           context_callback cb, void *user_data) -> cl_context {
+  cl_int err;
+  auto ctx = create_context(platform, devices, cb, user_data, err);
   set_err_if_err(err, "clCreateContext");
   return ctx;
 }
 
-auto create_context(cl_platform_id const &platform,
-                    std::vector<cl_device_id> const &devices) -> cl_context {
+inline auto create_context(cl_platform_id const &platform,
+                           std::vector<cl_device_id> const &devices)
+    -> cl_context {
   return create_context(platform, devices, nullptr, nullptr);
 }
 
@@ -283,25 +626,38 @@ template <typename... Ts> auto create_context_properties(Ts... ts) {
   return detail::create_context_properties_impl(ts...);
 }
 
-auto create_context_from_type(std::vector<cl_context_properties> const &ps,
-                              cl_device_type const &t, context_callback cb,
-                              void *user_data) -> cl_context {
+inline auto create_context_from_type(
+    std::vector<cl_context_properties> const &ps, cl_device_type const &t,
+    context_callback cb, void *user_data, cl_int &err) -> cl_context {
+  return clCreateContextFromType(ps.data(), t, cb, user_data, &err);
+}
+
+inline auto create_context_from_type(
+    std::vector<cl_context_properties> const &ps, cl_device_type const &t,
+    context_callback cb, void *user_data) -> cl_context {
   cl_int err;
-  auto ctx = clCreateContextFromType(ps.data(), t, cb, user_data, &err);
+  auto ctx = create_context_from_type(ps, t, cb, user_data, err);
   set_err_if_err(err, "clCreateContextFromType");
   return ctx;
 }
-auto create_context_from_type(std::vector<cl_context_properties> const &ps,
-                              cl_device_type const &t) {
+inline auto create_context_from_type(
+    std::vector<cl_context_properties> const &ps, cl_device_type const &t) {
   return create_context_from_type(ps, t, nullptr, nullptr);
 }
 
+template <std::size_t N>
+auto create_context_from_type(std::array<cl_context_properties, N> const &ps,
+                              cl_device_type const &t, context_callback cb,
+                              void *user_data, cl_int &err) -> cl_context {
+  return clCreateContextFromType(ps.data(), t, cb, user_data, &err);
+}
+
 template <std::size_t N>
 auto create_context_from_type(std::array<cl_context_properties, N> const &ps,
                               cl_device_type const &t, context_callback cb,
                               void *user_data) -> cl_context {
   cl_int err;
-  auto ctx = clCreateContextFromType(ps.data(), t, cb, user_data, &err);
+  auto ctx = create_context_from_type(ps, t, cb, user_data, err);
   set_err_if_err(err, "clCreateContextFromType");
   return ctx;
 }
@@ -312,119 +668,541 @@ auto create_context_from_type(std::array<cl_context_properties, N> const &ps,
   return create_context_from_type(ps, t, nullptr, nullptr);
 }
 
-auto create_program(cl_context ctx, char const *file) -> cl_program {
+inline auto read_file(char const *file) -> std::string {
   std::ifstream srcFile(file);
   if (!srcFile.is_open()) {
-    return nullptr;
+    return {};
   }
-  std::string code(std::istreambuf_iterator<char>(srcFile),
-                   (std::istreambuf_iterator<char>()));
+  return std::string(std::istreambuf_iterator<char>(srcFile),
+                     (std::istreambuf_iterator<char>()));
+}
 
-  auto code_ptr = code.c_str();
+inline auto create_program_with_source(cl_context ctx, std::string_view code,
+                                       cl_int &err) -> cl_program {
+  auto code_ptr = code.data();
   auto size_ptr = code.size();
   // Create program from source
+  return clCreateProgramWithSource(ctx, 1, &code_ptr, &size_ptr, &err);
+}
+
+inline auto create_program_with_source(cl_context ctx, std::string_view code)
+    -> cl_program {
   cl_int err;
-  auto program = clCreateProgramWithSource(ctx, 1, &code_ptr, &size_ptr, &err);
+  auto program = create_program_with_source(ctx, code, err);
   set_err_if_err(err, "clCreateProgramWithSource");
   return program;
 }
 
-auto build_program(cl_program const &p, std::vector<cl_device_id> const &ds)
-    -> bool {
+inline auto create_program(cl_context ctx, char const *file) -> cl_program {
+  auto code = read_file(file);
+  if (code.empty()) {
+    return nullptr;
+  }
+  return create_program_with_source(ctx, code);
+}
+
+// binaries[i] is the binary for ds[i].
+inline auto create_program_with_binary(
+    cl_context ctx, std::vector<cl_device_id> const &ds,
+    std::vector<std::vector<unsigned char>> const &binaries, cl_int &err)
+    -> cl_program {
+  auto sizes = std::vector<std::size_t>{};
+  auto ptrs = std::vector<unsigned char const *>{};
+  for (auto const &b : binaries) {
+    sizes.push_back(b.size());
+    ptrs.push_back(b.data());
+  }
+  auto status = std::vector<cl_int>(ds.size());
+  return clCreateProgramWithBinary(ctx, ds.size(), ds.data(), sizes.data(),
+                                   ptrs.data(), status.data(), &err);
+}
+
+inline auto create_program_with_binary(
+    cl_context ctx, std::vector<cl_device_id> const &ds,
+    std::vector<std::vector<unsigned char>> const &binaries) -> cl_program {
+  cl_int err;
+  auto program = create_program_with_binary(ctx, ds, binaries, err);
+  set_err_if_err(err, "clCreateProgramWithBinary");
+  return program;
+}
+
+inline auto build_program(cl_program const &p,
+                          std::vector<cl_device_id> const &ds,
+                          char const *options, cl_int &err) -> bool {
   // Build program
-  auto err = clBuildProgram(p, ds.size(), ds.data(), nullptr, nullptr, nullptr);
-  set_err_if_err(err, "clBuildProgram");
+  err = clBuildProgram(p, ds.size(), ds.data(), options, nullptr, nullptr);
   return err == CL_SUCCESS;
 }
 
-auto create_kernel(cl_program const &p, char const *name) -> cl_kernel {
+inline auto build_program(cl_program const &p,
+                          std::vector<cl_device_id> const &ds,
+                          char const *options) -> bool {
   cl_int err;
-  auto kernel = clCreateKernel(p, name, &err);
+  auto ok = build_program(p, ds, options, err);
+  set_err_if_err(err, "clBuildProgram");
+  return ok;
+}
+
+inline auto build_program(cl_program const &p,
+                          std::vector<cl_device_id> const &ds) -> bool {
+  return build_program(p, ds, nullptr);
+}
+
+inline auto create_kernel(cl_program const &p, char const *name, cl_int &err)
+    -> cl_kernel {
+  return clCreateKernel(p, name, &err);
+}
+
+inline auto create_kernel(cl_program const &p, char const *name) -> cl_kernel {
+  cl_int err;
+  auto kernel = create_kernel(p, name, err);
   set_err_if_err(err, "clCreateKernel");
   return kernel;
 }
 
-auto create_buffer(cl_context const &ctx, cl_mem_flags const &flags,
-                   size_t size, void *host_ptr) -> cl_mem {
+inline auto create_buffer(cl_context const &ctx, cl_mem_flags const &flags,
+                          size_t size, void *host_ptr, cl_int &err) -> cl_mem {
+  return clCreateBuffer(ctx, flags, size, host_ptr, &err);
+}
+
+inline auto create_buffer(cl_context const &ctx, cl_mem_flags const &flags,
+                          size_t size, void *host_ptr) -> cl_mem {
   auto err = cl_int{};
-  auto mem = clCreateBuffer(ctx, flags, size, host_ptr, &err);
+  auto mem = create_buffer(ctx, flags, size, host_ptr, err);
   set_err_if_err(err, "clCreateBuffer");
   return mem;
 }
 
-auto create_command_queue(cl_context const &c, cl_device_id const &d,
-                          cl_command_queue_properties const &ps)
+// origin must be a multiple of get_device_info_mem_base_addr_align() for
+// every device in the context.
+inline auto create_sub_buffer(cl_mem const &buffer, cl_mem_flags const &flags,
+                              size_t origin, size_t size, cl_int &err)
+    -> cl_mem {
+  cl_buffer_region region = {origin, size};
+  return clCreateSubBuffer(buffer, flags, CL_BUFFER_CREATE_TYPE_REGION, &region,
+                           &err);
+}
+
+inline auto create_sub_buffer(cl_mem const &buffer, cl_mem_flags const &flags,
+                              size_t origin, size_t size) -> cl_mem {
+  auto err = cl_int{};
+  auto mem = create_sub_buffer(buffer, flags, origin, size, err);
+  set_err_if_err(err, "clCreateSubBuffer");
+  return mem;
+}
+
+inline auto create_command_queue(cl_context const &c, cl_device_id const &d,
+                                 cl_command_queue_properties const &ps,
+                                 cl_int &err) -> cl_command_queue {
+  return clCreateCommandQueue(c, d, ps, &err);
+}
+
+inline auto create_command_queue(cl_context const &c, cl_device_id const &d,
+                                 cl_command_queue_properties const &ps)
     -> cl_command_queue {
   auto err = cl_int{};
-  auto q = clCreateCommandQueue(c, d, ps, &err);
+  auto q = create_command_queue(c, d, ps, err);
   set_err_if_err(err, "clCreateCommandQueue");
   return q;
 }
 
-auto set_arguments_impl(cl_kernel const &k, std::size_t i) {
+// OpenCL C name of a host scalar type, as reported by CL_KERNEL_ARG_TYPE_NAME.
+// types without a name here are not checked.
+template <typename T> struct type_name {
+  static constexpr char const *value = nullptr;
+};
+template <> struct type_name<cl_char> {
+  static constexpr char const *value = "char";
+};
+template <> struct type_name<cl_uchar> {
+  static constexpr char const *value = "uchar";
+};
+template <> struct type_name<cl_short> {
+  static constexpr char const *value = "short";
+};
+template <> struct type_name<cl_ushort> {
+  static constexpr char const *value = "ushort";
+};
+template <> struct type_name<cl_int> {
+  static constexpr char const *value = "int";
+};
+template <> struct type_name<cl_uint> {
+  static constexpr char const *value = "uint";
+};
+template <> struct type_name<cl_long> {
+  static constexpr char const *value = "long";
+};
+template <> struct type_name<cl_ulong> {
+  static constexpr char const *value = "ulong";
+};
+template <> struct type_name<cl_float> {
+  static constexpr char const *value = "float";
+};
+template <> struct type_name<cl_double> {
+  static constexpr char const *value = "double";
+};
+
+// __local memory for count elements of T, allocated by the runtime for each
+// launch, so tiles can be sized to the work-group chosen at run time.
+template <typename T> struct local {
+  explicit local(std::size_t n) : count(n) {}
+  std::size_t count;
+};
+
+// a buffer bound to a global or constant T* argument.
+template <typename T> struct buffer {
+  explicit buffer(cl_mem m) : mem(m) {}
+  cl_mem mem;
+};
+
+// an image bound to an image2d_t / image3d_t ... argument.
+struct image {
+  explicit image(cl_mem m) : mem(m) {}
+  cl_mem mem;
+};
+
+// how a host value is handed to clSetKernelArg, and which declared arguments
+// it may be bound to. plain values are passed by size and address to private
+// arguments of the same type.
+template <typename T> struct kernel_arg {
+  static auto size(T const &) -> std::size_t { return sizeof(T); }
+  static auto value(T const &t) -> void const * { return &t; }
+  static auto accepts(cl_kernel_arg_address_qualifier q, char const *type)
+      -> bool {
+    auto name = type_name<T>::value;
+    return q == CL_KERNEL_ARG_ADDRESS_PRIVATE &&
+           (!name || std::strcmp(type, name) == 0);
+  }
+};
+
+// untyped memory objects go to any buffer or image argument.
+template <> struct kernel_arg<cl_mem> {
+  static auto size(cl_mem const &) -> std::size_t { return sizeof(cl_mem); }
+  static auto value(cl_mem const &m) -> void const * { return &m; }
+  static auto accepts(cl_kernel_arg_address_qualifier q, char const *)
+      -> bool {
+    return q == CL_KERNEL_ARG_ADDRESS_GLOBAL ||
+           q == CL_KERNEL_ARG_ADDRESS_CONSTANT;
+  }
+};
+
+template <> struct kernel_arg<cl_sampler> {
+  static auto size(cl_sampler const &) -> std::size_t {
+    return sizeof(cl_sampler);
+  }
+  static auto value(cl_sampler const &s) -> void const * { return &s; }
+  static auto accepts(cl_kernel_arg_address_qualifier q, char const *type)
+      -> bool {
+    return q == CL_KERNEL_ARG_ADDRESS_PRIVATE &&
+           std::strcmp(type, "sampler_t") == 0;
+  }
+};
+
+template <typename T> struct kernel_arg<local<T>> {
+  static auto size(local<T> const &l) -> std::size_t {
+    return l.count * sizeof(T);
+  }
+  static auto value(local<T> const &) -> void const * { return nullptr; }
+  static auto accepts(cl_kernel_arg_address_qualifier q, char const *)
+      -> bool {
+    return q == CL_KERNEL_ARG_ADDRESS_LOCAL;
+  }
+};
+
+template <typename T> struct kernel_arg<buffer<T>> {
+  static auto size(buffer<T> const &) -> std::size_t { return sizeof(cl_mem); }
+  static auto value(buffer<T> const &b) -> void const * { return &b.mem; }
+  static auto accepts(cl_kernel_arg_address_qualifier q, char const *type)
+      -> bool {
+    if (q != CL_KERNEL_ARG_ADDRESS_GLOBAL &&
+        q != CL_KERNEL_ARG_ADDRESS_CONSTANT) {
+      return false;
+    }
+    auto name = type_name<T>::value;
+    auto n = name ? std::strlen(name) : 0;
+    return !name || (std::strncmp(type, name, n) == 0 &&
+                     std::strcmp(type + n, "*") == 0);
+  }
+};
+
+template <> struct kernel_arg<image> {
+  static auto size(image const &) -> std::size_t { return sizeof(cl_mem); }
+  static auto value(image const &i) -> void const * { return &i.mem; }
+  static auto accepts(cl_kernel_arg_address_qualifier q, char const *type)
+      -> bool {
+    return q == CL_KERNEL_ARG_ADDRESS_GLOBAL &&
+           std::strncmp(type, "image", 5) == 0;
+  }
+};
+
+// whether argument i of k accepts a T. CL_KERNEL_ARG_INFO_NOT_AVAILABLE when
+// the program kept no argument info, CL_INVALID_ARG_VALUE on a mismatch.
+template <typename T>
+auto check_argument(cl_kernel const &k, cl_uint i, T const &) -> cl_int {
+  auto q = cl_kernel_arg_address_qualifier{};
+  auto err = clGetKernelArgInfo(k, i, CL_KERNEL_ARG_ADDRESS_QUALIFIER,
+                                sizeof(q), &q, nullptr);
+  if (err != CL_SUCCESS) {
+    return err;
+  }
+  auto type = get_kernel_arg_info_type_name(k, i);
+  if (!kernel_arg<T>::accepts(q, type.c_str())) {
+    return CL_INVALID_ARG_VALUE;
+  }
+  return CL_SUCCESS;
+}
+
+inline auto check_arguments_impl(cl_kernel const &, cl_uint) -> cl_int {
+  return CL_SUCCESS;
+}
+
+template <typename T, typename... Ts>
+auto check_arguments_impl(cl_kernel const &k, cl_uint i, T const &t,
+                          Ts const &... ts) -> cl_int {
+  auto err = check_argument(k, i, t);
+  if (err != CL_SUCCESS) {
+    return err;
+  }
+  return check_arguments_impl(k, i + 1, ts...);
+}
+
+// checks count, address spaces and, where known, types of the arguments
+// against the kernel's declaration without binding them. a program built
+// without argument info passes unchecked.
+template <typename... Ts>
+auto check_arguments(cl_kernel const &k, Ts const &... ts) -> cl_int {
+  auto err = cl_int{CL_SUCCESS};
+  if (get_kernel_info_num_args(k) != sizeof...(Ts)) {
+    err = CL_INVALID_KERNEL_ARGS;
+  } else {
+    err = check_arguments_impl(k, 0, ts...);
+  }
+  if (err == CL_KERNEL_ARG_INFO_NOT_AVAILABLE) {
+    return CL_SUCCESS;
+  }
+  set_err_if_err(err, "check_arguments");
+  return err;
+}
+
+inline auto set_arguments_impl(cl_kernel const &, std::size_t) -> cl_int {
   return CL_SUCCESS;
 }
 
+// stops at the first argument that fails and returns its error.
 template <typename T, typename... Ts>
 auto set_arguments_impl(cl_kernel const &k, std::size_t i, T const &t,
-                        Ts... ts) {
-  auto err = clSetKernelArg(k, i, sizeof(T), &t);
-  set_err_if_err(err, "clSetKernelArg");
+                        Ts... ts) -> cl_int {
+  auto err = clSetKernelArg(k, i, kernel_arg<T>::size(t),
+                            kernel_arg<T>::value(t));
+  if (err != CL_SUCCESS) {
+    set_err_if_err(err, "clSetKernelArg");
+    return err;
+  }
   return set_arguments_impl(k, i + 1, ts...);
 }
 
-template <typename... Ts> auto set_arguments(cl_kernel const &k, Ts... ts) {
+// a cl_kernel holds its arguments, so threads setting arguments concurrently
+// need a kernel object each (see clCreateKernel).
+template <typename... Ts>
+auto set_arguments(cl_kernel const &k, Ts... ts) -> cl_int {
   return set_arguments_impl(k, 0, ts...);
 }
 
-auto to_string(cl_device_id const &id) -> std::string {
+inline auto to_string(cl_device_id const &id) -> std::string {
   return fmt::format("[name:{}, vendor:{}, profile:{}, type:{}, extensions:{}]",
                      get_device_info_name(id), get_device_info_vendor(id),
                      get_device_info_profile(id), get_device_info_type(id),
                      get_device_info_extensions(id));
 }
 
-auto to_string(cl_platform_id const &id) -> std::string {
+inline auto to_string(cl_platform_id const &id) -> std::string {
   return fmt::format("[name:{}, vendor:{}, profile:{},  extensions:{}]",
                      get_platform_info_name(id), get_platform_info_vendor(id),
                      get_platform_info_profile(id),
                      get_platform_info_extensions(id));
 }
 
-auto enqueue_nd_ranage_kernel(
-    cl_command_queue command_queue, cl_kernel kernel, cl_uint work_dim,
-    const size_t *global_work_offset, const size_t *global_work_size,
-    const size_t *local_work_size, cl_uint num_events_in_wait_list,
-    const cl_event *event_wait_list, cl_event *event) -> cl_int {
-  return clEnqueueNDRangeKernel(
+inline auto enqueue_nd_ranage_kernel(cl_command_queue command_queue,
+                                     cl_kernel kernel, cl_uint work_dim,
+                                     const size_t *global_work_offset,
+                                     const size_t *global_work_size,
+                                     const size_t *local_work_size,
+                                     cl_uint num_events_in_wait_list,
+                                     const cl_event *event_wait_list,
+                                     cl_event *event) -> cl_int {
+  auto t = trace_scope{command_queue, "clEnqueueNDRangeKernel", event};
+  t.kernel(kernel);
+  auto err = clEnqueueNDRangeKernel(
       command_queue, kernel, work_dim, global_work_offset, global_work_size,
-      local_work_size, num_events_in_wait_list, event_wait_list, event);
+      local_work_size, num_events_in_wait_list, event_wait_list, t.event());
+  t.end(err);
+  set_err_if_err(err, "clEnqueueNDRangeKernel");
+  return err;
 }
 
-auto enqueue_nd_ranage_kernel(cl_command_queue command_queue, cl_kernel kernel,
-                              cl_uint work_dim,
-                              const size_t *global_work_offset,
-                              const size_t *global_work_size,
-                              const size_t *local_work_size) -> cl_int {
+inline auto enqueue_nd_ranage_kernel(cl_command_queue command_queue,
+                                     cl_kernel kernel, cl_uint work_dim,
+                                     const size_t *global_work_offset,
+                                     const size_t *global_work_size,
+                                     const size_t *local_work_size) -> cl_int {
   return enqueue_nd_ranage_kernel(command_queue, kernel, work_dim,
                                   global_work_offset, global_work_size,
                                   local_work_size, 0, nullptr, nullptr);
 }
 
-auto enqueue_read_buffer(cl_command_queue command_queue, cl_mem buffer,
-                         cl_bool blocking_read, size_t offset, size_t cb,
-                         void *ptr, cl_uint num_events_in_wait_list,
-                         const cl_event *event_wait_list, cl_event *event)
-    -> cl_int {
-  return clEnqueueReadBuffer(command_queue, buffer, blocking_read, offset, cb,
-                             ptr, num_events_in_wait_list, event_wait_list,
-                             event);
+inline auto enqueue_read_buffer(cl_command_queue command_queue, cl_mem buffer,
+                                cl_bool blocking_read, size_t offset, size_t cb,
+                                void *ptr, cl_uint num_events_in_wait_list,
+                                const cl_event *event_wait_list,
+                                cl_event *event) -> cl_int {
+  auto t = trace_scope{command_queue, "clEnqueueReadBuffer", event};
+  auto err = clEnqueueReadBuffer(command_queue, buffer, blocking_read, offset,
+                                 cb, ptr, num_events_in_wait_list,
+                                 event_wait_list, t.event());
+  t.end(err);
+  set_err_if_err(err, "clEnqueueReadBuffer");
+  return err;
 }
 
-auto enqueue_read_buffer(cl_command_queue command_queue, cl_mem buffer,
-                         cl_bool blocking_read, size_t offset, size_t cb,
-                         void *ptr) -> cl_int {
+inline auto enqueue_read_buffer(cl_command_queue command_queue, cl_mem buffer,
+                                cl_bool blocking_read, size_t offset, size_t cb,
+                                void *ptr) -> cl_int {
   return enqueue_read_buffer(command_queue, buffer, blocking_read, offset, cb,
                              ptr, 0, nullptr, nullptr);
 }
+
+inline auto enqueue_write_buffer(cl_command_queue command_queue, cl_mem buffer,
+                                 cl_bool blocking_write, size_t offset,
+                                 size_t cb, const void *ptr,
+                                 cl_uint num_events_in_wait_list,
+                                 const cl_event *event_wait_list,
+                                 cl_event *event) -> cl_int {
+  auto t = trace_scope{command_queue, "clEnqueueWriteBuffer", event};
+  auto err = clEnqueueWriteBuffer(command_queue, buffer, blocking_write, offset,
+                                  cb, ptr, num_events_in_wait_list,
+                                  event_wait_list, t.event());
+  t.end(err);
+  set_err_if_err(err, "clEnqueueWriteBuffer");
+  return err;
+}
+
+inline auto enqueue_write_buffer(cl_command_queue command_queue, cl_mem buffer,
+                                 cl_bool blocking_write, size_t offset,
+                                 size_t cb, const void *ptr) -> cl_int {
+  return enqueue_write_buffer(command_queue, buffer, blocking_write, offset, cb,
+                              ptr, 0, nullptr, nullptr);
+}
+
+inline auto enqueue_map_buffer(cl_command_queue command_queue, cl_mem buffer,
+                               cl_bool blocking_map, cl_map_flags map_flags,
+                               size_t offset, size_t cb,
+                               cl_uint num_events_in_wait_list,
+                               const cl_event *event_wait_list, cl_event *event,
+                               cl_int &err) -> void * {
+  auto t = trace_scope{command_queue, "clEnqueueMapBuffer", event};
+  auto ptr = clEnqueueMapBuffer(command_queue, buffer, blocking_map, map_flags,
+                                offset, cb, num_events_in_wait_list,
+                                event_wait_list, t.event(), &err);
+  t.end(err);
+  return ptr;
+}
+
+inline auto enqueue_map_buffer(cl_command_queue command_queue, cl_mem buffer,
+                               cl_bool blocking_map, cl_map_flags map_flags,
+                               size_t offset, size_t cb) -> void * {
+  auto err = cl_int{};
+  auto ptr = enqueue_map_buffer(command_queue, buffer, blocking_map, map_flags,
+                                offset, cb, 0, nullptr, nullptr, err);
+  set_err_if_err(err, "clEnqueueMapBuffer");
+  return ptr;
+}
+
+inline auto enqueue_map_image(cl_command_queue command_queue, cl_mem image,
+                              cl_bool blocking_map, cl_map_flags map_flags,
+                              const size_t *origin, const size_t *region,
+                              size_t *image_row_pitch,
+                              size_t *image_slice_pitch,
+                              cl_uint num_events_in_wait_list,
+                              const cl_event *event_wait_list, cl_event *event,
+                              cl_int &err) -> void * {
+  auto t = trace_scope{command_queue, "clEnqueueMapImage", event};
+  auto ptr = clEnqueueMapImage(command_queue, image, blocking_map, map_flags,
+                               origin, region, image_row_pitch,
+                               image_slice_pitch, num_events_in_wait_list,
+                               event_wait_list, t.event(), &err);
+  t.end(err);
+  return ptr;
+}
+
+inline auto enqueue_map_image(cl_command_queue command_queue, cl_mem image,
+                              cl_bool blocking_map, cl_map_flags map_flags,
+                              const size_t *origin, const size_t *region,
+                              size_t *image_row_pitch) -> void * {
+  auto err = cl_int{};
+  auto ptr = enqueue_map_image(command_queue, image, blocking_map, map_flags,
+                               origin, region, image_row_pitch, nullptr, 0,
+                               nullptr, nullptr, err);
+  set_err_if_err(err, "clEnqueueMapImage");
+  return ptr;
+}
+
+inline auto enqueue_unmap_mem_object(cl_command_queue command_queue,
+                                     cl_mem memobj, void *mapped_ptr,
+                                     cl_uint num_events_in_wait_list,
+                                     const cl_event *event_wait_list,
+                                     cl_event *event) -> cl_int {
+  auto t = trace_scope{command_queue, "clEnqueueUnmapMemObject", event};
+  auto err = clEnqueueUnmapMemObject(command_queue, memobj, mapped_ptr,
+                                     num_events_in_wait_list, event_wait_list,
+                                     t.event());
+  t.end(err);
+  set_err_if_err(err, "clEnqueueUnmapMemObject");
+  return err;
+}
+
+inline auto enqueue_unmap_mem_object(cl_command_queue command_queue,
+                                     cl_mem memobj, void *mapped_ptr)
+    -> cl_int {
+  return enqueue_unmap_mem_object(command_queue, memobj, mapped_ptr, 0, nullptr,
+                                  nullptr);
+}
+
+inline auto finish(cl_command_queue command_queue) -> cl_int {
+  auto err = clFinish(command_queue);
+  set_err_if_err(err, "clFinish");
+  return err;
+}
+
+inline auto get_command_queue_info_device(cl_command_queue const &q)
+    -> cl_device_id {
+  auto d = cl_device_id{};
+  auto err = clGetCommandQueueInfo(q, CL_QUEUE_DEVICE, sizeof(d), &d, nullptr);
+  set_err_if_err(err, "clGetCommandQueueInfo");
+  return d;
+}
+
+inline auto get_command_queue_info_properties(cl_command_queue const &q)
+    -> cl_command_queue_properties {
+  auto ps = cl_command_queue_properties{};
+  auto err =
+      clGetCommandQueueInfo(q, CL_QUEUE_PROPERTIES, sizeof(ps), &ps, nullptr);
+  set_err_if_err(err, "clGetCommandQueueInfo");
+  return ps;
+}
+
+// device time in nanoseconds; the queue needs CL_QUEUE_PROFILING_ENABLE.
+inline auto get_event_profiling_info(cl_event const &e, cl_profiling_info info)
+    -> cl_ulong {
+  auto t = cl_ulong{};
+  auto err = clGetEventProfilingInfo(e, info, sizeof(t), &t, nullptr);
+  set_err_if_err(err, "clGetEventProfilingInfo");
+  return t;
+}
+
+// execution time of a completed command, from start to end.
+inline auto get_event_elapsed_ms(cl_event const &e) -> double {
+  auto start = get_event_profiling_info(e, CL_PROFILING_COMMAND_START);
+  auto end = get_event_profiling_info(e, CL_PROFILING_COMMAND_END);
+  return end > start ? (end - start) * 1e-6 : 0.0;
+}
 } // namespace clx
@@ -0,0 +1,459 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "clx.hpp"
+#include "device_caps.hpp"
+#include "kernels.hpp"
+
+namespace clx {
+
+// The valid 2D convolution of a width x height uint signal with a square
+// mask, into (width - m + 1) x (height - m + 1) outputs, as the tiled
+// convolve_tiled kernel of Convolution.cl. The program is built for one mask
+// width; given its values, the mask is baked in as well and the mask
+// argument of enqueue() is ignored.
+class tiled_convolution {
+public:
+  static constexpr std::size_t local_x = 16;
+  static constexpr std::size_t outputs_per_item = 4;
+
+  tiled_convolution(cl_context ctx, cl_device_id d, int mask_width,
+                    std::vector<cl_uint> const &mask = {})
+      : mask_width_(mask_width) {
+    auto const &caps = device_caps_of(d);
+    local_y_ = std::clamp<std::size_t>(caps.max_work_group_size / local_x, 1,
+                                       8);
+    // fewer rows per work-group when the halo of a large mask does not fit
+    while (local_y_ > 1 && mask_width > 0 &&
+           tile_bytes() > caps.local_mem_size) {
+      local_y_ /= 2;
+    }
+    auto taps = std::size_t(std::max(mask_width, 0)) * mask_width;
+    if (mask_width < 1 || tile_bytes() > caps.local_mem_size ||
+        (!mask.empty() && mask.size() != taps)) {
+      set_err_if_err(CL_INVALID_VALUE, "tiled_convolution");
+      return;
+    }
+
+    // the kernel requires local_x x local_y_ work-groups, and the build of a
+    // large unrolled mask can allow fewer work-items than the device does;
+    // rebuild with fewer rows then
+    while (build(ctx, d, mask)) {
+      auto limit = get_kernel_work_group_info_size(kernel_, d);
+      if (local_x * local_y_ <= limit) {
+        break;
+      }
+      release_program();
+      if (limit < local_x) {
+        set_err_if_err(CL_INVALID_WORK_GROUP_SIZE, "tiled_convolution");
+        return;
+      }
+      while (local_x * local_y_ > limit) {
+        local_y_ /= 2;
+      }
+    }
+  }
+
+  tiled_convolution(tiled_convolution const &) = delete;
+  auto operator=(tiled_convolution const &) -> tiled_convolution & = delete;
+
+  ~tiled_convolution() { release_program(); }
+
+  explicit operator bool() const { return kernel_ != nullptr; }
+
+  auto mask_width() const -> int { return mask_width_; }
+  // set when the program failed to build.
+  auto build_log() const -> std::string const & { return log_; }
+
+  // output holds (width - m + 1) * (height - m + 1) uints, row by row. mask
+  // may be null when the values are baked in.
+  auto enqueue(cl_command_queue q, cl_mem input, cl_mem mask, cl_mem output,
+               std::size_t width, std::size_t height,
+               cl_uint num_events_in_wait_list = 0,
+               const cl_event *event_wait_list = nullptr,
+               cl_event *event = nullptr) -> cl_int {
+    auto m = std::size_t(mask_width_);
+    if (width < m || height < m) {
+      return CL_INVALID_VALUE;
+    }
+    auto err = set_arguments(kernel_, input, mask, output, cl_int(width),
+                             cl_int(height));
+    if (err != CL_SUCCESS) {
+      return err;
+    }
+    auto tile_w = local_x * outputs_per_item;
+    auto out_w = width - m + 1;
+    auto out_h = height - m + 1;
+    size_t local[2] = {local_x, local_y_};
+    size_t global[2] = {(out_w + tile_w - 1) / tile_w * local_x,
+                        (out_h + local_y_ - 1) / local_y_ * local_y_};
+    return enqueue_nd_ranage_kernel(q, kernel_, 2, nullptr, global, local,
+                                    num_events_in_wait_list, event_wait_list,
+                                    event);
+  }
+
+private:
+  // builds the program for local_y_ and creates its kernel. false, with the
+  // program released, when either fails.
+  auto build(cl_context ctx, cl_device_id d, std::vector<cl_uint> const &mask)
+      -> bool {
+    auto options = fmt::format("-D MASK_WIDTH={} -D LOCAL_X={} -D LOCAL_Y={}",
+                               mask_width_, local_x, local_y_);
+    if (!mask.empty()) {
+      options += " -D MASK_VALUES=";
+      for (auto i = std::size_t{0}; i < mask.size(); i++) {
+        options += fmt::format("{}{}u", i ? "," : "", mask[i]);
+      }
+    }
+    program_ = create_program_with_source(ctx, kernel::convolution.text);
+    if (!program_) {
+      return false;
+    }
+    if (!build_program(program_, {d}, options.c_str())) {
+      log_ = get_program_build_info_log(program_, d);
+      release_program();
+      return false;
+    }
+    kernel_ = create_kernel(program_, "convolve_tiled");
+    if (!kernel_) {
+      release_program();
+      return false;
+    }
+    return true;
+  }
+
+  auto release_program() -> void {
+    if (kernel_) {
+      clReleaseKernel(kernel_);
+      kernel_ = nullptr;
+    }
+    if (program_) {
+      clReleaseProgram(program_);
+      program_ = nullptr;
+    }
+  }
+
+  // the input tile with its halo, in whole uint4s per row.
+  auto tile_bytes() const -> cl_ulong {
+    auto m = std::size_t(mask_width_);
+    auto vecs = (local_x * outputs_per_item + m - 1 + 3) / 4;
+    return (local_y_ + m - 1) * vecs * 4 * sizeof(cl_uint);
+  }
+
+  int mask_width_;
+  std::size_t local_y_ = 0;
+  std::string log_;
+  cl_program program_ = nullptr;
+  cl_kernel kernel_ = nullptr;
+};
+
+// The same convolution through 2D FFTs of overlapping n x n tiles
+// (overlap-save, fft_convolution.cl): O(log n) work per output instead of
+// O(m^2), for large masks. The mask spectrum is computed once, at
+// construction. Sums are computed in float and rounded, so the outputs are
+// exact only while they stay well within float precision (about 2^24);
+// tiled_convolution is exact in uint arithmetic.
+//
+// the tile buffers are kept across calls, so calls must be made from one
+// thread on one in-order queue.
+class fft_convolution {
+public:
+  // tiles of at most this many bytes per complex work buffer are transformed
+  // in one batch.
+  static constexpr std::size_t batch_bytes = 32 << 20;
+
+  // tile_size, a power of two of at least the mask width, defaults to four
+  // times the mask width and at least 64, so most of each tile is output.
+  fft_convolution(cl_context ctx, cl_device_id d, int mask_width,
+                  std::vector<cl_uint> const &mask, std::size_t tile_size = 0)
+      : ctx_(ctx), mask_width_(mask_width) {
+    auto m = std::size_t(std::max(mask_width, 0));
+    n_ = tile_size;
+    if (n_ == 0) {
+      n_ = 64;
+      while (n_ < 4 * m) {
+        n_ *= 2;
+      }
+    }
+    if (m < 1 || mask.size() != m * m || n_ < std::max<std::size_t>(m, 2) ||
+        (n_ & (n_ - 1)) != 0) {
+      set_err_if_err(CL_INVALID_VALUE, "fft_convolution");
+      return;
+    }
+    auto const &caps = device_caps_of(d);
+    batch_ = std::max<std::size_t>(
+        1, std::min<cl_ulong>(batch_bytes, caps.max_mem_alloc_size) /
+               (n_ * n_ * 2 * sizeof(cl_float)));
+
+    program_ = create_program_with_source(ctx, kernel::fft_convolution.text);
+    if (!program_) {
+      return;
+    }
+    if (!build_program(program_, {d})) {
+      log_ = get_program_build_info_log(program_, d);
+      return;
+    }
+    radix2_ = create_kernel(program_, "fft_radix2");
+    radix4_ = create_kernel(program_, "fft_radix4");
+    load_ = create_kernel(program_, "fft_load_tiles");
+    store_ = create_kernel(program_, "fft_store_tiles");
+    multiply_ = create_kernel(program_, "fft_multiply");
+    if (radix2_ && radix4_ && load_ && store_ && multiply_) {
+      compute_spectrum(d, mask);
+    }
+  }
+
+  fft_convolution(fft_convolution const &) = delete;
+  auto operator=(fft_convolution const &) -> fft_convolution & = delete;
+
+  ~fft_convolution() {
+    for (auto m : {spectrum_, work_[0], work_[1]}) {
+      if (m) {
+        clReleaseMemObject(m);
+      }
+    }
+    for (auto k : {radix2_, radix4_, load_, store_, multiply_}) {
+      if (k) {
+        clReleaseKernel(k);
+      }
+    }
+    if (program_) {
+      clReleaseProgram(program_);
+    }
+  }
+
+  explicit operator bool() const { return spectrum_ != nullptr; }
+
+  auto mask_width() const -> int { return mask_width_; }
+  auto tile_size() const -> std::size_t { return n_; }
+  // set when the program failed to build.
+  auto build_log() const -> std::string const & { return log_; }
+
+  // output holds (width - m + 1) * (height - m + 1) uints, row by row.
+  auto enqueue(cl_command_queue q, cl_mem input, cl_mem output,
+               std::size_t width, std::size_t height,
+               cl_uint num_events_in_wait_list = 0,
+               const cl_event *event_wait_list = nullptr,
+               cl_event *event = nullptr) -> cl_int {
+    auto m = std::size_t(mask_width_);
+    if (width < m || height < m) {
+      return CL_INVALID_VALUE;
+    }
+    auto out_w = width - m + 1;
+    auto out_h = height - m + 1;
+    auto step = n_ - m + 1;
+    auto tiles_x = (out_w + step - 1) / step;
+    auto tiles = tiles_x * ((out_h + step - 1) / step);
+    auto err = ensure_work(std::min(tiles, batch_));
+    for (auto first = std::size_t{0}; err == CL_SUCCESS && first < tiles;
+         first += batch_) {
+      auto count = std::min(batch_, tiles - first);
+      auto last = first + count == tiles;
+      auto cur = 0;
+      err = set_arguments(load_, input, cl_int(width), cl_int(height),
+                          cl_int(tiles_x), cl_int(step), cl_int(n_),
+                          cl_int(first), work_[0]);
+      if (err == CL_SUCCESS) {
+        size_t global[3] = {n_, n_, count};
+        err = enqueue_nd_ranage_kernel(
+            q, load_, 3, nullptr, global, nullptr,
+            first == 0 ? num_events_in_wait_list : 0,
+            first == 0 ? event_wait_list : nullptr, nullptr);
+      }
+      if (err == CL_SUCCESS) {
+        err = transform(q, count, -1.0f, cur);
+      }
+      if (err == CL_SUCCESS) {
+        err = set_arguments(multiply_, work_[cur], spectrum_,
+                            cl_int(n_ * n_), cl_float(1.0f / (n_ * n_)));
+      }
+      if (err == CL_SUCCESS) {
+        size_t global[2] = {n_ * n_, count};
+        err = enqueue_nd_ranage_kernel(q, multiply_, 2, nullptr, global,
+                                       nullptr);
+      }
+      if (err == CL_SUCCESS) {
+        err = transform(q, count, 1.0f, cur);
+      }
+      if (err == CL_SUCCESS) {
+        err = set_arguments(store_, work_[cur], output, cl_int(out_w),
+                            cl_int(out_h), cl_int(tiles_x), cl_int(step),
+                            cl_int(n_), cl_int(first));
+      }
+      if (err == CL_SUCCESS) {
+        size_t global[3] = {step, step, count};
+        err = enqueue_nd_ranage_kernel(q, store_, 3, nullptr, global, nullptr,
+                                       0, nullptr, last ? event : nullptr);
+      }
+    }
+    return err;
+  }
+
+private:
+  // grows the two ping-pong buffers to hold count tiles.
+  auto ensure_work(std::size_t count) -> cl_int {
+    auto bytes = count * n_ * n_ * 2 * sizeof(cl_float);
+    if (work_[0] && work_size_ >= bytes) {
+      return CL_SUCCESS;
+    }
+    work_size_ = 0;
+    for (auto &w : work_) {
+      if (w) {
+        clReleaseMemObject(w);
+      }
+      w = create_buffer(ctx_, CL_MEM_READ_WRITE, bytes, nullptr);
+      if (!w) {
+        return last_error();
+      }
+    }
+    work_size_ = bytes;
+    return CL_SUCCESS;
+  }
+
+  // the 2D transform of count tiles in work_[cur], rows then columns, one
+  // Stockham pass per radix; cur is left on the buffer holding the result.
+  auto transform(cl_command_queue q, std::size_t count, float sign, int &cur)
+      -> cl_int {
+    auto log2n = 0;
+    while ((std::size_t{1} << log2n) < n_) {
+      log2n++;
+    }
+    for (auto rows : {true, false}) {
+      auto stride = rows ? 1 : n_;
+      auto dist = rows ? n_ : 1;
+      auto ns = std::size_t{1};
+      for (auto pass = 0; pass < (log2n + 1) / 2; pass++) {
+        // the radix-2 pass, if any, comes first
+        auto radix = pass == 0 && log2n % 2 ? 2 : 4;
+        auto k = radix == 2 ? radix2_ : radix4_;
+        auto err = set_arguments(k, work_[cur], work_[1 - cur], cl_int(n_),
+                                 cl_int(ns), cl_int(stride), cl_int(dist),
+                                 cl_float(sign));
+        if (err != CL_SUCCESS) {
+          return err;
+        }
+        size_t global[3] = {n_ / radix, n_, count};
+        err = enqueue_nd_ranage_kernel(q, k, 3, nullptr, global, nullptr);
+        if (err != CL_SUCCESS) {
+          return err;
+        }
+        cur = 1 - cur;
+        ns *= radix;
+      }
+    }
+    return CL_SUCCESS;
+  }
+
+  // the forward transform of the zero-padded mask, on a queue of its own.
+  auto compute_spectrum(cl_device_id d, std::vector<cl_uint> const &mask)
+      -> void {
+    auto q = create_command_queue(ctx_, d, 0);
+    auto values = create_buffer(ctx_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                mask.size() * sizeof(cl_uint),
+                                const_cast<cl_uint *>(mask.data()));
+    auto bytes = n_ * n_ * 2 * sizeof(cl_float);
+    auto spectrum = create_buffer(ctx_, CL_MEM_READ_ONLY, bytes, nullptr);
+    auto err = q && values && spectrum ? ensure_work(1) : last_error();
+    auto cur = 0;
+    if (err == CL_SUCCESS) {
+      err = set_arguments(load_, values, cl_int(mask_width_),
+                          cl_int(mask_width_), cl_int(1), cl_int(n_),
+                          cl_int(n_), cl_int(0), work_[0]);
+    }
+    if (err == CL_SUCCESS) {
+      size_t global[3] = {n_, n_, 1};
+      err = enqueue_nd_ranage_kernel(q, load_, 3, nullptr, global, nullptr);
+    }
+    if (err == CL_SUCCESS) {
+      err = transform(q, 1, -1.0f, cur);
+    }
+    if (err == CL_SUCCESS) {
+      err = clEnqueueCopyBuffer(q, work_[cur], spectrum, 0, 0, bytes, 0,
+                                nullptr, nullptr);
+      set_err_if_err(err, "clEnqueueCopyBuffer");
+    }
+    if (err == CL_SUCCESS) {
+      err = clFinish(q);
+    }
+    if (err == CL_SUCCESS) {
+      spectrum_ = spectrum;
+    } else if (spectrum) {
+      clReleaseMemObject(spectrum);
+    }
+    if (values) {
+      clReleaseMemObject(values);
+    }
+    if (q) {
+      clReleaseCommandQueue(q);
+    }
+  }
+
+  cl_context ctx_;
+  int mask_width_;
+  std::size_t n_ = 0;
+  std::size_t batch_ = 1;
+  std::string log_;
+
+  cl_program program_ = nullptr;
+  cl_kernel radix2_ = nullptr;
+  cl_kernel radix4_ = nullptr;
+  cl_kernel load_ = nullptr;
+  cl_kernel store_ = nullptr;
+  cl_kernel multiply_ = nullptr;
+  cl_mem spectrum_ = nullptr;
+  cl_mem work_[2] = {nullptr, nullptr};
+  std::size_t work_size_ = 0;
+};
+
+// the mask width from which convolver takes the FFT path. where the
+// crossover falls depends on the device; clx_bench's convolve_direct_m* and
+// convolve_fft_m* cases measure it.
+constexpr int fft_mask_width = 15;
+
+// Convolution with a fixed mask through tiled_convolution, with the mask
+// baked in, or fft_convolution from fft_from mask width on.
+class convolver {
+public:
+  convolver(cl_context ctx, cl_device_id d, int mask_width,
+            std::vector<cl_uint> const &mask, int fft_from = fft_mask_width) {
+    if (mask_width >= fft_from) {
+      fft_ = std::make_unique<fft_convolution>(ctx, d, mask_width, mask);
+    } else {
+      direct_ = std::make_unique<tiled_convolution>(ctx, d, mask_width, mask);
+    }
+  }
+
+  explicit operator bool() const { return fft_ ? bool(*fft_) : bool(*direct_); }
+
+  auto uses_fft() const -> bool { return fft_ != nullptr; }
+
+  auto build_log() const -> std::string const & {
+    return fft_ ? fft_->build_log() : direct_->build_log();
+  }
+
+  auto enqueue(cl_command_queue q, cl_mem input, cl_mem output,
+               std::size_t width, std::size_t height,
+               cl_uint num_events_in_wait_list = 0,
+               const cl_event *event_wait_list = nullptr,
+               cl_event *event = nullptr) -> cl_int {
+    if (fft_) {
+      return fft_->enqueue(q, input, output, width, height,
+                           num_events_in_wait_list, event_wait_list, event);
+    }
+    return direct_->enqueue(q, input, nullptr, output, width, height,
+                            num_events_in_wait_list, event_wait_list, event);
+  }
+
+private:
+  std::unique_ptr<tiled_convolution> direct_;
+  std::unique_ptr<fft_convolution> fft_;
+};
+
+} // namespace clx
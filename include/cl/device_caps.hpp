@@ -0,0 +1,234 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+#include "clx.hpp"
+#include "sx.hpp"
+
+namespace clx {
+
+// Immutable snapshot of a device's identity and limits, filled with one
+// query per property. A device's limits never change, so schedulers hold on
+// to the snapshot and read it without calling into the driver again.
+struct device_caps {
+  cl_device_id id = nullptr;
+  cl_platform_id platform = nullptr;
+  cl_device_type type = 0;
+  std::string name;
+  std::string vendor;
+  std::string version;
+  std::string driver_version;
+  std::string extensions;
+  // what identity() returns, hashed once here since it takes platform
+  // queries.
+  std::uint64_t stable_id = 0;
+
+  cl_uint compute_units = 0;
+  cl_uint max_clock_frequency = 0; // MHz
+  cl_uint partition_max_sub_devices = 0;
+
+  std::size_t max_work_group_size = 0;
+  cl_uint max_work_item_dimensions = 0;
+  std::array<std::size_t, 3> max_work_item_sizes = {};
+  std::size_t max_parameter_size = 0;
+
+  cl_ulong global_mem_size = 0;
+  cl_ulong global_mem_cache_size = 0;
+  cl_ulong max_mem_alloc_size = 0;
+  cl_ulong local_mem_size = 0;
+  bool local_mem_dedicated = false; // CL_LOCAL rather than emulated in global
+  cl_ulong max_constant_buffer_size = 0;
+  cl_uint max_constant_args = 0;
+  std::size_t mem_base_addr_align = 0; // bytes
+  bool host_unified_memory = false;
+
+  bool image_support = false;
+  std::size_t image2d_max_width = 0;
+  std::size_t image2d_max_height = 0;
+  std::size_t image3d_max_width = 0;
+  std::size_t image3d_max_height = 0;
+  std::size_t image3d_max_depth = 0;
+  std::size_t image_max_buffer_size = 0;
+  cl_uint max_read_image_args = 0;
+  cl_uint max_write_image_args = 0;
+  cl_uint max_samplers = 0;
+
+  struct vector_widths {
+    cl_uint char_ = 0;
+    cl_uint short_ = 0;
+    cl_uint int_ = 0;
+    cl_uint long_ = 0;
+    cl_uint float_ = 0;
+    cl_uint double_ = 0;
+  } preferred_vector_width;
+
+  auto has_extension(std::string_view ext) const -> bool {
+    auto pos = extensions.find(ext);
+    while (pos != std::string::npos) {
+      auto end = pos + ext.size();
+      auto starts = pos == 0 || extensions[pos - 1] == ' ';
+      auto ends = end == extensions.size() || extensions[end] == ' ' ||
+                  extensions[end] == '\0';
+      if (starts && ends) {
+        return true;
+      }
+      pos = extensions.find(ext, end);
+    }
+    return false;
+  }
+};
+
+inline auto query_device_caps(cl_device_id const &d) -> device_caps {
+  using detail::get_info;
+  auto c = device_caps{};
+  c.id = d;
+  c.platform = get_info<CL_DEVICE_PLATFORM>(d);
+  c.type = get_info<CL_DEVICE_TYPE>(d);
+  c.name = get_info<CL_DEVICE_NAME>(d);
+  c.vendor = get_info<CL_DEVICE_VENDOR>(d);
+  c.version = get_info<CL_DEVICE_VERSION>(d);
+  c.driver_version = get_info<CL_DRIVER_VERSION>(d);
+  c.extensions = get_info<CL_DEVICE_EXTENSIONS>(d);
+  c.stable_id = sx::fnv1a(get_platform_info_name(c.platform));
+  c.stable_id = sx::fnv1a(get_platform_info_version(c.platform), c.stable_id);
+  c.stable_id = sx::fnv1a(c.name, c.stable_id);
+  c.stable_id = sx::fnv1a(c.version, c.stable_id);
+  c.stable_id = sx::fnv1a(c.driver_version, c.stable_id);
+
+  c.compute_units = get_info<CL_DEVICE_MAX_COMPUTE_UNITS>(d);
+  c.max_clock_frequency = get_info<CL_DEVICE_MAX_CLOCK_FREQUENCY>(d);
+  c.partition_max_sub_devices =
+      get_info<CL_DEVICE_PARTITION_MAX_SUB_DEVICES>(d);
+
+  c.max_work_group_size = get_info<CL_DEVICE_MAX_WORK_GROUP_SIZE>(d);
+  c.max_work_item_dimensions = get_info<CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS>(d);
+  auto sizes = get_info<CL_DEVICE_MAX_WORK_ITEM_SIZES>(d);
+  for (auto i = 0u; i < sizes.size() && i < c.max_work_item_sizes.size(); i++) {
+    c.max_work_item_sizes[i] = sizes[i];
+  }
+  c.max_parameter_size = get_info<CL_DEVICE_MAX_PARAMETER_SIZE>(d);
+
+  c.global_mem_size = get_info<CL_DEVICE_GLOBAL_MEM_SIZE>(d);
+  c.global_mem_cache_size = get_info<CL_DEVICE_GLOBAL_MEM_CACHE_SIZE>(d);
+  c.max_mem_alloc_size = get_info<CL_DEVICE_MAX_MEM_ALLOC_SIZE>(d);
+  c.local_mem_size = get_info<CL_DEVICE_LOCAL_MEM_SIZE>(d);
+  c.local_mem_dedicated = get_info<CL_DEVICE_LOCAL_MEM_TYPE>(d) == CL_LOCAL;
+  c.max_constant_buffer_size = get_info<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>(d);
+  c.max_constant_args = get_info<CL_DEVICE_MAX_CONSTANT_ARGS>(d);
+  c.mem_base_addr_align = get_info<CL_DEVICE_MEM_BASE_ADDR_ALIGN>(d) / 8;
+  c.host_unified_memory = get_info<CL_DEVICE_HOST_UNIFIED_MEMORY>(d);
+
+  c.image_support = get_info<CL_DEVICE_IMAGE_SUPPORT>(d);
+  if (c.image_support) {
+    c.image2d_max_width = get_info<CL_DEVICE_IMAGE2D_MAX_WIDTH>(d);
+    c.image2d_max_height = get_info<CL_DEVICE_IMAGE2D_MAX_HEIGHT>(d);
+    c.image3d_max_width = get_info<CL_DEVICE_IMAGE3D_MAX_WIDTH>(d);
+    c.image3d_max_height = get_info<CL_DEVICE_IMAGE3D_MAX_HEIGHT>(d);
+    c.image3d_max_depth = get_info<CL_DEVICE_IMAGE3D_MAX_DEPTH>(d);
+    c.image_max_buffer_size = get_info<CL_DEVICE_IMAGE_MAX_BUFFER_SIZE>(d);
+    c.max_read_image_args = get_info<CL_DEVICE_MAX_READ_IMAGE_ARGS>(d);
+    c.max_write_image_args = get_info<CL_DEVICE_MAX_WRITE_IMAGE_ARGS>(d);
+    c.max_samplers = get_info<CL_DEVICE_MAX_SAMPLERS>(d);
+  }
+
+  auto &w = c.preferred_vector_width;
+  w.char_ = get_info<CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR>(d);
+  w.short_ = get_info<CL_DEVICE_PREFERRED_VECTOR_WIDTH_SHORT>(d);
+  w.int_ = get_info<CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT>(d);
+  w.long_ = get_info<CL_DEVICE_PREFERRED_VECTOR_WIDTH_LONG>(d);
+  w.float_ = get_info<CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT>(d);
+  w.double_ = get_info<CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE>(d);
+  return c;
+}
+
+namespace detail {
+
+// the snapshots taken so far. a table is never modified once published;
+// adding a device publishes a copy with the new entry, and superseded
+// tables are kept since readers may still be scanning them.
+struct device_caps_table {
+  std::vector<std::pair<cl_device_id, device_caps const *>> entries;
+};
+
+struct device_caps_registry {
+  std::atomic<device_caps_table const *> current{nullptr};
+  std::mutex m;
+  std::vector<std::unique_ptr<device_caps const>> caps;
+  std::vector<std::unique_ptr<device_caps_table const>> tables;
+};
+
+inline auto find_caps(device_caps_table const *t, cl_device_id d)
+    -> device_caps const * {
+  if (t) {
+    for (auto const &[id, c] : t->entries) {
+      if (id == d) {
+        return c;
+      }
+    }
+  }
+  return nullptr;
+}
+
+} // namespace detail
+
+// the process-wide snapshot of d, queried on first use. the reference stays
+// valid for the life of the process. lookups of known devices scan the
+// published table without locking; only the first lookup of a device takes
+// the lock to query and publish it.
+inline auto device_caps_of(cl_device_id const &d) -> device_caps const & {
+  static auto registry = detail::device_caps_registry{};
+  auto known = registry.current.load(std::memory_order_acquire);
+  if (auto c = detail::find_caps(known, d)) {
+    return *c;
+  }
+
+  auto lock = std::lock_guard<std::mutex>{registry.m};
+  known = registry.current.load(std::memory_order_relaxed);
+  if (auto c = detail::find_caps(known, d)) {
+    return *c;
+  }
+  registry.caps.push_back(
+      std::make_unique<device_caps const>(query_device_caps(d)));
+  auto next = std::make_unique<detail::device_caps_table>();
+  if (known) {
+    next->entries = known->entries;
+  }
+  next->entries.emplace_back(d, registry.caps.back().get());
+  registry.current.store(next.get(), std::memory_order_release);
+  registry.tables.push_back(std::move(next));
+  return *registry.caps.back();
+}
+
+// stable across runs, unlike cl_device_id, and changes with the driver, so
+// results stored under it are dropped by a driver update.
+// hashes the platform and device names and versions.
+inline auto identity(device_caps const &c) -> std::uint64_t {
+  return c.stable_id;
+}
+
+inline auto to_string(device_caps const &c) -> std::string {
+  return fmt::format(
+      "[name:{}, vendor:{}, version:{}, driver:{}, compute_units:{}, "
+      "max_work_group_size:{}, max_work_item_sizes:{}x{}x{}, "
+      "global_mem:{}, local_mem:{}{}, constant_mem:{}, max_alloc:{}, "
+      "align:{}, images:{}, unified_memory:{}, vector_width(float):{}]",
+      c.name.c_str(), c.vendor.c_str(), c.version.c_str(),
+      c.driver_version.c_str(), c.compute_units, c.max_work_group_size,
+      c.max_work_item_sizes[0], c.max_work_item_sizes[1],
+      c.max_work_item_sizes[2], c.global_mem_size, c.local_mem_size,
+      c.local_mem_dedicated ? "" : " (global)", c.max_constant_buffer_size,
+      c.max_mem_alloc_size, c.mem_base_addr_align, c.image_support,
+      c.host_unified_memory, c.preferred_vector_width.float_);
+}
+
+} // namespace clx
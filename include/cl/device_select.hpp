@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+#include "cache.hpp"
+#include "clx.hpp"
+#include "device_caps.hpp"
+#include "kernels.hpp"
+#include "sx.hpp"
+
+namespace clx {
+
+// hard constraints a device must meet to be considered at all.
+struct device_requirements {
+  cl_device_type type = CL_DEVICE_TYPE_ALL;
+  bool images = false;
+  cl_ulong min_global_mem = 0;
+  cl_ulong min_local_mem = 0;
+  cl_ulong min_alloc = 0;
+  std::size_t min_work_group_size = 0;
+  std::vector<std::string> extensions;
+
+  auto satisfied_by(device_caps const &c) const -> bool {
+    return (c.type & type) != 0 && (!images || c.image_support) &&
+           c.global_mem_size >= min_global_mem &&
+           c.local_mem_size >= min_local_mem &&
+           c.max_mem_alloc_size >= min_alloc &&
+           c.max_work_group_size >= min_work_group_size &&
+           std::all_of(std::begin(extensions), std::end(extensions),
+                       [&](auto const &e) { return c.has_extension(e); });
+  }
+};
+
+// measured once per device and driver, then read from the cache directory.
+struct device_benchmark {
+  double bandwidth = 0; // device memory copy, GB/s
+  double latency = 0;   // enqueue to completion of an empty kernel, us
+  double gflops = 0;    // single precision mad throughput
+};
+
+struct selection_policy {
+  device_requirements requirements;
+  // run (or read the cached results of) the micro-benchmark for scoring;
+  // otherwise devices are scored from their capabilities only.
+  bool benchmark = false;
+  // reuse the device chosen by an earlier run with the same name and
+  // requirements, as long as it is still present.
+  bool persist = true;
+  std::string name = "default";
+  // the score is a weighted sum of logs, so weights are exponents and the
+  // units of each measure do not matter.
+  double flops_weight = 1.0;
+  double bandwidth_weight = 1.0;
+  double latency_weight = 0.25;
+  // replaces the built-in score when set. bench is null without benchmark.
+  std::function<double(device_caps const &, device_benchmark const *)> score;
+};
+
+struct device_choice {
+  cl_platform_id platform = nullptr;
+  cl_device_id device = nullptr;
+  double score = 0;
+  std::optional<device_benchmark> bench;
+
+  explicit operator bool() const { return device != nullptr; }
+};
+
+// a rough peak estimate: compute units x clock x float vector width x 2 for
+// mad. good enough to tell a discrete GPU from an integrated one or a CPU
+// runtime, not to compare similar devices; benchmark for that.
+inline auto estimated_gflops(device_caps const &c) -> double {
+  auto width = std::max<cl_uint>(c.preferred_vector_width.float_, 1);
+  auto lanes = (c.type & CL_DEVICE_TYPE_GPU) ? 16.0 : 1.0;
+  return c.compute_units * (c.max_clock_frequency * 1e-3) * width * lanes * 2;
+}
+
+namespace detail {
+
+// best of a few runs of an enqueue, timed with profiling events.
+template <typename F> auto best_ms(int runs, F &&enqueue) {
+  auto best = 0.0;
+  for (auto i = 0; i < runs; i++) {
+    auto e = cl_event{};
+    if (enqueue(&e) != CL_SUCCESS) {
+      return 0.0;
+    }
+    clWaitForEvents(1, &e);
+    auto ms = get_event_elapsed_ms(e);
+    clReleaseEvent(e);
+    best = i == 0 ? ms : std::min(best, ms);
+  }
+  return best;
+}
+
+inline auto device_benchmark_path() -> std::filesystem::path {
+  return cache_directory() / "device_benchmark.txt";
+}
+
+inline auto device_choice_path() -> std::filesystem::path {
+  return cache_directory() / "device_choice.txt";
+}
+
+} // namespace detail
+
+// runs the copy, empty and mad kernels of res/device_bench.cl on d. failures
+// leave the affected measure at 0.
+inline auto run_device_benchmark(cl_platform_id p, cl_device_id d)
+    -> device_benchmark {
+  auto out = device_benchmark{};
+  auto err = cl_int{};
+  auto ds = std::vector<cl_device_id>{d};
+  auto ctx = create_context(p, ds, nullptr, nullptr, err);
+  if (!ctx) {
+    return out;
+  }
+  auto q = create_command_queue(ctx, d, CL_QUEUE_PROFILING_ENABLE, err);
+  auto program =
+      create_program_with_source(ctx, kernel::device_bench.text, err);
+  if (!q || !program || !build_program(program, ds, nullptr, err)) {
+    if (program) {
+      clReleaseProgram(program);
+    }
+    if (q) {
+      clReleaseCommandQueue(q);
+    }
+    clReleaseContext(ctx);
+    return out;
+  }
+
+  auto const &caps = device_caps_of(d);
+  auto bytes = std::min<std::size_t>(64 << 20, caps.max_mem_alloc_size / 2);
+  bytes = bytes / 16 * 16;
+  auto in = create_buffer(ctx, CL_MEM_READ_ONLY, bytes, nullptr, err);
+  auto dst = create_buffer(ctx, CL_MEM_WRITE_ONLY, bytes, nullptr, err);
+  auto copy = create_kernel(program, "copy", err);
+  auto empty = create_kernel(program, "empty", err);
+  auto mad = create_kernel(program, "mad", err);
+
+  if (in && dst && copy) {
+    clSetKernelArg(copy, 0, sizeof(cl_mem), &in);
+    clSetKernelArg(copy, 1, sizeof(cl_mem), &dst);
+    size_t global[1] = {bytes / 16};
+    auto ms = detail::best_ms(5, [&](cl_event *e) {
+      return clEnqueueNDRangeKernel(q, copy, 1, nullptr, global, nullptr, 0,
+                                    nullptr, e);
+    });
+    out.bandwidth = ms > 0 ? 2.0 * bytes / (ms * 1e-3) / 1e9 : 0;
+  }
+
+  if (empty && dst) {
+    clSetKernelArg(empty, 0, sizeof(cl_mem), &dst);
+    size_t global[1] = {1};
+    auto runs = 50;
+    auto err = cl_int{CL_SUCCESS};
+    // host-observed, which is what a small launch actually costs
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < runs && err == CL_SUCCESS; i++) {
+      err = clEnqueueNDRangeKernel(q, empty, 1, nullptr, global, nullptr, 0,
+                                   nullptr, nullptr);
+      if (err == CL_SUCCESS) {
+        err = clFinish(q);
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+    out.latency =
+        err == CL_SUCCESS
+            ? std::chrono::duration<double, std::micro>(end - start).count() /
+                  runs
+            : 0;
+  }
+
+  if (mad && dst) {
+    auto iterations = cl_int{256};
+    clSetKernelArg(mad, 0, sizeof(cl_mem), &dst);
+    clSetKernelArg(mad, 1, sizeof(cl_int), &iterations);
+    size_t global[1] = {std::min<std::size_t>(1 << 20, bytes / 4)};
+    auto ms = detail::best_ms(3, [&](cl_event *e) {
+      return clEnqueueNDRangeKernel(q, mad, 1, nullptr, global, nullptr, 0,
+                                    nullptr, e);
+    });
+    out.gflops = ms > 0 ? 128.0 * iterations * global[0] / (ms * 1e-3) / 1e9
+                        : 0;
+  }
+
+  for (auto k : {copy, empty, mad}) {
+    if (k) {
+      clReleaseKernel(k);
+    }
+  }
+  for (auto m : {in, dst}) {
+    if (m) {
+      clReleaseMemObject(m);
+    }
+  }
+  clReleaseProgram(program);
+  clReleaseCommandQueue(q);
+  clReleaseContext(ctx);
+  return out;
+}
+
+// cached results for this device and driver, measuring on a miss. only a
+// complete measurement is stored; otherwise nothing is returned, so the
+// device is scored from its caps and measured again on the next run.
+inline auto device_benchmark_of(cl_platform_id p, cl_device_id d)
+    -> std::optional<device_benchmark> {
+  auto complete = [](device_benchmark const &b) {
+    return b.bandwidth > 0 && b.latency > 0 && b.gflops > 0;
+  };
+  auto key = identity(device_caps_of(d));
+  auto records = detail::read_records(detail::device_benchmark_path());
+  auto it = records.find(key);
+  if (it != std::end(records)) {
+    auto b = device_benchmark{};
+    auto ss = std::istringstream{it->second};
+    if (ss >> b.bandwidth >> b.latency >> b.gflops && complete(b)) {
+      return b;
+    }
+  }
+  auto b = run_device_benchmark(p, d);
+  if (!complete(b)) {
+    return std::nullopt;
+  }
+  detail::write_record(detail::device_benchmark_path(), key,
+                       fmt::format("{} {} {}", b.bandwidth, b.latency,
+                                   b.gflops));
+  return b;
+}
+
+inline auto score_device(selection_policy const &policy, device_caps const &c,
+                         device_benchmark const *bench) -> double {
+  if (policy.score) {
+    return policy.score(c, bench);
+  }
+  auto log = [](double v) { return std::log(std::max(v, 1e-9)); };
+  if (!bench) {
+    return policy.flops_weight * log(estimated_gflops(c));
+  }
+  return policy.flops_weight * log(bench->gflops) +
+         policy.bandwidth_weight * log(bench->bandwidth) -
+         policy.latency_weight * log(bench->latency);
+}
+
+// every device meeting the requirements, best first.
+inline auto rank_devices(selection_policy const &policy)
+    -> std::vector<device_choice> {
+  auto out = std::vector<device_choice>{};
+  for (auto const &p : get_platform_ids()) {
+    for (auto const &d : get_device_ids(p, CL_DEVICE_TYPE_ALL)) {
+      auto const &caps = device_caps_of(d);
+      if (!policy.requirements.satisfied_by(caps)) {
+        continue;
+      }
+      auto c = device_choice{p, d, 0, {}};
+      if (policy.benchmark) {
+        c.bench = device_benchmark_of(p, d);
+      }
+      c.score = score_device(policy, caps, c.bench ? &*c.bench : nullptr);
+      out.push_back(c);
+    }
+  }
+  std::stable_sort(
+      std::begin(out), std::end(out),
+      [](auto const &a, auto const &b) { return a.score > b.score; });
+  return out;
+}
+
+namespace detail {
+
+inline auto policy_key(selection_policy const &policy) -> std::uint64_t {
+  auto const &r = policy.requirements;
+  auto h = sx::fnv1a(policy.name);
+  h = sx::fnv1a(fmt::format("{}:{}:{}:{}:{}:{}:{}", r.type, r.images,
+                            r.min_global_mem, r.min_local_mem, r.min_alloc,
+                            r.min_work_group_size, policy.benchmark),
+                h);
+  for (auto const &e : r.extensions) {
+    h = sx::fnv1a(e, h);
+  }
+  return h;
+}
+
+} // namespace detail
+
+// picks a device for the policy. CLX_DEVICE, a substring of a device name,
+// overrides the ranking. with persist, the first run's choice is stored and
+// reused while that device and driver are present, so later runs skip the
+// ranking and stay on the same device. an empty choice means no device meets
+// the requirements.
+inline auto select_device(selection_policy const &policy = {})
+    -> device_choice {
+  auto key = detail::policy_key(policy);
+  auto forced = std::getenv("CLX_DEVICE");
+
+  if (policy.persist && !forced) {
+    auto records = detail::read_records(detail::device_choice_path());
+    auto it = records.find(key);
+    if (it != std::end(records)) {
+      auto id = std::uint64_t{};
+      auto ss = std::istringstream{it->second};
+      if (ss >> std::hex >> id) {
+        for (auto const &p : get_platform_ids()) {
+          for (auto const &d : get_device_ids(p, CL_DEVICE_TYPE_ALL)) {
+            auto const &caps = device_caps_of(d);
+            if (identity(caps) == id &&
+                policy.requirements.satisfied_by(caps)) {
+              return device_choice{p, d, 0, {}};
+            }
+          }
+        }
+      }
+    }
+  }
+
+  auto ranked = rank_devices(policy);
+  if (forced) {
+    auto it = std::find_if(std::begin(ranked), std::end(ranked),
+                           [&](auto const &c) {
+                             return device_caps_of(c.device).name.find(
+                                        forced) != std::string::npos;
+                           });
+    return it != std::end(ranked) ? *it : device_choice{};
+  }
+  if (ranked.empty()) {
+    return {};
+  }
+  if (policy.persist) {
+    detail::write_record(
+        detail::device_choice_path(), key,
+        fmt::format("{:016x}", identity(device_caps_of(ranked[0].device))));
+  }
+  return ranked[0];
+}
+
+} // namespace clx
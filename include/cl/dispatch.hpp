@@ -0,0 +1,502 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+#include "cache.hpp"
+#include "clx.hpp"
+#include "convolve.hpp"
+#include "device_caps.hpp"
+#include "device_select.hpp"
+#include "gaussian.hpp"
+#include "histogram.hpp"
+#include "host.hpp"
+#include "kernels.hpp"
+#include "sx.hpp"
+
+namespace clx {
+
+enum class backend { host, device };
+
+inline auto to_string(backend b) -> char const * {
+  return b == backend::host ? "host" : "device";
+}
+
+// The operations a dispatcher runs on either backend. Their sizes, which
+// crossovers are measured in, are elements for vadd and square,
+// multiply-adds for convolve and gaussian, and samples for histogram, so that
+// one calibration covers every mask width and sigma.
+enum class operation { vadd, square, convolve, gaussian, histogram };
+
+inline auto to_string(operation op) -> char const * {
+  switch (op) {
+  case operation::vadd:
+    return "vadd";
+  case operation::square:
+    return "square";
+  case operation::convolve:
+    return "convolve";
+  case operation::gaussian:
+    return "gaussian";
+  case operation::histogram:
+    return "histogram";
+  }
+  return "?";
+}
+
+namespace detail {
+
+inline auto crossover_path() -> std::filesystem::path {
+  return cache_directory() / "crossover.txt";
+}
+
+// best of a few runs of f after a warm-up, in host milliseconds; negative
+// when f fails.
+template <typename F> auto best_host_ms(int runs, F &&f) -> double {
+  if (f() != CL_SUCCESS) {
+    return -1;
+  }
+  auto best = std::numeric_limits<double>::max();
+  for (auto i = 0; i < runs; i++) {
+    auto start = std::chrono::steady_clock::now();
+    if (f() != CL_SUCCESS) {
+      return -1;
+    }
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(
+        best, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return best;
+}
+
+} // namespace detail
+
+// Runs vadd, square, convolve, gaussian and histogram on host memory, on the
+// host backend (host.hpp) or on a device, whichever is faster for the size.
+// Device runs include the copies in and out, which is what dominates small
+// problems. The size from which the device wins is measured per operation
+// on first use and kept per device and driver, so calibration runs once per
+// machine. Without a device, e.g. without an OpenCL runtime, everything
+// runs on the host. CLX_BACKEND=host or device forces a backend.
+//
+// device programs and buffers are kept across calls, so calls must be made
+// from one thread.
+class dispatcher {
+public:
+  static constexpr std::size_t calibration_min = 1 << 8;
+  static constexpr std::size_t calibration_max = 1 << 22;
+  static constexpr std::size_t never = std::numeric_limits<std::size_t>::max();
+
+  // the host alone.
+  dispatcher() = default;
+
+  // d, if not null, and the host.
+  dispatcher(cl_platform_id p, cl_device_id d) {
+    if (!d) {
+      return;
+    }
+    ctx_ = create_context(p, {d});
+    if (ctx_) {
+      queue_ = create_command_queue(ctx_, d, 0);
+    }
+    if (queue_) {
+      device_ = d;
+    }
+  }
+
+  explicit dispatcher(device_choice const &c)
+      : dispatcher(c.platform, c.device) {}
+
+  dispatcher(dispatcher const &) = delete;
+  auto operator=(dispatcher const &) -> dispatcher & = delete;
+
+  ~dispatcher() {
+    convolver_.reset();
+    gaussian_.reset();
+    histogram_.reset();
+    for (auto k : {vadd_, square_}) {
+      if (k) {
+        clReleaseKernel(k);
+      }
+    }
+    for (auto p : {vadd_program_, square_program_}) {
+      if (p) {
+        clReleaseProgram(p);
+      }
+    }
+    if (queue_) {
+      clReleaseCommandQueue(queue_);
+    }
+    if (ctx_) {
+      clReleaseContext(ctx_);
+    }
+  }
+
+  auto has_device() const -> bool { return device_ != nullptr; }
+  // the backend the last operation ran on.
+  auto last_backend() const -> backend { return last_; }
+
+  // the size from which op runs faster on the device, calibrated over
+  // calibration_min to calibration_max on first use. never when the device
+  // did not win up to calibration_max, or failed; a failure is kept for this
+  // dispatcher only, so a later process calibrates again.
+  auto crossover(operation op) -> std::size_t {
+    if (!device_) {
+      return never;
+    }
+    auto &known = crossovers_[static_cast<int>(op)];
+    if (known) {
+      return *known;
+    }
+    auto key = sx::fnv1a(to_string(op), identity(device_caps_of(device_)));
+    auto records = detail::read_records(detail::crossover_path());
+    auto it = records.find(key);
+    auto size = std::size_t{};
+    if (it != std::end(records) &&
+        std::istringstream{it->second} >> size) {
+      known = size;
+      return size;
+    }
+    auto calibrated = calibrate(op);
+    known = calibrated.value_or(never);
+    if (calibrated) {
+      detail::write_record(detail::crossover_path(), key,
+                           fmt::format("{}", *calibrated));
+    }
+    return *known;
+  }
+
+  auto backend_for(operation op, std::size_t size) -> backend {
+    if (!device_) {
+      return backend::host;
+    }
+    if (forced_) {
+      return *forced_;
+    }
+    if (auto env = std::getenv("CLX_BACKEND")) {
+      auto b = std::string_view{env};
+      if (b == "host" || b == "device") {
+        return b == "host" ? backend::host : backend::device;
+      }
+    }
+    return size >= crossover(op) ? backend::device : backend::host;
+  }
+
+  // c[i] = a[i] + b[i] for i < n.
+  auto vadd(int const *a, int const *b, int *c, std::size_t n) -> cl_int {
+    return run(
+        operation::vadd, n, [&] { host::vadd(a, b, c, n); },
+        [&] { return device_vadd(a, b, c, n); });
+  }
+
+  // data[i] *= data[i] for i < n.
+  auto square(int *data, std::size_t n) -> cl_int {
+    return run(
+        operation::square, n, [&] { host::square(data, n); },
+        [&] { return device_square(data, n); });
+  }
+
+  // the valid (width - mask_width + 1) x (height - mask_width + 1) outputs
+  // of convolving input with the mask.
+  auto convolve(cl_uint const *input, std::size_t width, std::size_t height,
+                cl_uint const *mask, std::size_t mask_width, cl_uint *output)
+      -> cl_int {
+    if (mask_width < 1 || width < mask_width || height < mask_width) {
+      return CL_INVALID_VALUE;
+    }
+    auto outputs = (width - mask_width + 1) * (height - mask_width + 1);
+    return run(
+        operation::convolve, outputs * mask_width * mask_width,
+        [&] {
+          host::convolve(input, width, height, mask, mask_width, output);
+        },
+        [&] {
+          return device_convolve(input, width, height, mask, mask_width,
+                                 output);
+        });
+  }
+
+  // width x height RGBA8 pixels blurred with sigma into dst.
+  auto gaussian(cl_uchar const *src, cl_uchar *dst, std::size_t width,
+                std::size_t height, float sigma) -> cl_int {
+    auto taps = gaussian_weights(sigma).size();
+    return run(
+        operation::gaussian, width * height * 4 * 2 * taps,
+        [&] { host::gaussian(src, dst, width, height, sigma); },
+        [&] { return device_gaussian(src, dst, width, height, sigma); });
+  }
+
+  // c.total_bins() counts of num_pixels pixels of samples.
+  auto histogram(histogram_config const &c, void const *samples,
+                 std::size_t num_pixels, cl_uint *counts) -> cl_int {
+    if (!valid(c)) {
+      return CL_INVALID_VALUE;
+    }
+    return run(
+        operation::histogram, num_pixels * c.channels,
+        [&] {
+          auto h = host::histogram(c, samples, num_pixels);
+          std::copy(std::begin(h), std::end(h), counts);
+        },
+        [&] { return device_histogram(c, samples, num_pixels, counts); });
+  }
+
+private:
+  template <typename H, typename D>
+  auto run(operation op, std::size_t size, H &&on_host, D &&on_device)
+      -> cl_int {
+    last_ = backend_for(op, size);
+    if (last_ == backend::host) {
+      on_host();
+      return CL_SUCCESS;
+    }
+    return on_device();
+  }
+
+  // the smallest size from which the device is faster at every calibration
+  // size, which go up by 4x. nullopt when a device run failed.
+  auto calibrate(operation op) -> std::optional<std::size_t> {
+    auto out = never;
+    for (auto size = calibration_min; size <= calibration_max; size *= 4) {
+      auto f = workload(op, size);
+      forced_ = backend::host;
+      auto host_ms = detail::best_host_ms(3, f);
+      forced_ = backend::device;
+      auto device_ms = detail::best_host_ms(3, f);
+      forced_.reset();
+      if (device_ms < 0) {
+        return std::nullopt;
+      }
+      if (device_ms < host_ms) {
+        out = std::min(out, size);
+      } else {
+        out = never;
+      }
+    }
+    return out;
+  }
+
+  // a call of op of about size, on data of its own.
+  auto workload(operation op, std::size_t size) -> std::function<cl_int()> {
+    auto side = [](std::size_t n) {
+      return std::max<std::size_t>(std::sqrt(double(n)), 1);
+    };
+    switch (op) {
+    case operation::vadd: {
+      auto data = std::make_shared<std::vector<int>>(3 * size, 1);
+      return [this, data, size] {
+        auto p = data->data();
+        return vadd(p, p + size, p + 2 * size, size);
+      };
+    }
+    case operation::square: {
+      auto data = std::make_shared<std::vector<int>>(size, 3);
+      return [this, data] { return square(data->data(), data->size()); };
+    }
+    case operation::convolve: {
+      // a 3x3 mask, 9 multiply-adds per output
+      auto n = side(size / 9) + 2;
+      auto input = std::make_shared<std::vector<cl_uint>>(n * n, 1);
+      auto output = std::make_shared<std::vector<cl_uint>>(n * n);
+      return [this, input, output, n] {
+        static cl_uint const mask[9] = {1, 1, 1, 1, 0, 1, 1, 1, 1};
+        return convolve(input->data(), n, n, mask, 3, output->data());
+      };
+    }
+    case operation::gaussian: {
+      // sigma 1, two passes of 7 taps over 4 channels
+      auto n = side(size / (2 * 7 * 4));
+      auto src = std::make_shared<std::vector<cl_uchar>>(n * n * 4, 128);
+      auto dst = std::make_shared<std::vector<cl_uchar>>(n * n * 4);
+      return [this, src, dst, n] {
+        return gaussian(src->data(), dst->data(), n, n, 1.0f);
+      };
+    }
+    case operation::histogram: {
+      auto c = histogram_config_for_depth(4, 256, 8);
+      auto pixels = std::max<std::size_t>(size / 4, 1);
+      auto samples = std::make_shared<std::vector<cl_uchar>>(pixels * 4);
+      for (auto i = std::size_t{0}; i < samples->size(); i++) {
+        (*samples)[i] = static_cast<cl_uchar>(i * 7);
+      }
+      auto counts = std::make_shared<std::vector<cl_uint>>(c.total_bins());
+      return [this, c, samples, counts, pixels] {
+        return histogram(c, samples->data(), pixels, counts->data());
+      };
+    }
+    }
+    return [] { return CL_INVALID_VALUE; };
+  }
+
+  // the kernel name of text, built on first use.
+  auto kernel_of(cl_program &program, cl_kernel &k, std::string_view text,
+                 char const *name) -> cl_kernel {
+    if (k) {
+      return k;
+    }
+    if (!program) {
+      program = create_program_with_source(ctx_, text);
+      if (program && !build_program(program, {device_})) {
+        clReleaseProgram(program);
+        program = nullptr;
+      }
+    }
+    if (program) {
+      k = create_kernel(program, name);
+    }
+    return k;
+  }
+
+  // a buffer of bytes, initialized from host when not null, released on
+  // scope exit.
+  auto scoped_buffer(cl_mem_flags flags, std::size_t bytes,
+                     void const *host = nullptr) {
+    if (host) {
+      flags |= CL_MEM_COPY_HOST_PTR;
+    }
+    auto m = create_buffer(ctx_, flags, bytes, const_cast<void *>(host));
+    return std::unique_ptr<_cl_mem, decltype(&clReleaseMemObject)>{
+        m, &clReleaseMemObject};
+  }
+
+  auto device_vadd(int const *a, int const *b, int *c, std::size_t n)
+      -> cl_int {
+    auto k = kernel_of(vadd_program_, vadd_, kernel::adder2.text, "vadd");
+    auto bytes = n * sizeof(int);
+    auto in_a = scoped_buffer(CL_MEM_READ_ONLY, bytes, a);
+    auto in_b = scoped_buffer(CL_MEM_READ_ONLY, bytes, b);
+    auto out = scoped_buffer(CL_MEM_WRITE_ONLY, bytes);
+    if (!k || !in_a || !in_b || !out) {
+      return last_error();
+    }
+    size_t global[1] = {n};
+    auto err = set_arguments(k, in_a.get(), in_b.get(), out.get());
+    if (err == CL_SUCCESS) {
+      err = enqueue_nd_ranage_kernel(queue_, k, 1, nullptr, global, nullptr);
+    }
+    if (err == CL_SUCCESS) {
+      err = enqueue_read_buffer(queue_, out.get(), CL_TRUE, 0, bytes, c);
+    }
+    return err;
+  }
+
+  auto device_square(int *data, std::size_t n) -> cl_int {
+    auto k =
+        kernel_of(square_program_, square_, kernel::simple.text, "square");
+    auto bytes = n * sizeof(int);
+    auto buffer = scoped_buffer(CL_MEM_READ_WRITE, bytes, data);
+    if (!k || !buffer) {
+      return last_error();
+    }
+    size_t global[1] = {n};
+    auto err = set_arguments(k, buffer.get());
+    if (err == CL_SUCCESS) {
+      err = enqueue_nd_ranage_kernel(queue_, k, 1, nullptr, global, nullptr);
+    }
+    if (err == CL_SUCCESS) {
+      err = enqueue_read_buffer(queue_, buffer.get(), CL_TRUE, 0, bytes, data);
+    }
+    return err;
+  }
+
+  auto device_convolve(cl_uint const *input, std::size_t width,
+                       std::size_t height, cl_uint const *mask,
+                       std::size_t mask_width, cl_uint *output) -> cl_int {
+    // the mask is baked into the program, which is kept for the next call
+    // with the same mask
+    auto values = std::vector<cl_uint>(mask, mask + mask_width * mask_width);
+    if (!convolver_ || values != convolver_mask_) {
+      convolver_ = std::make_unique<convolver>(ctx_, device_,
+                                               int(mask_width), values);
+      convolver_mask_ = values;
+    }
+    auto outputs = (width - mask_width + 1) * (height - mask_width + 1);
+    auto in = scoped_buffer(CL_MEM_READ_ONLY,
+                            width * height * sizeof(cl_uint), input);
+    auto out = scoped_buffer(CL_MEM_WRITE_ONLY, outputs * sizeof(cl_uint));
+    if (!*convolver_ || !in || !out) {
+      convolver_.reset();
+      return last_error();
+    }
+    auto err =
+        convolver_->enqueue(queue_, in.get(), out.get(), width, height);
+    if (err == CL_SUCCESS) {
+      err = enqueue_read_buffer(queue_, out.get(), CL_TRUE, 0,
+                                outputs * sizeof(cl_uint), output);
+    }
+    return err;
+  }
+
+  auto device_gaussian(cl_uchar const *src, cl_uchar *dst, std::size_t width,
+                       std::size_t height, float sigma) -> cl_int {
+    if (!gaussian_ || gaussian_sigma_ != sigma) {
+      gaussian_ = std::make_unique<separable_gaussian>(ctx_, device_, sigma);
+      gaussian_sigma_ = sigma;
+    }
+    auto bytes = width * height * 4;
+    auto in = scoped_buffer(CL_MEM_READ_ONLY, bytes, src);
+    auto out = scoped_buffer(CL_MEM_WRITE_ONLY, bytes);
+    if (!*gaussian_ || !in || !out) {
+      gaussian_.reset();
+      return last_error();
+    }
+    auto err =
+        gaussian_->enqueue_buffer(queue_, in.get(), out.get(), width, height);
+    if (err == CL_SUCCESS) {
+      err = enqueue_read_buffer(queue_, out.get(), CL_TRUE, 0, bytes, dst);
+    }
+    return err;
+  }
+
+  auto device_histogram(histogram_config const &c, void const *samples,
+                        std::size_t num_pixels, cl_uint *counts) -> cl_int {
+    if (!histogram_) {
+      histogram_ = std::make_unique<histogram_engine>(ctx_, device_);
+    }
+    auto in = scoped_buffer(CL_MEM_READ_ONLY,
+                            num_pixels * c.channels * sample_size(c.sample),
+                            samples);
+    auto out = scoped_buffer(CL_MEM_READ_WRITE,
+                             c.total_bins() * sizeof(cl_uint));
+    if (!in || !out) {
+      return last_error();
+    }
+    auto err = histogram_->enqueue(queue_, c, in.get(), num_pixels, out.get());
+    if (err == CL_SUCCESS) {
+      err = enqueue_read_buffer(queue_, out.get(), CL_TRUE, 0,
+                                c.total_bins() * sizeof(cl_uint), counts);
+    }
+    return err;
+  }
+
+  cl_device_id device_ = nullptr;
+  cl_context ctx_ = nullptr;
+  cl_command_queue queue_ = nullptr;
+  backend last_ = backend::host;
+  std::optional<backend> forced_;
+  std::optional<std::size_t> crossovers_[5];
+
+  cl_program vadd_program_ = nullptr;
+  cl_kernel vadd_ = nullptr;
+  cl_program square_program_ = nullptr;
+  cl_kernel square_ = nullptr;
+  std::unique_ptr<convolver> convolver_;
+  std::vector<cl_uint> convolver_mask_;
+  std::unique_ptr<separable_gaussian> gaussian_;
+  float gaussian_sigma_ = 0;
+  std::unique_ptr<histogram_engine> histogram_;
+};
+
+} // namespace clx
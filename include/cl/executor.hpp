@@ -0,0 +1,263 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "bound_kernel.hpp"
+#include "clx.hpp"
+#include "device_caps.hpp"
+
+namespace clx {
+
+// How a launch is split across devices. The range is cut along its outermost
+// dimension into units: elements for 1D, rows for 2D. Every output unit
+// depends on the input units [u - halo_before, u + halo_after], so for a 3x3
+// convolution over rows halo_after is 2.
+struct partition_layout {
+  std::size_t units = 0;             // output units, the partitioned extent
+  std::size_t inner = 1;             // global size of dimension 0 for 2D
+  std::size_t output_unit_bytes = 0; // bytes per output unit
+  std::size_t input_units = 0;       // input units, 0 if there is no input
+  std::size_t input_unit_bytes = 0;  // bytes per input unit
+  std::size_t halo_before = 0;
+  std::size_t halo_after = 0;
+};
+
+// one device's share of a launch. input and output are sub-buffers; input
+// starts at input unit input_begin, which can lie before begin - halo_before
+// when the sub-buffer origin had to be rounded down to the device alignment,
+// so kernels index it with an offset of begin - input_begin.
+struct partition_slice {
+  std::size_t device = 0;
+  std::size_t begin = 0;
+  std::size_t end = 0;
+  std::size_t input_begin = 0;
+  cl_mem input = nullptr;
+  cl_mem output = nullptr;
+};
+
+// split units into contiguous ranges proportional to weights, each boundary a
+// multiple of granularity. ranges can be empty when there is too little work.
+inline auto partition_range(std::size_t units,
+                            std::vector<std::size_t> const &weights,
+                            std::size_t granularity)
+    -> std::vector<std::pair<std::size_t, std::size_t>> {
+  auto total = std::accumulate(std::begin(weights), std::end(weights),
+                               std::size_t{0});
+  auto out = std::vector<std::pair<std::size_t, std::size_t>>{};
+  auto begin = std::size_t{0};
+  auto acc = std::size_t{0};
+  for (auto i = 0u; i < weights.size(); i++) {
+    acc += weights[i];
+    auto end = units;
+    if (i + 1 < weights.size()) {
+      end = units * acc / total / granularity * granularity;
+      end = std::min(std::max(end, begin), units);
+    }
+    out.emplace_back(begin, end);
+    begin = end;
+  }
+  return out;
+}
+
+// Runs one kernel across every device of a context. The range is partitioned
+// by compute units, each device gets sub-buffers for its output slice and its
+// input slice plus halo, and the launches are issued on per-device queues
+// concurrently. Since the sub-buffers alias one output buffer, reading that
+// buffer after run() returns gathers the result.
+class partitioned_executor {
+public:
+  // binds the arguments of a device's kernel for its slice. the kernels are
+  // kept across runs, so arguments equal to the last run's are not re-set.
+  using binder =
+      std::function<cl_int(bound_kernel &, partition_slice const &)>;
+
+  partitioned_executor(cl_context ctx, std::vector<cl_device_id> ds)
+      : ctx_(ctx), devices_(std::move(ds)) {
+    auto align = std::size_t{1};
+    for (auto const &d : devices_) {
+      queues_.push_back(create_command_queue(ctx_, d, 0));
+      auto const &caps = device_caps_of(d);
+      weights_.push_back(caps.compute_units);
+      align = std::lcm(align, caps.mem_base_addr_align);
+    }
+    alignment_ = align;
+  }
+
+  partitioned_executor(partitioned_executor const &) = delete;
+  auto operator=(partitioned_executor const &)
+      -> partitioned_executor & = delete;
+
+  ~partitioned_executor() {
+    for (auto &q : queues_) {
+      clReleaseCommandQueue(q);
+    }
+  }
+
+  auto devices() const -> std::vector<cl_device_id> const & {
+    return devices_;
+  }
+
+  auto queues() const -> std::vector<cl_command_queue> const & {
+    return queues_;
+  }
+
+  // argument binds made and skipped, summed over the devices' kernels.
+  auto argument_stats() const -> kernel_arg_stats {
+    auto out = kernel_arg_stats{};
+    for (auto const &k : kernels_) {
+      out.calls += k.stats().calls;
+      out.skipped += k.stats().skipped;
+    }
+    return out;
+  }
+
+  // override the compute-unit weights, e.g. with measured throughput.
+  auto set_weights(std::vector<std::size_t> weights) -> void {
+    weights_ = std::move(weights);
+  }
+
+  // slices are only as fine as the sub-buffer alignment allows.
+  auto slices(partition_layout const &l) const
+      -> std::vector<partition_slice> {
+    auto g = granularity(l.output_unit_bytes);
+    if (l.input_unit_bytes) {
+      g = std::lcm(g, granularity(l.input_unit_bytes));
+    }
+    auto out = std::vector<partition_slice>{};
+    auto ranges = partition_range(l.units, weights_, g);
+    for (auto i = 0u; i < ranges.size(); i++) {
+      auto s = partition_slice{};
+      s.device = i;
+      s.begin = ranges[i].first;
+      s.end = ranges[i].second;
+      auto in_g = l.input_unit_bytes ? granularity(l.input_unit_bytes) : 1;
+      auto first = s.begin > l.halo_before ? s.begin - l.halo_before : 0;
+      s.input_begin = first / in_g * in_g;
+      out.push_back(s);
+    }
+    return out;
+  }
+
+  // launches kernel_name on every device's slice and waits for all of them.
+  // returns the first enqueue error, else the error a slice failed to execute
+  // with, which is also recorded for last_error(). CL_INVALID_VALUE when the
+  // input is too short for the last slice's halo.
+  auto run(cl_program p, char const *kernel_name, cl_mem input, cl_mem output,
+           partition_layout const &l, cl_uint work_dim, binder bind)
+      -> cl_int {
+    if (input && l.input_unit_bytes &&
+        l.input_units < l.units + l.halo_after) {
+      set_err_if_err(CL_INVALID_VALUE, "partitioned_executor::run");
+      return CL_INVALID_VALUE;
+    }
+    if (kernels_.empty() || program_ != p || kernel_name_ != kernel_name) {
+      kernels_.clear();
+      for (auto i = 0u; i < devices_.size(); i++) {
+        auto k = bound_kernel{p, kernel_name};
+        if (!k) {
+          kernels_.clear();
+          return last_error();
+        }
+        kernels_.push_back(std::move(k));
+      }
+      program_ = p;
+      kernel_name_ = kernel_name;
+    }
+
+    auto err = cl_int{CL_SUCCESS};
+    auto ss = slices(l);
+    auto events = std::vector<cl_event>{};
+    for (auto &s : ss) {
+      if (s.begin == s.end) {
+        continue;
+      }
+      s.output = create_sub_buffer(output, 0, s.begin * l.output_unit_bytes,
+                                   (s.end - s.begin) * l.output_unit_bytes);
+      if (input && l.input_unit_bytes) {
+        auto last = std::min(l.input_units, s.end + l.halo_after);
+        s.input =
+            create_sub_buffer(input, 0, s.input_begin * l.input_unit_bytes,
+                              (last - s.input_begin) * l.input_unit_bytes);
+      }
+      if (!s.output || (input && l.input_unit_bytes && !s.input)) {
+        err = last_error();
+        break;
+      }
+      err = bind(kernels_[s.device], s);
+      if (err != CL_SUCCESS) {
+        break;
+      }
+
+      size_t global[2] = {l.inner, s.end - s.begin};
+      if (work_dim == 1) {
+        global[0] = s.end - s.begin;
+      }
+      auto e = cl_event{};
+      err = enqueue_nd_ranage_kernel(queues_[s.device], kernels_[s.device],
+                                     work_dim, nullptr, global, nullptr, 0,
+                                     nullptr, &e);
+      if (err != CL_SUCCESS) {
+        break;
+      }
+      clFlush(queues_[s.device]);
+      events.push_back(e);
+    }
+
+    if (!events.empty()) {
+      auto wait = clWaitForEvents(cl_uint(events.size()), events.data());
+      if (wait != CL_SUCCESS) {
+        // a slice that failed to execute has a negative status: its error
+        for (auto e : events) {
+          auto status = cl_int{CL_COMPLETE};
+          clGetEventInfo(e, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status),
+                         &status, nullptr);
+          if (status < 0) {
+            wait = status;
+            break;
+          }
+        }
+      }
+      set_err_if_err(wait, "clWaitForEvents");
+      if (err == CL_SUCCESS) {
+        err = wait;
+      }
+    }
+    for (auto &e : events) {
+      clReleaseEvent(e);
+    }
+    // the next run's sub-buffers may reuse these handles
+    for (auto &s : ss) {
+      if (s.input) {
+        kernels_[s.device].forget(s.input);
+        clReleaseMemObject(s.input);
+      }
+      if (s.output) {
+        kernels_[s.device].forget(s.output);
+        clReleaseMemObject(s.output);
+      }
+    }
+    return err;
+  }
+
+private:
+  // smallest number of units whose byte size is a multiple of the alignment.
+  auto granularity(std::size_t unit_bytes) const -> std::size_t {
+    return alignment_ / std::gcd(alignment_, unit_bytes);
+  }
+
+  cl_context ctx_;
+  std::vector<cl_device_id> devices_;
+  std::vector<cl_command_queue> queues_;
+  std::vector<std::size_t> weights_;
+  std::vector<bound_kernel> kernels_;
+  cl_program program_ = nullptr;
+  std::string kernel_name_;
+  std::size_t alignment_ = 1;
+};
+
+} // namespace clx
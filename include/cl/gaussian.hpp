@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "clx.hpp"
+#include "device_caps.hpp"
+#include "kernels.hpp"
+
+namespace clx {
+
+// the 2 * radius + 1 taps of a normalized Gaussian, radius = ceil(3 sigma)
+// and at least 1. sigma <= 0 gives the identity.
+inline auto gaussian_weights(float sigma) -> std::vector<float> {
+  auto radius = std::max(1, static_cast<int>(std::ceil(3 * sigma)));
+  auto weights = std::vector<float>(2 * radius + 1);
+  auto sum = 0.0;
+  for (auto i = -radius; i <= radius; i++) {
+    auto w = sigma > 0 ? std::exp(-0.5 * i * i / (double(sigma) * sigma))
+                       : (i == 0 ? 1.0 : 0.0);
+    weights[i + radius] = static_cast<float>(w);
+    sum += w;
+  }
+  for (auto &w : weights) {
+    w = static_cast<float>(w / sum);
+  }
+  return weights;
+}
+
+// Gaussian blur as a row pass into a float intermediate and a column pass,
+// 2 (2r + 1) taps per pixel instead of (2r + 1)^2, over either RGBA images
+// or plain buffers of RGBA8 pixels. The program is built for one sigma, with
+// the tile sized to the device's local memory (gaussian_separable.cl).
+//
+// the intermediate is kept across calls and grown as needed, so calls must
+// be made from one thread on one in-order queue.
+class separable_gaussian {
+public:
+  static constexpr std::size_t local_x = 16;
+
+  separable_gaussian(cl_context ctx, cl_device_id d, float sigma)
+      : ctx_(ctx), weights_(gaussian_weights(sigma)) {
+    radius_ = weights_.size() / 2;
+    auto const &caps = device_caps_of(d);
+    local_y_ = std::clamp<std::size_t>(caps.max_work_group_size / local_x, 1,
+                                       8);
+    // fewer pixels per work-item when the tiles of a large radius do not fit
+    pixels_ = 4;
+    while (pixels_ > 1 && tile_bytes() > caps.local_mem_size) {
+      pixels_ /= 2;
+    }
+    if (tile_bytes() > caps.local_mem_size) {
+      set_err_if_err(CL_OUT_OF_RESOURCES, "separable_gaussian");
+      return;
+    }
+
+    // the kernels require local_x x local_y_ work-groups, and a build can
+    // allow fewer work-items than the device does; rebuild with fewer rows
+    while (build(d)) {
+      auto limit = std::size_t{0};
+      for (auto k : kernels()) {
+        auto size = get_kernel_work_group_info_size(k, d);
+        limit = limit ? std::min(limit, size) : size;
+      }
+      if (local_x * local_y_ <= limit) {
+        break;
+      }
+      release_program();
+      if (limit < local_x) {
+        set_err_if_err(CL_INVALID_WORK_GROUP_SIZE, "separable_gaussian");
+        return;
+      }
+      while (local_x * local_y_ > limit) {
+        local_y_ /= 2;
+      }
+    }
+    if (!program_) {
+      return;
+    }
+
+    auto err = cl_int{};
+    sampler_ = clCreateSampler(ctx, CL_FALSE, CL_ADDRESS_CLAMP_TO_EDGE,
+                               CL_FILTER_NEAREST, &err);
+    set_err_if_err(err, "clCreateSampler");
+    weights_mem_ = create_buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 weights_.size() * sizeof(float),
+                                 weights_.data());
+  }
+
+  separable_gaussian(separable_gaussian const &) = delete;
+  auto operator=(separable_gaussian const &) -> separable_gaussian & = delete;
+
+  ~separable_gaussian() {
+    for (auto m : {weights_mem_, temp_image_, temp_buffer_}) {
+      if (m) {
+        clReleaseMemObject(m);
+      }
+    }
+    release_program();
+    if (sampler_) {
+      clReleaseSampler(sampler_);
+    }
+  }
+
+  explicit operator bool() const {
+    return rows_image_ && columns_image_ && rows_buffer_ && columns_buffer_ &&
+           sampler_ && weights_mem_;
+  }
+
+  // pixels read on each side of an output pixel, for tiling with halos.
+  auto radius() const -> std::size_t { return radius_; }
+  auto weights() const -> std::vector<float> const & { return weights_; }
+  auto pixels_per_item() const -> std::size_t { return pixels_; }
+  // set when the program failed to build.
+  auto build_log() const -> std::string const & { return log_; }
+
+  // filters the top-left width x height pixels of the RGBA image src into
+  // dst. done, if given, completes with the column pass.
+  auto enqueue_image(cl_command_queue q, cl_mem src, cl_mem dst,
+                     std::size_t width, std::size_t height,
+                     cl_uint num_events_in_wait_list = 0,
+                     const cl_event *event_wait_list = nullptr,
+                     cl_event *done = nullptr) -> cl_int {
+    auto err = ensure_temp_image(width, height);
+    if (err != CL_SUCCESS) {
+      return err;
+    }
+    err = set_arguments(rows_image_, image(src), image(temp_image_), sampler_,
+                        weights_mem_, cl_int(width), cl_int(height));
+    if (err == CL_SUCCESS) {
+      err = set_arguments(columns_image_, image(temp_image_), image(dst),
+                          sampler_, weights_mem_, cl_int(width),
+                          cl_int(height));
+    }
+    if (err != CL_SUCCESS) {
+      return err;
+    }
+    return enqueue_passes(q, rows_image_, columns_image_, width, height,
+                          num_events_in_wait_list, event_wait_list, done);
+  }
+
+  // the same over buffers of width * height RGBA8 pixels, row by row.
+  auto enqueue_buffer(cl_command_queue q, cl_mem src, cl_mem dst,
+                      std::size_t width, std::size_t height,
+                      cl_uint num_events_in_wait_list = 0,
+                      const cl_event *event_wait_list = nullptr,
+                      cl_event *done = nullptr) -> cl_int {
+    auto bytes = width * height * 4 * sizeof(cl_float);
+    if (!temp_buffer_ || temp_buffer_size_ < bytes) {
+      if (temp_buffer_) {
+        clReleaseMemObject(temp_buffer_);
+      }
+      temp_buffer_ = create_buffer(ctx_, CL_MEM_READ_WRITE, bytes, nullptr);
+      temp_buffer_size_ = temp_buffer_ ? bytes : 0;
+      if (!temp_buffer_) {
+        return last_error();
+      }
+    }
+    auto err = set_arguments(rows_buffer_, src, temp_buffer_, weights_mem_,
+                             cl_int(width), cl_int(height));
+    if (err == CL_SUCCESS) {
+      err = set_arguments(columns_buffer_, temp_buffer_, dst, weights_mem_,
+                          cl_int(width), cl_int(height));
+    }
+    if (err != CL_SUCCESS) {
+      return err;
+    }
+    return enqueue_passes(q, rows_buffer_, columns_buffer_, width, height,
+                          num_events_in_wait_list, event_wait_list, done);
+  }
+
+private:
+  auto kernels() const -> std::array<cl_kernel, 4> {
+    return {rows_image_, columns_image_, rows_buffer_, columns_buffer_};
+  }
+
+  // builds the program for local_y_ and creates its kernels. false, with the
+  // program released, when any of that fails.
+  auto build(cl_device_id d) -> bool {
+    program_ =
+        create_program_with_source(ctx_, kernel::gaussian_separable.text);
+    if (!program_) {
+      return false;
+    }
+    auto options =
+        fmt::format("-D RADIUS={} -D PIXELS_PER_ITEM={} -D LOCAL_X={} "
+                    "-D LOCAL_Y={}",
+                    radius_, pixels_, local_x, local_y_);
+    if (!build_program(program_, {d}, options.c_str())) {
+      log_ = get_program_build_info_log(program_, d);
+      release_program();
+      return false;
+    }
+    rows_image_ = create_kernel(program_, "gaussian_rows_image");
+    columns_image_ = create_kernel(program_, "gaussian_columns_image");
+    rows_buffer_ = create_kernel(program_, "gaussian_rows_buffer");
+    columns_buffer_ = create_kernel(program_, "gaussian_columns_buffer");
+    auto ks = kernels();
+    if (std::find(std::begin(ks), std::end(ks), nullptr) != std::end(ks)) {
+      release_program();
+      return false;
+    }
+    return true;
+  }
+
+  auto release_program() -> void {
+    for (auto k : kernels()) {
+      if (k) {
+        clReleaseKernel(k);
+      }
+    }
+    rows_image_ = columns_image_ = rows_buffer_ = columns_buffer_ = nullptr;
+    if (program_) {
+      clReleaseProgram(program_);
+      program_ = nullptr;
+    }
+  }
+
+  // local memory of the larger of the row and column tiles, in float4s.
+  auto tile_bytes() const -> cl_ulong {
+    auto rows = local_y_ * (local_x * pixels_ + 2 * radius_);
+    auto columns = (local_y_ * pixels_ + 2 * radius_) * local_x;
+    return std::max(rows, columns) * 4 * sizeof(cl_float);
+  }
+
+  auto ensure_temp_image(std::size_t width, std::size_t height) -> cl_int {
+    if (temp_image_ && temp_width_ >= width && temp_height_ >= height) {
+      return CL_SUCCESS;
+    }
+    if (temp_image_) {
+      clReleaseMemObject(temp_image_);
+    }
+    width = std::max(width, temp_width_);
+    height = std::max(height, temp_height_);
+    cl_image_format format;
+    format.image_channel_order = CL_RGBA;
+    format.image_channel_data_type = CL_FLOAT;
+    auto err = cl_int{};
+    temp_image_ = clCreateImage2D(ctx_, CL_MEM_READ_WRITE, &format, width,
+                                  height, 0, nullptr, &err);
+    set_err_if_err(err, "clCreateImage2D");
+    temp_width_ = temp_image_ ? width : 0;
+    temp_height_ = temp_image_ ? height : 0;
+    return err;
+  }
+
+  // each row-pass work-item covers pixels_ pixels along x, each column-pass
+  // work-item pixels_ pixels along y.
+  auto enqueue_passes(cl_command_queue q, cl_kernel rows, cl_kernel columns,
+                      std::size_t width, std::size_t height,
+                      cl_uint num_events_in_wait_list,
+                      const cl_event *event_wait_list, cl_event *done)
+      -> cl_int {
+    auto tile_w = local_x * pixels_;
+    auto tile_h = local_y_ * pixels_;
+    size_t local[2] = {local_x, local_y_};
+    size_t rows_global[2] = {(width + tile_w - 1) / tile_w * local_x,
+                             (height + local_y_ - 1) / local_y_ * local_y_};
+    size_t columns_global[2] = {(width + local_x - 1) / local_x * local_x,
+                                (height + tile_h - 1) / tile_h * local_y_};
+    cl_event rows_done = nullptr;
+    auto err = enqueue_nd_ranage_kernel(q, rows, 2, nullptr, rows_global,
+                                        local, num_events_in_wait_list,
+                                        event_wait_list, &rows_done);
+    if (err == CL_SUCCESS) {
+      err = enqueue_nd_ranage_kernel(q, columns, 2, nullptr, columns_global,
+                                     local, 1, &rows_done, done);
+      clReleaseEvent(rows_done);
+    }
+    return err;
+  }
+
+  cl_context ctx_;
+  std::vector<float> weights_;
+  std::size_t radius_ = 0;
+  std::size_t pixels_ = 0;
+  std::size_t local_y_ = 0;
+  std::string log_;
+
+  cl_program program_ = nullptr;
+  cl_kernel rows_image_ = nullptr;
+  cl_kernel columns_image_ = nullptr;
+  cl_kernel rows_buffer_ = nullptr;
+  cl_kernel columns_buffer_ = nullptr;
+  cl_sampler sampler_ = nullptr;
+  cl_mem weights_mem_ = nullptr;
+
+  cl_mem temp_image_ = nullptr;
+  std::size_t temp_width_ = 0;
+  std::size_t temp_height_ = 0;
+  cl_mem temp_buffer_ = nullptr;
+  std::size_t temp_buffer_size_ = 0;
+};
+
+} // namespace clx
@@ -0,0 +1,641 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "clx.hpp"
+#include "device_caps.hpp"
+#include "kernels.hpp"
+
+namespace clx {
+
+// How the work-items of a group share its local histogram
+// (histogram_image.cl).
+//  - shared: one copy, every work-item contends for every bin.
+//  - sub_group: one copy per block of warp-width work-items, copies padded
+//    apart so the same bin of neighbouring copies is in another bank.
+//  - lane: copies interleaved bin by bin, so neighbouring lanes that hit the
+//    same bin hit different banks.
+//  - automatic: picked from the device by choose_histogram_privatization.
+enum class histogram_privatization { shared, sub_group, lane, automatic };
+
+inline auto to_string(histogram_privatization p) -> char const * {
+  switch (p) {
+  case histogram_privatization::shared:
+    return "shared";
+  case histogram_privatization::sub_group:
+    return "sub_group";
+  case histogram_privatization::lane:
+    return "lane";
+  case histogram_privatization::automatic:
+    return "auto";
+  }
+  return "?";
+}
+
+inline auto parse_histogram_privatization(std::string_view s)
+    -> std::optional<histogram_privatization> {
+  for (auto p :
+       {histogram_privatization::shared, histogram_privatization::sub_group,
+        histogram_privatization::lane, histogram_privatization::automatic}) {
+    if (s == to_string(p)) {
+      return p;
+    }
+  }
+  return std::nullopt;
+}
+
+// How the work-groups' histograms become the final one.
+//  - two_pass: each group writes a partial histogram and a second kernel
+//    sums them.
+//  - atomic: each group adds its non-zero bins to the final histogram with
+//    global atomics; one launch, no partial buffer.
+//  - last_group: each group writes a partial histogram and the last group to
+//    finish sums them; one launch.
+enum class histogram_merge { two_pass, atomic, last_group };
+
+inline auto to_string(histogram_merge m) -> char const * {
+  switch (m) {
+  case histogram_merge::two_pass:
+    return "two_pass";
+  case histogram_merge::atomic:
+    return "atomic";
+  case histogram_merge::last_group:
+    return "last_group";
+  }
+  return "?";
+}
+
+inline auto parse_histogram_merge(std::string_view s)
+    -> std::optional<histogram_merge> {
+  for (auto m : {histogram_merge::two_pass, histogram_merge::atomic,
+                 histogram_merge::last_group}) {
+    if (s == to_string(m)) {
+      return m;
+    }
+  }
+  return std::nullopt;
+}
+
+// contention only serializes where work-items of a group run in lockstep
+// against banked local memory; CPUs run a group's work-items one after the
+// other and keep a single copy in cache.
+inline auto choose_histogram_privatization(device_caps const &caps)
+    -> histogram_privatization {
+  if ((caps.type & CL_DEVICE_TYPE_GPU) && caps.local_mem_dedicated) {
+    return histogram_privatization::sub_group;
+  }
+  return histogram_privatization::shared;
+}
+
+// the local histogram of one work-group of local_size work-items, bins
+// entries per copy.
+struct histogram_layout {
+  histogram_privatization privatization = histogram_privatization::shared;
+  int copies = 1;
+  bool interleaved = false;
+  std::size_t local_words = 0;
+};
+
+// as many copies as the strategy wants and local memory holds. warp is the
+// kernel's preferred work-group size multiple.
+inline auto histogram_layout_for(histogram_privatization p,
+                                 device_caps const &caps,
+                                 std::size_t local_size, std::size_t warp,
+                                 std::size_t bins) -> histogram_layout {
+  if (p == histogram_privatization::automatic) {
+    p = choose_histogram_privatization(caps);
+  }
+  // copies that are not interleaved are bins + 1 words apart, and the
+  // kernels clear that stride even for a single copy
+  auto layout = histogram_layout{p, 1, false, bins + 1};
+  if (p == histogram_privatization::shared) {
+    return layout;
+  }
+  warp = std::max<std::size_t>(warp, 1);
+  if (p == histogram_privatization::sub_group) {
+    auto fit = caps.local_mem_size / ((bins + 1) * sizeof(cl_uint));
+    auto copies = std::clamp<std::size_t>(local_size / warp, 1,
+                                          std::max<cl_ulong>(fit, 1));
+    layout.copies = static_cast<int>(copies);
+    layout.local_words = copies * (bins + 1);
+  } else {
+    auto fit = caps.local_mem_size / (bins * sizeof(cl_uint));
+    auto copies = std::clamp<std::size_t>(std::min(warp, local_size), 1,
+                                          std::max<cl_ulong>(fit, 1));
+    layout.copies = static_cast<int>(copies);
+    layout.interleaved = true;
+    layout.local_words = copies * bins;
+  }
+  return layout;
+}
+
+// Running histogram of a stream of RGBA8 frames (CL_UNORM_INT8 images),
+// kept on the device: each frame is histogrammed in one launch and added to
+// a 64-bit running histogram, and optionally to the sum of a ring of the last
+// window_frames frames' histograms, so nothing is read back per frame. The
+// host reads the running and window histograms when it wants them, blocking
+// or not (histogram_image.cl).
+//
+// calls must be made from one thread on one in-order queue.
+class histogram_stream {
+public:
+  static constexpr std::size_t bins = 256 * 3;
+  static constexpr int pixels_per_item = 32;
+
+  histogram_stream(cl_context ctx, cl_device_id d,
+                   std::size_t window_frames = 0,
+                   histogram_privatization p =
+                       histogram_privatization::automatic)
+      : window_frames_(window_frames) {
+    program_ = create_program_with_source(ctx, kernel::histogram_image.text);
+    if (!program_) {
+      return;
+    }
+    if (!build_program(program_, {d})) {
+      log_ = get_program_build_info_log(program_, d);
+      return;
+    }
+    histogram_ = create_kernel(program_, "histogram_image_rgba_unorm8_atomic");
+    accumulate_ = create_kernel(program_, "histogram_accumulate_unorm8");
+    if (!histogram_ || !accumulate_) {
+      return;
+    }
+    local_[1] = std::clamp<std::size_t>(
+        get_kernel_work_group_info_size(histogram_, d) / local_[0], 1, 16);
+    layout_ = histogram_layout_for(
+        p, device_caps_of(d), local_[0] * local_[1],
+        get_kernel_work_group_info_preferred_multiple(histogram_, d), bins);
+
+    // every buffer starts zeroed; the frame histogram is cleared again by
+    // each accumulation
+    auto zeros = std::vector<cl_ulong>(bins * std::max<std::size_t>(
+                                                  window_frames_, 1));
+    auto flags = CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR;
+    frame_ = create_buffer(ctx, flags, bins * sizeof(cl_uint), zeros.data());
+    running_ = create_buffer(ctx, flags, bins * sizeof(cl_ulong),
+                             zeros.data());
+    if (window_frames_ > 0) {
+      ring_ = create_buffer(ctx, flags,
+                            window_frames_ * bins * sizeof(cl_uint),
+                            zeros.data());
+      window_ = create_buffer(ctx, flags, bins * sizeof(cl_ulong),
+                              zeros.data());
+    }
+  }
+
+  histogram_stream(histogram_stream const &) = delete;
+  auto operator=(histogram_stream const &) -> histogram_stream & = delete;
+
+  ~histogram_stream() {
+    for (auto m : {frame_, running_, ring_, window_}) {
+      if (m) {
+        clReleaseMemObject(m);
+      }
+    }
+    for (auto k : {histogram_, accumulate_}) {
+      if (k) {
+        clReleaseKernel(k);
+      }
+    }
+    if (program_) {
+      clReleaseProgram(program_);
+    }
+  }
+
+  explicit operator bool() const {
+    return histogram_ && accumulate_ && frame_ && running_ &&
+           (window_frames_ == 0 || (ring_ && window_));
+  }
+
+  // frames added since construction or the last reset.
+  auto frames() const -> cl_ulong { return frames_; }
+  auto window_frames() const -> std::size_t { return window_frames_; }
+  // the frames the window histogram currently sums.
+  auto frames_in_window() const -> cl_ulong {
+    return std::min<cl_ulong>(frames_, window_frames_);
+  }
+  auto layout() const -> histogram_layout const & { return layout_; }
+  // set when the program failed to build.
+  auto build_log() const -> std::string const & { return log_; }
+
+  // adds the histogram of the width x height RGBA8 image to the stream.
+  // done, if given, completes when the running histogram includes it.
+  auto enqueue_frame(cl_command_queue q, cl_mem img, std::size_t width,
+                     std::size_t height, cl_uint num_events_in_wait_list = 0,
+                     const cl_event *event_wait_list = nullptr,
+                     cl_event *done = nullptr) -> cl_int {
+    auto items_x = (width + pixels_per_item - 1) / pixels_per_item;
+    size_t global[2] = {(items_x + local_[0] - 1) / local_[0] * local_[0],
+                        (height + local_[1] - 1) / local_[1] * local_[1]};
+    size_t accumulate_global[1] = {bins};
+    auto slot = window_frames_ > 0 ? frames_ % window_frames_ : 0;
+    auto err = set_arguments(histogram_, image(img), cl_int(pixels_per_item),
+                             buffer<cl_uint>(frame_),
+                             local<cl_uint>(layout_.local_words),
+                             cl_int(layout_.copies),
+                             cl_int(layout_.interleaved));
+    if (err == CL_SUCCESS) {
+      err = set_arguments(accumulate_, frame_, running_, ring_, cl_int(slot),
+                          cl_int(window_frames_), window_);
+    }
+    if (err != CL_SUCCESS) {
+      return err;
+    }
+    cl_event counted = nullptr;
+    err = enqueue_nd_ranage_kernel(q, histogram_, 2, nullptr, global, local_,
+                                   num_events_in_wait_list, event_wait_list,
+                                   &counted);
+    if (err != CL_SUCCESS) {
+      return err;
+    }
+    err = enqueue_nd_ranage_kernel(q, accumulate_, 1, nullptr,
+                                   accumulate_global, nullptr, 1, &counted,
+                                   done);
+    clReleaseEvent(counted);
+    if (err == CL_SUCCESS) {
+      frames_++;
+    }
+    return err;
+  }
+
+  // reads the bins counts of the running histogram into running and, with a
+  // window, of the window histogram into window; either may be null. a
+  // non-blocking read completes with done, and the host arrays must outlive
+  // it.
+  auto enqueue_read(cl_command_queue q, cl_ulong *running, cl_ulong *window,
+                    cl_bool blocking, cl_uint num_events_in_wait_list = 0,
+                    const cl_event *event_wait_list = nullptr,
+                    cl_event *done = nullptr) -> cl_int {
+    if (!window_) {
+      window = nullptr;
+    }
+    auto err = CL_SUCCESS;
+    if (running) {
+      err = enqueue_read_buffer(q, running_, blocking, 0,
+                                bins * sizeof(cl_ulong), running,
+                                num_events_in_wait_list, event_wait_list,
+                                window ? nullptr : done);
+      if (err != CL_SUCCESS || !window) {
+        return err;
+      }
+      // the in-order queue orders the window read after the running one
+      num_events_in_wait_list = 0;
+      event_wait_list = nullptr;
+    }
+    if (window) {
+      err = enqueue_read_buffer(q, window_, blocking, 0,
+                                bins * sizeof(cl_ulong), window,
+                                num_events_in_wait_list, event_wait_list,
+                                done);
+    }
+    return err;
+  }
+
+  // starts the stream over, zeroing the running and window histograms.
+  auto reset(cl_command_queue q) -> cl_int {
+    auto zero = cl_uint{0};
+    auto err = CL_SUCCESS;
+    for (auto [m, size] :
+         {std::pair{running_, bins * sizeof(cl_ulong)},
+          std::pair{ring_, window_frames_ * bins * sizeof(cl_uint)},
+          std::pair{window_, bins * sizeof(cl_ulong)}}) {
+      if (m && err == CL_SUCCESS) {
+        err = clEnqueueFillBuffer(q, m, &zero, sizeof(zero), 0, size, 0,
+                                  nullptr, nullptr);
+        set_err_if_err(err, "clEnqueueFillBuffer");
+      }
+    }
+    if (err == CL_SUCCESS) {
+      frames_ = 0;
+    }
+    return err;
+  }
+
+private:
+  std::size_t window_frames_;
+  cl_ulong frames_ = 0;
+  size_t local_[2] = {16, 16};
+  histogram_layout layout_;
+  std::string log_;
+
+  cl_program program_ = nullptr;
+  cl_kernel histogram_ = nullptr;
+  cl_kernel accumulate_ = nullptr;
+  cl_mem frame_ = nullptr;
+  cl_mem running_ = nullptr;
+  cl_mem ring_ = nullptr;
+  cl_mem window_ = nullptr;
+};
+
+// The sample type of a generic histogram's pixels (histogram_generic.cl).
+enum class histogram_sample { u8, u16, f32 };
+
+// A histogram of channels interleaved samples per pixel into bins bins per
+// channel, counted channel-major. Integer samples in the inclusive range
+// [range_min, range_max] are spread evenly over the bins; f32 samples map
+// [range_min, range_max) linearly onto them. Samples outside the range count
+// in the first or last bin.
+struct histogram_config {
+  histogram_sample sample = histogram_sample::u8;
+  int channels = 1;
+  int bins = 256;
+  double range_min = 0;
+  double range_max = 255;
+
+  auto total_bins() const -> std::size_t {
+    return std::size_t(channels) * std::size_t(bins);
+  }
+  auto operator<(histogram_config const &o) const -> bool {
+    return std::tie(sample, channels, bins, range_min, range_max) <
+           std::tie(o.sample, o.channels, o.bins, o.range_min, o.range_max);
+  }
+};
+
+// integer samples of bit_depth bits over their full range, u8 up to 8 bits
+// and u16 up to 16.
+inline auto histogram_config_for_depth(int channels, int bins, int bit_depth)
+    -> histogram_config {
+  auto sample = bit_depth <= 8 ? histogram_sample::u8 : histogram_sample::u16;
+  return {sample, channels, bins, 0, std::ldexp(1.0, bit_depth) - 1};
+}
+
+inline auto sample_size(histogram_sample s) -> std::size_t {
+  return s == histogram_sample::u8 ? 1 : s == histogram_sample::u16 ? 2 : 4;
+}
+
+// 1 to 4 channels, 1 to 65536 bins, and for integer samples a non-empty
+// integral range the sample type can hold.
+inline auto valid(histogram_config const &c) -> bool {
+  if (c.channels < 1 || c.channels > 4 || c.bins < 1 || c.bins > 65536 ||
+      !(c.range_min < c.range_max)) {
+    return false;
+  }
+  if (c.sample == histogram_sample::f32) {
+    return std::isfinite(c.range_min) && std::isfinite(c.range_max);
+  }
+  auto max = c.sample == histogram_sample::u8 ? 255.0 : 65535.0;
+  return c.range_min >= 0 && c.range_max <= max &&
+         c.range_min == std::floor(c.range_min) &&
+         c.range_max == std::floor(c.range_max);
+}
+
+// bins per unit of an f32 sample, in the precision the kernel uses.
+inline auto histogram_scale(histogram_config const &c) -> float {
+  return static_cast<float>(c.bins / (c.range_max - c.range_min));
+}
+
+// the bin of a sample within its channel, as histogram_generic.cl computes it.
+template <typename T>
+auto histogram_bin(histogram_config const &c, T v) -> std::uint32_t {
+  if (c.sample == histogram_sample::f32) {
+    auto f = (static_cast<float>(v) - static_cast<float>(c.range_min)) *
+             histogram_scale(c);
+    return static_cast<std::uint32_t>(
+        std::fmin(std::fmax(f, 0.0f), static_cast<float>(c.bins - 1)));
+  }
+  auto lo = static_cast<std::int32_t>(c.range_min);
+  auto hi = static_cast<std::int32_t>(c.range_max);
+  auto u = static_cast<std::uint32_t>(
+      std::clamp(static_cast<std::int32_t>(v), lo, hi) - lo);
+  return u * std::uint32_t(c.bins) / std::uint32_t(hi - lo + 1);
+}
+
+// the -D options that specialize histogram_generic.cl for c.
+inline auto histogram_options(histogram_config const &c) -> std::string {
+  auto common = fmt::format("-D CHANNELS={} -D BINS={}", c.channels, c.bins);
+  if (c.sample == histogram_sample::f32) {
+    // hex literals carry the exact floats the host reference uses
+    return fmt::format("{} -D SAMPLE_T=float -D FLOAT_SAMPLES "
+                       "-D RANGE_MIN={:a}f -D RANGE_SCALE={:a}f",
+                       common, static_cast<float>(c.range_min),
+                       histogram_scale(c));
+  }
+  return fmt::format("{} -D SAMPLE_T={} -D RANGE_MIN={} -D RANGE_MAX={}",
+                     common,
+                     c.sample == histogram_sample::u8 ? "uchar" : "ushort",
+                     std::int32_t(c.range_min), std::int32_t(c.range_max));
+}
+
+// Where histogram_engine counts.
+//  - local: a local histogram per work-group, merged into the result with
+//    global atomics. needs the channels * bins counts in local memory.
+//  - global: a few copies of the histogram in global memory, shared by
+//    work-groups in turn and summed by a second kernel.
+//  - automatic: local when it fits.
+enum class histogram_storage { local, global, automatic };
+
+inline auto to_string(histogram_storage s) -> char const * {
+  switch (s) {
+  case histogram_storage::local:
+    return "local";
+  case histogram_storage::global:
+    return "global";
+  case histogram_storage::automatic:
+    return "auto";
+  }
+  return "?";
+}
+
+// Histograms of buffers of pixels for any histogram_config, from
+// histogram_generic.cl specialized per configuration. Programs are built on
+// first use of a configuration and kept, as is the scratch buffer of the
+// global strategy, so calls must be made from one thread on one in-order
+// queue.
+class histogram_engine {
+public:
+  static constexpr std::size_t local_size = 256;
+  // pixels each work-item counts, at least, before more work-groups are
+  // launched.
+  static constexpr std::size_t pixels_per_item = 16;
+  static constexpr int max_global_copies = 16;
+
+  histogram_engine(cl_context ctx, cl_device_id d)
+      : ctx_(ctx), device_(d), caps_(&device_caps_of(d)) {}
+
+  histogram_engine(histogram_engine const &) = delete;
+  auto operator=(histogram_engine const &) -> histogram_engine & = delete;
+
+  ~histogram_engine() {
+    for (auto &[config, p] : programs_) {
+      for (auto k : {p.local, p.global, p.reduce}) {
+        if (k) {
+          clReleaseKernel(k);
+        }
+      }
+      if (p.program) {
+        clReleaseProgram(p.program);
+      }
+    }
+    if (scratch_) {
+      clReleaseMemObject(scratch_);
+    }
+  }
+
+  // set when the last program failed to build.
+  auto build_log() const -> std::string const & { return log_; }
+
+  // local when a work-group's histogram, padded, fits in local memory.
+  auto storage_for(histogram_config const &c) const -> histogram_storage {
+    auto bytes = (c.total_bins() + 1) * sizeof(cl_uint);
+    return bytes <= caps_->local_mem_size ? histogram_storage::local
+                                          : histogram_storage::global;
+  }
+
+  // counts num_pixels pixels of samples into histogram, which holds
+  // c.total_bins() counts and is overwritten. done, if given, completes with
+  // the last command.
+  auto enqueue(cl_command_queue q, histogram_config const &c, cl_mem samples,
+               std::size_t num_pixels, cl_mem histogram,
+               histogram_storage storage = histogram_storage::automatic,
+               cl_uint num_events_in_wait_list = 0,
+               const cl_event *event_wait_list = nullptr,
+               cl_event *done = nullptr) -> cl_int {
+    if (!valid(c)) {
+      set_err_if_err(CL_INVALID_VALUE, "histogram_engine");
+      return CL_INVALID_VALUE;
+    }
+    auto const *p = program_for(c);
+    if (!p) {
+      return last_error();
+    }
+    if (storage == histogram_storage::automatic) {
+      storage = storage_for(c);
+    }
+    auto local = std::min(local_size,
+                          get_kernel_work_group_info_size(
+                              storage == histogram_storage::local ? p->local
+                                                                  : p->global,
+                              device_));
+    auto groups = std::clamp<std::size_t>(
+        (num_pixels + local * pixels_per_item - 1) / (local * pixels_per_item),
+        1, std::max<std::size_t>(caps_->compute_units, 1) * 8);
+    size_t global_size[1] = {groups * local};
+    size_t local_sizes[1] = {local};
+    auto zero = cl_uint{0};
+    auto total = c.total_bins();
+
+    if (storage == histogram_storage::local) {
+      auto warp = get_kernel_work_group_info_preferred_multiple(p->local,
+                                                                device_);
+      auto layout = histogram_layout_for(histogram_privatization::automatic,
+                                         *caps_, local, warp, total);
+      auto err = set_arguments(
+          p->local, samples, cl_uint(num_pixels), histogram,
+          clx::local<cl_uint>(layout.local_words), cl_int(layout.copies),
+          cl_int(layout.interleaved));
+      if (err == CL_SUCCESS) {
+        err = clEnqueueFillBuffer(q, histogram, &zero, sizeof(zero), 0,
+                                  total * sizeof(cl_uint),
+                                  num_events_in_wait_list, event_wait_list,
+                                  nullptr);
+        set_err_if_err(err, "clEnqueueFillBuffer");
+      }
+      if (err == CL_SUCCESS) {
+        err = enqueue_nd_ranage_kernel(q, p->local, 1, nullptr, global_size,
+                                       local_sizes, 0, nullptr, done);
+      }
+      return err;
+    }
+
+    // as many copies as fit a quarter of an allocation, and no more than
+    // there are work-groups to share them
+    auto fit = caps_->max_mem_alloc_size / 4 / (total * sizeof(cl_uint));
+    auto copies = static_cast<int>(std::clamp<cl_ulong>(
+        std::min<cl_ulong>(fit, groups), 1, max_global_copies));
+    auto bytes = copies * total * sizeof(cl_uint);
+    if (!scratch_ || scratch_size_ < bytes) {
+      if (scratch_) {
+        clReleaseMemObject(scratch_);
+      }
+      scratch_ = create_buffer(ctx_, CL_MEM_READ_WRITE, bytes, nullptr);
+      scratch_size_ = scratch_ ? bytes : 0;
+      if (!scratch_) {
+        return last_error();
+      }
+    }
+    size_t reduce_global[1] = {total};
+    auto err = set_arguments(p->global, samples, cl_uint(num_pixels),
+                             scratch_, cl_int(copies));
+    if (err == CL_SUCCESS) {
+      err = set_arguments(p->reduce, scratch_, cl_int(copies), histogram);
+    }
+    if (err == CL_SUCCESS) {
+      err = clEnqueueFillBuffer(q, scratch_, &zero, sizeof(zero), 0, bytes,
+                                num_events_in_wait_list, event_wait_list,
+                                nullptr);
+      set_err_if_err(err, "clEnqueueFillBuffer");
+    }
+    if (err == CL_SUCCESS) {
+      err = enqueue_nd_ranage_kernel(q, p->global, 1, nullptr, global_size,
+                                     local_sizes, 0, nullptr, nullptr);
+    }
+    if (err == CL_SUCCESS) {
+      err = enqueue_nd_ranage_kernel(q, p->reduce, 1, nullptr, reduce_global,
+                                     nullptr, 0, nullptr, done);
+    }
+    return err;
+  }
+
+private:
+  struct program {
+    cl_program program = nullptr;
+    cl_kernel local = nullptr;
+    cl_kernel global = nullptr;
+    cl_kernel reduce = nullptr;
+  };
+
+  // the program for c, built on first use. a failed build is not cached.
+  auto program_for(histogram_config const &c) -> program const * {
+    auto it = programs_.find(c);
+    if (it != std::end(programs_)) {
+      return &it->second;
+    }
+    auto p = program{};
+    p.program =
+        create_program_with_source(ctx_, kernel::histogram_generic.text);
+    if (!p.program) {
+      return nullptr;
+    }
+    auto options = histogram_options(c);
+    if (!build_program(p.program, {device_}, options.c_str())) {
+      log_ = get_program_build_info_log(p.program, device_);
+      clReleaseProgram(p.program);
+      return nullptr;
+    }
+    p.local = create_kernel(p.program, "histogram_generic_local");
+    p.global = create_kernel(p.program, "histogram_generic_global");
+    p.reduce = create_kernel(p.program, "histogram_generic_reduce");
+    if (!p.local || !p.global || !p.reduce) {
+      for (auto k : {p.local, p.global, p.reduce}) {
+        if (k) {
+          clReleaseKernel(k);
+        }
+      }
+      clReleaseProgram(p.program);
+      return nullptr;
+    }
+    return &programs_.emplace(c, p).first->second;
+  }
+
+  cl_context ctx_;
+  cl_device_id device_;
+  device_caps const *caps_;
+  std::string log_;
+  std::map<histogram_config, program> programs_;
+  cl_mem scratch_ = nullptr;
+  std::size_t scratch_size_ = 0;
+};
+
+} // namespace clx
@@ -0,0 +1,443 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// x86 builds compile the AVX2 loops with a target attribute, whatever the
+// -m flags, and take them when the CPU has AVX2. NEON is part of the aarch64
+// baseline, so it is used whenever the compiler targets it.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CLX_HOST_AVX2 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "gaussian.hpp"
+#include "histogram.hpp"
+
+namespace clx {
+
+// The host backend: the operations of the exercise kernels on a pool of
+// std::thread workers, with AVX2 inner loops on x86 CPUs that have it, NEON
+// ones on ARM and plain loops otherwise. Results match the kernels: integer
+// arithmetic wraps the same way and histograms bin the same way. Gaussian
+// outputs can differ by one step where the device contracts multiplies and
+// adds.
+namespace host {
+
+// the worker threads parallel_for uses, at least 1.
+inline auto threads() -> std::size_t {
+  static auto const n =
+      std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+  return n;
+}
+
+namespace detail {
+
+// threads() - 1 workers, started on first use and kept for the life of the
+// process, so a parallel call costs a wake-up rather than thread start-ups.
+class worker_pool {
+public:
+  // never destroyed, so no worker is joined during static destruction.
+  static auto instance() -> worker_pool & {
+    static auto pool = new worker_pool{threads() - 1};
+    return *pool;
+  }
+
+  // calls task(i) for every i < count on the workers and the calling thread
+  // and returns once all calls are done. while the pool runs another
+  // caller's tasks, e.g. for a nested call, the calling thread runs them all.
+  auto run(std::size_t count, std::function<void(std::size_t)> const &task)
+      -> void {
+    auto busy = std::unique_lock<std::mutex>{busy_, std::try_to_lock};
+    if (!busy || workers_.empty() || count < 2) {
+      for (auto i = std::size_t{0}; i < count; i++) {
+        task(i);
+      }
+      return;
+    }
+    {
+      auto lock = std::lock_guard<std::mutex>{m_};
+      task_ = &task;
+      count_ = count;
+      next_ = 0;
+      generation_++;
+    }
+    wake_.notify_all();
+    drain(task, count);
+    auto lock = std::unique_lock<std::mutex>{m_};
+    done_.wait(lock, [&] { return finished_ == count && active_ == 0; });
+    task_ = nullptr;
+    finished_ = 0;
+  }
+
+private:
+  explicit worker_pool(std::size_t n) {
+    for (auto i = std::size_t{0}; i < n; i++) {
+      workers_.emplace_back([this] { work(); });
+    }
+  }
+
+  auto work() -> void {
+    auto seen = std::uint64_t{0};
+    auto lock = std::unique_lock<std::mutex>{m_};
+    for (;;) {
+      wake_.wait(lock, [&] { return generation_ != seen; });
+      seen = generation_;
+      // a wake-up that comes after its tasks were all done
+      if (!task_) {
+        continue;
+      }
+      auto task = task_;
+      auto count = count_;
+      active_++;
+      lock.unlock();
+      drain(*task, count);
+      lock.lock();
+      active_--;
+      done_.notify_all();
+    }
+  }
+
+  auto drain(std::function<void(std::size_t)> const &task, std::size_t count)
+      -> void {
+    auto n = std::size_t{0};
+    for (auto i = next_++; i < count; i = next_++) {
+      task(i);
+      n++;
+    }
+    if (n) {
+      auto lock = std::lock_guard<std::mutex>{m_};
+      finished_ += n;
+      done_.notify_all();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex busy_;
+  std::mutex m_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  std::function<void(std::size_t)> const *task_ = nullptr;
+  std::size_t count_ = 0;
+  std::atomic<std::size_t> next_{0};
+  std::size_t finished_ = 0;
+  std::size_t active_ = 0;
+  std::uint64_t generation_ = 0;
+};
+
+} // namespace detail
+
+// calls f(begin, end) over contiguous chunks of [0, n) of at least grain
+// items each, at most one per thread, on the worker pool and the calling
+// thread. below two grains f runs inline, so small problems pay no wake-up.
+template <typename F>
+auto parallel_for(std::size_t n, std::size_t grain, F &&f) -> void {
+  auto chunks = std::clamp<std::size_t>(n / std::max<std::size_t>(grain, 1),
+                                        1, threads());
+  if (chunks == 1) {
+    f(std::size_t{0}, n);
+    return;
+  }
+  detail::worker_pool::instance().run(chunks, [&](std::size_t i) {
+    f(n * i / chunks, n * (i + 1) / chunks);
+  });
+}
+
+namespace detail {
+
+// items of a simple element-wise loop worth a thread of their own.
+constexpr std::size_t grain = 1 << 16;
+
+#if defined(CLX_HOST_AVX2)
+// whether the AVX2 loops may run, checked once.
+inline auto has_avx2() -> bool {
+  static auto const yes = __builtin_cpu_supports("avx2") != 0;
+  return yes;
+}
+
+// the AVX2 loops each do the multiples of 8 from i and return where they
+// stopped; the caller finishes the rest.
+__attribute__((target("avx2"))) inline auto
+axpy_avx2(float *y, float const *x, float a, std::size_t i, std::size_t n)
+    -> std::size_t {
+  auto va = _mm256_set1_ps(a);
+  for (; i + 8 <= n; i += 8) {
+    auto p = _mm256_mul_ps(va, _mm256_loadu_ps(x + i));
+    _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), p));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) inline auto
+vadd_avx2(int const *a, int const *b, int *c, std::size_t i, std::size_t n)
+    -> std::size_t {
+  for (; i + 8 <= n; i += 8) {
+    auto va = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + i));
+    auto vb = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(b + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(c + i),
+                        _mm256_add_epi32(va, vb));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) inline auto
+square_avx2(int *data, std::size_t i, std::size_t n) -> std::size_t {
+  for (; i + 8 <= n; i += 8) {
+    auto p = reinterpret_cast<__m256i *>(data + i);
+    auto v = _mm256_loadu_si256(p);
+    _mm256_storeu_si256(p, _mm256_mullo_epi32(v, v));
+  }
+  return i;
+}
+
+// outputs x, x + 1, ... of the row at input, which is width samples wide.
+__attribute__((target("avx2"))) inline auto
+convolve_row_avx2(cl_uint const *input, std::size_t width,
+                  cl_uint const *mask, std::size_t mask_width, cl_uint *out,
+                  std::size_t x, std::size_t out_w) -> std::size_t {
+  for (; x + 8 <= out_w; x += 8) {
+    auto sum = _mm256_setzero_si256();
+    for (auto r = std::size_t{0}; r < mask_width; r++) {
+      auto row = input + r * width + x;
+      for (auto c = std::size_t{0}; c < mask_width; c++) {
+        auto m = _mm256_set1_epi32(int(mask[r * mask_width + c]));
+        auto v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(row + c));
+        sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(m, v));
+      }
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + x), sum);
+  }
+  return x;
+}
+#endif
+
+// y[i] += a * x[i] for i < n.
+inline auto axpy(float *y, float const *x, float a, std::size_t n) -> void {
+  auto i = std::size_t{0};
+#if defined(CLX_HOST_AVX2)
+  if (has_avx2()) {
+    i = axpy_avx2(y, x, a, i, n);
+  }
+#elif defined(__ARM_NEON)
+  auto va = vdupq_n_f32(a);
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32(y + i, vaddq_f32(vld1q_f32(y + i), vmulq_f32(va,
+                                                           vld1q_f32(x + i))));
+  }
+#endif
+  for (; i < n; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+} // namespace detail
+
+// c[i] = a[i] + b[i], wrapping like vadd in res/adder2.cl.
+inline auto vadd(int const *a, int const *b, int *c, std::size_t n) -> void {
+  parallel_for(n, detail::grain, [&](std::size_t begin, std::size_t end) {
+    auto i = begin;
+#if defined(CLX_HOST_AVX2)
+    if (detail::has_avx2()) {
+      i = detail::vadd_avx2(a, b, c, i, end);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= end; i += 4) {
+      vst1q_s32(c + i, vaddq_s32(vld1q_s32(a + i), vld1q_s32(b + i)));
+    }
+#endif
+    for (; i < end; i++) {
+      c[i] = static_cast<int>(static_cast<unsigned>(a[i]) +
+                              static_cast<unsigned>(b[i]));
+    }
+  });
+}
+
+// data[i] *= data[i], wrapping like square in res/simple.cl.
+inline auto square(int *data, std::size_t n) -> void {
+  parallel_for(n, detail::grain, [&](std::size_t begin, std::size_t end) {
+    auto i = begin;
+#if defined(CLX_HOST_AVX2)
+    if (detail::has_avx2()) {
+      i = detail::square_avx2(data, i, end);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= end; i += 4) {
+      auto v = vld1q_s32(data + i);
+      vst1q_s32(data + i, vmulq_s32(v, v));
+    }
+#endif
+    for (; i < end; i++) {
+      auto u = static_cast<unsigned>(data[i]);
+      data[i] = static_cast<int>(u * u);
+    }
+  });
+}
+
+// the valid (width - mask_width + 1) x (height - mask_width + 1) outputs of
+// Convolution.cl: each output is the sum of the mask times the signal under
+// it, in wrapping uint arithmetic.
+inline auto convolve(cl_uint const *input, std::size_t width,
+                     std::size_t height, cl_uint const *mask,
+                     std::size_t mask_width, cl_uint *output) -> void {
+  if (mask_width < 1 || width < mask_width || height < mask_width) {
+    return;
+  }
+  auto out_w = width - mask_width + 1;
+  auto out_h = height - mask_width + 1;
+  auto taps = mask_width * mask_width;
+  auto grain = std::max<std::size_t>(detail::grain / (out_w * taps), 1);
+  parallel_for(out_h, grain, [&](std::size_t begin, std::size_t end) {
+    for (auto y = begin; y < end; y++) {
+      auto out = output + y * out_w;
+      auto x = std::size_t{0};
+#if defined(CLX_HOST_AVX2)
+      if (detail::has_avx2()) {
+        x = detail::convolve_row_avx2(input + y * width, width, mask,
+                                      mask_width, out, x, out_w);
+      }
+#elif defined(__ARM_NEON)
+      for (; x + 4 <= out_w; x += 4) {
+        auto sum = vdupq_n_u32(0);
+        for (auto r = std::size_t{0}; r < mask_width; r++) {
+          auto row = input + (y + r) * width + x;
+          for (auto c = std::size_t{0}; c < mask_width; c++) {
+            sum = vmlaq_n_u32(sum, vld1q_u32(row + c),
+                              mask[r * mask_width + c]);
+          }
+        }
+        vst1q_u32(out + x, sum);
+      }
+#endif
+      for (; x < out_w; x++) {
+        auto sum = cl_uint{0};
+        for (auto r = std::size_t{0}; r < mask_width; r++) {
+          for (auto c = std::size_t{0}; c < mask_width; c++) {
+            sum += mask[r * mask_width + c] * input[(y + r) * width + x + c];
+          }
+        }
+        out[x] = sum;
+      }
+    }
+  });
+}
+
+// separable_gaussian::enqueue_buffer on the host: width x height RGBA8
+// pixels filtered by gaussian_weights(sigma) along rows into a float
+// intermediate in [0, 1], then along columns, edges clamped.
+inline auto gaussian(cl_uchar const *src, cl_uchar *dst, std::size_t width,
+                     std::size_t height, float sigma) -> void {
+  auto weights = gaussian_weights(sigma);
+  auto radius = weights.size() / 2;
+  auto row_floats = width * 4;
+  auto grain =
+      std::max<std::size_t>(detail::grain / (row_floats * weights.size()), 1);
+  auto temp = std::vector<float>(row_floats * height);
+
+  parallel_for(height, grain, [&](std::size_t begin, std::size_t end) {
+    // the row with radius clamped pixels either side, so every tap is one
+    // axpy over the whole row
+    auto padded = std::vector<float>((width + 2 * radius) * 4);
+    for (auto y = begin; y < end; y++) {
+      auto in = src + y * row_floats;
+      for (auto i = std::size_t{0}; i < width + 2 * radius; i++) {
+        auto x = std::clamp<std::ptrdiff_t>(std::ptrdiff_t(i) -
+                                                std::ptrdiff_t(radius),
+                                            0, std::ptrdiff_t(width) - 1);
+        for (auto c = 0; c < 4; c++) {
+          padded[i * 4 + c] = in[x * 4 + c] * (1.0f / 255.0f);
+        }
+      }
+      auto out = temp.data() + y * row_floats;
+      std::fill(out, out + row_floats, 0.0f);
+      for (auto k = std::size_t{0}; k < weights.size(); k++) {
+        detail::axpy(out, padded.data() + k * 4, weights[k], row_floats);
+      }
+    }
+  });
+
+  parallel_for(height, grain, [&](std::size_t begin, std::size_t end) {
+    auto sum = std::vector<float>(row_floats);
+    for (auto y = begin; y < end; y++) {
+      std::fill(std::begin(sum), std::end(sum), 0.0f);
+      for (auto k = std::size_t{0}; k < weights.size(); k++) {
+        auto row = std::clamp<std::ptrdiff_t>(
+            std::ptrdiff_t(y + k) - std::ptrdiff_t(radius), 0,
+            std::ptrdiff_t(height) - 1);
+        detail::axpy(sum.data(), temp.data() + row * row_floats, weights[k],
+                     row_floats);
+      }
+      // convert_uchar4_sat_rte: nearbyint rounds half to even
+      auto out = dst + y * row_floats;
+      for (auto i = std::size_t{0}; i < row_floats; i++) {
+        out[i] = static_cast<cl_uchar>(
+            std::clamp(std::nearbyint(sum[i] * 255.0f), 0.0f, 255.0f));
+      }
+    }
+  });
+}
+
+// the histogram of num_pixels pixels of c.sample samples, c.total_bins()
+// counts as histogram_engine produces them. each worker counts into its own
+// histogram and the copies are summed.
+inline auto histogram(histogram_config const &c, void const *samples,
+                      std::size_t num_pixels) -> std::vector<cl_uint> {
+  auto bins = c.total_bins();
+  auto chunks = std::clamp<std::size_t>(num_pixels / detail::grain, 1,
+                                        threads());
+  auto partial = std::vector<std::vector<cl_uint>>(
+      chunks, std::vector<cl_uint>(bins));
+  auto count = [&](auto const *p) {
+    parallel_for(chunks, 1, [&](std::size_t begin, std::size_t end) {
+      for (auto chunk = begin; chunk < end; chunk++) {
+        auto &h = partial[chunk];
+        auto first = num_pixels * chunk / chunks * c.channels;
+        auto last = num_pixels * (chunk + 1) / chunks * c.channels;
+        for (auto i = first; i < last; i++) {
+          auto channel = i % c.channels;
+          h[channel * c.bins + histogram_bin(c, p[i])]++;
+        }
+      }
+    });
+  };
+  switch (c.sample) {
+  case histogram_sample::u8:
+    count(static_cast<cl_uchar const *>(samples));
+    break;
+  case histogram_sample::u16:
+    count(static_cast<cl_ushort const *>(samples));
+    break;
+  case histogram_sample::f32:
+    count(static_cast<cl_float const *>(samples));
+    break;
+  }
+  for (auto chunk = std::size_t{1}; chunk < chunks; chunk++) {
+    for (auto i = std::size_t{0}; i < bins; i++) {
+      partial[0][i] += partial[chunk][i];
+    }
+  }
+  return partial[0];
+}
+
+// the 256 * 3 red, green and blue bins of histogram_image_rgba_unorm8 for
+// num_pixels RGBA8 pixels.
+inline auto histogram_rgba_unorm8(cl_uchar const *rgba, std::size_t num_pixels)
+    -> std::vector<cl_uint> {
+  auto rgba_config = histogram_config_for_depth(4, 256, 8);
+  auto counts = histogram(rgba_config, rgba, num_pixels);
+  counts.resize(256 * 3);
+  return counts;
+}
+
+} // namespace host
+
+} // namespace clx
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+
+#include <fmt/format.h>
+
+namespace clx {
+namespace detail {
+
+// s as the contents of a JSON string, up to its first NUL.
+inline auto json_escape(std::string const &s) -> std::string {
+  auto out = std::string{};
+  for (auto c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c == '\0') {
+      break;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out += fmt::format("\\u{:04x}", int(c));
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+} // namespace detail
+} // namespace clx
@@ -1,12 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+#include "sx.hpp"
+
+namespace clx {
+namespace kernel {
+
+// an OpenCL C source embedded at build time (see cmake/ClxEmbedKernels.cmake).
+// the hash is computed at compile time and is what clx::program_cache keys on.
+struct source {
+  constexpr source(std::string_view name, std::string_view text)
+      : name(name), text(text), hash(sx::fnv1a(text)) {}
+
+  std::string_view name;
+  std::string_view text;
+  std::uint64_t hash;
+};
+
+} // namespace kernel
+} // namespace clx
+
+#include "cl/embedded_kernels.hpp"
+
 namespace clx {
 namespace kernel {
 
-static char adder2[] =
-    "__kernel void \n"
-    "vadd(__global int *a, __global int *b, __global int *c) \n"
-    "{                                                      \n"
-    "   size_t i = get_global_id(0);                        \n"
-    "   c[i] = a[i] + b[i];                                 \n"
-    "}                                                      \n";
+constexpr auto find(std::string_view name) -> source const * {
+  for (auto s : registry) {
+    if (s->name == name) {
+      return s;
+    }
+  }
+  return nullptr;
 }
+
+} // namespace kernel
 } // namespace clx
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+#include "cache.hpp"
+#include "clx.hpp"
+#include "device_caps.hpp"
+#include "sx.hpp"
+
+namespace clx {
+
+// On-disk cache of program binaries (CL_PROGRAM_BINARIES).
+//
+// An entry is keyed by the hash of the source, the build options and the
+// platform/device/driver identity, so a driver update or an option change
+// produces a new key instead of reusing a stale binary. Entries are written to
+// a temporary file and renamed into place, so concurrent processes either see
+// a complete entry or none at all.
+class program_cache {
+public:
+  static constexpr std::uint32_t format_version = 1;
+
+  explicit program_cache(std::filesystem::path dir) : dir_(std::move(dir)) {
+    auto ec = std::error_code{};
+    std::filesystem::create_directories(dir_, ec);
+  }
+
+  program_cache() : program_cache(default_directory()) {}
+
+  // programs/ in cache_directory(), so clear() only touches program entries.
+  static auto default_directory() -> std::filesystem::path {
+    return cache_directory() / "programs";
+  }
+
+  auto directory() const -> std::filesystem::path const & { return dir_; }
+
+  auto key(std::uint64_t source_hash, char const *options,
+           cl_device_id const &d) const -> std::uint64_t {
+    auto const &caps = device_caps_of(d);
+    auto h = sx::fnv1a(fmt::format("{}:{:016x}", format_version, source_hash));
+    h = sx::fnv1a(options ? options : "", h);
+    h = sx::fnv1a(get_platform_info_name(caps.platform), h);
+    h = sx::fnv1a(get_platform_info_version(caps.platform), h);
+    h = sx::fnv1a(caps.name, h);
+    h = sx::fnv1a(caps.version, h);
+    h = sx::fnv1a(caps.driver_version, h);
+    return h;
+  }
+
+  auto path(std::uint64_t key) const -> std::filesystem::path {
+    return dir_ / fmt::format("{:016x}.bin", key);
+  }
+
+  // returns an empty binary on a miss. corrupt or mismatching entries are
+  // removed.
+  auto load(std::uint64_t key) const -> std::vector<unsigned char> {
+    std::ifstream in(path(key), std::ios::binary);
+    if (!in.is_open()) {
+      return {};
+    }
+    auto ec = std::error_code{};
+    auto file_size = std::filesystem::file_size(path(key), ec);
+    auto h = header{};
+    in.read(reinterpret_cast<char *>(&h), sizeof(h));
+    // the size is checked against the file before allocating, so a corrupt
+    // header cannot ask for an arbitrary amount of memory.
+    if (!in || ec || std::string_view{h.magic, 4} != "CLXB" ||
+        h.version != format_version || h.key != key ||
+        h.size != file_size - sizeof(h)) {
+      erase(key);
+      return {};
+    }
+    auto bin = std::vector<unsigned char>(h.size);
+    in.read(reinterpret_cast<char *>(bin.data()), bin.size());
+    if (!in || checksum(bin) != h.checksum) {
+      erase(key);
+      return {};
+    }
+    return bin;
+  }
+
+  auto store(std::uint64_t key, std::vector<unsigned char> const &bin) const
+      -> bool {
+    auto h = header{{'C', 'L', 'X', 'B'}, format_version, key, bin.size(),
+                    checksum(bin)};
+    auto content = std::string(reinterpret_cast<char const *>(&h), sizeof(h));
+    content.append(reinterpret_cast<char const *>(bin.data()), bin.size());
+    // the last writer wins and readers never see a torn file
+    return write_file_atomic(path(key), content);
+  }
+
+  auto erase(std::uint64_t key) const -> void {
+    auto ec = std::error_code{};
+    std::filesystem::remove(path(key), ec);
+  }
+
+  auto clear() const -> void {
+    auto ec = std::error_code{};
+    for (auto const &e : std::filesystem::directory_iterator(dir_, ec)) {
+      if (e.path().extension() == ".bin" || e.path().extension() == ".tmp") {
+        std::filesystem::remove(e.path(), ec);
+      }
+    }
+  }
+
+private:
+  struct header {
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t key;
+    std::uint64_t size;
+    std::uint64_t checksum;
+  };
+
+  static auto checksum(std::vector<unsigned char> const &bin)
+      -> std::uint64_t {
+    return sx::fnv1a({reinterpret_cast<char const *>(bin.data()), bin.size()});
+  }
+
+  std::filesystem::path dir_;
+};
+
+// create and build a program, reusing binaries from the cache when every
+// device has an entry. otherwise the program is built from source and the
+// resulting binaries are stored. a cached binary the driver rejects is dropped
+// and the program is rebuilt from source. on a build failure the program is
+// still returned so that its build log can be read; check
+// get_program_build_info_status().
+inline auto build_program_cached(program_cache const &cache, cl_context ctx,
+                                 std::vector<cl_device_id> const &ds,
+                                 std::string_view source,
+                                 std::uint64_t source_hash, char const *options)
+    -> cl_program {
+  auto keys = std::vector<std::uint64_t>{};
+  auto bins = std::vector<std::vector<unsigned char>>{};
+  for (auto const &d : ds) {
+    keys.push_back(cache.key(source_hash, options, d));
+    bins.push_back(cache.load(keys.back()));
+  }
+
+  auto hit = std::none_of(std::begin(bins), std::end(bins),
+                          [](auto const &b) { return b.empty(); });
+  if (hit) {
+    // a rejected binary is recovered from, so keep it out of the last error
+    auto err = cl_int{};
+    auto program = create_program_with_binary(ctx, ds, bins, err);
+    if (program && build_program(program, ds, options, err)) {
+      return program;
+    }
+    if (program) {
+      clReleaseProgram(program);
+    }
+    for (auto const &k : keys) {
+      cache.erase(k);
+    }
+  }
+
+  auto program = create_program_with_source(ctx, source);
+  if (!program) {
+    return nullptr;
+  }
+  if (!build_program(program, ds, options)) {
+    return program;
+  }
+
+  auto devices = get_program_info_devices(program);
+  auto binaries = get_program_info_binaries(program);
+  for (auto i = 0u; i < devices.size() && i < binaries.size(); i++) {
+    auto it = std::find(std::begin(ds), std::end(ds), devices[i]);
+    if (it != std::end(ds) && !binaries[i].empty()) {
+      cache.store(keys[it - std::begin(ds)], binaries[i]);
+    }
+  }
+  return program;
+}
+
+inline auto build_program_cached(program_cache const &cache, cl_context ctx,
+                                 std::vector<cl_device_id> const &ds,
+                                 std::string_view source, char const *options)
+    -> cl_program {
+  return build_program_cached(cache, ctx, ds, source, sx::fnv1a(source),
+                              options);
+}
+
+inline auto build_program_from_file_cached(program_cache const &cache,
+                                           cl_context ctx,
+                                           std::vector<cl_device_id> const &ds,
+                                           char const *file,
+                                           char const *options) -> cl_program {
+  auto source = read_file(file);
+  if (source.empty()) {
+    return nullptr;
+  }
+  return build_program_cached(cache, ctx, ds, source, options);
+}
+
+} // namespace clx
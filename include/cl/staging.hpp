@@ -0,0 +1,250 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "clx.hpp"
+
+namespace clx {
+
+// Scoped view of a mapped buffer region. The mapping is released with a
+// (non-blocking) unmap when the view goes out of scope; the queue orders the
+// unmap before any later command touching the buffer.
+class mapped_buffer {
+public:
+  mapped_buffer() = default;
+
+  mapped_buffer(cl_command_queue q, cl_mem mem, cl_map_flags flags,
+                std::size_t offset, std::size_t size)
+      : q_(q), mem_(mem), size_(size) {
+    ptr_ = enqueue_map_buffer(q, mem, CL_TRUE, flags, offset, size);
+  }
+
+  mapped_buffer(mapped_buffer &&o) noexcept { swap(o); }
+
+  auto operator=(mapped_buffer &&o) noexcept -> mapped_buffer & {
+    unmap();
+    swap(o);
+    return *this;
+  }
+
+  ~mapped_buffer() { unmap(); }
+
+  auto data() const -> void * { return ptr_; }
+
+  template <typename T> auto as() const -> T * {
+    return static_cast<T *>(ptr_);
+  }
+
+  auto size() const -> std::size_t { return size_; }
+
+  explicit operator bool() const { return ptr_ != nullptr; }
+
+  auto unmap() -> cl_int {
+    if (!ptr_) {
+      return CL_SUCCESS;
+    }
+    auto err = enqueue_unmap_mem_object(q_, mem_, ptr_);
+    ptr_ = nullptr;
+    return err;
+  }
+
+private:
+  auto swap(mapped_buffer &o) noexcept -> void {
+    std::swap(q_, o.q_);
+    std::swap(mem_, o.mem_);
+    std::swap(ptr_, o.ptr_);
+    std::swap(size_, o.size_);
+  }
+
+  cl_command_queue q_ = nullptr;
+  cl_mem mem_ = nullptr;
+  void *ptr_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+// Scoped view of a mapped 2D image. Rows are row_pitch() bytes apart, which
+// may be larger than width * pixel size.
+class mapped_image {
+public:
+  mapped_image() = default;
+
+  mapped_image(cl_command_queue q, cl_mem image, cl_map_flags flags,
+               std::size_t width, std::size_t height)
+      : q_(q), mem_(image), width_(width), height_(height) {
+    size_t origin[3] = {0, 0, 0};
+    size_t region[3] = {width, height, 1};
+    ptr_ = enqueue_map_image(q, image, CL_TRUE, flags, origin, region,
+                             &row_pitch_);
+  }
+
+  mapped_image(mapped_image &&o) noexcept { swap(o); }
+
+  auto operator=(mapped_image &&o) noexcept -> mapped_image & {
+    unmap();
+    swap(o);
+    return *this;
+  }
+
+  ~mapped_image() { unmap(); }
+
+  auto data() const -> void * { return ptr_; }
+
+  auto row(std::size_t y) const -> unsigned char * {
+    return static_cast<unsigned char *>(ptr_) + y * row_pitch_;
+  }
+
+  auto row_pitch() const -> std::size_t { return row_pitch_; }
+  auto width() const -> std::size_t { return width_; }
+  auto height() const -> std::size_t { return height_; }
+
+  explicit operator bool() const { return ptr_ != nullptr; }
+
+  auto unmap() -> cl_int {
+    if (!ptr_) {
+      return CL_SUCCESS;
+    }
+    auto err = enqueue_unmap_mem_object(q_, mem_, ptr_);
+    ptr_ = nullptr;
+    return err;
+  }
+
+private:
+  auto swap(mapped_image &o) noexcept -> void {
+    std::swap(q_, o.q_);
+    std::swap(mem_, o.mem_);
+    std::swap(ptr_, o.ptr_);
+    std::swap(row_pitch_, o.row_pitch_);
+    std::swap(width_, o.width_);
+    std::swap(height_, o.height_);
+  }
+
+  cl_command_queue q_ = nullptr;
+  cl_mem mem_ = nullptr;
+  void *ptr_ = nullptr;
+  std::size_t row_pitch_ = 0;
+  std::size_t width_ = 0;
+  std::size_t height_ = 0;
+};
+
+// Pinned host memory: a CL_MEM_ALLOC_HOST_PTR buffer that stays mapped for
+// its whole lifetime. Transfers to and from other buffers go through data(),
+// which drivers can DMA from directly instead of bouncing through an internal
+// pinned copy as they do for pageable memory.
+class staging_buffer {
+public:
+  staging_buffer(cl_context ctx, cl_command_queue q, std::size_t capacity)
+      : capacity_(capacity) {
+    mem_ = create_buffer(ctx, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                         capacity, nullptr);
+    if (mem_) {
+      view_ = mapped_buffer{q, mem_, CL_MAP_READ | CL_MAP_WRITE, 0, capacity};
+    }
+  }
+
+  staging_buffer(staging_buffer const &) = delete;
+  auto operator=(staging_buffer const &) -> staging_buffer & = delete;
+
+  ~staging_buffer() {
+    if (view_) {
+      view_.unmap();
+    }
+    if (mem_) {
+      clReleaseMemObject(mem_);
+    }
+  }
+
+  auto data() const -> void * { return view_.data(); }
+
+  template <typename T> auto as() const -> T * { return view_.as<T>(); }
+
+  auto capacity() const -> std::size_t { return capacity_; }
+
+  explicit operator bool() const { return static_cast<bool>(view_); }
+
+  // data() must not be modified until the write has completed; pass an event
+  // or a blocking flag accordingly.
+  auto upload(cl_command_queue q, cl_mem dst, cl_bool blocking,
+              std::size_t offset, std::size_t size,
+              cl_uint num_events_in_wait_list = 0,
+              const cl_event *event_wait_list = nullptr,
+              cl_event *event = nullptr) const -> cl_int {
+    return enqueue_write_buffer(q, dst, blocking, offset, size, data(),
+                                num_events_in_wait_list, event_wait_list,
+                                event);
+  }
+
+  auto download(cl_command_queue q, cl_mem src, cl_bool blocking,
+                std::size_t offset, std::size_t size,
+                cl_uint num_events_in_wait_list = 0,
+                const cl_event *event_wait_list = nullptr,
+                cl_event *event = nullptr) const -> cl_int {
+    return enqueue_read_buffer(q, src, blocking, offset, size, data(),
+                               num_events_in_wait_list, event_wait_list, event);
+  }
+
+private:
+  cl_mem mem_ = nullptr;
+  std::size_t capacity_;
+  mapped_buffer view_;
+};
+
+// Recycles staging buffers. Capacities are rounded up to a power of two (at
+// least min_capacity) so buffers are reusable across slightly different
+// transfer sizes.
+class staging_allocator {
+public:
+  static constexpr std::size_t min_capacity = 64 << 10;
+
+  staging_allocator(cl_context ctx, cl_command_queue q) : ctx_(ctx), q_(q) {}
+
+  // returns nullptr if the buffer could not be created or mapped. a free
+  // buffer more than one size class above the request is left for a larger
+  // transfer rather than pinned for a small one.
+  auto acquire(std::size_t size) -> std::unique_ptr<staging_buffer> {
+    auto capacity = min_capacity;
+    while (capacity < size) {
+      capacity <<= 1;
+    }
+    {
+      auto lock = std::lock_guard<std::mutex>{mutex_};
+      auto it = std::find_if(
+          std::begin(free_), std::end(free_),
+          [&](auto const &b) { return b->capacity() >= size; });
+      if (it != std::end(free_) && (*it)->capacity() <= 2 * capacity) {
+        auto b = std::move(*it);
+        free_.erase(it);
+        return b;
+      }
+    }
+    auto b = std::make_unique<staging_buffer>(ctx_, q_, capacity);
+    if (!*b) {
+      return nullptr;
+    }
+    return b;
+  }
+
+  auto release(std::unique_ptr<staging_buffer> b) -> void {
+    if (!b) {
+      return;
+    }
+    auto lock = std::lock_guard<std::mutex>{mutex_};
+    // keep the list sorted by capacity so acquire() picks the best fit
+    auto it = std::find_if(
+        std::begin(free_), std::end(free_),
+        [&](auto const &f) { return f->capacity() >= b->capacity(); });
+    free_.insert(it, std::move(b));
+  }
+
+private:
+  cl_context ctx_;
+  cl_command_queue q_;
+  std::vector<std::unique_ptr<staging_buffer>> free_;
+  std::mutex mutex_;
+};
+
+} // namespace clx
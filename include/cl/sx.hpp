@@ -1,4 +1,8 @@
+#pragma once
+
 #include <array>
+#include <cstdint>
+#include <string_view>
 
 namespace sx {
 
@@ -54,4 +58,16 @@ constexpr auto make_array(T const &t, Ts... ts) {
   return make_array(t, make_array(ts...));
 }
 
+// 64-bit FNV-1a. constexpr so that hashes of embedded sources can be
+// computed at compile time; h chains several inputs into one hash.
+constexpr auto fnv1a(std::string_view s,
+                     std::uint64_t h = 0xcbf29ce484222325ull)
+    -> std::uint64_t {
+  for (auto c : s) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
 } // namespace sx
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "clx.hpp"
+
+namespace clx {
+
+// Event graph of device commands and host callbacks.
+//
+// Nodes are declared with the nodes they depend on; since a dependency must
+// already exist, declaration order is a topological order. run() maps the
+// graph onto the given queues: a node continues on the queue of its first
+// dependency when it is the first successor there (in-order queues then
+// order it for free), otherwise it starts a new branch on the next queue.
+// Cross-queue dependencies become event wait lists, host callbacks run on
+// the calling thread and release their successors through user events, and
+// every event is released once the graph has finished.
+class task_graph {
+public:
+  using node = std::size_t;
+
+  task_graph() = default;
+  task_graph(task_graph const &) = delete;
+  auto operator=(task_graph const &) -> task_graph & = delete;
+
+  // enqueues one command on the given queue, waiting on the given events
+  // and returning its own event. kernel arguments may be set inside since
+  // commands are enqueued in declaration order.
+  using command = std::function<cl_int(cl_command_queue, cl_uint,
+                                       const cl_event *, cl_event *)>;
+
+  auto add(command c, std::vector<node> deps) -> node {
+    nodes_.push_back({std::move(c), nullptr, std::move(deps)});
+    return nodes_.size() - 1;
+  }
+
+  auto add_host(std::function<void()> fn, std::vector<node> deps) -> node {
+    nodes_.push_back({nullptr, std::move(fn), std::move(deps)});
+    return nodes_.size() - 1;
+  }
+
+  auto add_kernel(cl_kernel k, cl_uint work_dim,
+                  std::array<std::size_t, 3> global_work_size,
+                  std::array<std::size_t, 3> local_work_size,
+                  std::vector<node> deps) -> node {
+    auto local = local_work_size[0] != 0;
+    return add(
+        [=](cl_command_queue q, cl_uint n, const cl_event *wait, cl_event *e) {
+          return enqueue_nd_ranage_kernel(q, k, work_dim, nullptr,
+                                          global_work_size.data(),
+                                          local ? local_work_size.data()
+                                                : nullptr,
+                                          n, wait, e);
+        },
+        std::move(deps));
+  }
+
+  auto add_write(cl_mem dst, std::size_t offset, std::size_t size,
+                 const void *src, std::vector<node> deps) -> node {
+    return add(
+        [=](cl_command_queue q, cl_uint n, const cl_event *wait, cl_event *e) {
+          return enqueue_write_buffer(q, dst, CL_FALSE, offset, size, src, n,
+                                      wait, e);
+        },
+        std::move(deps));
+  }
+
+  auto add_read(cl_mem src, std::size_t offset, std::size_t size, void *dst,
+                std::vector<node> deps) -> node {
+    return add(
+        [=](cl_command_queue q, cl_uint n, const cl_event *wait, cl_event *e) {
+          return enqueue_read_buffer(q, src, CL_FALSE, offset, size, dst, n,
+                                     wait, e);
+        },
+        std::move(deps));
+  }
+
+  auto add_copy(cl_mem src, cl_mem dst, std::size_t src_offset,
+                std::size_t dst_offset, std::size_t size,
+                std::vector<node> deps) -> node {
+    return add(
+        [=](cl_command_queue q, cl_uint n, const cl_event *wait, cl_event *e) {
+          auto err = clEnqueueCopyBuffer(q, src, dst, src_offset, dst_offset,
+                                         size, n, wait, e);
+          set_err_if_err(err, "clEnqueueCopyBuffer");
+          return err;
+        },
+        std::move(deps));
+  }
+
+  auto size() const -> std::size_t { return nodes_.size(); }
+
+  // queue each node ran on during the last run(), for inspection.
+  auto queue_of(node n) const -> cl_command_queue { return nodes_[n].queue; }
+
+  // submits the whole graph and blocks until it has completed. returns the
+  // first error; on failure commands still waiting on host callbacks are
+  // released with an error status so the queues drain.
+  auto run(std::vector<cl_command_queue> const &queues) -> cl_int {
+    if (queues.empty()) {
+      return CL_INVALID_COMMAND_QUEUE;
+    }
+    auto ctx = cl_context{};
+    clGetCommandQueueInfo(queues[0], CL_QUEUE_CONTEXT, sizeof(ctx), &ctx,
+                          nullptr);
+
+    auto err = submit(ctx, queues);
+    for (auto const &q : queues) {
+      clFlush(q);
+    }
+    if (err == CL_SUCCESS) {
+      err = run_host_nodes();
+    }
+    if (err != CL_SUCCESS) {
+      for (auto &n : nodes_) {
+        if (n.fn && n.event && !n.done) {
+          clSetUserEventStatus(n.event, CL_INVALID_OPERATION);
+          n.done = true;
+        }
+      }
+    }
+    for (auto const &q : queues) {
+      finish(q);
+    }
+    release_events();
+    return err;
+  }
+
+  ~task_graph() { release_events(); }
+
+private:
+  struct node_t {
+    command cmd;
+    std::function<void()> fn;
+    std::vector<node> deps;
+    cl_command_queue queue = nullptr;
+    cl_event event = nullptr;
+    bool continued = false;
+    bool done = false;
+  };
+
+  auto assign_queue(node_t &n, std::vector<cl_command_queue> const &queues,
+                    std::size_t &next) -> cl_command_queue {
+    for (auto d : n.deps) {
+      auto &dep = nodes_[d];
+      if (dep.cmd && !dep.continued) {
+        dep.continued = true;
+        return dep.queue;
+      }
+    }
+    return queues[next++ % queues.size()];
+  }
+
+  auto submit(cl_context ctx, std::vector<cl_command_queue> const &queues)
+      -> cl_int {
+    auto next = std::size_t{0};
+    auto wait = std::vector<cl_event>{};
+    for (auto &n : nodes_) {
+      n.continued = false;
+      n.done = false;
+    }
+    for (auto &n : nodes_) {
+      auto err = cl_int{CL_SUCCESS};
+      if (n.fn) {
+        n.queue = nullptr;
+        n.event = clCreateUserEvent(ctx, &err);
+        set_err_if_err(err, "clCreateUserEvent");
+      } else {
+        n.queue = assign_queue(n, queues, next);
+        wait.clear();
+        for (auto d : n.deps) {
+          // earlier commands on the same in-order queue are already ordered
+          if (nodes_[d].queue != n.queue && nodes_[d].event) {
+            wait.push_back(nodes_[d].event);
+          }
+        }
+        err = n.cmd(n.queue, wait.size(), wait.empty() ? nullptr : wait.data(),
+                    &n.event);
+      }
+      if (err != CL_SUCCESS) {
+        return err;
+      }
+    }
+    return CL_SUCCESS;
+  }
+
+  auto run_host_nodes() -> cl_int {
+    auto wait = std::vector<cl_event>{};
+    for (auto &n : nodes_) {
+      if (!n.fn) {
+        continue;
+      }
+      wait.clear();
+      for (auto d : n.deps) {
+        wait.push_back(nodes_[d].event);
+      }
+      if (!wait.empty()) {
+        auto err = clWaitForEvents(wait.size(), wait.data());
+        if (err != CL_SUCCESS) {
+          set_err_if_err(err, "clWaitForEvents");
+          return err;
+        }
+      }
+      n.fn();
+      clSetUserEventStatus(n.event, CL_COMPLETE);
+      n.done = true;
+    }
+    return CL_SUCCESS;
+  }
+
+  auto release_events() -> void {
+    for (auto &n : nodes_) {
+      if (n.event) {
+        clReleaseEvent(n.event);
+        n.event = nullptr;
+      }
+    }
+  }
+
+  std::vector<node_t> nodes_;
+};
+
+} // namespace clx
@@ -0,0 +1,454 @@
+#pragma once
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/format.h>
+#include "json.hpp"
+
+namespace clx {
+
+// one traced command. host times are ns since the tracer was created, device
+// times the raw CL_PROFILING_COMMAND_* values, 0 when the queue does not
+// profile.
+struct trace_record {
+  char const *call = nullptr; // the clEnqueue* function
+  std::string name;           // kernel name, or empty
+  cl_command_queue queue = nullptr;
+  std::uint32_t thread = 0;
+  std::uint64_t host_begin = 0;
+  std::uint64_t host_end = 0;
+  cl_ulong queued = 0;
+  cl_ulong submit = 0;
+  cl_ulong start = 0;
+  cl_ulong end = 0;
+};
+
+// Records the clx enqueue calls of every thread: the host call's duration
+// and, on queues created with CL_QUEUE_PROFILING_ENABLE, the command's
+// QUEUED/SUBMIT/START/END times from a completion callback. write() emits a
+// Chrome trace (chrome://tracing, ui.perfetto.dev) with a track per host
+// thread and per queue. Only every Nth command is traced, at most
+// max_records are kept, and each thread keeps its records in a buffer of its
+// own, so tracing can stay on in production.
+//
+// Queues are not changed: a trace has device times only for the queues the
+// application created with CL_QUEUE_PROFILING_ENABLE.
+//
+// CLX_TRACE=<file> starts tracing when the process starts and writes the
+// file when it exits; CLX_TRACE_SAMPLE=<N> traces every Nth command.
+class tracer {
+public:
+  // never destroyed: completion callbacks can still run during static
+  // destruction, so they must always find a live tracer. the trace file is
+  // written from an atexit handler instead.
+  static auto instance() -> tracer & {
+    static auto t = new tracer{};
+    return *t;
+  }
+
+  // path may be empty to only collect; every is clamped to at least 1.
+  auto start(std::string path, std::uint32_t every = 1,
+             std::size_t max_records = std::size_t{1} << 20) -> void {
+    auto lock = std::lock_guard<std::mutex>{m_};
+    path_ = std::move(path);
+    every_.store(std::max<std::uint32_t>(every, 1), std::memory_order_relaxed);
+    max_records_.store(max_records, std::memory_order_relaxed);
+    enabled_.store(true, std::memory_order_relaxed);
+  }
+
+  auto stop() -> void { enabled_.store(false, std::memory_order_relaxed); }
+
+  auto enabled() const -> bool {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // whether the next command is traced.
+  auto sample() -> bool {
+    return count_.fetch_add(1, std::memory_order_relaxed) %
+               every_.load(std::memory_order_relaxed) ==
+           0;
+  }
+
+  auto now() const -> std::uint64_t {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - epoch_)
+        .count();
+  }
+
+  // a small per-thread number for the host track.
+  auto thread_track() -> std::uint32_t {
+    thread_local auto id = next_thread_.fetch_add(1);
+    return id;
+  }
+
+  // cached per queue; a queue's properties never change.
+  auto profiling(cl_command_queue q) -> bool {
+    auto lock = std::lock_guard<std::mutex>{m_};
+    auto it = queues_.find(q);
+    if (it != std::end(queues_)) {
+      return it->second.profiling;
+    }
+    auto info = queue_info{};
+    auto ps = cl_command_queue_properties{};
+    clGetCommandQueueInfo(q, CL_QUEUE_PROPERTIES, sizeof(ps), &ps, nullptr);
+    info.profiling = (ps & CL_QUEUE_PROFILING_ENABLE) != 0;
+    info.track = static_cast<std::uint32_t>(queues_.size());
+    auto d = cl_device_id{};
+    auto size = std::size_t{};
+    clGetCommandQueueInfo(q, CL_QUEUE_DEVICE, sizeof(d), &d, nullptr);
+    if (d && clGetDeviceInfo(d, CL_DEVICE_NAME, 0, nullptr, &size) ==
+                 CL_SUCCESS) {
+      info.device.resize(size);
+      clGetDeviceInfo(d, CL_DEVICE_NAME, size, &info.device[0], nullptr);
+      info.device.resize(info.device.find('\0'));
+    }
+    queues_[q] = info;
+    return info.profiling;
+  }
+
+  // keeps r, after its device times are read when e completes. takes over a
+  // reference to e; e may be null when the queue does not profile.
+  auto record(trace_record r, cl_event e) -> void {
+    if (!e) {
+      add(std::move(r));
+      return;
+    }
+    pending_++;
+    auto p = new pending{this, std::move(r)};
+    if (clSetEventCallback(e, CL_COMPLETE, &tracer::on_complete, p) !=
+        CL_SUCCESS) {
+      pending_--;
+      add(std::move(p->r));
+      delete p;
+      clReleaseEvent(e);
+    }
+  }
+
+  auto records() const -> std::vector<trace_record> {
+    auto lock = std::lock_guard<std::mutex>{m_};
+    return gather();
+  }
+
+  // records not kept because max_records was reached.
+  auto dropped() const -> std::size_t {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+  auto clear() -> void {
+    auto lock = std::lock_guard<std::mutex>{m_};
+    for (auto const &b : buffers_) {
+      auto buffer_lock = std::lock_guard<std::mutex>{b->m};
+      b->records.clear();
+    }
+    added_.store(0, std::memory_order_relaxed);
+    dropped_.store(0, std::memory_order_relaxed);
+  }
+
+  // call once the traced queues are finished; callbacks still outstanding
+  // after a short wait are left out.
+  auto write(std::string const &path) -> bool {
+    for (auto i = 0; pending_ > 0 && i < 100; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::ofstream out(path);
+    out << to_json();
+    return bool(out);
+  }
+
+  auto to_json() const -> std::string {
+    auto lock = std::lock_guard<std::mutex>{m_};
+    auto records = gather();
+
+    // the device clock has its own origin. QUEUED is taken during the host
+    // call, so the latest offset that puts every QUEUED after its call's
+    // begin is the tightest alignment of the two clocks.
+    auto offsets = std::map<cl_command_queue, std::int64_t>{};
+    for (auto const &r : records) {
+      if (!r.queued) {
+        continue;
+      }
+      auto o = std::int64_t(r.host_begin) - std::int64_t(r.queued);
+      auto it = offsets.find(r.queue);
+      if (it == std::end(offsets) || o > it->second) {
+        offsets[r.queue] = o;
+      }
+    }
+
+    auto us = [](std::int64_t ns) { return fmt::format("{:.3f}", ns * 1e-3); };
+    auto events = std::vector<std::string>{};
+    auto span = [&](char const *name, char const *cat, int pid,
+                    std::uint32_t tid, std::int64_t begin, std::int64_t end) {
+      events.push_back(fmt::format(
+          "{{\"name\": \"{}\", \"cat\": \"{}\", \"ph\": \"X\", \"pid\": {}, "
+          "\"tid\": {}, \"ts\": {}, \"dur\": {}}}",
+          detail::json_escape(name), cat, pid, tid, us(begin),
+          us(std::max<std::int64_t>(end - begin, 0))));
+    };
+    auto meta = [&](char const *what, int pid, std::uint32_t tid,
+                    std::string const &name) {
+      events.push_back(fmt::format(
+          "{{\"name\": \"{}\", \"ph\": \"M\", \"pid\": {}, \"tid\": {}, "
+          "\"args\": {{\"name\": \"{}\"}}}}",
+          what, pid, tid, detail::json_escape(name)));
+    };
+
+    meta("process_name", host_pid, 0, "host");
+    meta("process_name", queue_pid, 0, "queues");
+    auto threads = std::vector<bool>(next_thread_, false);
+    for (auto const &q : queues_) {
+      meta("thread_name", queue_pid, q.second.track,
+           fmt::format("queue {} ({})", q.second.track, q.second.device));
+    }
+
+    auto flow = std::uint64_t{0};
+    for (auto const &r : records) {
+      if (r.thread < threads.size() && !threads[r.thread]) {
+        threads[r.thread] = true;
+        meta("thread_name", host_pid, r.thread,
+             fmt::format("host thread {}", r.thread));
+      }
+      auto label = r.name.empty() ? std::string{r.call}
+                                  : fmt::format("{} {}", r.call, r.name);
+      span(label.c_str(), "host", host_pid, r.thread, r.host_begin,
+           r.host_end);
+
+      auto it = offsets.find(r.queue);
+      auto q = queues_.find(r.queue);
+      if (!r.queued || it == std::end(offsets) || q == std::end(queues_)) {
+        continue;
+      }
+      auto device = [&](cl_ulong t) { return std::int64_t(t) + it->second; };
+      auto track = q->second.track;
+      auto name = r.name.empty() ? std::string{r.call} : r.name;
+      span("queued", "wait", queue_pid, track, device(r.queued),
+           device(r.submit));
+      span("submitted", "wait", queue_pid, track, device(r.submit),
+           device(r.start));
+      span(name.c_str(), "device", queue_pid, track, device(r.start),
+           device(r.end));
+
+      // an arrow from the host call to the command's execution
+      events.push_back(fmt::format(
+          "{{\"name\": \"enqueue\", \"cat\": \"flow\", \"ph\": \"s\", "
+          "\"id\": {}, \"pid\": {}, \"tid\": {}, \"ts\": {}}}",
+          flow, host_pid, r.thread, us(r.host_begin)));
+      events.push_back(fmt::format(
+          "{{\"name\": \"enqueue\", \"cat\": \"flow\", \"ph\": \"f\", "
+          "\"bp\": \"e\", \"id\": {}, \"pid\": {}, \"tid\": {}, \"ts\": {}}}",
+          flow, queue_pid, track, us(device(r.start))));
+      flow++;
+    }
+
+    auto out =
+        std::string{"{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n"};
+    for (auto i = std::size_t{0}; i < events.size(); i++) {
+      out += events[i];
+      out += i + 1 < events.size() ? ",\n" : "\n";
+    }
+    out += fmt::format("], \"otherData\": {{\"dropped\": {}}}}}\n",
+                       dropped());
+    return out;
+  }
+
+private:
+  static constexpr int host_pid = 1;
+  static constexpr int queue_pid = 2;
+
+  struct queue_info {
+    bool profiling = false;
+    std::uint32_t track = 0;
+    std::string device;
+  };
+
+  struct pending {
+    tracer *t;
+    trace_record r;
+  };
+
+  // the records of one thread. its lock is only contended while the records
+  // are read.
+  struct buffer {
+    std::mutex m;
+    std::vector<trace_record> records;
+  };
+
+  tracer() : epoch_(std::chrono::steady_clock::now()) {
+    if (auto path = std::getenv("CLX_TRACE")) {
+      auto every = std::uint32_t{1};
+      if (auto sample = std::getenv("CLX_TRACE_SAMPLE")) {
+        every = static_cast<std::uint32_t>(std::strtoul(sample, nullptr, 10));
+      }
+      start(path, every);
+    }
+    std::atexit([] {
+      auto &t = instance();
+      auto path = std::string{};
+      {
+        auto lock = std::lock_guard<std::mutex>{t.m_};
+        path = t.path_;
+      }
+      if (!path.empty()) {
+        t.write(path);
+      }
+    });
+  }
+
+  static auto CL_CALLBACK on_complete(cl_event e, cl_int status, void *user)
+      -> void {
+    auto p = static_cast<pending *>(user);
+    if (status == CL_COMPLETE) {
+      auto get = [&](cl_profiling_info info) {
+        auto t = cl_ulong{};
+        clGetEventProfilingInfo(e, info, sizeof(t), &t, nullptr);
+        return t;
+      };
+      p->r.queued = get(CL_PROFILING_COMMAND_QUEUED);
+      p->r.submit = get(CL_PROFILING_COMMAND_SUBMIT);
+      p->r.start = get(CL_PROFILING_COMMAND_START);
+      p->r.end = get(CL_PROFILING_COMMAND_END);
+    }
+    p->t->add(std::move(p->r));
+    p->t->pending_--;
+    delete p;
+    clReleaseEvent(e);
+  }
+
+  // the calling thread's buffer, registered on first use. buffers outlive
+  // their threads, so records of finished threads are kept.
+  auto local_buffer() -> buffer & {
+    thread_local auto b = [this] {
+      auto b = std::make_shared<buffer>();
+      auto lock = std::lock_guard<std::mutex>{m_};
+      buffers_.push_back(b);
+      return b;
+    }();
+    return *b;
+  }
+
+  auto add(trace_record r) -> void {
+    if (added_.fetch_add(1, std::memory_order_relaxed) >=
+        max_records_.load(std::memory_order_relaxed)) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    auto &b = local_buffer();
+    auto lock = std::lock_guard<std::mutex>{b.m};
+    b.records.push_back(std::move(r));
+  }
+
+  // the records of every thread; m_ must be held.
+  auto gather() const -> std::vector<trace_record> {
+    auto out = std::vector<trace_record>{};
+    for (auto const &b : buffers_) {
+      auto lock = std::lock_guard<std::mutex>{b->m};
+      out.insert(std::end(out), std::begin(b->records), std::end(b->records));
+    }
+    return out;
+  }
+
+  std::chrono::steady_clock::time_point epoch_;
+  std::atomic<bool> enabled_{false};
+  std::atomic<std::uint64_t> count_{0};
+  std::atomic<std::uint32_t> next_thread_{0};
+  std::atomic<int> pending_{0};
+  std::atomic<std::uint32_t> every_{1};
+  std::atomic<std::size_t> max_records_{0};
+  std::atomic<std::size_t> added_{0};
+  std::atomic<std::size_t> dropped_{0};
+  std::string path_;
+  mutable std::mutex m_;
+  std::unordered_map<cl_command_queue, queue_info> queues_;
+  std::vector<std::shared_ptr<buffer>> buffers_;
+};
+
+// Wraps one enqueue call. When the tracer is off, or the command is not
+// sampled, it only costs a relaxed load; otherwise it times the call and
+// supplies an event for the device times when the caller passed none.
+//
+//   auto t = trace_scope{q, "clEnqueueReadBuffer", event};
+//   auto err = clEnqueueReadBuffer(..., t.event());
+//   t.end(err);
+class trace_scope {
+public:
+  trace_scope(cl_command_queue q, char const *call, cl_event *event)
+      : event_(event) {
+    auto &t = tracer::instance();
+    if (!t.enabled() || !t.sample()) {
+      return;
+    }
+    active_ = true;
+    r_.call = call;
+    r_.queue = q;
+    r_.thread = t.thread_track();
+    if (t.profiling(q) && !event_) {
+      event_ = &local_;
+    }
+    profiling_ = event_ && t.profiling(q);
+    r_.host_begin = t.now();
+  }
+
+  trace_scope(trace_scope const &) = delete;
+  auto operator=(trace_scope const &) -> trace_scope & = delete;
+
+  auto event() const -> cl_event * { return event_; }
+
+  // names the command after the kernel it runs.
+  auto kernel(cl_kernel k) -> void {
+    if (!active_) {
+      return;
+    }
+    auto size = std::size_t{};
+    if (clGetKernelInfo(k, CL_KERNEL_FUNCTION_NAME, 0, nullptr, &size) ==
+            CL_SUCCESS &&
+        size > 1) {
+      r_.name.resize(size);
+      clGetKernelInfo(k, CL_KERNEL_FUNCTION_NAME, size, &r_.name[0], nullptr);
+      r_.name.resize(size - 1);
+    }
+  }
+
+  auto end(cl_int err) -> void {
+    if (!active_) {
+      return;
+    }
+    active_ = false;
+    auto &t = tracer::instance();
+    r_.host_end = t.now();
+    auto e = cl_event{};
+    if (err == CL_SUCCESS && profiling_) {
+      e = *event_;
+      if (event_ != &local_) {
+        // the caller owns its event; the tracer takes its own reference
+        clRetainEvent(e);
+      }
+    }
+    t.record(std::move(r_), e);
+  }
+
+private:
+  cl_event *event_;
+  cl_event local_ = nullptr;
+  bool active_ = false;
+  bool profiling_ = false;
+  trace_record r_;
+};
+
+} // namespace clx
@@ -0,0 +1,361 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/format.h>
+#include "cache.hpp"
+#include "clx.hpp"
+#include "device_caps.hpp"
+#include "sx.hpp"
+
+namespace clx {
+
+// a local size of all zeros leaves the choice to the driver.
+using work_size = std::array<std::size_t, 3>;
+
+struct tuning_result {
+  work_size local = {};
+  long param = 0;
+  double ms = 0;
+};
+
+// what a tuning run sweeps besides the local size.
+struct tuning_space {
+  // values of one kernel tuning parameter, e.g. pixels per work-item.
+  std::vector<long> params = {0};
+  // round the global size up to a multiple of each local size tried; the
+  // kernel must then bound-check its ids. otherwise only local sizes that
+  // divide the global size are legal.
+  bool pad = false;
+  // binds the parameter, and anything sized by the local size, before a
+  // trial and returns the global size to launch with. when null the problem
+  // size is launched as is.
+  std::function<work_size(long param, work_size const &local)> apply;
+  // also try the driver's choice of local size, passed to apply as zeros.
+  bool driver_choice = true;
+  int runs = 3;
+};
+
+// Empirical work-group size tuner. For a kernel, device and problem-size
+// bucket it times every legal local size (multiples of
+// CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE and powers of two up to
+// CL_KERNEL_WORK_GROUP_SIZE) for every tuning parameter value and keeps the
+// fastest in an on-disk database, so the sweep runs once per machine. Trials
+// re-run the kernel, so only tune launches that can be repeated.
+class autotuner {
+public:
+  explicit autotuner(std::filesystem::path db) : path_(std::move(db)) {
+    for (auto const &r : detail::read_records(path_)) {
+      auto t = tuning_result{};
+      auto ss = std::istringstream{r.second};
+      if (ss >> t.local[0] >> t.local[1] >> t.local[2] >> t.param >> t.ms) {
+        results_[r.first] = t;
+      }
+    }
+  }
+
+  autotuner() : autotuner(default_path()) {}
+
+  // tuning.txt in cache_directory().
+  static auto default_path() -> std::filesystem::path {
+    return cache_directory() / "tuning.txt";
+  }
+
+  auto path() const -> std::filesystem::path const & { return path_; }
+
+  // problem sizes rounding up to the same powers of two share an entry.
+  static auto bucket(cl_uint work_dim, work_size const &problem) -> work_size {
+    auto out = work_size{1, 1, 1};
+    for (auto i = 0u; i < work_dim && i < 3; i++) {
+      while (out[i] < problem[i]) {
+        out[i] <<= 1;
+      }
+    }
+    return out;
+  }
+
+  auto key(cl_kernel k, cl_device_id d, cl_uint work_dim,
+           work_size const &problem) -> std::uint64_t {
+    auto b = bucket(work_dim, problem);
+    auto h = sx::fnv1a(fmt::format("{:016x}:{}:{}x{}x{}", kernel_hash(k),
+                                   work_dim, b[0], b[1], b[2]));
+    h = sx::fnv1a(fmt::format("{:016x}", identity(device_caps_of(d))), h);
+    return h;
+  }
+
+  auto lookup(cl_kernel k, cl_device_id d, cl_uint work_dim,
+              work_size const &problem) -> std::optional<tuning_result> {
+    auto id = key(k, d, work_dim, problem);
+    auto lock = std::lock_guard<std::mutex>{m_};
+    auto it = results_.find(id);
+    if (it == std::end(results_)) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  // legal local sizes for k on d.
+  auto candidates(cl_kernel k, cl_device_id d, cl_uint work_dim,
+                  work_size const &global, bool pad) const
+      -> std::vector<work_size> {
+    auto const &caps = device_caps_of(d);
+    auto max_wg = get_kernel_work_group_info_size(k, d);
+    auto multiple = std::max<std::size_t>(
+        get_kernel_work_group_info_preferred_multiple(k, d), 1);
+
+    auto sizes = std::vector<std::size_t>{};
+    for (auto s = std::size_t{1}; s <= max_wg; s <<= 1) {
+      sizes.push_back(s);
+    }
+    for (auto s = multiple; s <= max_wg; s <<= 1) {
+      sizes.push_back(s);
+    }
+    std::sort(std::begin(sizes), std::end(sizes));
+    sizes.erase(std::unique(std::begin(sizes), std::end(sizes)),
+                std::end(sizes));
+
+    auto fits = [&](std::size_t l, cl_uint i) {
+      if (l > caps.max_work_item_sizes[i]) {
+        return false;
+      }
+      // no point in groups larger than the padded range
+      auto limit = pad ? bucket(1, {global[i]})[0] : global[i];
+      return l <= limit && (pad || global[i] % l == 0);
+    };
+
+    auto out = std::vector<work_size>{};
+    for (auto x : sizes) {
+      if (!fits(x, 0)) {
+        continue;
+      }
+      if (work_dim == 1) {
+        out.push_back({x, 1, 1});
+        continue;
+      }
+      for (auto y = std::size_t{1}; x * y <= max_wg; y <<= 1) {
+        if (!fits(y, 1)) {
+          continue;
+        }
+        // groups smaller than the preferred multiple leave lanes idle
+        if (x * y < multiple && x * y < max_wg) {
+          continue;
+        }
+        out.push_back({x, y, 1});
+      }
+    }
+    return out;
+  }
+
+  // sweeps the space on q and stores the winner. the kernel is left bound
+  // for the winning parameter. returns a zero local size, the driver's
+  // choice, when no trial succeeded.
+  auto tune(cl_command_queue q, cl_kernel k, cl_uint work_dim,
+            work_size const &problem, tuning_space const &space = {})
+      -> tuning_result {
+    auto d = get_command_queue_info_device(q);
+    auto ps = get_command_queue_info_properties(q);
+    auto profiling = (ps & CL_QUEUE_PROFILING_ENABLE) != 0;
+
+    // apply reshapes the global size, so without pad divisibility is checked
+    // per trial against what it returns rather than against problem
+    auto per_trial = space.apply && !space.pad;
+    auto locals = candidates(k, d, work_dim, problem, space.pad || per_trial);
+    if (space.driver_choice) {
+      locals.insert(std::begin(locals), work_size{0, 0, 0});
+    }
+    auto best = std::optional<tuning_result>{};
+    for (auto param : space.params) {
+      for (auto const &local : locals) {
+        auto g = space.apply ? space.apply(param, local) : problem;
+        if (space.pad && local[0]) {
+          for (auto i = 0u; i < work_dim; i++) {
+            g[i] = (g[i] + local[i] - 1) / local[i] * local[i];
+          }
+        }
+        if (per_trial && local[0] && !divides(work_dim, g, local)) {
+          continue;
+        }
+        auto ms = time_launch(q, k, work_dim, g, local, space.runs, profiling);
+        if (ms > 0 && (!best || ms < best->ms)) {
+          best = tuning_result{local, param, ms};
+        }
+      }
+    }
+
+    auto fallback = space.params.empty() ? 0 : space.params[0];
+    auto result = best.value_or(tuning_result{{0, 0, 0}, fallback, 0});
+    if (space.apply && best) {
+      space.apply(result.param, result.local);
+    }
+    if (best) {
+      store(key(k, d, work_dim, problem), result);
+    }
+    return result;
+  }
+
+  auto store(std::uint64_t id, tuning_result const &t) -> void {
+    {
+      auto lock = std::lock_guard<std::mutex>{m_};
+      results_[id] = t;
+    }
+    generation_++;
+    detail::write_record(path_, id,
+                         fmt::format("{} {} {} {} {}", t.local[0], t.local[1],
+                                     t.local[2], t.param, t.ms));
+  }
+
+  // drop what is remembered about k, before it is released.
+  auto forget(cl_kernel k) -> void {
+    {
+      auto lock = std::lock_guard<std::mutex>{m_};
+      kernels_.erase(k);
+    }
+    generation_++;
+  }
+
+  // drop the local sizes resolved for launches on q, before it is released.
+  auto forget(cl_command_queue) -> void { generation_++; }
+
+  // bumped whenever a resolved local size may have changed; enqueue_tuned
+  // drops its per-thread cache when it moves.
+  auto generation() const -> std::uint64_t { return generation_; }
+
+  static auto divides(cl_uint work_dim, work_size const &global,
+                      work_size const &local) -> bool {
+    for (auto i = 0u; i < work_dim; i++) {
+      if (global[i] % local[i] != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  // name and program source, so an edited kernel is tuned afresh. cached per
+  // handle since it takes a copy of the whole source.
+  auto kernel_hash(cl_kernel k) -> std::uint64_t {
+    {
+      auto lock = std::lock_guard<std::mutex>{m_};
+      auto it = kernels_.find(k);
+      if (it != std::end(kernels_)) {
+        return it->second;
+      }
+    }
+    auto h = sx::fnv1a(get_kernel_info_function_name(k));
+    h = sx::fnv1a(get_program_info_source(get_kernel_info_program(k)), h);
+    auto lock = std::lock_guard<std::mutex>{m_};
+    kernels_[k] = h;
+    return h;
+  }
+
+  // best of runs after a warm-up, in ms, or 0 when the launch fails.
+  static auto time_launch(cl_command_queue q, cl_kernel k, cl_uint work_dim,
+                          work_size const &global, work_size const &local,
+                          int runs, bool profiling) -> double {
+    auto l = local[0] ? local.data() : nullptr;
+    if (clEnqueueNDRangeKernel(q, k, work_dim, nullptr, global.data(), l, 0,
+                               nullptr, nullptr) != CL_SUCCESS ||
+        clFinish(q) != CL_SUCCESS) {
+      return 0;
+    }
+    auto best = 0.0;
+    for (auto i = 0; i < runs; i++) {
+      auto e = cl_event{};
+      auto start = std::chrono::steady_clock::now();
+      if (clEnqueueNDRangeKernel(q, k, work_dim, nullptr, global.data(), l, 0,
+                                 nullptr, &e) != CL_SUCCESS) {
+        return 0;
+      }
+      if (clWaitForEvents(1, &e) != CL_SUCCESS) {
+        clReleaseEvent(e);
+        return 0;
+      }
+      auto end = std::chrono::steady_clock::now();
+      auto ms = profiling
+                    ? get_event_elapsed_ms(e)
+                    : std::chrono::duration<double, std::milli>(end - start)
+                          .count();
+      clReleaseEvent(e);
+      best = i == 0 ? ms : std::min(best, ms);
+    }
+    return best;
+  }
+
+  std::filesystem::path path_;
+  std::mutex m_;
+  std::map<std::uint64_t, tuning_result> results_;
+  std::unordered_map<cl_kernel, std::uint64_t> kernels_;
+  std::atomic<std::uint64_t> generation_{0};
+};
+
+// the database shared by enqueue_tuned().
+inline auto default_autotuner() -> autotuner & {
+  static auto tuner = autotuner{};
+  return tuner;
+}
+
+// launches with the tuned local size for this kernel, device and problem
+// bucket, or leaves the choice to the driver when there is no entry. with
+// pad the global size is rounded up to the tuned local size, otherwise an
+// entry that does not divide it is ignored. the local size is resolved once
+// per kernel, queue and bucket and kept per thread, so repeat launches make
+// no driver queries and take no locks; call default_autotuner().forget()
+// before releasing a kernel or queue launched this way. only the local size is
+// applied: a kernel tuned over params must have the tuned param, from
+// lookup(), bound by its caller.
+inline auto enqueue_tuned(cl_command_queue q, cl_kernel k, cl_uint work_dim,
+                          const size_t *global_work_size, bool pad = false,
+                          cl_uint num_events = 0,
+                          const cl_event *wait = nullptr, cl_event *e = nullptr)
+    -> cl_int {
+  using launch = std::tuple<cl_kernel, cl_command_queue, cl_uint, work_size>;
+  thread_local auto resolved = std::map<launch, work_size>{};
+  thread_local auto generation = std::uint64_t{0};
+
+  auto &tuner = default_autotuner();
+  if (generation != tuner.generation()) {
+    resolved.clear();
+    generation = tuner.generation();
+  }
+
+  auto problem = work_size{1, 1, 1};
+  std::copy(global_work_size, global_work_size + work_dim, std::begin(problem));
+  auto id = launch{k, q, work_dim, autotuner::bucket(work_dim, problem)};
+  auto it = resolved.find(id);
+  if (it == std::end(resolved)) {
+    auto d = get_command_queue_info_device(q);
+    auto t = tuner.lookup(k, d, work_dim, problem);
+    it = resolved.emplace(id, t ? t->local : work_size{}).first;
+  }
+
+  auto global = problem;
+  auto local = it->second;
+  if (local[0]) {
+    if (pad) {
+      for (auto i = 0u; i < work_dim; i++) {
+        global[i] = (global[i] + local[i] - 1) / local[i] * local[i];
+      }
+    } else if (!autotuner::divides(work_dim, global, local)) {
+      local = {};
+    }
+  }
+  return enqueue_nd_ranage_kernel(q, k, work_dim, nullptr, global.data(),
+                                  local[0] ? local.data() : nullptr,
+                                  num_events, wait, e);
+}
+
+} // namespace clx
@@ -0,0 +1,29 @@
+// micro-benchmarks for clx::select_device
+
+__kernel void copy(__global const float4 *in, __global float4 *out) {
+  const size_t i = get_global_id(0);
+  out[i] = in[i];
+}
+
+__kernel void empty(__global int *unused) {}
+
+// 16 float4 mads per iteration, 128 flops per work-item and iteration.
+__kernel void mad(__global float *out, int iterations) {
+  const size_t i = get_global_id(0);
+  float4 a = (float4)(i, i + 1, i + 2, i + 3) * 1e-6f;
+  float4 b = a + 0.5f;
+  const float4 m = (float4)(0.999f);
+  const float4 c = (float4)(1e-3f);
+  for (int n = 0; n < iterations; n++) {
+    a = mad(a, m, c); b = mad(b, m, c);
+    a = mad(a, m, c); b = mad(b, m, c);
+    a = mad(a, m, c); b = mad(b, m, c);
+    a = mad(a, m, c); b = mad(b, m, c);
+    a = mad(a, m, c); b = mad(b, m, c);
+    a = mad(a, m, c); b = mad(b, m, c);
+    a = mad(a, m, c); b = mad(b, m, c);
+    a = mad(a, m, c); b = mad(b, m, c);
+  }
+  a += b;
+  out[i] = a.x + a.y + a.z + a.w;
+}